@@ -1,5 +1,9 @@
+#include "BatchRenderer.hpp"
+#include "Benchmarks.hpp"
+#include "DeviceChecks.hpp"
 #include "GameCore.hpp"
 #include "GameHandler.hpp"
+#include "HeadlessHandler.hpp"
 
 #include <Config.hpp>
 #include <Debug.hpp>
@@ -10,6 +14,7 @@
 #include <argparse/argparse.hpp>
 #include <tracy/Tracy.hpp>
 
+#include <cstdint>
 #include <cstdlib>
 #include <ctime>
 #include <exception>
@@ -18,6 +23,7 @@
 #include <iostream>
 #include <iterator>
 #include <memory>
+#include <optional>
 #include <source_location>
 #include <stdexcept>
 #include <string>
@@ -32,6 +38,10 @@
 #define STB_IMAGE_STATIC
 #include <stb_image.h>
 
+// used by BatchRenderer.cpp
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
 #ifdef DEBUG_ALLOCATIONS
 void *operator new(std::size_t count) {
   void *ptr = malloc(count);
@@ -53,7 +63,18 @@ void operator delete(void *ptr, std::size_t) noexcept {
 #endif
 
 namespace {
-void parse_args(std::span<const char *> args) {
+struct app_options {
+  // set if running without a window
+  std::optional<v4dg::HeadlessHandler::Options> headless;
+  // set if rendering a zoom path to files
+  std::optional<v4dg::BatchRenderer::Options> batch;
+  // set if only running a micro benchmark
+  std::optional<std::string> benchmark;
+  // set if only running a device self-check
+  std::optional<std::string> check;
+};
+
+app_options parse_args(std::span<const char *> args) {
   argparse::ArgumentParser parser;
 
   parser.add_argument("-d", "--debug-level")
@@ -66,6 +87,50 @@ void parse_args(std::span<const char *> args) {
       .default_value(false)
       .implicit_value(true);
 
+  parser.add_argument("--headless")
+      .help("render offscreen without a window (no display required)")
+      .default_value(false)
+      .implicit_value(true);
+  parser.add_argument("--frames")
+      .help("number of frames to render in headless mode")
+      .default_value(v4dg::HeadlessHandler::Options{}.frame_count)
+      .scan<'u', std::uint32_t>();
+  parser.add_argument("--width")
+      .help("width of the offscreen target in headless mode")
+      .default_value(v4dg::HeadlessHandler::Options{}.extent.width)
+      .scan<'u', std::uint32_t>();
+  parser.add_argument("--height")
+      .help("height of the offscreen target in headless mode")
+      .default_value(v4dg::HeadlessHandler::Options{}.extent.height)
+      .scan<'u', std::uint32_t>();
+  parser.add_argument("--images")
+      .help("number of offscreen images cycled in headless mode")
+      .default_value(v4dg::HeadlessHandler::Options{}.image_count)
+      .scan<'u', std::uint32_t>();
+  parser.add_argument("--iterations")
+      .help("write the iteration counts of the last headless frame to a file "
+            "(raw native-endian uint32 per pixel, row major)");
+  parser.add_argument("--compare-cpu")
+      .help("compare the iteration counts of every kernel variant after "
+            "the headless frames with the CPU renderer (exit code 1 if any "
+            "pixel differs)")
+      .default_value(false)
+      .implicit_value(true);
+
+  parser.add_argument("--render")
+      .help("render the zoom path of a keyframe file to images and exit "
+            "(lines of '<frame> <x> <y> <height>'; uses --width/--height)");
+  parser.add_argument("--output")
+      .help("file name pattern of --render frames (.png or .hdr)")
+      .default_value(v4dg::BatchRenderer::Options{}.output);
+
+  parser.add_argument("--benchmark")
+      .help(std::format("run a micro benchmark and exit ({})",
+                        v4dg::benchmark_names()));
+  parser.add_argument("--check")
+      .help(std::format("run a self-check on the device and exit ({})",
+                        v4dg::check_names()));
+
 #ifdef _WIN32
   parser.add_argument("--output-debug-string")
       .help("enable logging to OutputDebugString")
@@ -141,6 +206,46 @@ void parse_args(std::span<const char *> args) {
 
   v4dg::logger.setLogLevel(log_level);
   v4dg::logger.setLogReciever(v4dg::MultiLogReciever::from_span(recievers));
+
+  app_options options;
+
+  if (parser.get<bool>("--headless")) {
+    options.headless = v4dg::HeadlessHandler::Options{
+        .extent = {parser.get<std::uint32_t>("--width"),
+                   parser.get<std::uint32_t>("--height")},
+        .image_count = parser.get<std::uint32_t>("--images"),
+        .frame_count = parser.get<std::uint32_t>("--frames"),
+        .compare_cpu = parser.get<bool>("--compare-cpu"),
+    };
+    if (parser.is_used("--iterations")) {
+      options.headless->iterations_path =
+          parser.get<std::string>("--iterations");
+    }
+  }
+
+  if (parser.is_used("--render")) {
+    v4dg::BatchRenderer::Options batch{
+        .path = parser.get<std::string>("--render"),
+        .output = parser.get<std::string>("--output"),
+    };
+    if (parser.is_used("--width")) {
+      batch.extent.width = parser.get<std::uint32_t>("--width");
+    }
+    if (parser.is_used("--height")) {
+      batch.extent.height = parser.get<std::uint32_t>("--height");
+    }
+    options.batch = std::move(batch);
+  }
+
+  if (parser.is_used("--benchmark")) {
+    options.benchmark = parser.get<std::string>("--benchmark");
+  }
+
+  if (parser.is_used("--check")) {
+    options.check = parser.get<std::string>("--check");
+  }
+
+  return options;
 }
 } // namespace
 
@@ -148,12 +253,16 @@ extern "C" int main(int argc, const char *argv[]) try {
   std::span const args{argv, static_cast<std::size_t>(argc)};
   std::srand(static_cast<unsigned int>(std::time(nullptr)));
 
-  parse_args(args);
+  auto options = parse_args(args);
 
   v4dg::logger.Log("starting");
   v4dg::logger.Log("debug level: {}", v4dg::logger.getLogLevel());
   v4dg::logger.Log("path: {}", std::filesystem::current_path().string());
 
+  if (options.benchmark) {
+    return v4dg::run_benchmark(*options.benchmark);
+  }
+
   const v4dg::SDL_GlobalContext _{};
 
   v4dg::Config cfg{"4dGraphics"};
@@ -162,6 +271,18 @@ extern "C" int main(int argc, const char *argv[]) try {
                    cfg.data_dir().string(), cfg.cache_dir().string(),
                    cfg.user_data_dir().string());
 
+  if (options.check) {
+    return v4dg::run_check(cfg, *options.check);
+  }
+
+  if (options.batch) {
+    return v4dg::BatchRenderer{cfg, *options.batch}.Run();
+  }
+
+  if (options.headless) {
+    return v4dg::HeadlessHandler{cfg, *options.headless}.Run();
+  }
+
   return v4dg::MyGameHandler{cfg}.Run();
 } catch (const std::exception &e) {
   v4dg::logger.FatalError("Exception: {}", e.what());
@@ -0,0 +1,342 @@
+#include "BatchRenderer.hpp"
+
+#include <CommandBuffer.hpp>
+#include <Context.hpp>
+#include <Debug.hpp>
+#include <Device.hpp>
+#include <OffscreenSwapchain.hpp>
+#include <TransferManager.hpp>
+#include <VulkanResources.hpp>
+#include <cppHelpers.hpp>
+#include <v4dgCore.hpp>
+
+#include <glm/glm.hpp>
+#include <stb_image_write.h>
+#include <taskflow/taskflow.hpp>
+#include <tracy/Tracy.hpp>
+#include <vulkan-memory-allocator-hpp/vk_mem_alloc.hpp>
+#include <vulkan/vulkan.hpp>
+#include <vulkan/vulkan_raii.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iterator>
+#include <ranges>
+#include <span>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace v4dg;
+
+namespace {
+constexpr auto frames_in_flight =
+    static_cast<std::uint32_t>(max_frames_in_flight);
+// frames read back but not written yet (on top of the frames in flight)
+constexpr std::uint32_t max_encoding_frames = 8;
+
+vk::Format target_format(const std::filesystem::path &output) {
+  auto const ext = output.extension();
+  if (ext == ".png") {
+    return vk::Format::eR8G8B8A8Unorm;
+  }
+  if (ext == ".hdr") {
+    return vk::Format::eR32G32B32A32Sfloat;
+  }
+  throw exception("Unsupported output format '{}' (.png or .hdr)",
+                  ext.string());
+}
+} // namespace
+
+std::vector<ZoomKeyframe>
+v4dg::load_zoom_path(const std::filesystem::path &path) {
+  std::ifstream file(path);
+  if (!file) {
+    throw exception("Could not open zoom path {}", path.string());
+  }
+
+  std::vector<ZoomKeyframe> keyframes;
+  std::string line;
+  for (std::size_t line_no = 1; std::getline(file, line); line_no++) {
+    line.erase(std::ranges::find(line, '#'), line.end());
+    if (std::ranges::all_of(line, [](unsigned char c) {
+          return std::isspace(c) != 0;
+        })) {
+      continue;
+    }
+
+    std::istringstream fields(line);
+    ZoomKeyframe key{};
+    if (!(fields >> key.frame >> key.center.x >> key.center.y >>
+          key.height) ||
+        !(key.height > 0.)) {
+      throw exception("{}:{}: expected '<frame> <x> <y> <height>'",
+                      path.string(), line_no);
+    }
+    if (!keyframes.empty() && key.frame <= keyframes.back().frame) {
+      throw exception("{}:{}: frame {} is not after frame {}", path.string(),
+                      line_no, key.frame, keyframes.back().frame);
+    }
+    keyframes.push_back(key);
+  }
+
+  if (keyframes.empty()) {
+    throw exception("Zoom path {} has no keyframes", path.string());
+  }
+  return keyframes;
+}
+
+ZoomKeyframe v4dg::interpolate_zoom(std::span<const ZoomKeyframe> path,
+                                    std::uint32_t frame) {
+  auto next = std::ranges::upper_bound(path, frame, {}, &ZoomKeyframe::frame);
+  if (next == path.begin()) {
+    return {frame, path.front().center, path.front().height};
+  }
+  if (next == path.end()) {
+    return {frame, path.back().center, path.back().height};
+  }
+
+  const auto &a = *std::prev(next);
+  const auto &b = *next;
+  double const t = static_cast<double>(frame - a.frame) /
+                   static_cast<double>(b.frame - a.frame);
+
+  double const height =
+      std::exp(std::lerp(std::log(a.height), std::log(b.height), t));
+
+  // a zoom around a fixed point p moves the center as c - p ~ height
+  double const zoom = a.height - b.height;
+  double const u = std::abs(zoom) > a.height * 1e-9 // NOLINT(*-magic-numbers)
+                       ? (a.height - height) / zoom
+                       : t;
+  return {frame, glm::mix(a.center, b.center, u), height};
+}
+
+BatchRenderer::BatchRenderer(const Config &cfg, Options options_)
+    : cfg(cfg), options(std::move(options_)),
+      path(load_zoom_path(options.path)), instance(vk::raii::Context{}, true),
+      device(instance), context(cfg, device), transfer_manager(context),
+      target(context, options.extent, target_format(options.output),
+             frames_in_flight + 1,
+             vk::ImageUsageFlagBits::eTransferDst |
+                 vk::ImageUsageFlagBits::eTransferSrc),
+      mandelbrot(cfg, context) {
+  file_format = target.format() == vk::Format::eR8G8B8A8Unorm
+                    ? FileFormat::Png
+                    : FileFormat::Hdr;
+
+  // offline frames have to be final: no coarser cached tiles
+  mandelbrot.tiled() = false;
+  mandelbrot.progressive() = false;
+  mandelbrot.resize(options.extent);
+
+  vk::DeviceSize const texel = file_format == FileFormat::Png
+                                   ? 4 * sizeof(std::uint8_t)
+                                   : 4 * sizeof(float);
+  vk::DeviceSize const size =
+      vk::DeviceSize{options.extent.width} * options.extent.height * texel;
+
+  auto const count =
+      frames_in_flight +
+      std::clamp<std::uint32_t>(
+          static_cast<std::uint32_t>(context.executor().num_workers()), 1,
+          max_encoding_frames);
+  for (std::uint32_t i = 0; i < count; i++) {
+    Buffer buffer{
+        context.device(),
+        size,
+        vk::BufferUsageFlagBits2KHR::eTransferDst,
+        vma::AllocationCreateInfo{}
+            .setFlags(vma::AllocationCreateFlagBits::eHostAccessRandom |
+                      vma::AllocationCreateFlagBits::eMapped)
+            .setUsage(vma::MemoryUsage::eAuto),
+    };
+    buffer->setName(context.device(), "batch readback {}", i);
+    readbacks.push_back({std::move(buffer), {}});
+  }
+}
+
+BatchRenderer::~BatchRenderer() {
+  for (auto &rb : readbacks) {
+    if (rb.encoding.valid()) {
+      rb.encoding.wait();
+    }
+  }
+  context.cleanup();
+}
+
+void BatchRenderer::record(CommandBuffer &cb, std::uint32_t image_idx,
+                           const Buffer &buffer) {
+  ZoneScoped;
+
+  cb->begin({vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+
+  mandelbrot.record(cb);
+
+  vk::Image const image = target.image(image_idx);
+
+  cb.barrier({}, {}, {},
+             {{
+                 vk::PipelineStageFlagBits2::eCopy,
+                 vk::AccessFlagBits2::eNone,
+                 vk::PipelineStageFlagBits2::eBlit,
+                 vk::AccessFlagBits2::eTransferWrite,
+                 vk::ImageLayout::eUndefined,
+                 vk::ImageLayout::eTransferDstOptimal,
+                 vk::QueueFamilyIgnored,
+                 vk::QueueFamilyIgnored,
+                 image,
+                 {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1},
+             }});
+
+  mandelbrot.blit(cb, image, target.extent());
+
+  cb.barrier({}, {}, {},
+             {{
+                 vk::PipelineStageFlagBits2::eBlit,
+                 vk::AccessFlagBits2::eTransferWrite,
+                 vk::PipelineStageFlagBits2::eCopy,
+                 vk::AccessFlagBits2::eTransferRead,
+                 vk::ImageLayout::eTransferDstOptimal,
+                 vk::ImageLayout::eTransferSrcOptimal,
+                 vk::QueueFamilyIgnored,
+                 vk::QueueFamilyIgnored,
+                 image,
+                 {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1},
+             }});
+
+  cb->copyImageToBuffer(
+      image, vk::ImageLayout::eTransferSrcOptimal, buffer->vk(),
+      vk::BufferImageCopy{
+          0,
+          0,
+          0,
+          {vk::ImageAspectFlagBits::eColor, 0, 0, 1},
+          {0, 0, 0},
+          {target.extent().width, target.extent().height, 1},
+      });
+
+  cb.barrier({},
+             {vk::MemoryBarrier2{vk::PipelineStageFlagBits2::eCopy,
+                                 vk::AccessFlagBits2::eTransferWrite,
+                                 vk::PipelineStageFlagBits2::eHost,
+                                 vk::AccessFlagBits2::eHostRead}},
+             {}, {});
+
+  cb.end();
+}
+
+void BatchRenderer::encode(std::uint32_t frame) {
+  auto &rb = readback(frame);
+  rb.encoding = context.executor().async([this, frame, &rb] {
+    ZoneScopedN("encode frame");
+
+    auto const name = std::vformat(options.output,
+                                   std::make_format_args(frame));
+    if (auto const dir = std::filesystem::path(name).parent_path();
+        !dir.empty()) {
+      std::filesystem::create_directories(dir);
+    }
+
+    rb.buffer->invalidate();
+    void *data = rb.buffer->allocator()
+                     .getAllocationInfo(rb.buffer->allocation())
+                     .pMappedData;
+
+    auto const width = static_cast<int>(options.extent.width);
+    auto const height = static_cast<int>(options.extent.height);
+    int const written =
+        file_format == FileFormat::Png
+            ? stbi_write_png(name.c_str(), width, height, 4, data,
+                             width * 4)
+            : stbi_write_hdr(name.c_str(), width, height, 4,
+                             static_cast<const float *>(data));
+    if (written == 0) {
+      throw exception("Could not write {}", name);
+    }
+  });
+}
+
+int BatchRenderer::Run() try {
+  auto const frame_count = path.back().frame + 1;
+  logger.Log("Rendering {} frames of {}x{} to {} ({} readback buffers)",
+             frame_count, options.extent.width, options.extent.height,
+             options.output, readbacks.size());
+
+  auto start = std::chrono::high_resolution_clock::now();
+
+  for (std::uint32_t frame = 0; frame < frame_count; ++frame) {
+    FrameMarkStart(nullptr);
+    detail::destroy_helper const frame_mark_scope{
+        [] { FrameMarkEnd(nullptr); }};
+
+    {
+      ZoneScopedN("advance frame");
+      context.next_frame();
+    }
+
+    // next_frame waited for the frame max_frames_in_flight ago
+    if (frame >= frames_in_flight) {
+      encode(frame - frames_in_flight);
+    }
+
+    auto &rb = readback(frame);
+    if (rb.encoding.valid()) {
+      ZoneScopedN("wait for encoding");
+      rb.encoding.get();
+    }
+
+    auto const view = interpolate_zoom(path, frame);
+    auto &params = mandelbrot.params();
+    params.center = view.center;
+    params.scale = glm::dvec2{view.height / mandelbrot.extent().height};
+    mandelbrot.wait_until_ready();
+
+    auto &graphics = *context.get_queue(Context::QueueType::Graphics);
+    auto cb = graphics.getCommandBuffer();
+    record(cb, target.acquire(), rb.buffer);
+    graphics.submit(SubmitionInfo::gather(std::move(cb)));
+
+    transfer_manager.doOutstandingTransfers();
+  }
+
+  context.cleanup();
+
+  for (auto frame = frame_count - std::min(frame_count, frames_in_flight);
+       frame < frame_count; ++frame) {
+    encode(frame);
+  }
+  for (auto &rb : readbacks) {
+    if (rb.encoding.valid()) {
+      rb.encoding.get();
+    }
+  }
+
+  auto elapsed = std::chrono::duration<double>(
+                     std::chrono::high_resolution_clock::now() - start)
+                     .count();
+
+  logger.Log("Batch render finished: {} frames in {:.3f}s ({:.2f} fps)",
+             frame_count, elapsed, frame_count / std::max(elapsed, 1e-9));
+
+  if (const auto *profiler =
+          context.get_queue(Context::QueueType::Graphics)->profiler()) {
+    for (const auto &zone : profiler->stats()) {
+      logger.Log("  gpu {}: avg {:.3f}ms max {:.3f}ms ({} samples)", zone.name,
+                 zone.avg_ms, zone.max_ms, zone.samples);
+    }
+  }
+
+  return 0;
+} catch (const vk::DeviceLostError &err) {
+  context.device().make_device_lost_dump(cfg, err);
+  return 1;
+}
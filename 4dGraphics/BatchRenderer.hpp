@@ -0,0 +1,99 @@
+#pragma once
+
+#include "MandelbrotRenderer.hpp"
+
+#include <CommandBuffer.hpp>
+#include <Config.hpp>
+#include <Context.hpp>
+#include <Device.hpp>
+#include <OffscreenSwapchain.hpp>
+#include <TransferManager.hpp>
+#include <VulkanResources.hpp>
+
+#include <glm/glm.hpp>
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+#include <filesystem>
+#include <future>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace v4dg {
+// a view of a zoom path; frames between keyframes are interpolated
+struct ZoomKeyframe {
+  std::uint32_t frame;
+  glm::dvec2 center;
+  // height of the view in the complex plane (independent of the resolution)
+  double height;
+};
+
+// one "<frame> <center x> <center y> <height>" per line, '#' starts a comment
+//   (frames have to be increasing)
+[[nodiscard]] std::vector<ZoomKeyframe>
+load_zoom_path(const std::filesystem::path &path);
+
+// the height is interpolated log-linearly and the center so that the point
+//   zoomed into stays in place on the screen
+[[nodiscard]] ZoomKeyframe interpolate_zoom(std::span<const ZoomKeyframe> path,
+                                            std::uint32_t frame);
+
+// Renders a zoom path to image files without a window (render farms).
+//   Frames are recorded max_frames_in_flight ahead and copied to host
+//   buffers in their own command buffer; once a frame is finished its
+//   buffer is encoded on the executor while the GPU renders the next ones.
+class BatchRenderer {
+public:
+  struct Options {
+    vk::Extent2D extent{1920, 1080};
+    std::filesystem::path path;
+    // std::format pattern of the file names taking the frame index:
+    //   .png (8-bit) or .hdr (Radiance RGBE, float)
+    std::string output{"frame_{:05}.png"};
+  };
+
+  BatchRenderer(const Config &cfg, Options options);
+  BatchRenderer(const BatchRenderer &) = delete;
+  BatchRenderer &operator=(const BatchRenderer &) = delete;
+  BatchRenderer(BatchRenderer &&) = delete;
+  BatchRenderer &operator=(BatchRenderer &&) = delete;
+  ~BatchRenderer();
+
+  int Run();
+
+private:
+  enum class FileFormat : std::uint8_t { Png, Hdr };
+
+  // a frame between the readback copy and the written file
+  struct Readback {
+    Buffer buffer;
+    std::future<void> encoding;
+  };
+
+  const Config &cfg;
+  Options options;
+  std::vector<ZoomKeyframe> path;
+  FileFormat file_format;
+
+  Instance instance;
+  Device device;
+  Context context;
+  TransferManager transfer_manager;
+
+  OffscreenSwapchain target;
+  MandelbrotRenderer mandelbrot;
+
+  std::vector<Readback> readbacks;
+
+  [[nodiscard]] Readback &readback(std::uint32_t frame) {
+    return readbacks[frame % readbacks.size()];
+  }
+
+  void record(CommandBuffer &cb, std::uint32_t image_idx,
+              const Buffer &buffer);
+  // starts writing `frame` (its GPU work has to be finished)
+  void encode(std::uint32_t frame);
+};
+} // namespace v4dg
@@ -0,0 +1,467 @@
+#include "Benchmarks.hpp"
+
+#include "MandelbrotCpu.hpp"
+
+#include <BindlessManager.hpp>
+#include <Debug.hpp>
+#include <HandleCache.hpp>
+#include <v4dgCore.hpp>
+
+#include <ankerl/unordered_dense.h>
+#include <glm/glm.hpp>
+#include <taskflow/taskflow.hpp>
+#include <tracy/Tracy.hpp>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <latch>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace v4dg;
+
+namespace {
+// simple xorshift so that every reader walks the keys in a different order
+struct rng {
+  std::uint32_t state;
+
+  std::uint32_t operator()() noexcept {
+    state ^= state << 13; // NOLINT(*-magic-numbers)
+    state ^= state >> 17; // NOLINT(*-magic-numbers)
+    state ^= state << 5;  // NOLINT(*-magic-numbers)
+    return state;
+  }
+};
+
+// runs `fn(thread_idx)` on `threads` threads released at the same time;
+//   returns the wall time in seconds
+double run_concurrently(unsigned threads,
+                        const std::function<void(unsigned)> &fn) {
+  std::latch start{threads + 1};
+  std::vector<std::jthread> workers;
+  workers.reserve(threads);
+
+  for (unsigned i = 0; i < threads; i++) {
+    workers.emplace_back([&, i] {
+      start.arrive_and_wait();
+      fn(i);
+    });
+  }
+
+  start.arrive_and_wait();
+  auto begin = std::chrono::steady_clock::now();
+  workers.clear();
+  auto end = std::chrono::steady_clock::now();
+
+  return std::chrono::duration<double>(end - begin).count();
+}
+
+// the handle_cache design before the snapshot (RCU) rewrite
+//   - kept only as the baseline of the benchmark
+template <handle_descriptor handle_desc> class legacy_handle_cache {
+public:
+  using handle_type = typename handle_desc::handle_type;
+  using handle_data = typename handle_desc::handle_data;
+
+  explicit legacy_handle_cache(handle_data data) : m_data(data) {}
+
+  std::shared_ptr<const handle_type> get(const handle_desc &desc) {
+    if (auto it = m_old.find(desc); it != m_old.end()) {
+      if (auto handle = it->second.lock(); handle) {
+        return handle;
+      }
+    }
+
+    {
+      std::shared_lock lock(m_mut);
+      if (auto it = m_new.find(desc); it != m_new.end()) {
+        if (auto handle = it->second.lock(); handle) {
+          return handle;
+        }
+      }
+    }
+
+    std::unique_lock lock(m_mut);
+    if (auto it = m_new.find(desc); it != m_new.end()) {
+      if (auto handle = it->second.lock(); handle) {
+        return handle;
+      }
+    }
+
+    auto handle = desc.create(m_data);
+    m_new.insert_or_assign(desc, handle);
+    return handle;
+  }
+
+  // not safe against concurrent get() - the reason for the rewrite
+  void flush() {
+    std::unique_lock lock(m_mut);
+
+    auto storage = m_new.extract();
+    for (auto &&[desc, handle] : storage) {
+      m_old.insert_or_assign(std::move(desc), std::move(handle));
+    }
+    std::erase_if(m_old,
+                  [](const auto &pair) { return pair.second.expired(); });
+  }
+
+private:
+  using map_type =
+      ankerl::unordered_dense::map<handle_desc,
+                                   std::weak_ptr<const handle_type>,
+                                   typename handle_desc::hash>;
+
+  map_type m_old;
+  std::shared_mutex m_mut;
+  map_type m_new;
+
+  handle_data m_data;
+};
+
+struct bench_handle_desc {
+  using handle_type = std::uint64_t;
+  using handle_data = int;
+  struct hash {
+    using is_avalanching = void;
+    std::size_t operator()(const bench_handle_desc &d) const noexcept {
+      return ankerl::unordered_dense::hash<std::uint32_t>{}(d.key);
+    }
+  };
+
+  std::uint32_t key;
+
+  bool operator==(const bench_handle_desc &) const = default;
+
+  [[nodiscard]] std::shared_ptr<const std::uint64_t> create(int) const {
+    return std::make_shared<const std::uint64_t>(key);
+  }
+};
+
+int handle_cache_benchmark() {
+  ZoneScoped;
+
+  static constexpr unsigned readers = 16;
+  static constexpr std::uint32_t keys = 1024;
+  static constexpr std::size_t lookups = 1 << 20;
+
+  std::atomic<std::uint64_t> sink{0};
+
+  auto measure = [&](std::string_view name, auto &&lookup) {
+    double const seconds = run_concurrently(readers, [&](unsigned idx) {
+      rng random{idx + 1};
+      std::uint64_t sum = 0;
+      for (std::size_t i = 0; i < lookups; i++) {
+        sum += lookup(bench_handle_desc{random() % keys});
+      }
+      sink.fetch_add(sum, std::memory_order_relaxed);
+    });
+
+    double const total = static_cast<double>(readers) * lookups;
+    double const mlookups = total / seconds / 1e6; // NOLINT(*-magic-numbers)
+    double const ns = seconds * 1e9 / lookups;     // NOLINT(*-magic-numbers)
+    logger.Log("  {:<28} {:8.2f} Mlookups/s ({:.1f} ns/lookup/thread)", name,
+               mlookups, ns);
+  };
+
+  // keep all handles alive so nothing is dropped on flush
+  std::vector<std::shared_ptr<const std::uint64_t>> keep;
+  keep.reserve(2 * keys);
+
+  legacy_handle_cache<bench_handle_desc> legacy{0};
+  handle_cache<bench_handle_desc> snapshot{0};
+
+  for (std::uint32_t key = 0; key < keys; key++) {
+    keep.push_back(legacy.get({key}));
+    keep.push_back(snapshot.get({key}));
+  }
+  legacy.flush();
+  snapshot.flush();
+
+  logger.Log("handle_cache: {} readers, {} keys, {} lookups per reader",
+             readers, keys, lookups);
+
+  measure("legacy get (weak_ptr::lock)",
+          [&](const bench_handle_desc &d) { return *legacy.get(d); });
+  measure("snapshot get (shared_ptr)",
+          [&](const bench_handle_desc &d) { return *snapshot.get(d); });
+  measure("snapshot get_ref",
+          [&](const bench_handle_desc &d) { return snapshot.get_ref(d); });
+
+  // the new cache tolerates flushes while it is being read
+  std::atomic<bool> done{false};
+  std::jthread flusher{[&] {
+    while (!done.load(std::memory_order_relaxed)) {
+      snapshot.flush();
+      std::this_thread::sleep_for(std::chrono::milliseconds{1});
+    }
+  }};
+  measure("snapshot get_ref + flushes",
+          [&](const bench_handle_desc &d) { return snapshot.get_ref(d); });
+  done = true;
+
+  logger.Debug("checksum {}", sink.load());
+  return EXIT_SUCCESS;
+}
+
+// the BindlessHeap design before the per-thread caches
+//   - kept only as the baseline of the benchmark
+class legacy_bindless_heap {
+public:
+  explicit legacy_bindless_heap(std::uint32_t max_count)
+      : m_max_count(max_count) {}
+
+  std::uint32_t allocate() {
+    std::scoped_lock const _{m_mutex};
+    if (m_free.empty()) {
+      if (m_count >= m_max_count) {
+        throw exception("out of bindless resources (max {})", m_max_count);
+      }
+      return m_count++;
+    }
+
+    std::uint32_t const res = m_free.back();
+    m_free.pop_back();
+    return res;
+  }
+
+  void free(std::uint32_t res) {
+    std::scoped_lock const _{m_mutex};
+    m_free.push_back(res);
+  }
+
+private:
+  std::uint32_t m_max_count;
+  std::uint32_t m_count{1};
+
+  std::mutex m_mutex;
+  std::deque<std::uint32_t> m_free;
+};
+
+int bindless_heap_benchmark() {
+  ZoneScoped;
+
+  static constexpr unsigned threads = 8;
+  // every texture takes up to 3 handles (see ImageView)
+  static constexpr std::size_t handles_per_texture = 3;
+  static constexpr std::size_t textures = 1 << 17;
+  // textures each loader keeps alive before streaming them out
+  static constexpr std::size_t resident = 256;
+  // fits every handle even if the frame thread never runs
+  static constexpr std::uint32_t max_count = 1 << 22;
+
+  std::atomic<std::uint64_t> sink{0};
+
+  auto measure = [&](std::string_view name, auto &&allocate, auto &&free) {
+    double const seconds = run_concurrently(threads, [&](unsigned) {
+      std::deque<decltype(allocate())> held;
+      std::uint64_t sum = 0;
+
+      for (std::size_t i = 0; i < textures; i++) {
+        for (std::size_t j = 0; j < handles_per_texture; j++) {
+          held.push_back(allocate());
+        }
+        while (held.size() > resident * handles_per_texture) {
+          sum += held.front().index();
+          free(held.front());
+          held.pop_front();
+        }
+      }
+      for (auto &h : held) {
+        free(h);
+      }
+      sink.fetch_add(sum, std::memory_order_relaxed);
+    });
+
+    double const ops = 2. * threads * textures * handles_per_texture;
+    double const mops = ops / seconds / 1e6; // NOLINT(*-magic-numbers)
+    logger.Log("  {:<28} {:8.2f} Mops/s", name, mops);
+  };
+
+  logger.Log("bindless heap: {} threads, {} textures of {} handles each, "
+             "{} resident per thread",
+             threads, textures, handles_per_texture, resident);
+
+  {
+    struct legacy_handle {
+      std::uint32_t idx;
+      [[nodiscard]] std::uint32_t index() const { return idx; }
+    };
+
+    legacy_bindless_heap legacy{max_count};
+    measure(
+        "legacy (mutex + deque)",
+        [&] { return legacy_handle{legacy.allocate()}; },
+        [&](legacy_handle h) { legacy.free(h.idx); });
+  }
+
+  {
+    BindlessHeap heap;
+    heap.setup(BindlessType::eSampledImage, max_count);
+
+    // freed handles are only recycled on frame boundaries
+    std::atomic<bool> done{false};
+    std::jthread frames{[&] {
+      for (std::size_t frame = 1; !done.load(std::memory_order_relaxed);
+           frame++) {
+        heap.next_frame(frame % max_frames_in_flight);
+        std::this_thread::sleep_for(std::chrono::milliseconds{1});
+      }
+    }};
+    measure(
+        "per-thread caches", [&] { return heap.allocate(); },
+        [&](BindlessResource h) { heap.free(h); });
+    done = true;
+  }
+
+  // the only index is handed out once per version, then never again
+  bool exhausted = false;
+  {
+    // 6 version bits
+    static constexpr std::uint32_t versions = 64;
+    BindlessHeap heap;
+    heap.setup(BindlessType::eSampledImage, 2);
+
+    std::uint32_t uses = 0;
+    try {
+      for (;; uses++) {
+        BindlessResource const res = heap.allocate();
+        if (res.version() != uses % versions) {
+          break;
+        }
+        heap.free(res);
+        for (std::size_t frame = 0; frame < max_frames_in_flight; frame++) {
+          heap.next_frame(frame);
+        }
+      }
+    } catch (const exception &) {
+      exhausted = uses == versions && heap.stats().exhausted == 1;
+    }
+    if (!exhausted) {
+      logger.Error("bindless heap: index reused {} times before exhausted",
+                   uses);
+    }
+  }
+
+  logger.Debug("checksum {}", sink.load());
+  return exhausted ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int mandelbrot_cpu_benchmark() {
+  ZoneScoped;
+
+  static constexpr std::uint32_t width = 1024;
+  static constexpr std::uint32_t height = 768;
+  static constexpr int repeats = 3;
+
+  MandelbrotCpuView view{
+      .center = {-0.5, 0.},            // NOLINT(*-magic-numbers)
+      .scale = glm::dvec2{3. / width}, // NOLINT(*-magic-numbers)
+      .width = width,
+      .height = height,
+  };
+
+  tf::Executor executor;
+  std::vector<std::uint32_t> scalar(std::size_t{width} * height);
+  std::vector<std::uint32_t> simd(scalar.size());
+
+  auto measure = [&](int variant, CpuKernel kernel, std::string_view name,
+                     std::vector<std::uint32_t> &out) {
+    if (view.escape_values) {
+      // only checked for exactness
+      mandelbrot_cpu(view, variant, kernel, out, executor);
+      return;
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < repeats; i++) {
+      mandelbrot_cpu(view, variant, kernel, out, executor);
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double const seconds = std::chrono::duration<double>(end - begin).count();
+    double const iterations = static_cast<double>(
+        std::reduce(out.begin(), out.end(), std::uint64_t{0}));
+    // NOLINTNEXTLINE(*-magic-numbers)
+    double const rate = repeats * iterations / seconds / 1e6;
+    logger.Log("  variant {} {:<10} {:8.2f} Mpixel-iterations/s", variant,
+               name, rate);
+  };
+
+  logger.Log("mandelbrot cpu: {}x{}, {} iterations max, {} threads, "
+             "SIMD {} ({} lanes)",
+             width, height, view.max_iter, executor.num_workers(),
+             mandelbrot_simd_isa(), mandelbrot_simd_width());
+
+  bool exact = true;
+  // the classic and the smooth coloring bailout
+  for (bool const escape_values : {false, true}) {
+    view.escape_values = escape_values;
+    for (int variant = 0; variant < 3; variant++) {
+      measure(variant, CpuKernel::Scalar, "scalar", scalar);
+      measure(variant, CpuKernel::Simd, mandelbrot_simd_isa(), simd);
+
+      // the kernels only differ in the order of independent operations
+      auto const mismatches = std::transform_reduce(
+          scalar.begin(), scalar.end(), simd.begin(), std::size_t{0},
+          std::plus<>{}, [](std::uint32_t a, std::uint32_t b) {
+            return static_cast<std::size_t>(a != b);
+          });
+      if (mismatches != 0) {
+        logger.Error("  variant {}{}: {} pixels differ between the kernels",
+                     variant, escape_values ? " (smooth bailout)" : "",
+                     mismatches);
+        exact = false;
+      }
+    }
+  }
+
+  return exact ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+struct benchmark {
+  std::string_view name;
+  int (*run)();
+};
+
+constexpr std::array benchmarks{
+    benchmark{"handle-cache", handle_cache_benchmark},
+    benchmark{"bindless-heap", bindless_heap_benchmark},
+    benchmark{"mandelbrot-cpu", mandelbrot_cpu_benchmark},
+};
+} // namespace
+
+std::string v4dg::benchmark_names() {
+  std::string names;
+  for (const auto &bench : benchmarks) {
+    if (!names.empty()) {
+      names += ", ";
+    }
+    names += bench.name;
+  }
+  return names;
+}
+
+int v4dg::run_benchmark(std::string_view name) {
+  for (const auto &bench : benchmarks) {
+    if (bench.name == name) {
+      return bench.run();
+    }
+  }
+
+  logger.Error("Unknown benchmark {} (available: {})", name,
+               benchmark_names());
+  return EXIT_FAILURE;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+namespace v4dg {
+// micro benchmarks selectable with `--benchmark <name>`;
+//   they run without a window or a Vulkan device and log their results
+//   (see DeviceChecks.hpp for the checks that need one)
+
+// comma separated list of the available benchmarks
+[[nodiscard]] std::string benchmark_names();
+
+// returns the process exit code
+int run_benchmark(std::string_view name);
+} // namespace v4dg
@@ -0,0 +1,256 @@
+#include "DeepZoom.hpp"
+
+#include <tracy/Tracy.hpp>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+using namespace v4dg;
+
+namespace {
+constexpr double limb_scale = 0x1p32;
+
+// magnitude comparison of equally sized limb vectors
+int compare(const std::vector<std::uint32_t> &a,
+            const std::vector<std::uint32_t> &b) noexcept {
+  for (std::size_t i = a.size(); i-- > 0;) {
+    if (a[i] != b[i]) {
+      return a[i] < b[i] ? -1 : 1;
+    }
+  }
+  return 0;
+}
+
+glm::dvec2 cmul(glm::dvec2 a, glm::dvec2 b) noexcept {
+  return {a.x * b.x - a.y * b.y, a.x * b.y + a.y * b.x};
+}
+
+bool finite(glm::dvec2 v) noexcept {
+  return std::isfinite(v.x) && std::isfinite(v.y);
+}
+
+// the cubic term has to stay this small relative to the linear one
+constexpr double series_tolerance = 1e-6;
+} // namespace
+
+BigFixed::BigFixed(double value, std::size_t frac_limbs)
+    : m_limbs(frac_limbs + 1, 0), m_negative(value < 0.) {
+  double mag = std::abs(value);
+  double const integer = std::floor(mag);
+  m_limbs.back() = static_cast<std::uint32_t>(integer);
+  mag -= integer;
+
+  // exact: scaling by 2^32 only changes the exponent
+  for (std::size_t i = frac_limbs; i-- > 0 && mag != 0.;) {
+    mag *= limb_scale;
+    double const limb = std::floor(mag);
+    m_limbs[i] = static_cast<std::uint32_t>(limb);
+    mag -= limb;
+  }
+}
+
+BigFixed BigFixed::with_precision(std::size_t frac_limbs) const {
+  BigFixed out{*this};
+  auto const current = this->frac_limbs();
+  if (frac_limbs > current) {
+    out.m_limbs.insert(out.m_limbs.begin(), frac_limbs - current, 0);
+  } else {
+    out.m_limbs.erase(out.m_limbs.begin(),
+                      out.m_limbs.begin() +
+                          static_cast<std::ptrdiff_t>(current - frac_limbs));
+  }
+  return out;
+}
+
+double BigFixed::to_double() const noexcept {
+  auto top = m_limbs.size();
+  while (top > 0 && m_limbs[top - 1] == 0) {
+    top--;
+  }
+
+  // three limbs from the highest non-zero one carry all 53 bits
+  double value = 0.;
+  for (std::size_t i = top > 3 ? top - 3 : 0; i < top; i++) {
+    value += std::ldexp(static_cast<double>(m_limbs[i]),
+                        static_cast<int>(limb_bits * i) -
+                            static_cast<int>(limb_bits * frac_limbs()));
+  }
+  return m_negative ? -value : value;
+}
+
+BigFixed &BigFixed::operator+=(const BigFixed &o) {
+  add(o, false);
+  return *this;
+}
+
+BigFixed &BigFixed::operator-=(const BigFixed &o) {
+  add(o, true);
+  return *this;
+}
+
+void BigFixed::add(const BigFixed &o, bool negate) {
+  if (o.frac_limbs() > frac_limbs()) {
+    *this = with_precision(o.frac_limbs());
+  }
+
+  BigFixed extended;
+  const BigFixed *other = &o;
+  if (o.frac_limbs() != frac_limbs()) {
+    extended = o.with_precision(frac_limbs());
+    other = &extended;
+  }
+  const BigFixed &rhs = *other;
+  bool const rhs_negative = rhs.m_negative != negate;
+
+  if (m_negative == rhs_negative) {
+    std::uint64_t carry = 0;
+    for (std::size_t i = 0; i < m_limbs.size(); i++) {
+      carry += std::uint64_t{m_limbs[i]} + rhs.m_limbs[i];
+      m_limbs[i] = static_cast<std::uint32_t>(carry);
+      carry >>= limb_bits;
+    }
+    return;
+  }
+
+  // different signs: the smaller magnitude is subtracted from the larger
+  bool const swap = compare(m_limbs, rhs.m_limbs) < 0;
+  const auto &big = swap ? rhs.m_limbs : m_limbs;
+  const auto &small = swap ? m_limbs : rhs.m_limbs;
+
+  std::vector<std::uint32_t> out(m_limbs.size());
+  std::int64_t borrow = 0;
+  for (std::size_t i = 0; i < out.size(); i++) {
+    std::int64_t diff = std::int64_t{big[i]} - small[i] - borrow;
+    borrow = diff < 0 ? 1 : 0;
+    diff += borrow << limb_bits;
+    out[i] = static_cast<std::uint32_t>(diff);
+  }
+
+  m_limbs = std::move(out);
+  m_negative = swap ? rhs_negative : m_negative;
+}
+
+BigFixed v4dg::operator*(const BigFixed &a, const BigFixed &b) {
+  auto const frac = std::max(a.frac_limbs(), b.frac_limbs());
+  if (a.frac_limbs() != frac) {
+    return a.with_precision(frac) * b;
+  }
+  if (b.frac_limbs() != frac) {
+    return a * b.with_precision(frac);
+  }
+  const BigFixed &lhs = a;
+  const BigFixed &rhs = b;
+
+  auto const n = frac + 1;
+  std::vector<std::uint32_t> product(2 * n, 0);
+  for (std::size_t i = 0; i < n; i++) {
+    std::uint64_t carry = 0;
+    for (std::size_t j = 0; j < n; j++) {
+      carry += std::uint64_t{lhs.m_limbs[i]} * rhs.m_limbs[j] + product[i + j];
+      product[i + j] = static_cast<std::uint32_t>(carry);
+      carry >>= BigFixed::limb_bits;
+    }
+    product[i + n] = static_cast<std::uint32_t>(carry);
+  }
+
+  // the binary point of the product is after 2 * frac limbs
+  BigFixed out;
+  out.m_limbs.assign(product.begin() + static_cast<std::ptrdiff_t>(frac),
+                     product.begin() + static_cast<std::ptrdiff_t>(frac + n));
+  out.m_negative = lhs.m_negative != rhs.m_negative;
+  return out;
+}
+
+ReferenceOrbit v4dg::compute_reference_orbit(const BigFixed &cx,
+                                             const BigFixed &cy, double scale,
+                                             double radius,
+                                             std::uint32_t max_iter,
+                                             std::size_t precision_bits) {
+  ZoneScoped;
+
+  auto const limbs = BigFixed::limbs_for(precision_bits);
+  ReferenceOrbit orbit{
+      .cx = cx.with_precision(limbs),
+      .cy = cy.with_precision(limbs),
+      .scale = scale,
+      .radius = radius,
+      .max_iter = max_iter,
+      .precision_bits = precision_bits,
+      .z = {},
+      .skip = 0,
+      .a = {},
+      .b = {},
+      .c = {},
+  };
+  orbit.z.reserve(max_iter + 1);
+  orbit.z.emplace_back(0., 0.);
+
+  BigFixed x{0., limbs};
+  BigFixed y{0., limbs};
+
+  // dz_n = a_n dc + b_n dc^2 + c_n dc^3, dz_0 = 0
+  glm::dvec2 a{};
+  glm::dvec2 b{};
+  glm::dvec2 c{};
+  bool series_valid = true;
+  double const r = radius;
+  // the accepted approximation one step earlier
+  std::uint32_t prev_skip = 0;
+  glm::dvec2 prev_a{};
+  glm::dvec2 prev_b{};
+  glm::dvec2 prev_c{};
+
+  for (std::uint32_t n = 0; n < max_iter; n++) {
+    if (series_valid) {
+      glm::dvec2 const z2 = 2. * orbit.z.back();
+      glm::dvec2 const na = cmul(z2, a) + glm::dvec2{1., 0.};
+      glm::dvec2 const nb = cmul(z2, b) + cmul(a, a);
+      glm::dvec2 const nc = cmul(z2, c) + 2. * cmul(a, b);
+
+      // the cubic term estimates the error of the quadratic approximation
+      series_valid = finite(na) && finite(nb) && finite(nc) &&
+                     glm::length(nc) * r * r * r <=
+                         series_tolerance * glm::length(na) * r;
+      if (series_valid) {
+        prev_skip = orbit.skip;
+        prev_a = std::exchange(a, na);
+        prev_b = std::exchange(b, nb);
+        prev_c = std::exchange(c, nc);
+        orbit.skip = n + 1;
+      }
+    }
+
+    // Z_{n+1} = Z_n^2 + C
+    auto const xx = x * x;
+    auto const yy = y * y;
+    auto const xy = x * y;
+    x = xx - yy + orbit.cx;
+    y = xy + xy + orbit.cy;
+
+    glm::dvec2 const z{x.to_double(), y.to_double()};
+    orbit.z.push_back(z);
+    if (glm::dot(z, z) > 4.) { // NOLINT(*-magic-numbers)
+      break;
+    }
+  }
+
+  // the pixels need at least one step of the orbit after the skip
+  //   (only the last accepted step can violate this)
+  if (orbit.skip + 2 > orbit.z.size()) {
+    orbit.skip = prev_skip;
+    a = prev_a;
+    b = prev_b;
+    c = prev_c;
+  }
+
+  orbit.a = a;
+  orbit.b = b;
+  orbit.c = c;
+  return orbit;
+}
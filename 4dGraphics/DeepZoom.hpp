@@ -0,0 +1,77 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace v4dg {
+// Arbitrary precision signed fixed point number (sign and magnitude) with
+//   32 integer bits and frac_limbs() 32-bit fraction limbs.
+//   Operations on numbers of different precision use the higher one.
+class BigFixed {
+public:
+  static constexpr std::size_t limb_bits = 32;
+
+  BigFixed() : BigFixed(0., 1) {}
+  // |value| has to fit into the 32 integer bits
+  BigFixed(double value, std::size_t frac_limbs);
+
+  // fraction limbs needed for `bits` fraction bits
+  [[nodiscard]] static std::size_t limbs_for(std::size_t bits) noexcept {
+    return (bits + limb_bits - 1) / limb_bits;
+  }
+
+  [[nodiscard]] std::size_t frac_limbs() const noexcept {
+    return m_limbs.size() - 1;
+  }
+  // truncates or extends the fraction
+  [[nodiscard]] BigFixed with_precision(std::size_t frac_limbs) const;
+
+  [[nodiscard]] double to_double() const noexcept;
+
+  BigFixed &operator+=(const BigFixed &o);
+  BigFixed &operator-=(const BigFixed &o);
+
+  friend BigFixed operator+(BigFixed a, const BigFixed &b) { return a += b; }
+  friend BigFixed operator-(BigFixed a, const BigFixed &b) { return a -= b; }
+  // the integer part wraps on overflow
+  friend BigFixed operator*(const BigFixed &a, const BigFixed &b);
+
+private:
+  void add(const BigFixed &o, bool negate);
+
+  // little endian magnitude; the last limb is the integer part
+  std::vector<std::uint32_t> m_limbs;
+  bool m_negative{false};
+};
+
+// Orbit of a reference point for perturbation rendering: pixels iterate
+//   only their (double) difference dz to the reference orbit Z.
+struct ReferenceOrbit {
+  BigFixed cx;
+  BigFixed cy;
+  // pixel size and |dc| the series approximation was computed for
+  double scale;
+  double radius;
+  std::uint32_t max_iter;
+  std::size_t precision_bits;
+
+  // Z_0 = 0 ... Z_n until the reference escapes or reaches max_iter
+  std::vector<glm::dvec2> z;
+
+  // series approximation: dz_skip = a dc + b dc^2 + c dc^3 for |dc| < radius
+  std::uint32_t skip;
+  glm::dvec2 a;
+  glm::dvec2 b;
+  glm::dvec2 c;
+};
+
+// iterates the reference point with `precision_bits` fraction bits
+//   (long running - meant for a worker thread)
+[[nodiscard]] ReferenceOrbit
+compute_reference_orbit(const BigFixed &cx, const BigFixed &cy, double scale,
+                        double radius, std::uint32_t max_iter,
+                        std::size_t precision_bits);
+} // namespace v4dg
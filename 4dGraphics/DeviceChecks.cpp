@@ -0,0 +1,558 @@
+#include "DeviceChecks.hpp"
+#include "MandelbrotRenderer.hpp"
+
+#include <BindlessManager.hpp>
+#include <CommandBuffer.hpp>
+#include <Config.hpp>
+#include <Context.hpp>
+#include <DSAllocator.hpp>
+#include <Debug.hpp>
+#include <Defragmenter.hpp>
+#include <Device.hpp>
+#include <MemoryPools.hpp>
+#include <ResourceRegistry.hpp>
+#include <VulkanCaches.hpp>
+#include <VulkanConstructs.hpp>
+
+#include <tracy/Tracy.hpp>
+#include <vulkan-memory-allocator-hpp/vk_mem_alloc.hpp>
+#include <vulkan/vulkan.hpp>
+#include <vulkan/vulkan_raii.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <ranges>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace v4dg;
+
+namespace {
+// frees handles (and destroys their samplers) while another thread flushes
+//   the queued writes - a flush that still writes a destroyed sampler is
+//   reported by the validation layers
+int bindless_free_flush_check(Context &ctx) {
+  ZoneScoped;
+
+  static constexpr int iterations = 1 << 14;
+  // freed handles are only reused after a few frames
+  static constexpr int frame_length = 64;
+
+  auto &bindless = ctx.bindlessManager();
+
+  std::atomic<bool> done{false};
+  std::atomic<std::size_t> flushes{0};
+  std::jthread flusher{[&] {
+    while (!done.load(std::memory_order_relaxed)) {
+      bindless.flush_writes();
+      flushes.fetch_add(1, std::memory_order_relaxed);
+    }
+  }};
+
+  for (int i = 0; i < iterations; i++) {
+    vk::raii::Sampler const sampler{ctx.vkDevice(), vk::SamplerCreateInfo{}};
+    {
+      auto res = bindless.allocate(BindlessType::eSampler);
+      bindless.queue_write(res.get(), vk::DescriptorImageInfo{*sampler});
+      // freed here - the sampler is destroyed right after
+    }
+
+    if (i % frame_length == frame_length - 1) {
+      ctx.next_frame();
+    }
+  }
+
+  done = true;
+  flusher.join();
+  bindless.flush_writes();
+
+  logger.Log("bindless free/flush: {} handles freed during {} flushes",
+             iterations, flushes.load());
+  return EXIT_SUCCESS;
+}
+
+// allocates a fixed mix of sets for a few frames - the learned pool weights
+//   have to move towards the descriptors per set of that mix
+int ds_tuner_check(Context &ctx) {
+  ZoneScoped;
+
+  static constexpr int frames = 32;
+  // 4 storage images each
+  static constexpr int image_sets = 96;
+  // a uniform buffer and 2 combined image samplers each
+  static constexpr int sampler_sets = 32;
+  static constexpr float set_count = image_sets + sampler_sets;
+
+  using enum vk::DescriptorType;
+  auto const stages = vk::ShaderStageFlagBits::eCompute;
+  vk::DescriptorSetLayout const images = ctx.descriptor_set_layout(
+      DescriptorSetLayoutInfo{}.add_binding(0, eStorageImage, stages, 4));
+  vk::DescriptorSetLayout const samplers = ctx.descriptor_set_layout(
+      DescriptorSetLayoutInfo{}
+          .add_binding(0, eUniformBuffer, stages)
+          .add_binding(1, eCombinedImageSampler, stages, 2));
+
+  // NOLINTBEGIN(*-magic-numbers)
+  std::array<std::pair<vk::DescriptorType, float>, 4> const demand{{
+      {eStorageImage, 4.F * image_sets / set_count},
+      {eUniformBuffer, 1.F * sampler_sets / set_count},
+      {eCombinedImageSampler, 2.F * sampler_sets / set_count},
+      {eStorageBuffer, 0.F},
+  }};
+  // NOLINTEND(*-magic-numbers)
+
+  auto weight_of = [](const DSAllocatorWeights &weights,
+                      vk::DescriptorType type) {
+    auto it = std::ranges::find(weights.m_weights, type,
+                                &DSAllocatorWeights::DescriptorWieght::type);
+    return it == weights.m_weights.end() ? 0.F : it->weight;
+  };
+
+  auto &tuner = ctx.ds_tuner();
+  auto const before = tuner.learned_weights();
+  auto const sets_before = tuner.stats().sets;
+
+  DSAllocatorPool pool{ctx.vkDevice(), tuner};
+  for (int frame = 0; frame < frames; frame++) {
+    {
+      auto allocator = pool.get_allocator();
+      for (int i = 0; i < image_sets; i++) {
+        allocator.allocate(images);
+      }
+      for (int i = 0; i < sampler_sets; i++) {
+        allocator.allocate(samplers);
+      }
+    }
+
+    ctx.next_frame();
+    pool.advance_frame();
+  }
+
+  auto const after = tuner.learned_weights();
+  auto const stats = tuner.stats();
+
+  bool ok = stats.sets - sets_before ==
+            static_cast<std::uint64_t>(frames * set_count);
+  logger.Log("descriptor pool tuner: {} sets in {} frames, generation {}",
+             stats.sets - sets_before, frames, stats.generation);
+
+  for (auto [type, expected] : demand) {
+    float const from = weight_of(before, type);
+    float const to = weight_of(after, type);
+    logger.Log("  {}: {:.3f} -> {:.3f} (demand {:.3f})", type, from, to,
+               expected);
+
+    // learn_rate of the remaining distance per frame - at least half of
+    //   it is covered after `frames`
+    static constexpr float covered = 0.5F;
+    if (!(std::abs(to - expected) < covered * std::abs(from - expected))) {
+      ok = false;
+    }
+  }
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// pushes a transient set for every pipeline kind the device supports - the
+//   validation layers check the recorded commands
+int transient_sets_check(Context &ctx) {
+  ZoneScoped;
+
+  const Device &device = ctx.device();
+  auto &bindless = ctx.bindlessManager();
+  auto const bind_point = vk::PipelineBindPoint::eCompute;
+
+  static constexpr vk::DeviceSize buffer_size = 256;
+  Buffer const buffer{device, buffer_size,
+                      vk::BufferUsageFlagBits2KHR::eStorageBuffer};
+  vk::DescriptorBufferInfo const buffer_info{buffer->vk(), 0, vk::WholeSize};
+  vk::WriteDescriptorSet const write{
+      {}, 0, 0, vk::DescriptorType::eStorageBuffer, {}, buffer_info, {},
+  };
+
+  auto cb = ctx.get_queue(Context::QueueType::Graphics)->getCommandBuffer();
+  cb->begin({vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+
+  // kept until the command buffer is done
+  std::vector<vk::raii::PipelineLayout> layouts;
+  auto exercise = [&](bool descriptor_buffer) {
+    vk::DescriptorSetLayout const set_layout = ctx.descriptor_set_layout(
+        DescriptorSetLayoutInfo{
+            CommandBuffer::transient_set_layout_flags(descriptor_buffer)}
+            .add_binding(0, vk::DescriptorType::eStorageBuffer,
+                         vk::ShaderStageFlagBits::eCompute));
+
+    // descriptor buffer pipelines have the bindless set bound as well
+    std::vector<vk::DescriptorSetLayout> set_layouts;
+    if (descriptor_buffer) {
+      set_layouts.push_back(*bindless.get_layouts());
+    }
+    set_layouts.push_back(set_layout);
+
+    const auto &layout = layouts.emplace_back(
+        ctx.vkDevice(), vk::PipelineLayoutCreateInfo{{}, set_layouts});
+    if (descriptor_buffer) {
+      bindless.bind(cb, *layout, bind_point);
+    }
+    cb.bindTransientSet(bind_point, *layout,
+                        static_cast<std::uint32_t>(set_layouts.size() - 1),
+                        {&write, 1});
+
+    logger.Log("  pushed set{}",
+               descriptor_buffer ? " (descriptor buffer pipeline)" : "");
+  };
+
+  logger.Log("transient sets:");
+  exercise(false);
+  if (bindless.uses_descriptor_buffer()) {
+    if (CommandBuffer::transient_sets_supported(device, true)) {
+      exercise(true);
+    } else {
+      logger.Log("  none with descriptor buffer pipelines (no bufferless "
+                 "push descriptors)");
+    }
+  }
+
+  cb.end();
+  ctx.get_queue(Context::QueueType::Graphics)
+      ->submit(SubmitionInfo::gather(std::move(cb)));
+  ctx.vkDevice().waitIdle();
+
+  return EXIT_SUCCESS;
+}
+
+// recreates a buffer until its slot runs out of generations - no earlier
+//   handle may become alive again and the slot has to be retired
+int registry_generations_check(Context &ctx) {
+  ZoneScoped;
+
+  static constexpr vk::DeviceSize buffer_size = 256;
+  static constexpr std::uint32_t cycles = BufferHandle::generation_mask + 2;
+
+  auto &resources = ctx.resources();
+  auto const retired_before = resources.stats().retired_slots;
+
+  std::vector<BufferHandle> handles;
+  bool ok = true;
+  for (std::uint32_t i = 0; i < cycles; i++) {
+    BufferHandle const handle = resources.create_buffer(
+        buffer_size, vk::BufferUsageFlagBits2KHR::eStorageBuffer);
+    ok = ok && std::ranges::none_of(handles, [&](BufferHandle old) {
+      return resources.alive(old);
+    });
+    handles.push_back(handle);
+
+    resources.destroy(handle);
+    // nothing was submitted - the registry collects it right away
+    ctx.next_frame();
+  }
+
+  auto const retired = resources.stats().retired_slots - retired_before;
+  logger.Log("registry generations: {} buffers, {} slots retired", cycles,
+             retired);
+  return ok && retired != 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// feeds the memory budget simulated heap numbers - pressure has to evict the
+//   tile atlas and keep it evicted while throttled, no pressure must not
+int memory_eviction_check(Context &ctx) {
+  ZoneScoped;
+
+  auto &budget = ctx.memoryBudget();
+  MandelbrotRenderer mandelbrot{ctx.config(), ctx};
+  mandelbrot.wait_until_ready();
+
+  auto record_frame = [&] {
+    auto &queue = *ctx.get_queue(Context::QueueType::Graphics);
+    auto cb = queue.getCommandBuffer();
+    cb->begin({vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+    mandelbrot.record(cb);
+    cb.end();
+    queue.submit(SubmitionInfo::gather(std::move(cb)));
+    ctx.vkDevice().waitIdle();
+    return mandelbrot.tile_stats().atlas_bytes;
+  };
+  auto device_heap = [](vk::DeviceSize usage) {
+    static constexpr vk::DeviceSize heap_budget = vk::DeviceSize{1} << 40;
+    return std::array{MemoryHeapBudget{
+        .heap = 0,
+        .device_local = true,
+        .usage = usage,
+        .budget = heap_budget,
+        .block_bytes = usage,
+        .allocation_bytes = usage,
+    }};
+  };
+  // NOLINTBEGIN(*-magic-numbers)
+  auto const calm = device_heap(vk::DeviceSize{1} << 39);
+  auto const pressure = device_heap((vk::DeviceSize{1} << 40) / 100 * 95);
+  // NOLINTEND(*-magic-numbers)
+
+  // the first tiled frame allocates the atlas
+  bool ok = record_frame() != 0;
+  auto const evictions_before = budget.stats().evictions;
+
+  budget.update(calm);
+  ok = ok && mandelbrot.tile_stats().atlas_evictions == 0;
+
+  budget.update(pressure);
+  auto const evicted = budget.stats().evictions - evictions_before;
+  ok = ok && mandelbrot.tile_stats().atlas_evictions == 1 && evicted != 0;
+  // rendered directly while throttled
+  ok = ok && record_frame() == 0;
+
+  budget.update(calm);
+  ok = ok && record_frame() != 0;
+
+  logger.Log("memory eviction: {} evictions, atlas evicted {} times", evicted,
+             mandelbrot.tile_stats().atlas_evictions);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// fills images of the streaming texture pool, frees every other one and
+//   forces a defragmentation of the rest - moved images have to resolve to
+//   new objects through their old handles and keep their contents
+int defrag_relocate_check(Context &ctx) {
+  ZoneScoped;
+
+  static constexpr std::uint32_t image_count = 64;
+  static constexpr std::uint32_t image_size = 256;
+  static constexpr int max_frames = 64;
+  static constexpr vk::DeviceSize texel = 4;
+  static constexpr float unorm_max = 255.F;
+
+  auto &resources = ctx.resources();
+  auto &defragmenter = ctx.defragmenter();
+  auto &queue = *ctx.get_queue(Context::QueueType::Graphics);
+  auto const layout = vk::ImageLayout::eShaderReadOnlyOptimal;
+
+  if (!ctx.device().memoryPools().pool(MemoryClass::StreamingTexture)) {
+    logger.Log("defrag relocate: no streaming texture pool - skipped");
+    return EXIT_SUCCESS;
+  }
+
+  Image::ImageCreateInfo const info{
+      .format = vk::Format::eR8G8B8A8Unorm,
+      .extent = {image_size, image_size, 1},
+      .usage = vk::ImageUsageFlagBits::eSampled |
+               vk::ImageUsageFlagBits::eTransferSrc |
+               vk::ImageUsageFlagBits::eTransferDst,
+  };
+  auto const allocation =
+      ctx.device().memoryPools().allocation_info(MemoryClass::StreamingTexture);
+
+  auto submit = [&](auto &&record) {
+    auto cb = queue.getCommandBuffer();
+    cb->begin({vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+    record(cb);
+    cb.end();
+    queue.submit(SubmitionInfo::gather(std::move(cb)));
+    ctx.vkDevice().waitIdle();
+  };
+  auto barrier = [&](vk::Image image, vk::ImageLayout from,
+                     vk::ImageLayout to) {
+    return vk::ImageMemoryBarrier2{
+        vk::PipelineStageFlagBits2::eAllCommands,
+        vk::AccessFlagBits2::eMemoryWrite,
+        vk::PipelineStageFlagBits2::eAllCommands,
+        vk::AccessFlagBits2::eMemoryRead | vk::AccessFlagBits2::eMemoryWrite,
+        from,
+        to,
+        vk::QueueFamilyIgnored,
+        vk::QueueFamilyIgnored,
+        image,
+        {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1},
+    };
+  };
+
+  // image i is cleared to red = i
+  std::vector<UniqueImage> images;
+  for (std::uint32_t i = 0; i < image_count; i++) {
+    images.emplace_back(resources, resources.create_image(info, allocation));
+  }
+  submit([&](CommandBuffer &cb) {
+    for (auto [i, image] : std::views::enumerate(images)) {
+      vk::Image const vk_image = resources.image(*image);
+      cb.barrier({}, {}, {},
+                 barrier(vk_image, vk::ImageLayout::eUndefined,
+                         vk::ImageLayout::eTransferDstOptimal));
+      cb->clearColorImage(
+          vk_image, vk::ImageLayout::eTransferDstOptimal,
+          vk::ClearColorValue{static_cast<float>(i) / unorm_max, 0.F, 0.F, 1.F},
+          vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eColor, 0, 1, 0,
+                                    1});
+      cb.barrier({}, {}, {},
+                 barrier(vk_image, vk::ImageLayout::eTransferDstOptimal,
+                         layout));
+    }
+  });
+
+  struct kept {
+    std::uint32_t index;
+    ImageHandle image;
+    ImageViewHandle view;
+    vk::Image vk_image;
+    BindlessResource handle;
+  };
+  std::vector<kept> kept_images;
+  std::vector<UniqueImageView> views;
+  for (std::uint32_t i = 0; i < image_count; i++) {
+    if (i % 2 != 0) {
+      images[i].reset();
+      continue;
+    }
+    auto view = resources.create_image_view(
+        *images[i], vk::ImageViewType::e2D, info.format,
+        vk::ImageUsageFlagBits::eSampled);
+    std::array const image_views{view};
+    defragmenter.track(*images[i], info, image_views, layout,
+                       queue.queue().family());
+    kept_images.push_back({i, *images[i], view, resources.image(*images[i]),
+                           resources.sampledOptimalHandle(view)});
+    views.emplace_back(resources, view);
+  }
+
+  auto const moves_before = defragmenter.stats().moves;
+  defragmenter.request();
+  // the first frame collects the freed images, the next ones move the rest
+  for (int frame = 0; frame < max_frames; frame++) {
+    ctx.next_frame();
+    ctx.vkDevice().waitIdle();
+    if (frame != 0 && !defragmenter.stats().running) {
+      break;
+    }
+  }
+  auto const moves = defragmenter.stats().moves - moves_before;
+
+  std::uint32_t moved = 0;
+  bool ok = moves != 0;
+  for (const auto &k : kept_images) {
+    if (resources.image(k.image) == k.vk_image) {
+      continue;
+    }
+    moved++;
+    ok = ok && resources.alive(k.view) &&
+         resources.image(k.view) == k.image &&
+         resources.sampledOptimalHandle(k.view) != k.handle;
+  }
+  ok = ok && moved != 0;
+
+  // the first texel of every kept image
+  UniqueBuffer const readback{
+      resources,
+      resources.create_buffer(
+          texel * kept_images.size(),
+          vk::BufferUsageFlagBits2KHR::eTransferDst,
+          vma::AllocationCreateInfo{}
+              .setFlags(vma::AllocationCreateFlagBits::eHostAccessRandom |
+                        vma::AllocationCreateFlagBits::eMapped)
+              .setUsage(vma::MemoryUsage::eAuto)),
+  };
+  submit([&](CommandBuffer &cb) {
+    for (auto [slot, k] : std::views::enumerate(kept_images)) {
+      vk::Image const vk_image = resources.image(k.image);
+      cb.barrier({}, {}, {},
+                 barrier(vk_image, layout,
+                         vk::ImageLayout::eTransferSrcOptimal));
+      cb->copyImageToBuffer(
+          vk_image, vk::ImageLayout::eTransferSrcOptimal,
+          resources.buffer(*readback),
+          vk::BufferImageCopy{
+              static_cast<vk::DeviceSize>(slot) * texel,
+              0,
+              0,
+              {vk::ImageAspectFlagBits::eColor, 0, 0, 1},
+              {},
+              {1, 1, 1},
+          });
+      cb.barrier({}, {}, {},
+                 barrier(vk_image, vk::ImageLayout::eTransferSrcOptimal,
+                         layout));
+    }
+  });
+  ctx.device().allocator().invalidateAllocation(
+      resources.allocation(*readback), 0, vk::WholeSize);
+  const auto *texels = static_cast<const std::uint8_t *>(
+      resources.mapped(*readback));
+  for (auto [slot, k] : std::views::enumerate(kept_images)) {
+    ok = ok && texels[slot * texel] == k.index;
+  }
+
+  logger.Log("defrag relocate: {} moves, {} of {} images relocated", moves,
+             moved, kept_images.size());
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// known starting weights - weights passed to the Context are not stored
+DSAllocatorWeights check_weights() {
+  using enum vk::DescriptorType;
+  return {.m_weights = {
+              {.type = eStorageImage, .weight = 1.F},
+              {.type = eUniformBuffer, .weight = 1.F},
+              {.type = eCombinedImageSampler, .weight = 1.F},
+              {.type = eStorageBuffer, .weight = 1.F},
+          }};
+}
+
+struct check {
+  std::string_view name;
+  int (*run)(Context &);
+};
+
+constexpr std::array checks{
+    check{"bindless-free-flush", bindless_free_flush_check},
+    check{"ds-tuner", ds_tuner_check},
+    check{"transient-sets", transient_sets_check},
+    check{"registry-generations", registry_generations_check},
+    check{"memory-eviction", memory_eviction_check},
+    check{"defrag-relocate", defrag_relocate_check},
+};
+} // namespace
+
+std::string v4dg::check_names() {
+  std::string names;
+  for (const auto &c : checks) {
+    if (!names.empty()) {
+      names += ", ";
+    }
+    names += c.name;
+  }
+  return names;
+}
+
+int v4dg::run_check(const Config &cfg, std::string_view name) {
+  for (const auto &c : checks) {
+    if (c.name != name) {
+      continue;
+    }
+
+    Instance const instance{vk::raii::Context{}, true};
+    Device const device{instance};
+    Context context{cfg, device, check_weights()};
+
+    int result = EXIT_FAILURE;
+    try {
+      result = c.run(context);
+    } catch (...) {
+      context.cleanup();
+      throw;
+    }
+    context.cleanup();
+
+    if (result != EXIT_SUCCESS) {
+      logger.Error("Check {} failed", name);
+    }
+    return result;
+  }
+
+  logger.Error("Unknown check {} (available: {})", name, check_names());
+  return EXIT_FAILURE;
+}
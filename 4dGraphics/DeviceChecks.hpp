@@ -0,0 +1,18 @@
+#pragma once
+
+#include <Config.hpp>
+
+#include <string>
+#include <string_view>
+
+namespace v4dg {
+// self-checks selectable with `--check <name>`; unlike the benchmarks they
+//   need a Vulkan device (created without a window). Run them with the
+//   validation layers - some only fail there
+
+// comma separated list of the available checks
+[[nodiscard]] std::string check_names();
+
+// returns the process exit code
+int run_check(const Config &cfg, std::string_view name);
+} // namespace v4dg
@@ -0,0 +1,66 @@
+#include "DynamicResolution.hpp"
+
+#include <GpuProfiler.hpp>
+#include <v4dgCore.hpp>
+
+#include <vulkan/vulkan.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+using namespace v4dg;
+
+namespace {
+// weight of a new sample in the filtered time
+constexpr double filter_weight = .25;
+// the largest relative change of the scale in one step
+constexpr double max_step = 1.25;
+} // namespace
+
+bool DynamicResolution::update(const GpuProfiler::ZoneStats &zone) {
+  if (zone.samples == m_samples) {
+    return false;
+  }
+  m_samples = zone.samples;
+
+  // the profiler reports frames max_frames_in_flight frames late
+  if (m_settle > 0) {
+    m_settle--;
+    return false;
+  }
+
+  m_filtered_ms = m_filtered_ms == 0.
+                      ? zone.last_ms
+                      : std::lerp(m_filtered_ms, zone.last_ms, filter_weight);
+  if (!m_settings.enabled || !(m_filtered_ms > 0.)) {
+    return false;
+  }
+
+  // the time goes with the pixel count - the square of the scale
+  double const wanted =
+      m_scale * std::sqrt(m_settings.target_ms / m_filtered_ms);
+  double const step =
+      std::clamp(wanted, m_scale / max_step, m_scale * max_step);
+  double const scale = std::max(m_settings.min_scale,
+                                std::min(step, m_settings.max_scale));
+  if (std::abs(scale - m_scale) < m_settings.hysteresis * m_scale) {
+    return false;
+  }
+
+  // expected until the new scale is measured
+  double const ratio = scale / m_scale;
+  m_filtered_ms *= ratio * ratio;
+  m_scale = scale;
+  m_settle = static_cast<std::uint32_t>(max_frames_in_flight);
+  return true;
+}
+
+vk::Extent2D DynamicResolution::extent(vk::Extent2D output) const noexcept {
+  auto axis = [s = scale()](std::uint32_t size) {
+    auto const scaled = static_cast<std::uint32_t>(
+        std::lround(static_cast<double>(size) * s));
+    return std::max(scaled, std::uint32_t{1});
+  };
+  return {axis(output.width), axis(output.height)};
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <GpuProfiler.hpp>
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+
+namespace v4dg {
+// Picks the render resolution that keeps the GPU time of a pass at
+//   target_ms. The time is assumed to be proportional to the pixel count;
+//   the timings are filtered and the scale only changes in steps of at least
+//   `hysteresis` so that the render target is not reallocated every frame.
+class DynamicResolution {
+public:
+  struct Settings {
+    bool enabled{true};
+    double target_ms{8.};
+    // bounds of the scale of the output resolution (per axis)
+    double min_scale{.25};
+    double max_scale{1.};
+    // relative change of the scale below which it is kept
+    double hysteresis{.05};
+  };
+
+  DynamicResolution() = default;
+  explicit DynamicResolution(const Settings &settings)
+      : m_settings(settings) {}
+
+  // feeds the GPU timings of the pass; true if scale() changed
+  //   (ignored while the frames rendered at the previous scale are measured)
+  bool update(const GpuProfiler::ZoneStats &zone);
+
+  [[nodiscard]] double scale() const noexcept {
+    return m_settings.enabled ? m_scale : 1.;
+  }
+  // render resolution for `output`
+  [[nodiscard]] vk::Extent2D extent(vk::Extent2D output) const noexcept;
+
+  [[nodiscard]] Settings &settings() noexcept { return m_settings; }
+  // filtered GPU time of the pass
+  [[nodiscard]] double gpu_ms() const noexcept { return m_filtered_ms; }
+
+private:
+  Settings m_settings;
+  double m_scale{1.};
+
+  double m_filtered_ms{0.};
+  std::uint64_t m_samples{0};
+  // samples still rendered at the previous scale
+  std::uint32_t m_settle{0};
+};
+} // namespace v4dg
@@ -1,15 +1,13 @@
 #include "GameHandler.hpp"
 
+#include <BindlessManager.hpp>
 #include <CommandBuffer.hpp>
 #include <Context.hpp>
 #include <Debug.hpp>
 #include <Device.hpp>
-#include <PipelineBuilder.hpp>
+#include <MemoryPools.hpp>
 #include <Swapchain.hpp>
 #include <TransferManager.hpp>
-#include <VulkanCaches.hpp>
-#include <VulkanConstructs.hpp>
-#include <VulkanResources.hpp>
 #include <cppHelpers.hpp>
 
 #include <SDL2/SDL_vulkan.h>
@@ -25,18 +23,18 @@
 #include <vulkan/vulkan.hpp>
 #include <vulkan/vulkan_raii.hpp>
 
+#include <algorithm>
 #include <chrono>
 #include <cmath>
 #include <cstdint>
 #include <filesystem>
-#include <format>
 #include <imgui.h>
 #include <limits>
 #include <mutex>
 #include <optional>
+#include <ranges>
 #include <thread>
 #include <utility>
-#include <variant>
 #include <vector>
 
 using namespace v4dg;
@@ -131,55 +129,7 @@ MyGameHandler::MyGameHandler(const Config &cfg)
           .image_count = 3,
       }
                     .build(context)),
-      imguiVulkanImpl(swapchain, context),
-      texture(ImageView::createTexture(
-          context,
-          Image::ImageCreateInfo{
-              .format = vk::Format::eR16G16B16A16Sfloat,
-              .extent = tex_extent,
-              .usage = vk::ImageUsageFlagBits::eStorage |
-                       vk::ImageUsageFlagBits::eTransferSrc,
-          },
-          {{}, vma::MemoryUsage::eAuto})),
-      descriptor_set_layout(nullptr),
-      pipeline_layout(PipelineLayoutInfo()
-                          .add_sets(context.bindlessManager().get_layouts())
-                          .add_push({vk::ShaderStageFlagBits::eCompute, 0U,
-                                     sizeof(MandelbrotPushConstants)})
-                          .create(device)),
-      pipeline({nullptr, nullptr, nullptr}) {
-
-  texture->setName(device, "mandelbrot texture");
-
-  auto shader =
-      load_shader_code(cfg.data_dir() / "Shaders/Mandelbrot.comp.spv");
-  if (!shader) {
-    std::visit(
-        [&](const auto &e) {
-          throw exception("Could not load shader: {}", to_string(e));
-        },
-        shader.error());
-  }
-
-  for (int variant = 0; variant < 3; variant++) {
-    ShaderStageData shader_data(vk::ShaderStageFlagBits::eCompute, *shader);
-
-    if (instance.debugUtilsEnabled()) {
-      shader_data.set_debug_name(
-          std::format("Shaders/Mandelbrot.comp.spv (var {})", variant));
-    }
-
-    shader_data.add_specialization(0, variant);
-    vk::ComputePipelineCreateInfo const pci{
-        {},
-        shader_data.get(),
-        *pipeline_layout,
-    };
-
-    pipeline[variant] = {device.device(), context.pipeline_cache(), pci};
-    device.setDebugName(pipeline[variant], "mandelbrot pipeline ({})", variant);
-  }
-}
+      imguiVulkanImpl(swapchain, context), mandelbrot(cfg, context) {}
 
 MyGameHandler::~MyGameHandler() { context.cleanup(); }
 
@@ -195,7 +145,7 @@ void MyGameHandler::recreate_swapchain() {
   context.get_destruction_stack().push(swapchain.move_out());
   swapchain = builder.build(context);
 
-  mandelbrot_push_constants.scale *=
+  mandelbrot.params().scale *=
       glm::dvec2(swapchain.extent().width, swapchain.extent().height) /
       glm::dvec2(old_size.width, old_size.height);
 }
@@ -264,24 +214,215 @@ void MyGameHandler::gui() {
   ZoneScoped;
   ImGui::NewFrame();
 
+  auto &params = mandelbrot.params();
+
   ImGui::ShowDemoWindow();
   ImGui::ShowMetricsWindow();
 
   ImGui::Begin("Mandelbrot");
-  ImGui::SliderInt("variant", &current_pipeline, 0, 2);
-  ImGui::Text("center: %f %f", mandelbrot_push_constants.center.x,
-              mandelbrot_push_constants.center.y);
-  ImGui::Text("scale: %f %f", mandelbrot_push_constants.scale.x,
-              mandelbrot_push_constants.scale.y);
+  ImGui::SliderInt("variant", &mandelbrot.variant(), 0,
+                   MandelbrotRenderer::variant_count - 1);
+  const auto &kernel = mandelbrot.kernels().variants[mandelbrot.variant()];
+  ImGui::Text("workgroup: %ux%u, subgroup size: %u, groups: %u",
+              kernel.local_x, kernel.local_y, kernel.subgroup_size,
+              kernel.groups);
+  ImGui::Text("center: %.17g %.17g", params.center.x, params.center.y);
+  ImGui::Text("scale: %g %g", params.scale.x, params.scale.y);
+  ImGui::Checkbox("interior checks", &mandelbrot.interior_checks());
+  ImGui::Checkbox("Mariani-Silver subdivision", &mandelbrot.subdivision());
+  ImGui::Checkbox("adaptive iterations", &mandelbrot.adaptive_iter());
+  ImGui::Checkbox("progressive", &mandelbrot.progressive());
+  static constexpr int max_refine_step = 1024;
+  int refine_step = static_cast<int>(mandelbrot.refine_step());
+  if (ImGui::SliderInt("refine iterations per frame", &refine_step, 1,
+                       max_refine_step, "%d", ImGuiSliderFlags_Logarithmic)) {
+    mandelbrot.refine_step() = static_cast<std::uint32_t>(refine_step);
+  }
+  ImGui::Text("max iterations: %u (refined %u)", mandelbrot.current_max_iter(),
+              mandelbrot.refined());
+  ImGui::Checkbox("smooth coloring", &mandelbrot.smooth_coloring());
+  auto &palette = mandelbrot.palette();
+  ImGui::Checkbox("histogram equalization", &palette.equalize);
+  ImGui::SliderFloat("hue offset", &palette.hue_offset, 0.F, 1.F);
+  static constexpr float max_hue_cycles = 16.F;
+  ImGui::SliderFloat("hue cycles", &palette.hue_cycles, 1.F / max_hue_cycles,
+                     max_hue_cycles, "%.3f", ImGuiSliderFlags_Logarithmic);
+  ImGui::Checkbox("tile cache", &mandelbrot.tiled());
+  static constexpr int max_tiles_per_frame = 256;
+  int tile_budget = static_cast<int>(mandelbrot.iteration_budget() /
+                                     MandelbrotRenderer::tile_cost);
+  if (ImGui::SliderInt("tiles per frame", &tile_budget, 1,
+                       max_tiles_per_frame)) {
+    mandelbrot.iteration_budget() =
+        std::uint64_t(tile_budget) * MandelbrotRenderer::tile_cost;
+  }
+  const auto &tiles = mandelbrot.tile_stats();
+  ImGui::Text("level %lld: %u visible, %u computed, %u coarser, %u missing",
+              static_cast<long long>(tiles.level), tiles.visible,
+              tiles.computed, tiles.fallback, tiles.missing);
+  ImGui::Text("atlas: %zu/%zu tiles, %llu hits, %llu computed, "
+              "%llu evicted",
+              tiles.cache.live, tiles.cache.capacity,
+              static_cast<unsigned long long>(tiles.cache.hits),
+              static_cast<unsigned long long>(tiles.cache.computed),
+              static_cast<unsigned long long>(tiles.cache.evictions));
+  ImGui::Text("atlas memory: %llu bytes, evicted %llu times",
+              static_cast<unsigned long long>(tiles.atlas_bytes),
+              static_cast<unsigned long long>(tiles.atlas_evictions));
+  ImGui::Checkbox("perturbation", &mandelbrot.perturbation());
+  static constexpr int min_deep_iter = 256;
+  static constexpr int max_deep_iter = 1 << 16;
+  int deep_max_iter = static_cast<int>(mandelbrot.deep_max_iter());
+  if (ImGui::SliderInt("deep max iterations", &deep_max_iter, min_deep_iter,
+                       max_deep_iter, "%d", ImGuiSliderFlags_Logarithmic)) {
+    mandelbrot.deep_max_iter() = static_cast<std::uint32_t>(deep_max_iter);
+  }
+  const auto &deep = mandelbrot.deep_stats();
+  ImGui::Text("perturbation %s%s: %llu references, orbit %u, skip %u, "
+              "%zu bits",
+              deep.active ? "on" : "off",
+              deep.computing ? " (computing)" : "",
+              static_cast<unsigned long long>(deep.references),
+              deep.orbit_length, deep.skip, deep.precision_bits);
+  ImGui::End();
+
+  ImGui::Begin("Dynamic resolution");
+  auto &resolution_settings = resolution.settings();
+  ImGui::Checkbox("enabled", &resolution_settings.enabled);
+  static constexpr float max_target_ms = 50.F;
+  auto target_ms = static_cast<float>(resolution_settings.target_ms);
+  if (ImGui::SliderFloat("target GPU time (ms)", &target_ms, 1.F,
+                         max_target_ms)) {
+    resolution_settings.target_ms = target_ms;
+  }
+  static constexpr float min_render_scale = .1F;
+  auto min_scale = static_cast<float>(resolution_settings.min_scale);
+  auto max_scale = static_cast<float>(resolution_settings.max_scale);
+  if (ImGui::SliderFloat("min scale", &min_scale, min_render_scale, 1.F)) {
+    resolution_settings.min_scale = min_scale;
+    resolution_settings.max_scale = std::max(max_scale, min_scale);
+  }
+  if (ImGui::SliderFloat("max scale", &max_scale, min_render_scale, 1.F)) {
+    resolution_settings.max_scale = max_scale;
+    resolution_settings.min_scale = std::min(min_scale, max_scale);
+  }
+  ImGui::Checkbox("edge-aware upscale", &mandelbrot.edge_aware_upscale());
+  ImGui::Text("render %ux%u (scale %.2f), GPU %.3f ms",
+              mandelbrot.extent().width, mandelbrot.extent().height,
+              resolution.scale(), resolution.gpu_ms());
+  ImGui::End();
+
+  if (const auto *profiler =
+          context.get_queue(Context::QueueType::Graphics)->profiler()) {
+    ImGui::Begin("GPU timings");
+    for (const auto &zone : profiler->stats()) {
+      ImGui::Text("%s: %.3f ms (avg %.3f ms, max %.3f ms)", zone.name.c_str(),
+                  zone.last_ms, zone.avg_ms, zone.max_ms);
+    }
+    ImGui::End();
+  }
+
+  ImGui::Begin("Bindless heaps");
+  auto const bindless_stats = context.bindlessManager().stats();
+  for (auto &&[type, stats] :
+       std::views::zip(BindlessManager::handle_types, bindless_stats)) {
+    auto const name = BindlessResource::type_name(type);
+    ImGui::Text("%.*s: %u/%u live (%.1f%%), %u retired, %u free, "
+                "%u exhausted, %.1f%% fragmented",
+                static_cast<int>(name.size()), name.data(), stats.live,
+                stats.capacity,
+                stats.occupancy() * 100., // NOLINT(*-magic-numbers)
+                stats.retired, stats.free(), stats.exhausted,
+                stats.fragmentation() * 100.); // NOLINT(*-magic-numbers)
+  }
+  ImGui::End();
+
+  ImGui::Begin("Handle caches");
+  for (const auto &[name, stats] : context.cache_stats()) {
+    ImGui::Text("%.*s: %zu live, %zu retired, %.1f%% hits (%llu/%llu), "
+                "%llu evicted, create avg %.3f ms max %.3f ms",
+                static_cast<int>(name.size()), name.data(), stats.live,
+                stats.retired,
+                stats.hit_rate() * 100., // NOLINT(*-magic-numbers)
+                static_cast<unsigned long long>(stats.hits),
+                static_cast<unsigned long long>(stats.hits + stats.misses),
+                static_cast<unsigned long long>(stats.evictions),
+                std::chrono::duration<double, std::milli>(
+                    stats.avg_create_time())
+                    .count(),
+                std::chrono::duration<double, std::milli>(
+                    stats.max_create_time)
+                    .count());
+  }
+  ImGui::End();
+
+  ImGui::Begin("Descriptor pools");
+  auto const ds_stats = context.ds_tuner().stats();
+  ImGui::Text("%llu sets (%llu undescribed), %llu retries, %llu pools "
+              "created, %llu full, %llu dropped, generation %u",
+              static_cast<unsigned long long>(ds_stats.sets),
+              static_cast<unsigned long long>(ds_stats.undescribed_sets),
+              static_cast<unsigned long long>(ds_stats.retries),
+              static_cast<unsigned long long>(ds_stats.pools_created),
+              static_cast<unsigned long long>(ds_stats.pools_full),
+              static_cast<unsigned long long>(ds_stats.pools_dropped),
+              ds_stats.generation);
+  for (const auto &weight : context.ds_tuner().learned_weights().m_weights) {
+    ImGui::Text("%s: %.3f", vk::to_string(weight.type).c_str(),
+                weight.weight);
+  }
+  ImGui::End();
+
+  ImGui::Begin("Memory budget");
+  static constexpr double mib = 1 << 20;
+  auto const budget_stats = context.memoryBudget().stats();
+  ImGui::Text("device pressure %.1f%%%s, %llu throttled frames, "
+              "%llu evictions (%.1f MiB)",
+              budget_stats.pressure * 100., // NOLINT(*-magic-numbers)
+              context.memoryBudget().throttled() ? " (throttled)" : "",
+              static_cast<unsigned long long>(budget_stats.throttled_frames),
+              static_cast<unsigned long long>(budget_stats.evictions),
+              static_cast<double>(budget_stats.evicted_bytes) / mib);
+  for (const auto &heap : context.device().memoryPools().budgets()) {
+    ImGui::Text("heap %u%s: %.1f/%.1f MiB (%.1f MiB in VMA blocks)",
+                heap.heap, heap.device_local ? " (device)" : "",
+                static_cast<double>(heap.usage) / mib,
+                static_cast<double>(heap.budget) / mib,
+                static_cast<double>(heap.block_bytes) / mib);
+    ImGui::ProgressBar(static_cast<float>(heap.pressure()));
+  }
+  for (const auto &pool : context.device().memoryPools().stats()) {
+    ImGui::Text("%.*s: %u allocations, %.1f/%.1f MiB in %u blocks",
+                static_cast<int>(pool.name.size()), pool.name.data(),
+                pool.allocations,
+                static_cast<double>(pool.allocation_bytes) / mib,
+                static_cast<double>(pool.block_bytes) / mib, pool.blocks);
+  }
+  ImGui::End();
+
+  ImGui::Begin("Defragmentation");
+  auto const defrag_stats = context.defragmenter().stats();
+  ImGui::Text("%s, %zu tracked textures, fragmentation %.1f%%",
+              defrag_stats.running ? "running" : "idle", defrag_stats.tracked,
+              defrag_stats.fragmentation * 100.); // NOLINT(*-magic-numbers)
+  ImGui::Text("%llu passes, %llu moves (%.1f MiB), %.1f MiB freed",
+              static_cast<unsigned long long>(defrag_stats.passes),
+              static_cast<unsigned long long>(defrag_stats.moves),
+              static_cast<double>(defrag_stats.bytes_moved) / mib,
+              static_cast<double>(defrag_stats.bytes_freed) / mib);
   ImGui::End();
 
   auto &io = ImGui::GetIO();
   if (!io.WantCaptureMouse) {
+    // params.scale is per render pixel, the mouse moves in window pixels
+    auto const render_ratio = to_glm<double>(mandelbrot.extent()) /
+                              to_glm<double>(swapchain.extent());
+
     // move mandelbrot
     if (ImGui::IsMouseDragging(ImGuiMouseButton_Left)) {
       auto delta = ImGui::GetMouseDragDelta(ImGuiMouseButton_Left);
-      mandelbrot_push_constants.center -=
-          glm::dvec2(delta.x, delta.y) * mandelbrot_push_constants.scale;
+      mandelbrot.move(-glm::dvec2(delta.x, delta.y) * render_ratio *
+                      params.scale);
       ImGui::ResetMouseDragDelta(ImGuiMouseButton_Left);
     }
 
@@ -297,21 +438,29 @@ void MyGameHandler::gui() {
       auto mouse_center_rel =
           mouse_pos - swapchain_size / 2.0; // NOLINT(*-magic-numbers)
 
-      auto world_pos = mandelbrot_push_constants.center +
-                       mouse_center_rel * mandelbrot_push_constants.scale;
+      // fractal so exponential zoom (down to what the deltas can express)
+      auto scale = params.scale;
+      auto new_scale = glm::max(scale * std::pow(zoom_speed, delta),
+                                glm::dvec2{MandelbrotRenderer::min_scale});
 
-      // fractal so exponential zoom
-      auto scale = mandelbrot_push_constants.scale;
-      auto new_scale = scale * std::pow(zoom_speed, delta);
+      // relative move - the precise center may be beyond doubles
+      mandelbrot.move(mouse_center_rel * render_ratio * (scale - new_scale));
+      params.scale = new_scale;
+    }
+  }
 
-      auto new_center = world_pos - mouse_center_rel * new_scale;
+  ImGui::Render();
+}
 
-      mandelbrot_push_constants.center = new_center;
-      mandelbrot_push_constants.scale = new_scale;
+void MyGameHandler::update_resolution() {
+  if (const auto *profiler =
+          context.get_queue(Context::QueueType::Graphics)->profiler()) {
+    if (auto zone = profiler->zone(MandelbrotRenderer::gpu_zone)) {
+      resolution.update(*zone);
     }
   }
 
-  ImGui::Render();
+  mandelbrot.resize(resolution.extent(swapchain.extent()));
 }
 
 void MyGameHandler::record_gui(CommandBuffer &cb, vk::Image image,
@@ -320,94 +469,24 @@ void MyGameHandler::record_gui(CommandBuffer &cb, vk::Image image,
 
   cb->begin({vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
 
-  cb.barrier({}, {}, {},
-             {
-                 {
-                     vk::PipelineStageFlagBits2::eBlit,
-                     vk::AccessFlagBits2::eNone,
-                     vk::PipelineStageFlagBits2::eComputeShader,
-                     vk::AccessFlagBits2::eShaderStorageWrite,
-                     vk::ImageLayout::eUndefined,
-                     vk::ImageLayout::eGeneral,
-                     vk::QueueFamilyIgnored,
-                     vk::QueueFamilyIgnored,
-                     texture->vkImage(),
-                     {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1},
-                 },
-                 {
-                     vk::PipelineStageFlagBits2::eBlit,
-                     vk::AccessFlagBits2::eNone,
-                     vk::PipelineStageFlagBits2::eBlit,
-                     vk::AccessFlagBits2::eTransferWrite,
-                     vk::ImageLayout::eUndefined,
-                     vk::ImageLayout::eTransferDstOptimal,
-                     vk::QueueFamilyIgnored,
-                     vk::QueueFamilyIgnored,
-                     image,
-                     {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1},
-                 },
-             });
-
-  // render mandelbrot
-  {
-    ZoneScopedN("mandelbrot");
-    auto labal = cb.debugLabelScope("mandelbrot", {0.0F, 1.0F, 0.0F, 1.0F});
-    cb->bindPipeline(vk::PipelineBindPoint::eCompute,
-                     *pipeline[current_pipeline]);
-
-    context.bindlessManager().bind(cb, *pipeline_layout,
-                                   vk::PipelineBindPoint::eCompute);
-
-    mandelbrot_push_constants.image_idx = texture->storageHandle();
-
-    cb->pushConstants<MandelbrotPushConstants>(
-        *pipeline_layout, vk::ShaderStageFlagBits::eCompute, 0,
-        mandelbrot_push_constants);
-
-    static constexpr auto workgroup_size_base = 8;
-    auto workgroup_size = workgroup_size_base * (current_pipeline == 0 ? 2 : 1);
-    cb->dispatch(DivCeil(texture->image()->extent().width, workgroup_size),
-                 DivCeil(texture->image()->extent().height, workgroup_size), 1);
-  }
+  update_resolution();
+  mandelbrot.record(cb);
 
   cb.barrier({}, {}, {},
-             {
-                 {
-                     vk::PipelineStageFlagBits2::eComputeShader,
-                     vk::AccessFlagBits2::eShaderStorageWrite,
-                     vk::PipelineStageFlagBits2::eTransfer,
-                     vk::AccessFlagBits2::eTransferRead,
-                     vk::ImageLayout::eGeneral,
-                     vk::ImageLayout::eTransferSrcOptimal,
-                     vk::QueueFamilyIgnored,
-                     vk::QueueFamilyIgnored,
-                     texture->vkImage(),
-                     {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1},
-                 },
-             });
-
-  {
-    ZoneScopedN("blit");
-
-    cb->blitImage(
-        texture->vkImage(), vk::ImageLayout::eTransferSrcOptimal, image,
-        vk::ImageLayout::eTransferDstOptimal,
-        vk::ImageBlit{
-            {vk::ImageAspectFlagBits::eColor, 0, 0, 1},
-            {
-                vk::Offset3D{0, 0, 0},
-                vk::Offset3D{int32_t(texture->image()->extent().width),
-                             int32_t(texture->image()->extent().height), 1},
-            },
-            {vk::ImageAspectFlagBits::eColor, 0, 0, 1},
-            {
-                vk::Offset3D{0, 0, 0},
-                vk::Offset3D{int32_t(swapchain.extent().width),
-                             int32_t(swapchain.extent().height), 1},
-            },
-        },
-        vk::Filter::eLinear);
-  }
+             {{
+                 vk::PipelineStageFlagBits2::eBlit,
+                 vk::AccessFlagBits2::eNone,
+                 vk::PipelineStageFlagBits2::eBlit,
+                 vk::AccessFlagBits2::eTransferWrite,
+                 vk::ImageLayout::eUndefined,
+                 vk::ImageLayout::eTransferDstOptimal,
+                 vk::QueueFamilyIgnored,
+                 vk::QueueFamilyIgnored,
+                 image,
+                 {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1},
+             }});
+
+  mandelbrot.blit(cb, image, swapchain.extent());
 
   cb.barrier({}, {}, {},
              {{vk::PipelineStageFlagBits2::eBlit,
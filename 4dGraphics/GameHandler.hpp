@@ -1,22 +1,20 @@
 #pragma once
 
+#include "DynamicResolution.hpp"
 #include "GameCore.hpp"
+#include "MandelbrotRenderer.hpp"
 
-#include <BindlessManager.hpp>
 #include <CommandBuffer.hpp>
 #include <Config.hpp>
 #include <Context.hpp>
 #include <Device.hpp>
 #include <Swapchain.hpp>
 #include <TransferManager.hpp>
-#include <VulkanResources.hpp>
 
 #include <SDL.h>
-#include <glm/glm.hpp>
 #include <vulkan/vulkan.hpp>
 #include <vulkan/vulkan_raii.hpp>
 
-#include <array>
 #include <cstdint>
 #include <filesystem>
 
@@ -47,9 +45,6 @@ public:
   int Run();
 
 private:
-  static constexpr vk::Extent3D tex_extent{1024, 720, 1};
-  static constexpr auto default_scale = 1. / 128;
-
   const Config &cfg;
 
   SDL_Context sdlContext{SDL_INIT_VIDEO | SDL_INIT_GAMECONTROLLER};
@@ -62,29 +57,21 @@ private:
   Swapchain swapchain;
   ImGui_VulkanImpl imguiVulkanImpl;
 
-  ImageView texture;
+  MandelbrotRenderer mandelbrot;
+  DynamicResolution resolution;
 
   bool should_close{false};
   bool has_focus{true};
 
   vk::Extent2D wanted_extent{0, 0};
 
-  vk::raii::DescriptorSetLayout descriptor_set_layout;
-  vk::raii::PipelineLayout pipeline_layout;
-  std::array<vk::raii::Pipeline, 3> pipeline;
-  int current_pipeline{2};
-
-  struct MandelbrotPushConstants {
-    glm::dvec2 center;
-    glm::dvec2 scale{default_scale};
-    BindlessResource image_idx;
-  } mandelbrot_push_constants;
-
   void recreate_swapchain();
   std::uint32_t wait_for_image();
   bool handle_events();
 
   void gui();
+  // picks the mandelbrot render extent from its GPU time
+  void update_resolution();
   void record_gui(CommandBuffer &cb, vk::Image, vk::ImageView);
   void present(std::uint32_t image_idx);
 };
@@ -0,0 +1,312 @@
+#include "HeadlessHandler.hpp"
+
+#include "MandelbrotCpu.hpp"
+
+#include <BindlessManager.hpp>
+#include <CommandBuffer.hpp>
+#include <Context.hpp>
+#include <Debug.hpp>
+#include <Device.hpp>
+#include <MemoryPools.hpp>
+#include <OffscreenSwapchain.hpp>
+#include <ResourceRegistry.hpp>
+#include <TransferManager.hpp>
+#include <cppHelpers.hpp>
+#include <v4dgCore.hpp>
+
+#include <taskflow/taskflow.hpp>
+#include <tracy/Tracy.hpp>
+#include <vulkan-memory-allocator-hpp/vk_mem_alloc.hpp>
+#include <vulkan/vulkan.hpp>
+#include <vulkan/vulkan_raii.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <ios>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+using namespace v4dg;
+
+HeadlessHandler::HeadlessHandler(const Config &cfg, const Options &options)
+    : cfg(cfg), options(options), instance(vk::raii::Context{}, true),
+      device(instance), context(cfg, device), transfer_manager(context),
+      target(context, options.extent, vk::Format::eR8G8B8A8Unorm,
+             options.image_count),
+      mandelbrot(cfg, context) {}
+
+HeadlessHandler::~HeadlessHandler() { context.cleanup(); }
+
+void HeadlessHandler::record(CommandBuffer &cb, std::uint32_t image_idx) {
+  ZoneScoped;
+
+  cb->begin({vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+
+  mandelbrot.record(cb);
+
+  vk::Image const image = target.image(image_idx);
+
+  cb.barrier({}, {}, {},
+             {{
+                 vk::PipelineStageFlagBits2::eBlit,
+                 vk::AccessFlagBits2::eNone,
+                 vk::PipelineStageFlagBits2::eBlit,
+                 vk::AccessFlagBits2::eTransferWrite,
+                 vk::ImageLayout::eUndefined,
+                 vk::ImageLayout::eTransferDstOptimal,
+                 vk::QueueFamilyIgnored,
+                 vk::QueueFamilyIgnored,
+                 image,
+                 {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1},
+             }});
+
+  mandelbrot.blit(cb, image, target.extent());
+
+  // leave the image ready for readback
+  cb.barrier({}, {}, {},
+             {{
+                 vk::PipelineStageFlagBits2::eBlit,
+                 vk::AccessFlagBits2::eTransferWrite,
+                 vk::PipelineStageFlagBits2::eTransfer,
+                 vk::AccessFlagBits2::eTransferRead,
+                 vk::ImageLayout::eTransferDstOptimal,
+                 vk::ImageLayout::eTransferSrcOptimal,
+                 vk::QueueFamilyIgnored,
+                 vk::QueueFamilyIgnored,
+                 image,
+                 {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1},
+             }});
+
+  cb.end();
+}
+
+int HeadlessHandler::check_iterations() {
+  ZoneScoped;
+
+  mandelbrot.wait_until_ready();
+
+  auto &resources = context.resources();
+  vk::Extent2D const extent = mandelbrot.extent();
+  std::size_t const pixels =
+      static_cast<std::size_t>(extent.width) * extent.height;
+  UniqueBuffer const readback{
+      resources,
+      resources.create_buffer(
+          pixels * sizeof(float), vk::BufferUsageFlagBits2KHR::eTransferDst,
+          vma::AllocationCreateInfo{}
+              .setFlags(vma::AllocationCreateFlagBits::eHostAccessRandom |
+                        vma::AllocationCreateFlagBits::eMapped)
+              .setUsage(vma::MemoryUsage::eAuto)),
+  };
+
+  auto gpu_iterations = [&](int variant) {
+    auto &graphics = *context.get_queue(Context::QueueType::Graphics);
+    auto cb = graphics.getCommandBuffer();
+    cb->begin({vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+    mandelbrot.record_iterations(cb, variant, *readback);
+    cb.end();
+    graphics.submit(SubmitionInfo::gather(std::move(cb)));
+    context.vkDevice().waitIdle();
+
+    context.device().allocator().invalidateAllocation(
+        resources.allocation(*readback), 0, vk::WholeSize);
+    std::span const counts{
+        static_cast<const float *>(resources.mapped(*readback)), pixels};
+    std::vector<std::uint32_t> iterations(pixels);
+    std::ranges::transform(counts, iterations.begin(), [](float n) {
+      return static_cast<std::uint32_t>(n);
+    });
+    return iterations;
+  };
+
+  if (options.iterations_path) {
+    auto const counts = gpu_iterations(mandelbrot.variant());
+    std::ofstream file(*options.iterations_path,
+                       std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char *>(counts.data()),
+               static_cast<std::streamsize>(counts.size() *
+                                            sizeof(std::uint32_t)));
+    if (!file) {
+      throw exception("Could not write {}",
+                      options.iterations_path->string());
+    }
+    logger.Log("Wrote the iteration counts of variant {} ({}x{}) to {}",
+               mandelbrot.variant(), extent.width, extent.height,
+               options.iterations_path->string());
+  }
+
+  if (!options.compare_cpu) {
+    return 0;
+  }
+
+  const auto &pc = mandelbrot.params();
+  MandelbrotCpuView const view{
+      .center = pc.center,
+      .scale = pc.scale,
+      .width = extent.width,
+      .height = extent.height,
+      .max_iter = mandelbrot.current_max_iter(),
+  };
+  std::vector<std::uint32_t> cpu(pixels);
+
+  int result = 0;
+  for (int variant = 0; variant < MandelbrotRenderer::variant_count;
+       variant++) {
+    auto const gpu = gpu_iterations(variant);
+    // the persistent variant iterates like variant 2
+    mandelbrot_cpu(view,
+                   variant == MandelbrotRenderer::variant_persistent ? 2
+                                                                     : variant,
+                   CpuKernel::Simd, cpu, context.executor());
+
+    auto const mismatches = std::ranges::count_if(
+        std::views::zip(gpu, cpu),
+        [](auto pair) { return std::get<0>(pair) != std::get<1>(pair); });
+    if (mismatches == 0) {
+      logger.Log("  variant {}: iteration counts match the CPU", variant);
+      continue;
+    }
+
+    auto const first = static_cast<std::size_t>(
+        std::ranges::mismatch(gpu, cpu).in1 - gpu.begin());
+    logger.Error("  variant {}: {} of {} pixels differ from the CPU (first "
+                 "at {}x{}: gpu {} cpu {}); a driver contracting fp64 "
+                 "multiply-adds does not round like the CPU",
+                 variant, mismatches, pixels, first % extent.width,
+                 first / extent.width, gpu[first], cpu[first]);
+    result = 1;
+  }
+  return result;
+}
+
+int HeadlessHandler::Run() try {
+  logger.Log("Running headless: {} frames of {}x{} into {} images",
+             options.frame_count, target.extent().width,
+             target.extent().height, target.images().size());
+
+  auto start = std::chrono::high_resolution_clock::now();
+
+  for (std::uint32_t frame = 0; frame < options.frame_count; ++frame) {
+    FrameMarkStart(nullptr);
+    detail::destroy_helper const frame_mark_scope{
+        [] { FrameMarkEnd(nullptr); }};
+
+    {
+      ZoneScopedN("advance frame");
+      context.next_frame();
+    }
+
+    std::uint32_t const image_idx = target.acquire();
+
+    tf::Taskflow tf;
+    std::optional<CommandBuffer> recorded;
+
+    auto record_task = tf.emplace([&] {
+                           recorded = context.getGraphicsCommandBuffer();
+                           record(*recorded, image_idx);
+                         }).name("record");
+
+    tf.emplace([&] {
+        context.get_queue(Context::QueueType::Graphics)
+            ->submit(SubmitionInfo::gather(std::move(recorded).value()));
+      })
+        .name("submit")
+        .succeed(record_task);
+
+    tf.emplace([&] { transfer_manager.doOutstandingTransfers(); })
+        .name("async transfer")
+        .succeed(record_task);
+
+    context.executor().run(tf).wait();
+  }
+
+  int const result = options.iterations_path || options.compare_cpu
+                         ? check_iterations()
+                         : 0;
+
+  context.cleanup();
+
+  auto elapsed = std::chrono::duration<double>(
+                     std::chrono::high_resolution_clock::now() - start)
+                     .count();
+
+  logger.Log("Headless run finished: {} frames in {:.3f}s ({:.2f} fps)",
+             options.frame_count, elapsed,
+             options.frame_count / std::max(elapsed, 1e-9));
+
+  if (const auto *profiler =
+          context.get_queue(Context::QueueType::Graphics)->profiler()) {
+    for (const auto &zone : profiler->stats()) {
+      logger.Log("  gpu {}: avg {:.3f}ms max {:.3f}ms ({} samples)", zone.name,
+                 zone.avg_ms, zone.max_ms, zone.samples);
+    }
+  }
+
+  auto const bindless_stats = context.bindlessManager().stats();
+  for (auto &&[type, stats] :
+       std::views::zip(BindlessManager::handle_types, bindless_stats)) {
+    logger.Log("  bindless {}: {}/{} live ({:.1f}%), {} retired, {} free, "
+               "{} exhausted, {:.1f}% fragmented",
+               BindlessResource::type_name(type), stats.live, stats.capacity,
+               stats.occupancy() * 100., // NOLINT(*-magic-numbers)
+               stats.retired, stats.free(), stats.exhausted,
+               stats.fragmentation() * 100.); // NOLINT(*-magic-numbers)
+  }
+  for (const auto &heap : context.device().memoryPools().budgets()) {
+    logger.Log("  heap {}{}: {}/{} bytes ({:.1f}%)", heap.heap,
+               heap.device_local ? " (device)" : "", heap.usage, heap.budget,
+               heap.pressure() * 100.); // NOLINT(*-magic-numbers)
+  }
+  for (const auto &pool : context.device().memoryPools().stats()) {
+    logger.Log("  pool {}: {} allocations, {}/{} bytes in {} blocks",
+               pool.name, pool.allocations, pool.allocation_bytes,
+               pool.block_bytes, pool.blocks);
+  }
+  auto const resource_stats = context.resources().stats();
+  logger.Log("  resources: {} buffers, {} images, {} views, {} pending, "
+             "{} retired slots",
+             resource_stats.buffers, resource_stats.images,
+             resource_stats.image_views, resource_stats.pending,
+             resource_stats.retired_slots);
+  const auto &tiles = mandelbrot.tile_stats();
+  logger.Log("  mandelbrot tiles: {}/{} in the atlas, {} hits, {} computed, "
+             "{} evicted; atlas {} bytes, evicted {} times",
+             tiles.cache.live, tiles.cache.capacity, tiles.cache.hits,
+             tiles.cache.computed, tiles.cache.evictions, tiles.atlas_bytes,
+             tiles.atlas_evictions);
+  auto const defrag_stats = context.defragmenter().stats();
+  logger.Log("  defragmentation: {} passes, {} moves ({} bytes), {} bytes "
+             "freed, {} tracked",
+             defrag_stats.passes, defrag_stats.moves, defrag_stats.bytes_moved,
+             defrag_stats.bytes_freed, defrag_stats.tracked);
+  for (const auto &[name, stats] : context.cache_stats()) {
+    logger.Log("  cache {}: {} live, {} evicted, {:.1f}% hits ({}/{}), "
+               "create avg {:.3f}ms max {:.3f}ms",
+               name, stats.live, stats.evictions,
+               stats.hit_rate() * 100., // NOLINT(*-magic-numbers)
+               stats.hits, stats.hits + stats.misses,
+               std::chrono::duration<double, std::milli>(
+                   stats.avg_create_time())
+                   .count(),
+               std::chrono::duration<double, std::milli>(stats.max_create_time)
+                   .count());
+  }
+  auto const ds_stats = context.ds_tuner().stats();
+  logger.Log("  descriptor pools: {} sets ({} undescribed), {} retries, {} "
+             "created, {} full, {} dropped, generation {}",
+             ds_stats.sets, ds_stats.undescribed_sets, ds_stats.retries,
+             ds_stats.pools_created, ds_stats.pools_full,
+             ds_stats.pools_dropped, ds_stats.generation);
+
+  return result;
+} catch (const vk::DeviceLostError &err) {
+  context.device().make_device_lost_dump(cfg, err);
+  return 1;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "MandelbrotRenderer.hpp"
+
+#include <CommandBuffer.hpp>
+#include <Config.hpp>
+#include <Context.hpp>
+#include <Device.hpp>
+#include <OffscreenSwapchain.hpp>
+#include <TransferManager.hpp>
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+
+namespace v4dg {
+// renders without a window/surface into an OffscreenSwapchain
+//   (servers without a display, CI, software ICDs like lavapipe)
+class HeadlessHandler {
+public:
+  struct Options {
+    vk::Extent2D extent{1024, 768};
+    std::uint32_t image_count{max_frames_in_flight + 1};
+    std::uint32_t frame_count{100};
+    // after the frames: the iteration counts of the selected variant
+    //   (raw uint32 per pixel) are written to iterations_path and those of
+    //   every variant compared with mandelbrot_cpu()
+    bool compare_cpu{false};
+    std::optional<std::filesystem::path> iterations_path;
+  };
+
+  HeadlessHandler(const Config &cfg, const Options &options);
+  HeadlessHandler(const HeadlessHandler &) = delete;
+  HeadlessHandler &operator=(const HeadlessHandler &) = delete;
+  HeadlessHandler(HeadlessHandler &&) = delete;
+  HeadlessHandler &operator=(HeadlessHandler &&) = delete;
+  ~HeadlessHandler();
+
+  int Run();
+
+private:
+  const Config &cfg;
+  Options options;
+
+  Instance instance;
+  Device device;
+  Context context;
+  TransferManager transfer_manager;
+
+  OffscreenSwapchain target;
+  MandelbrotRenderer mandelbrot;
+
+  void record(CommandBuffer &cb, std::uint32_t image_idx);
+  // 1 if the GPU and CPU iteration counts differ
+  int check_iterations();
+};
+} // namespace v4dg
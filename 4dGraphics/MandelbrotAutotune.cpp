@@ -0,0 +1,204 @@
+#include "MandelbrotAutotune.hpp"
+
+#include <Debug.hpp>
+#include <Device.hpp>
+#include <PipelineBuilder.hpp>
+#include <cppHelpers.hpp>
+
+#include <vulkan/vulkan.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <optional>
+#include <span>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+using namespace v4dg;
+
+namespace {
+// workgroup shapes of the 2D variants
+constexpr std::array<std::pair<std::uint32_t, std::uint32_t>, 6>
+    shapes_2d{{{8, 4}, {8, 8}, {16, 8}, {16, 16}, {32, 4}, {32, 8}}};
+// and of the persistent one (a subgroup takes pixels from the queue)
+constexpr std::array<std::pair<std::uint32_t, std::uint32_t>, 3>
+    shapes_persistent{{{64, 1}, {128, 1}, {256, 1}}};
+constexpr std::array<std::uint32_t, 3> persistent_groups{128, 512, 2048};
+// one workgroup per image region
+constexpr std::array<std::uint32_t, 1> grid_groups{0};
+
+// the tuning is only valid for the device and driver it was measured on
+std::string device_id(const Device &device) {
+  const auto &props = device.stats()
+                          .properties.get<vk::PhysicalDeviceProperties2>()
+                          ->properties;
+  return std::format("device {} {} {}", props.vendorID, props.deviceID,
+                     props.driverVersion);
+}
+} // namespace
+
+void KernelConfig::apply(ShaderStageData &shader) const {
+  shader.add_specialization(1, local_x).add_specialization(2, local_y);
+  if (subgroup_size != 0) {
+    shader.set_subgroup_size_info(
+        vk::PipelineShaderStageRequiredSubgroupSizeCreateInfoEXT{
+            subgroup_size});
+  }
+}
+
+std::vector<KernelConfig> v4dg::kernel_candidates(const Device &device,
+                                                  bool persistent) {
+  const auto &props = device.stats().properties;
+  const auto &limits =
+      props.get<vk::PhysicalDeviceProperties2>()->properties.limits;
+  const auto &props13 = *props.get<vk::PhysicalDeviceVulkan13Properties>();
+
+  // 0: the size the driver picks
+  std::vector<std::uint32_t> subgroup_sizes{0};
+  if (props13.requiredSubgroupSizeStages & vk::ShaderStageFlagBits::eCompute) {
+    for (auto size = props13.minSubgroupSize;
+         size != 0 && size <= props13.maxSubgroupSize; size *= 2) {
+      subgroup_sizes.push_back(size);
+    }
+  }
+
+  using shape = std::pair<std::uint32_t, std::uint32_t>;
+  std::span<const shape> const shapes =
+      persistent ? std::span<const shape>(shapes_persistent)
+                 : std::span<const shape>(shapes_2d);
+  std::span<const std::uint32_t> const groups =
+      persistent ? std::span<const std::uint32_t>(persistent_groups)
+                 : std::span<const std::uint32_t>(grid_groups);
+
+  std::vector<KernelConfig> candidates;
+  for (auto [x, y] : shapes) {
+    if (x > limits.maxComputeWorkGroupSize[0] ||
+        y > limits.maxComputeWorkGroupSize[1] ||
+        x * y > limits.maxComputeWorkGroupInvocations) {
+      continue;
+    }
+    for (auto size : subgroup_sizes) {
+      if (size != 0 && x * y > size * props13.maxComputeWorkgroupSubgroups) {
+        continue;
+      }
+      for (auto count : groups) {
+        candidates.push_back({x, y, size, count});
+      }
+    }
+  }
+  return candidates;
+}
+
+std::optional<KernelTuning>
+KernelTuning::load(const std::filesystem::path &path, const Device &device,
+                   std::size_t variant_count, std::size_t persistent_variant) {
+  auto file = GetFileString(path);
+  if (!file) {
+    logger.Log("No kernel tuning at {} ({})", path.string(),
+               to_string(file.error()));
+    return std::nullopt;
+  }
+
+  std::istringstream stream{*file};
+  std::string line;
+
+  // the first non-comment line identifies the device
+  bool matched_device = false;
+  KernelTuning tuning{std::vector<KernelConfig>(variant_count)};
+  std::vector<bool> found(variant_count);
+  while (std::getline(stream, line)) {
+    if (line.empty() || line.front() == '#') {
+      continue;
+    }
+    if (!matched_device) {
+      if (line != device_id(device)) {
+        logger.Log("Kernel tuning {} is from another device or driver",
+                   path.string());
+        return std::nullopt;
+      }
+      matched_device = true;
+      continue;
+    }
+
+    std::istringstream fields{line};
+    std::size_t variant{};
+    KernelConfig config{};
+    if (!(fields >> variant >> config.local_x >> config.local_y >>
+          config.subgroup_size >> config.groups) ||
+        variant >= variant_count || config.invocations() == 0) {
+      logger.Warning("Kernel tuning {} is malformed - ignoring",
+                     path.string());
+      return std::nullopt;
+    }
+
+    tuning.variants[variant] = config;
+    found[variant] = true;
+  }
+
+  if (std::ranges::find(found, false) != found.end()) {
+    // written for fewer variants - tune again
+    return std::nullopt;
+  }
+
+  // edited by hand or written before the candidates changed - a config
+  //   beyond the device limits would fail the pipeline creation
+  auto const candidates_2d = kernel_candidates(device, false);
+  auto const candidates_persistent = kernel_candidates(device, true);
+  for (std::size_t variant = 0; variant < variant_count; variant++) {
+    const auto &candidates = variant == persistent_variant
+                                 ? candidates_persistent
+                                 : candidates_2d;
+    if (std::ranges::find(candidates, tuning.variants[variant]) ==
+        candidates.end()) {
+      logger.Warning("Kernel tuning {} has an unsupported configuration for "
+                     "variant {} - ignoring",
+                     path.string(), variant);
+      return std::nullopt;
+    }
+  }
+
+  logger.Debug("Loaded kernel tuning from {}", path.string());
+  return tuning;
+}
+
+void KernelTuning::store(const std::filesystem::path &path,
+                         const Device &device) const {
+  auto tmp_path = path;
+  tmp_path += ".tmp";
+
+  {
+    std::ofstream file(tmp_path, std::ios::trunc);
+    file << "# mandelbrot kernels: <variant> <local_x> <local_y> "
+            "<subgroup size> <groups>\n"
+         << device_id(device) << '\n';
+    for (std::size_t variant = 0; variant < variants.size(); variant++) {
+      const auto &config = variants[variant];
+      file << variant << ' ' << config.local_x << ' ' << config.local_y << ' '
+           << config.subgroup_size << ' ' << config.groups << '\n';
+    }
+    file.flush();
+
+    if (!file) {
+      logger.Warning("Could not write kernel tuning {}", tmp_path.string());
+      std::error_code ec;
+      std::filesystem::remove(tmp_path, ec);
+      return;
+    }
+  }
+
+  std::error_code ec;
+  std::filesystem::rename(tmp_path, path, ec);
+  if (ec) {
+    logger.Warning("Could not replace kernel tuning {}: {}", path.string(),
+                   ec.message());
+    std::filesystem::remove(tmp_path, ec);
+  }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <Device.hpp>
+#include <PipelineBuilder.hpp>
+
+#include <vulkan/vulkan.hpp>
+
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <vector>
+
+namespace v4dg {
+// workgroup shape of a Mandelbrot.comp variant (specialization constants
+//   1 and 2) and the subgroup size it requires (0: left to the driver)
+struct KernelConfig {
+  std::uint32_t local_x{8};
+  std::uint32_t local_y{8};
+  std::uint32_t subgroup_size{0};
+  // persistent variant: number of workgroups (0: one per image region)
+  std::uint32_t groups{0};
+
+  [[nodiscard]] std::uint32_t invocations() const noexcept {
+    return local_x * local_y;
+  }
+  // adds the specialization and the required subgroup size to `shader`
+  void apply(ShaderStageData &shader) const;
+
+  auto operator<=>(const KernelConfig &) const = default;
+};
+
+// the configurations worth benchmarking on `device` (persistent kernels
+//   have a 1D shape and vary the workgroup count)
+[[nodiscard]] std::vector<KernelConfig>
+kernel_candidates(const Device &device, bool persistent);
+
+// Winners of the autotuner, one per variant. Stored in the cache dir as
+//   `<variant> <local_x> <local_y> <subgroup_size> <groups>` lines after a
+//   line identifying the device and driver they were measured on.
+struct KernelTuning {
+  std::vector<KernelConfig> variants;
+
+  // std::nullopt if the file is missing, malformed, from another device or
+  //   has a configuration that is not among the kernel_candidates() of
+  //   `device` (`persistent_variant` takes the persistent ones)
+  [[nodiscard]] static std::optional<KernelTuning>
+  load(const std::filesystem::path &path, const Device &device,
+       std::size_t variant_count, std::size_t persistent_variant);
+  // writes to a temporary file and renames it over `path`
+  void store(const std::filesystem::path &path, const Device &device) const;
+};
+} // namespace v4dg
@@ -0,0 +1,319 @@
+#include "MandelbrotCpu.hpp"
+#include "MandelbrotCpuSimd.hpp"
+
+#include <cppHelpers.hpp>
+#include <v4dgCore.hpp>
+
+#include <glm/glm.hpp>
+#include <taskflow/algorithm/for_each.hpp>
+#include <taskflow/taskflow.hpp>
+#include <tracy/Tracy.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+using namespace v4dg;
+
+namespace {
+constexpr std::uint32_t tile_size = 64;
+// |z|^2 of the escape (bailout_classic/smooth of Mandelbrot.comp)
+constexpr double bailout_classic = 4.;
+constexpr double bailout_smooth = 65536.;
+
+double bailout(const MandelbrotCpuView &view) {
+  return view.escape_values ? bailout_smooth : bailout_classic;
+}
+
+// ports of the shader functions (same operation order)
+
+glm::uvec4 last_to_inf_paralel(glm::dvec4 c, std::uint32_t max_iter,
+                               double bailout) {
+  glm::dvec4 const min_inf{bailout};
+
+  glm::dvec4 re{0.};
+  glm::dvec4 im{0.};
+
+  glm::dvec4 resq = re * re;
+  glm::dvec4 imsq = im * im;
+
+  std::uint32_t big_n = 0;
+  glm::uvec4 n{0};
+
+  glm::bvec4 act;
+
+  do {
+    im = 2. * re * im + glm::dvec4{c.z, c.w, c.z, c.w};
+    re = resq - imsq + glm::dvec4{c.x, c.x, c.y, c.y};
+
+    resq = re * re;
+    imsq = im * im;
+
+    act = glm::lessThanEqual(resq + imsq, min_inf);
+    n += glm::uvec4(act);
+    big_n++;
+  } while (glm::any(act) && big_n < max_iter);
+
+  return n;
+}
+
+std::uint32_t last_to_inf(glm::dvec2 c, std::uint32_t max_iter,
+                          double bailout) {
+  glm::dvec2 const one_neg_one{1., -1.};
+
+  glm::dvec2 z{0., 0.};
+
+  std::uint32_t n = 0;
+  do {
+    z = glm::dvec2{glm::dot(z, one_neg_one * z), 2. * z.x * z.y} + c;
+
+    n++;
+  } while (glm::dot(z, z) <= bailout && n < max_iter);
+
+  return n;
+}
+
+std::uint32_t last_to_inf_v3(glm::dvec2 c, std::uint32_t max_iter,
+                             double bailout) {
+  glm::dvec2 z{0., 0.};
+  glm::dvec2 zsq = z * z;
+
+  std::uint32_t n = 0;
+  do {
+    z = glm::dvec2{zsq.x - zsq.y, 2. * z.x * z.y} + c;
+    zsq = z * z;
+
+    n++;
+  } while (zsq.x + zsq.y <= bailout && n < max_iter);
+
+  return n;
+}
+
+// The SIMD kernels compute the escape time of every lane independently:
+//   the first iteration with |z|^2 > bailout (max_iter + 1 if there is
+//   none). getLastToInf/V3 return min(escape, max_iter) and
+//   getLastToInfParalel (which counts the iterations still inside) returns
+//   escape - 1.
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+// part of the base instruction set - no dispatch
+struct neon_lanes {
+  static constexpr std::size_t width = 2;
+  using reg = float64x2_t;
+  using mask = uint64x2_t;
+
+  static reg load(const double *p) { return vld1q_f64(p); }
+  static void store(double *p, reg v) { vst1q_f64(p, v); }
+  static reg set1(double v) { return vdupq_n_f64(v); }
+  static reg add(reg a, reg b) { return vaddq_f64(a, b); }
+  static reg sub(reg a, reg b) { return vsubq_f64(a, b); }
+  static reg mul(reg a, reg b) { return vmulq_f64(a, b); }
+  static mask gt(reg a, reg b) { return vcgtq_f64(a, b); }
+  static mask all() { return vdupq_n_u64(~std::uint64_t{0}); }
+  static mask both(mask a, mask b) { return vandq_u64(a, b); }
+  static mask but_not(mask a, mask b) { return vbicq_u64(a, b); }
+  // m ? b : a
+  static reg select(mask m, reg a, reg b) { return vbslq_f64(m, b, a); }
+  static bool any(mask m) {
+    return vmaxvq_u32(vreinterpretq_u32_u64(m)) != 0;
+  }
+};
+#endif
+
+struct scalar_lanes {
+  static constexpr std::size_t width = 1;
+  using reg = double;
+  using mask = bool;
+
+  static reg load(const double *p) { return *p; }
+  static void store(double *p, reg v) { *p = v; }
+  static reg set1(double v) { return v; }
+  static reg add(reg a, reg b) { return a + b; }
+  static reg sub(reg a, reg b) { return a - b; }
+  static reg mul(reg a, reg b) { return a * b; }
+  static mask gt(reg a, reg b) { return a > b; }
+  static mask all() { return true; }
+  static mask both(mask a, mask b) { return a && b; }
+  static mask but_not(mask a, mask b) { return a && !b; }
+  // m ? b : a
+  static reg select(mask m, reg a, reg b) { return m ? b : a; }
+  static bool any(mask m) { return m; }
+};
+
+// the widest instruction set of the CPU
+detail::simd_kernel select_simd_kernel() noexcept {
+#ifdef V4DG_MANDELBROT_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return detail::simd_kernel_avx512();
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return detail::simd_kernel_avx2();
+  }
+#endif
+#if defined(__ARM_NEON) && defined(__aarch64__)
+  return {"neon", neon_lanes::width, &detail::escape_times<neon_lanes>};
+#else
+  return {"none", scalar_lanes::width, &detail::escape_times<scalar_lanes>};
+#endif
+}
+
+const detail::simd_kernel &simd_kernel() noexcept {
+  static detail::simd_kernel const kernel = select_simd_kernel();
+  return kernel;
+}
+
+// the widest lanes - tiles are whole lane groups
+constexpr std::size_t max_simd_width = 8;
+static_assert(tile_size % max_simd_width == 0);
+
+// pixel rectangle [x0, x1) x [y0, y1) of the image
+struct region {
+  std::uint32_t x0;
+  std::uint32_t y0;
+  std::uint32_t x1;
+  std::uint32_t y1;
+};
+
+// c of the pixel as computed by Mandelbrot.comp
+glm::dvec2 pixel_c(const MandelbrotCpuView &view, int variant,
+                   std::uint32_t x, std::uint32_t y) {
+  glm::ivec2 const size(view.width, view.height);
+
+  if (variant != 0) {
+    glm::ivec2 const pos(x, y);
+    return view.center + glm::dvec2(pos - size / 2) * view.scale;
+  }
+
+  // invocations start at even pixels and offset c by the scale
+  glm::ivec2 const base(x & ~1U, y & ~1U);
+  glm::dvec2 c = view.center + glm::dvec2(base - size / 2) * view.scale;
+  if ((x & 1U) != 0) {
+    c.x += view.scale.x;
+  }
+  if ((y & 1U) != 0) {
+    c.y += view.scale.y;
+  }
+  return c;
+}
+
+void render_scalar(const MandelbrotCpuView &view, int variant, region r,
+                   std::span<std::uint32_t> out) {
+  auto const store = [&](std::uint32_t x, std::uint32_t y, std::uint32_t n) {
+    if (x < view.width && y < view.height) {
+      out[(std::size_t{y} * view.width) + x] = n;
+    }
+  };
+
+  if (variant == 0) {
+    // tiles start at even pixels - each 2x2 block is a shader invocation
+    for (std::uint32_t y = r.y0; y < r.y1; y += 2) {
+      for (std::uint32_t x = r.x0; x < r.x1; x += 2) {
+        glm::dvec2 const base = pixel_c(view, variant, x, y);
+        glm::dvec4 const c{base.x, base.x + view.scale.x, base.y,
+                           base.y + view.scale.y};
+        glm::uvec4 const n =
+            last_to_inf_paralel(c, view.max_iter, bailout(view));
+
+        store(x, y, n.x);
+        store(x, y + 1, n.y);
+        store(x + 1, y, n.z);
+        store(x + 1, y + 1, n.w);
+      }
+    }
+    return;
+  }
+
+  for (std::uint32_t y = r.y0; y < r.y1; y++) {
+    for (std::uint32_t x = r.x0; x < r.x1; x++) {
+      glm::dvec2 const c = pixel_c(view, variant, x, y);
+      store(x, y,
+            variant == 1 ? last_to_inf(c, view.max_iter, bailout(view))
+                         : last_to_inf_v3(c, view.max_iter, bailout(view)));
+    }
+  }
+}
+
+void render_simd(const MandelbrotCpuView &view, int variant, region r,
+                 std::span<std::uint32_t> out) {
+  const auto &kernel = simd_kernel();
+
+  // padding lanes escape in the first iteration (|c|^2 = 2 bailout^2)
+  std::array<double, tile_size> cx{};
+  std::array<double, tile_size> cy{};
+  std::array<double, tile_size> escape{};
+  std::size_t const count = DivCeil(std::size_t{r.x1 - r.x0}, kernel.width) *
+                            kernel.width;
+
+  for (std::uint32_t y = r.y0; y < r.y1; y++) {
+    std::ranges::fill(cx, bailout(view));
+    std::ranges::fill(cy, bailout(view));
+    for (std::uint32_t x = r.x0; x < r.x1; x++) {
+      glm::dvec2 const c = pixel_c(view, variant, x, y);
+      cx[x - r.x0] = c.x;
+      cy[x - r.x0] = c.y;
+    }
+
+    kernel.escape_times(cx.data(), cy.data(), count, view.max_iter,
+                        bailout(view), escape.data());
+
+    auto *row = &out[(std::size_t{y} * view.width) + r.x0];
+    for (std::uint32_t x = 0; x < r.x1 - r.x0; x++) {
+      auto const t = static_cast<std::uint32_t>(escape[x]);
+      row[x] = variant == 0 ? t - 1 : std::min(t, view.max_iter);
+    }
+  }
+}
+} // namespace
+
+std::string_view v4dg::mandelbrot_simd_isa() noexcept {
+  return simd_kernel().isa;
+}
+
+std::uint32_t v4dg::mandelbrot_simd_width() noexcept {
+  return static_cast<std::uint32_t>(simd_kernel().width);
+}
+
+void v4dg::mandelbrot_cpu(const MandelbrotCpuView &view, int variant,
+                          CpuKernel kernel, std::span<std::uint32_t> out,
+                          tf::Executor &executor) {
+  ZoneScoped;
+
+  if (out.size() < std::size_t{view.width} * view.height) {
+    throw exception("mandelbrot_cpu: output of {} pixels for a {}x{} image",
+                    out.size(), view.width, view.height);
+  }
+
+  std::uint32_t const tiles_x = DivCeil(view.width, tile_size);
+  std::uint32_t const tiles_y = DivCeil(view.height, tile_size);
+
+  tf::Taskflow taskflow;
+  taskflow.for_each_index(
+      std::uint32_t{0}, tiles_x * tiles_y, std::uint32_t{1},
+      [&](std::uint32_t tile) {
+        ZoneScopedN("mandelbrot tile");
+
+        std::uint32_t const x0 = (tile % tiles_x) * tile_size;
+        std::uint32_t const y0 = (tile / tiles_x) * tile_size;
+        region const r{
+            .x0 = x0,
+            .y0 = y0,
+            .x1 = std::min(x0 + tile_size, view.width),
+            .y1 = std::min(y0 + tile_size, view.height),
+        };
+
+        if (kernel == CpuKernel::Simd) {
+          render_simd(view, variant, r, out);
+        } else {
+          render_scalar(view, variant, r, out);
+        }
+      });
+  executor.run(taskflow).wait();
+}
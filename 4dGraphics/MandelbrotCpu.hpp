@@ -0,0 +1,47 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <taskflow/taskflow.hpp>
+
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+namespace v4dg {
+// the view of a Mandelbrot.comp dispatch covering the whole image
+struct MandelbrotCpuView {
+  glm::dvec2 center;
+  glm::dvec2 scale;
+  std::uint32_t width;
+  std::uint32_t height;
+  // has to match the max_iter push constant of Mandelbrot.comp to compare
+  //   against it
+  std::uint32_t max_iter{512}; // NOLINT(*-magic-numbers)
+  // flag_escape_values: the orbits run to the large bailout of the smooth
+  //   coloring (|z|^2 > 2^16) instead of |z| > 2
+  bool escape_values{false};
+};
+
+enum class CpuKernel : std::uint8_t {
+  Scalar,
+  // the widest instruction set of the CPU, picked at run time (AVX-512 or
+  //   AVX2 on x86-64, NEON on AArch64, scalar otherwise)
+  Simd,
+};
+
+// instruction set and double lanes used by CpuKernel::Simd
+[[nodiscard]] std::string_view mandelbrot_simd_isa() noexcept;
+[[nodiscard]] std::uint32_t mandelbrot_simd_width() noexcept;
+
+// Reference implementation of Mandelbrot.comp (without the interior
+//   checks): writes the iteration count of every pixel (row major) instead
+//   of its color.
+//   `variant` is the specialization constant of the shader; all kernels
+//   round like the shader without contracted multiply-adds, so their results
+//   are bit-exact with each other (and with the GPU if its driver does not
+//   contract them either - see the --compare-cpu headless option).
+//   Tiles of the image are computed in parallel on `executor`.
+void mandelbrot_cpu(const MandelbrotCpuView &view, int variant,
+                    CpuKernel kernel, std::span<std::uint32_t> out,
+                    tf::Executor &executor);
+} // namespace v4dg
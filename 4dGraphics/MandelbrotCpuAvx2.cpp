@@ -0,0 +1,36 @@
+// built with -mavx2 (CMakeLists.txt) - see MandelbrotCpuSimd.hpp
+#include "MandelbrotCpuSimd.hpp"
+
+#include <immintrin.h>
+
+#include <cstddef>
+
+namespace {
+struct lanes {
+  static constexpr std::size_t width = 4;
+  using reg = __m256d;
+  using mask = __m256d;
+
+  static reg load(const double *p) { return _mm256_loadu_pd(p); }
+  static void store(double *p, reg v) { _mm256_storeu_pd(p, v); }
+  static reg set1(double v) { return _mm256_set1_pd(v); }
+  static reg add(reg a, reg b) { return _mm256_add_pd(a, b); }
+  static reg sub(reg a, reg b) { return _mm256_sub_pd(a, b); }
+  static reg mul(reg a, reg b) { return _mm256_mul_pd(a, b); }
+  static mask gt(reg a, reg b) { return _mm256_cmp_pd(a, b, _CMP_GT_OQ); }
+  static mask all() {
+    return _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+  }
+  static mask both(mask a, mask b) { return _mm256_and_pd(a, b); }
+  static mask but_not(mask a, mask b) { return _mm256_andnot_pd(b, a); }
+  // m ? b : a
+  static reg select(mask m, reg a, reg b) {
+    return _mm256_blendv_pd(a, b, m);
+  }
+  static bool any(mask m) { return _mm256_movemask_pd(m) != 0; }
+};
+} // namespace
+
+v4dg::detail::simd_kernel v4dg::detail::simd_kernel_avx2() noexcept {
+  return {"avx2", lanes::width, &escape_times<lanes>};
+}
@@ -0,0 +1,34 @@
+// built with -mavx512f (CMakeLists.txt) - see MandelbrotCpuSimd.hpp
+#include "MandelbrotCpuSimd.hpp"
+
+#include <immintrin.h>
+
+#include <cstddef>
+
+namespace {
+struct lanes {
+  static constexpr std::size_t width = 8;
+  using reg = __m512d;
+  using mask = __mmask8;
+
+  static reg load(const double *p) { return _mm512_loadu_pd(p); }
+  static void store(double *p, reg v) { _mm512_storeu_pd(p, v); }
+  static reg set1(double v) { return _mm512_set1_pd(v); }
+  static reg add(reg a, reg b) { return _mm512_add_pd(a, b); }
+  static reg sub(reg a, reg b) { return _mm512_sub_pd(a, b); }
+  static reg mul(reg a, reg b) { return _mm512_mul_pd(a, b); }
+  static mask gt(reg a, reg b) { return _mm512_cmp_pd_mask(a, b, _CMP_GT_OQ); }
+  static mask all() { return 0xFF; } // NOLINT(*-magic-numbers)
+  static mask both(mask a, mask b) { return a & b; }
+  static mask but_not(mask a, mask b) { return a & ~b; }
+  // m ? b : a
+  static reg select(mask m, reg a, reg b) {
+    return _mm512_mask_blend_pd(m, a, b);
+  }
+  static bool any(mask m) { return m != 0; }
+};
+} // namespace
+
+v4dg::detail::simd_kernel v4dg::detail::simd_kernel_avx512() noexcept {
+  return {"avx512", lanes::width, &escape_times<lanes>};
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Internal to the MandelbrotCpu library: the SIMD kernel is instantiated
+//   once per instruction set, each in a translation unit built for it
+//   (MandelbrotCpuAvx2.cpp, MandelbrotCpuAvx512.cpp), and MandelbrotCpu.cpp
+//   picks one at run time.
+//   The kernel must stay free of inline functions with external linkage
+//   (std templates, glm): the linker could pick the copy built for a newer
+//   instruction set for every other caller.
+
+namespace v4dg::detail {
+// escape times of `count` points (a multiple of the width): the first
+//   iteration with |z|^2 > bailout (max_iter + 1 if there is none)
+using escape_times_fn = void (*)(const double *cx, const double *cy,
+                                 std::size_t count, std::uint32_t max_iter,
+                                 double bailout, double *escape);
+
+struct simd_kernel {
+  const char *isa;
+  std::size_t width;
+  escape_times_fn escape_times;
+};
+
+// only call these once the CPU is known to support the instruction set
+#ifdef V4DG_MANDELBROT_X86_KERNELS
+[[nodiscard]] simd_kernel simd_kernel_avx2() noexcept;
+[[nodiscard]] simd_kernel simd_kernel_avx512() noexcept;
+#endif
+
+// L: width, reg, mask and the operations on them (see the instantiations)
+template <typename L>
+void escape_times(const double *cx, const double *cy, std::size_t count,
+                  std::uint32_t max_iter, double bailout, double *escape) {
+  for (std::size_t i = 0; i < count; i += L::width) {
+    typename L::reg const crx = L::load(cx + i);
+    typename L::reg const cry = L::load(cy + i);
+    typename L::reg const min_inf = L::set1(bailout);
+    typename L::reg const two = L::set1(2.);
+
+    typename L::reg x = L::set1(0.);
+    typename L::reg y = L::set1(0.);
+    typename L::reg xx = L::set1(0.);
+    typename L::reg yy = L::set1(0.);
+
+    typename L::reg out = L::set1(static_cast<double>(max_iter) + 1.);
+    typename L::mask active = L::all();
+
+    for (std::uint32_t t = 1; t <= max_iter; t++) {
+      y = L::add(L::mul(L::mul(two, x), y), cry);
+      x = L::add(L::sub(xx, yy), crx);
+
+      xx = L::mul(x, x);
+      yy = L::mul(y, y);
+
+      auto const escaped = L::both(active, L::gt(L::add(xx, yy), min_inf));
+      out = L::select(escaped, out, L::set1(static_cast<double>(t)));
+      active = L::but_not(active, escaped);
+      if (!L::any(active)) {
+        break;
+      }
+    }
+
+    L::store(escape + i, out);
+  }
+}
+} // namespace v4dg::detail
@@ -0,0 +1,1658 @@
+#include "MandelbrotRenderer.hpp"
+
+#include "DeepZoom.hpp"
+#include "MandelbrotAutotune.hpp"
+
+#include <CommandBuffer.hpp>
+#include <Config.hpp>
+#include <Context.hpp>
+#include <Debug.hpp>
+#include <MemoryPools.hpp>
+#include <PipelineBuilder.hpp>
+#include <ResourceRegistry.hpp>
+#include <VulkanCaches.hpp>
+#include <VulkanConstructs.hpp>
+#include <VulkanResources.hpp>
+#include <cppHelpers.hpp>
+
+#include <tracy/Tracy.hpp>
+#include <vulkan-memory-allocator-hpp/vk_mem_alloc.hpp>
+#include <vulkan/vulkan.hpp>
+#include <vulkan/vulkan_raii.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <future>
+#include <initializer_list>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <variant>
+#include <vector>
+
+using namespace v4dg;
+
+namespace {
+std::shared_ptr<const std::vector<std::uint32_t>>
+load_code(const Config &cfg, const char *name) {
+  auto shader = load_shader_code(cfg.data_dir() / name);
+  if (!shader) {
+    std::visit(
+        [&](const auto &e) {
+          throw exception("Could not load shader: {}", to_string(e));
+        },
+        shader.error());
+  }
+
+  return std::make_shared<const std::vector<std::uint32_t>>(
+      std::move(*shader));
+}
+
+std::shared_ptr<const AsyncPipeline>
+make_kernel(Context &ctx, vk::PipelineLayout layout,
+            const std::shared_ptr<const std::vector<std::uint32_t>> &code,
+            int variant, const KernelConfig &config) {
+  ShaderStageData shader_data(vk::ShaderStageFlagBits::eCompute, code);
+
+  if (ctx.instance().debugUtilsEnabled()) {
+    shader_data.set_debug_name(
+        std::format("Shaders/Mandelbrot.comp.spv (var {}, {}x{})", variant,
+                    config.local_x, config.local_y));
+  }
+
+  shader_data.add_specialization(0, variant);
+  config.apply(shader_data);
+
+  return ctx.compute_pipelines().get(ComputePipelineInfo{
+      layout, std::move(shader_data), ctx.bindlessManager().pipeline_flags()});
+}
+
+glm::ivec2 slot_texel(std::uint32_t slot) {
+  auto const width = MandelbrotRenderer::atlas_tiles.width;
+  return glm::ivec2(slot % width, slot / width) *
+         static_cast<int>(MandelbrotRenderer::tile_size);
+}
+
+double view_radius(vk::Extent2D extent, glm::dvec2 scale) {
+  return glm::length(glm::dvec2(extent.width, extent.height) / 2. * scale);
+}
+
+ImageView make_texture(Context &ctx, vk::Extent2D extent, vk::Format format,
+                       vk::ImageUsageFlags usage, const char *name) {
+  ImageView texture = ImageView::createTexture(
+      ctx,
+      Image::ImageCreateInfo{
+          .format = format,
+          .extent = {extent.width, extent.height, 1},
+          .usage = usage,
+      },
+      ctx.device().memoryPools().allocation_info(MemoryClass::RenderTarget));
+  texture->setName(ctx.device(), "{}", name);
+  return texture;
+}
+
+constexpr auto texture_format = vk::Format::eR16G16B16A16Sfloat;
+constexpr auto texture_usage = vk::ImageUsageFlagBits::eStorage |
+                               vk::ImageUsageFlagBits::eTransferSrc;
+
+// the autotuner view: seahorse valley (slow and fast pixels side by side)
+const glm::dvec2 tune_center{-0.7453, 0.1127};
+constexpr double tune_height = 0.01;
+constexpr std::uint32_t tune_max_iter = 1024;
+// the fastest of the runs counts
+constexpr std::uint32_t tune_runs = 3;
+// the work queue hands out the pixels in blocks of this size (Mandelbrot.comp)
+constexpr std::uint32_t queue_block = 8;
+
+// new references are computed for this many view radii (panning slack)
+constexpr double reference_slack = 4.;
+// and once the view zooms this much deeper than the reference
+constexpr double rereference_zoom = 16.;
+
+vk::ImageMemoryBarrier2 whole_image_barrier(
+    vk::PipelineStageFlags2 src_stage, vk::AccessFlags2 src_access,
+    vk::PipelineStageFlags2 dst_stage, vk::AccessFlags2 dst_access,
+    vk::ImageLayout old_layout, vk::ImageLayout new_layout, vk::Image image) {
+  return {
+      src_stage,
+      src_access,
+      dst_stage,
+      dst_access,
+      old_layout,
+      new_layout,
+      vk::QueueFamilyIgnored,
+      vk::QueueFamilyIgnored,
+      image,
+      {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1},
+  };
+}
+} // namespace
+
+MandelbrotRenderer::MandelbrotRenderer(const Config &cfg, Context &ctx)
+    : m_ctx(&ctx),
+      m_texture(make_texture(ctx, m_extent, texture_format, texture_usage,
+                             "mandelbrot texture")),
+      m_pipeline_layout(PipelineLayoutInfo()
+                            .add_sets(ctx.bindlessManager().get_layouts())
+                            .add_push({vk::ShaderStageFlagBits::eCompute, 0U,
+                                       sizeof(PushConstants)})
+                            .create(ctx.device())),
+      m_tile_tables(make_per_frame_it([&](std::size_t i) {
+        Buffer table{
+            ctx.device(),
+            max_visible_tiles * sizeof(TileEntry),
+            vk::BufferUsageFlagBits2KHR::eStorageBuffer |
+                vk::BufferUsageFlagBits2KHR::eShaderDeviceAddress,
+            ctx.device().memoryPools().allocation_info(
+                MemoryClass::SmallBuffer),
+        };
+        table->setName(ctx.device(), "mandelbrot tile table {}", i);
+        return table;
+      })),
+      m_composite_layout(PipelineLayoutInfo()
+                             .add_sets(ctx.bindlessManager().get_layouts())
+                             .add_push({vk::ShaderStageFlagBits::eCompute, 0U,
+                                        sizeof(CompositeConstants)})
+                             .create(ctx.device())),
+      m_tile_cache(atlas_tiles.width * atlas_tiles.height),
+      m_deep_layout(PipelineLayoutInfo()
+                        .add_sets(ctx.bindlessManager().get_layouts())
+                        .add_push({vk::ShaderStageFlagBits::eCompute, 0U,
+                                   sizeof(DeepConstants)})
+                        .create(ctx.device())),
+      m_subdivide_layout(PipelineLayoutInfo()
+                             .add_sets(ctx.bindlessManager().get_layouts())
+                             .add_push({vk::ShaderStageFlagBits::eCompute, 0U,
+                                        sizeof(SubdivideConstants)})
+                             .create(ctx.device())),
+      m_refine_layout(PipelineLayoutInfo()
+                          .add_sets(ctx.bindlessManager().get_layouts())
+                          .add_push({vk::ShaderStageFlagBits::eCompute, 0U,
+                                     sizeof(RefineConstants)})
+                          .create(ctx.device())),
+      m_histogram_layout(PipelineLayoutInfo()
+                             .add_sets(ctx.bindlessManager().get_layouts())
+                             .add_push({vk::ShaderStageFlagBits::eCompute, 0U,
+                                        sizeof(HistogramConstants)})
+                             .create(ctx.device())),
+      m_color_layout(PipelineLayoutInfo()
+                         .add_sets(ctx.bindlessManager().get_layouts())
+                         .add_push({vk::ShaderStageFlagBits::eCompute, 0U,
+                                    sizeof(ColorConstants)})
+                         .create(ctx.device())),
+      m_histogram_buffer(
+          ctx.device(), vk::DeviceSize{histogram_bins} * sizeof(std::uint32_t),
+          vk::BufferUsageFlagBits2KHR::eStorageBuffer |
+              vk::BufferUsageFlagBits2KHR::eShaderDeviceAddress |
+              vk::BufferUsageFlagBits2KHR::eTransferDst,
+          vma::AllocationCreateInfo{{}, vma::MemoryUsage::eAutoPreferDevice}),
+      m_upscale_layout(PipelineLayoutInfo()
+                           .add_sets(ctx.bindlessManager().get_layouts())
+                           .add_push({vk::ShaderStageFlagBits::eCompute, 0U,
+                                      sizeof(UpscaleConstants)})
+                           .create(ctx.device())) {
+
+  m_histogram_buffer->setName(ctx.device(), "mandelbrot histogram");
+
+  auto code = load_code(cfg, "Shaders/Mandelbrot.comp.spv");
+
+  auto const tuning_path = cfg.cache_dir() / "mandelbrot_kernels.txt";
+  if (auto tuning = KernelTuning::load(tuning_path, ctx.device(),
+                                       variant_count, variant_persistent)) {
+    m_kernels = *std::move(tuning);
+  } else if (auto tuned = autotune(code)) {
+    m_kernels = *std::move(tuned);
+    m_kernels.store(tuning_path, ctx.device());
+  } else {
+    m_kernels = default_kernels();
+  }
+
+  for (int variant = 0; variant < variant_count; variant++) {
+    m_pipelines[variant] = make_kernel(ctx, *m_pipeline_layout, code, variant,
+                                       m_kernels.variants[variant]);
+  }
+
+  ShaderStageData composite(
+      vk::ShaderStageFlagBits::eCompute,
+      load_code(cfg, "Shaders/MandelbrotComposite.comp.spv"));
+  if (ctx.instance().debugUtilsEnabled()) {
+    composite.set_debug_name("Shaders/MandelbrotComposite.comp.spv");
+  }
+
+  m_composite = ctx.compute_pipelines().get(
+      ComputePipelineInfo{*m_composite_layout, std::move(composite),
+                          ctx.bindlessManager().pipeline_flags()});
+
+  ShaderStageData deep(vk::ShaderStageFlagBits::eCompute,
+                       load_code(cfg, "Shaders/MandelbrotDeep.comp.spv"));
+  if (ctx.instance().debugUtilsEnabled()) {
+    deep.set_debug_name("Shaders/MandelbrotDeep.comp.spv");
+  }
+
+  m_deep = ctx.compute_pipelines().get(
+      ComputePipelineInfo{*m_deep_layout, std::move(deep),
+                          ctx.bindlessManager().pipeline_flags()});
+
+  ShaderStageData subdivide(
+      vk::ShaderStageFlagBits::eCompute,
+      load_code(cfg, "Shaders/MandelbrotSubdivide.comp.spv"));
+  if (ctx.instance().debugUtilsEnabled()) {
+    subdivide.set_debug_name("Shaders/MandelbrotSubdivide.comp.spv");
+  }
+
+  m_subdivide = ctx.compute_pipelines().get(
+      ComputePipelineInfo{*m_subdivide_layout, std::move(subdivide),
+                          ctx.bindlessManager().pipeline_flags()});
+
+  ShaderStageData refine(vk::ShaderStageFlagBits::eCompute,
+                         load_code(cfg, "Shaders/MandelbrotRefine.comp.spv"));
+  if (ctx.instance().debugUtilsEnabled()) {
+    refine.set_debug_name("Shaders/MandelbrotRefine.comp.spv");
+  }
+
+  m_refine = ctx.compute_pipelines().get(
+      ComputePipelineInfo{*m_refine_layout, std::move(refine),
+                          ctx.bindlessManager().pipeline_flags()});
+
+  auto histogram = load_code(cfg, "Shaders/MandelbrotHistogram.comp.spv");
+  for (int variant = 0; variant < 2; variant++) {
+    ShaderStageData shader_data(vk::ShaderStageFlagBits::eCompute, histogram);
+
+    if (ctx.instance().debugUtilsEnabled()) {
+      shader_data.set_debug_name(
+          std::format("Shaders/MandelbrotHistogram.comp.spv (var {})",
+                      variant));
+    }
+
+    shader_data.add_specialization(0, variant);
+
+    m_histogram[variant] = ctx.compute_pipelines().get(
+        ComputePipelineInfo{*m_histogram_layout, std::move(shader_data),
+                            ctx.bindlessManager().pipeline_flags()});
+  }
+
+  ShaderStageData color(vk::ShaderStageFlagBits::eCompute,
+                        load_code(cfg, "Shaders/MandelbrotColor.comp.spv"));
+  if (ctx.instance().debugUtilsEnabled()) {
+    color.set_debug_name("Shaders/MandelbrotColor.comp.spv");
+  }
+
+  m_color = ctx.compute_pipelines().get(
+      ComputePipelineInfo{*m_color_layout, std::move(color),
+                          ctx.bindlessManager().pipeline_flags()});
+
+  ShaderStageData upscale(vk::ShaderStageFlagBits::eCompute,
+                          load_code(cfg, "Shaders/MandelbrotUpscale.comp.spv"));
+  if (ctx.instance().debugUtilsEnabled()) {
+    upscale.set_debug_name("Shaders/MandelbrotUpscale.comp.spv");
+  }
+
+  m_upscale = ctx.compute_pipelines().get(
+      ComputePipelineInfo{*m_upscale_layout, std::move(upscale),
+                          ctx.bindlessManager().pipeline_flags()});
+
+  // the tiles are recomputed when needed (all or nothing - one image)
+  m_atlas_evictor = UniqueEvictor{
+      ctx.memoryBudget(), [this](vk::DeviceSize) { return evict_atlas(); }};
+}
+
+void MandelbrotRenderer::resize(vk::Extent2D extent) {
+  extent = {
+      std::clamp(extent.width, min_extent.width, max_extent.width),
+      std::clamp(extent.height, min_extent.height, max_extent.height),
+  };
+  if (extent == m_extent) {
+    return;
+  }
+
+  ZoneScoped;
+
+  // the same part of the plane on more (or fewer) pixels
+  m_push_constants.scale *=
+      glm::dvec2(m_extent.width, m_extent.height) /
+      glm::dvec2(extent.width, extent.height);
+  m_extent = extent;
+
+  // the old resources may still be used by the frames in flight
+  //   (the registry defers the destruction of the rest)
+  m_ctx->get_destruction_stack().push(std::move(m_texture));
+  m_texture = make_texture(*m_ctx, m_extent, texture_format, texture_usage,
+                           "mandelbrot texture");
+  m_texture_initialized = false;
+
+  m_subdivision_buffer.reset();
+  m_refine_states.reset();
+  m_refine_view.reset();
+  m_escape_values = {};
+  m_escape_view.reset();
+  m_work_queue.reset();
+}
+
+void MandelbrotRenderer::wait_until_ready() {
+  ZoneScoped;
+
+  for (const auto &pipeline : m_pipelines) {
+    (void)pipeline->wait();
+  }
+  for (const auto *pipeline :
+       {&m_composite, &m_deep, &m_subdivide, &m_refine, &m_histogram[0],
+        &m_histogram[1], &m_color, &m_upscale}) {
+    (void)(*pipeline)->wait();
+  }
+
+  sync_center();
+  if (!m_perturbation || !(m_push_constants.scale.x < perturbation_scale)) {
+    return;
+  }
+
+  update_reference();
+  while (m_pending_reference.valid()) {
+    m_pending_reference.wait();
+    update_reference();
+  }
+}
+
+auto MandelbrotRenderer::make_transient(vk::Extent2D extent, vk::Format format,
+                                        vk::ImageUsageFlags usage,
+                                        zstring_view name)
+    -> transient_texture {
+  auto &resources = m_ctx->resources();
+
+  UniqueImage image{
+      resources,
+      resources.create_image(
+          Image::ImageCreateInfo{
+              .format = format,
+              .extent = {extent.width, extent.height, 1},
+              .usage = usage,
+          },
+          m_ctx->device().memoryPools().allocation_info(
+              MemoryClass::RenderTarget)),
+  };
+  resources.setName(*image, name);
+
+  UniqueImageView view{resources,
+                       resources.create_image_view(
+                           *image, vk::ImageViewType::e2D, format, usage)};
+  resources.setName(*view, name);
+  return {.image = std::move(image), .view = std::move(view)};
+}
+
+ImageViewHandle MandelbrotRenderer::atlas() {
+  if (!m_atlas.view) {
+    m_atlas = make_transient({atlas_tiles.width * tile_size,
+                              atlas_tiles.height * tile_size},
+                             vk::Format::eR8G8B8A8Unorm,
+                             vk::ImageUsageFlagBits::eStorage,
+                             "mandelbrot tile atlas");
+    m_atlas_initialized = false;
+    m_tile_stats.atlas_bytes =
+        m_ctx->device()
+            .allocator()
+            .getAllocationInfo(m_ctx->resources().allocation(*m_atlas.image))
+            .size;
+  }
+  return *m_atlas.view;
+}
+
+vk::DeviceSize MandelbrotRenderer::evict_atlas() {
+  if (!m_atlas.image) {
+    return 0;
+  }
+
+  // the registry keeps the image for the frames in flight
+  m_atlas = {};
+  m_atlas_initialized = false;
+  m_tile_cache.clear();
+
+  logger.Debug("mandelbrot: evicted the tile atlas ({} bytes)",
+               m_tile_stats.atlas_bytes);
+  m_tile_stats.atlas_evictions++;
+  return std::exchange(m_tile_stats.atlas_bytes, 0);
+}
+
+BufferHandle MandelbrotRenderer::subdivision_buffer() {
+  if (!m_subdivision_buffer) {
+    auto &resources = m_ctx->resources();
+    m_subdivision_layout = subdivision_layout(m_extent);
+    m_subdivision_buffer = {
+        resources,
+        resources.create_buffer(
+            m_subdivision_layout.back(),
+            vk::BufferUsageFlagBits2KHR::eStorageBuffer |
+                vk::BufferUsageFlagBits2KHR::eShaderDeviceAddress |
+                vk::BufferUsageFlagBits2KHR::eIndirectBuffer |
+                vk::BufferUsageFlagBits2KHR::eTransferDst,
+            vma::AllocationCreateInfo{{},
+                                      vma::MemoryUsage::eAutoPreferDevice}),
+    };
+    resources.setName(*m_subdivision_buffer, "mandelbrot subdivision");
+  }
+  return *m_subdivision_buffer;
+}
+
+ImageViewHandle MandelbrotRenderer::escape_values() {
+  if (!m_escape_values.view) {
+    m_escape_values = make_transient(m_extent, vk::Format::eR32Sfloat,
+                                     vk::ImageUsageFlagBits::eStorage,
+                                     "mandelbrot escape values");
+  }
+  return *m_escape_values.view;
+}
+
+BufferHandle MandelbrotRenderer::work_queue() {
+  if (!m_work_queue) {
+    // the queue covers whole blocks of the image or of a tile
+    auto const blocks = [](std::uint32_t size) {
+      return DivCeil(std::max(size, tile_size), queue_block);
+    };
+    vk::DeviceSize const pixels = vk::DeviceSize{blocks(m_extent.width)} *
+                                  blocks(m_extent.height) * queue_block *
+                                  queue_block;
+    auto &resources = m_ctx->resources();
+    m_work_queue = {
+        resources,
+        resources.create_buffer(
+            sizeof(WorkQueueHeader) + (pixels * sizeof(SlowOrbit)),
+            vk::BufferUsageFlagBits2KHR::eStorageBuffer |
+                vk::BufferUsageFlagBits2KHR::eShaderDeviceAddress |
+                vk::BufferUsageFlagBits2KHR::eTransferDst,
+            vma::AllocationCreateInfo{{},
+                                      vma::MemoryUsage::eAutoPreferDevice}),
+    };
+    resources.setName(*m_work_queue, "mandelbrot work queue");
+  }
+  return *m_work_queue;
+}
+
+BufferHandle MandelbrotRenderer::refine_states() {
+  if (!m_refine_states) {
+    auto &resources = m_ctx->resources();
+    m_refine_states = {
+        resources,
+        resources.create_buffer(
+            vk::DeviceSize{m_extent.width} * m_extent.height *
+                sizeof(RefineState),
+            vk::BufferUsageFlagBits2KHR::eStorageBuffer |
+                vk::BufferUsageFlagBits2KHR::eShaderDeviceAddress,
+            vma::AllocationCreateInfo{{},
+                                      vma::MemoryUsage::eAutoPreferDevice}),
+    };
+    resources.setName(*m_refine_states, "mandelbrot refinement states");
+  }
+  return *m_refine_states;
+}
+
+std::uint32_t MandelbrotRenderer::adaptive_max_iter(double scale) {
+  if (!(scale > 0.)) {
+    return adaptive_iter_base;
+  }
+
+  double const octaves = std::max(0., std::log2(default_scale / scale));
+  double const iter =
+      adaptive_iter_base + (adaptive_iter_per_octave * octaves);
+  return static_cast<std::uint32_t>(
+      std::min(iter, static_cast<double>(max_adaptive_iter)));
+}
+
+std::uint32_t MandelbrotRenderer::max_iter_for(double scale) const {
+  return m_adaptive_iter ? adaptive_max_iter(scale) : max_iter;
+}
+
+std::uint32_t MandelbrotRenderer::current_max_iter() const {
+  return max_iter_for(m_push_constants.scale.x);
+}
+
+std::array<vk::DeviceSize, MandelbrotRenderer::subdivision_levels + 1>
+MandelbrotRenderer::subdivision_layout(vk::Extent2D extent) {
+  static constexpr vk::DeviceSize alignment = sizeof(RectListHeader);
+
+  // the first pass takes its rectangles from the workgroup id
+  std::array<vk::DeviceSize, subdivision_levels + 1> layout{};
+  vk::DeviceSize offset =
+      AlignUp(vk::DeviceSize{extent.width} * extent.height *
+                  sizeof(std::uint32_t),
+              alignment);
+  for (std::uint32_t level = 1; level < subdivision_levels; level++) {
+    std::uint32_t const size = subdivision_rect >> level;
+    vk::DeviceSize const rects =
+        vk::DeviceSize{DivCeil(extent.width, size)} *
+        DivCeil(extent.height, size);
+
+    layout[level] = offset;
+    offset = AlignUp(offset + sizeof(RectListHeader) +
+                         (rects * sizeof(glm::uvec2)),
+                     alignment);
+  }
+  layout.back() = offset;
+  return layout;
+}
+
+std::uint32_t MandelbrotRenderer::flags() const noexcept {
+  return m_interior_checks ? flag_interior_checks : 0;
+}
+
+void MandelbrotRenderer::move(glm::dvec2 delta) {
+  sync_center();
+
+  auto const limbs = BigFixed::limbs_for(precision_bits());
+  m_center_x += BigFixed{delta.x, limbs};
+  m_center_y += BigFixed{delta.y, limbs};
+
+  m_push_constants.center = {m_center_x.to_double(), m_center_y.to_double()};
+  m_center_approx = m_push_constants.center;
+}
+
+void MandelbrotRenderer::sync_center() {
+  if (m_push_constants.center == m_center_approx) {
+    return;
+  }
+
+  auto const limbs = BigFixed::limbs_for(precision_bits());
+  m_center_x = BigFixed{m_push_constants.center.x, limbs};
+  m_center_y = BigFixed{m_push_constants.center.y, limbs};
+  m_center_approx = m_push_constants.center;
+}
+
+std::size_t MandelbrotRenderer::precision_bits() const {
+  double const scale =
+      std::min(m_push_constants.scale.x, m_push_constants.scale.y);
+  double const bits = scale > 0. ? std::max(0., -std::log2(scale)) : 0.;
+  return static_cast<std::size_t>(std::ceil(bits)) + guard_bits;
+}
+
+void MandelbrotRenderer::record(CommandBuffer &cb) {
+  ZoneScopedN("mandelbrot");
+  auto label = cb.debugLabelScope(gpu_zone, {0.0F, 0.5F, 0.0F, 1.0F});
+
+  // progressive refinement keeps the pixels that are not final yet
+  cb.barrier({}, {}, {},
+             {whole_image_barrier(vk::PipelineStageFlagBits2::eBlit,
+                                  vk::AccessFlagBits2::eNone,
+                                  vk::PipelineStageFlagBits2::eComputeShader,
+                                  vk::AccessFlagBits2::eShaderStorageWrite,
+                                  m_texture_initialized
+                                      ? vk::ImageLayout::eTransferSrcOptimal
+                                      : vk::ImageLayout::eUndefined,
+                                  vk::ImageLayout::eGeneral,
+                                  m_texture->vkImage())});
+  m_texture_initialized = true;
+
+  sync_center();
+  bool const deep = m_perturbation &&
+                    m_push_constants.scale.x < perturbation_scale;
+  m_deep_stats.active = deep;
+  if (deep) {
+    update_reference();
+  }
+
+  bool const smooth = m_smooth_coloring && record_smooth(cb, deep);
+  if (!smooth) {
+    m_escape_view.reset();
+  }
+
+  // the composite pipeline is checked first - planning allocates the tiles
+  bool const progressive = !smooth && !deep && !m_subdivision &&
+                           m_progressive && record_progressive(cb);
+  if (!progressive) {
+    m_refine_view.reset();
+  }
+
+  BindlessResource const target = m_texture->storageHandle();
+  if (smooth || progressive || (deep && record_deep(cb, target, flags())) ||
+      (m_subdivision && record_subdivided(cb))) {
+    m_tile_stats.visible = 0;
+  } else if (m_tiled && m_composite->try_get() &&
+             (m_atlas.view || !m_ctx->memoryBudget().throttled()) &&
+             plan_tiles()) {
+    record_tiled(cb);
+  } else {
+    m_tile_stats.visible = 0;
+    record_direct(cb, target, flags());
+  }
+
+  cb.barrier({}, {}, {},
+             {whole_image_barrier(vk::PipelineStageFlagBits2::eComputeShader,
+                                  vk::AccessFlagBits2::eShaderStorageWrite,
+                                  vk::PipelineStageFlagBits2::eTransfer,
+                                  vk::AccessFlagBits2::eTransferRead,
+                                  vk::ImageLayout::eGeneral,
+                                  vk::ImageLayout::eTransferSrcOptimal,
+                                  m_texture->vkImage())});
+}
+
+KernelTuning MandelbrotRenderer::default_kernels() {
+  KernelTuning tuning{std::vector<KernelConfig>(variant_count)};
+  tuning.variants[variant_persistent] = {
+      .local_x = 64, // NOLINT(*-magic-numbers)
+      .local_y = 1,
+      .subgroup_size = 0,
+      .groups = 512, // NOLINT(*-magic-numbers)
+  };
+  return tuning;
+}
+
+std::optional<KernelTuning> MandelbrotRenderer::autotune(
+    const std::shared_ptr<const std::vector<std::uint32_t>> &code) {
+  ZoneScoped;
+
+  auto &queue = *m_ctx->get_queue(Context::QueueType::Graphics);
+  auto const valid_bits = queue.queue().timestampValidBits();
+  if (valid_bits == 0) {
+    logger.Warning("No timestamps on the graphics queue - using the default "
+                   "Mandelbrot kernels");
+    return std::nullopt;
+  }
+  std::uint64_t const mask = valid_bits >= 64
+                                 ? std::numeric_limits<std::uint64_t>::max()
+                                 : (std::uint64_t{1} << valid_bits) - 1;
+
+  const auto &device = m_ctx->device();
+  double const period_ns = device.stats()
+                               .properties.get<vk::PhysicalDeviceProperties2>()
+                               ->properties.limits.timestampPeriod;
+
+  struct candidate {
+    int variant;
+    KernelConfig config;
+    std::shared_ptr<const AsyncPipeline> pipeline;
+  };
+
+  // all of them compile in the background while the first ones run
+  std::vector<candidate> candidates;
+  for (int variant = 0; variant < variant_count; variant++) {
+    for (const auto &config :
+         kernel_candidates(device, variant == variant_persistent)) {
+      candidates.push_back({variant, config,
+                            make_kernel(*m_ctx, *m_pipeline_layout, code,
+                                        variant, config)});
+    }
+  }
+  logger.Log("Tuning {} Mandelbrot kernels", candidates.size());
+
+  vk::raii::QueryPool pool{device.device(),
+                           {{}, vk::QueryType::eTimestamp, 2 * tune_runs}};
+
+  PushConstants const pc{
+      .center = tune_center,
+      .scale = glm::dvec2{tune_height / m_extent.height},
+      .offset = {0, 0},
+      .extent = glm::uvec2(m_extent.width, m_extent.height),
+      .image_idx = m_texture->storageHandle(),
+      .flags = flag_interior_checks,
+      .max_iter = tune_max_iter,
+  };
+
+  KernelTuning tuning = default_kernels();
+  std::vector<double> best(variant_count,
+                           std::numeric_limits<double>::infinity());
+
+  for (const auto &c : candidates) {
+    pool.reset(0, 2 * tune_runs);
+
+    auto cb = queue.getCommandBuffer();
+    cb->begin({vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+
+    cb.barrier({}, {}, {},
+               {whole_image_barrier(vk::PipelineStageFlagBits2::eNone,
+                                    vk::AccessFlagBits2::eNone,
+                                    vk::PipelineStageFlagBits2::eComputeShader,
+                                    vk::AccessFlagBits2::eShaderStorageWrite,
+                                    vk::ImageLayout::eUndefined,
+                                    vk::ImageLayout::eGeneral,
+                                    m_texture->vkImage())});
+
+    cb->bindPipeline(vk::PipelineBindPoint::eCompute, *c.pipeline->wait());
+    m_ctx->bindlessManager().bind(cb, *m_pipeline_layout,
+                                  vk::PipelineBindPoint::eCompute);
+
+    for (std::uint32_t run = 0; run < tune_runs; run++) {
+      cb->writeTimestamp2(vk::PipelineStageFlagBits2::eComputeShader, *pool,
+                          2 * run);
+      dispatch_kernel(cb, c.variant, c.config, pc);
+      cb->writeTimestamp2(vk::PipelineStageFlagBits2::eComputeShader, *pool,
+                          (2 * run) + 1);
+
+      cb.barrier(
+          {},
+          {vk::MemoryBarrier2{vk::PipelineStageFlagBits2::eComputeShader,
+                              vk::AccessFlagBits2::eShaderStorageWrite,
+                              vk::PipelineStageFlagBits2::eComputeShader,
+                              vk::AccessFlagBits2::eShaderStorageWrite}},
+          {}, {});
+    }
+
+    cb.end();
+    queue.submit(SubmitionInfo::gather(std::move(cb)));
+    // one candidate per submit - a long one must not trip the GPU watchdog
+    device.device().waitIdle();
+
+    auto [result, stamps] = pool.getResults<std::uint64_t>(
+        0, 2 * tune_runs, 2 * tune_runs * sizeof(std::uint64_t),
+        sizeof(std::uint64_t),
+        vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait);
+    if (result != vk::Result::eSuccess) {
+      continue;
+    }
+
+    double ms = std::numeric_limits<double>::infinity();
+    for (std::uint32_t run = 0; run < tune_runs; run++) {
+      auto const ticks = (stamps[(2 * run) + 1] - stamps[2 * run]) & mask;
+      ms = std::min(ms, static_cast<double>(ticks) * period_ns * 1e-6);
+    }
+
+    logger.Debug("  var {} {}x{} subgroup {} groups {}: {:.3f}ms", c.variant,
+                 c.config.local_x, c.config.local_y, c.config.subgroup_size,
+                 c.config.groups, ms);
+    if (ms < best[c.variant]) {
+      best[c.variant] = ms;
+      tuning.variants[c.variant] = c.config;
+    }
+  }
+
+  for (int variant = 0; variant < variant_count; variant++) {
+    const auto &config = tuning.variants[variant];
+    logger.Log("Mandelbrot variant {}: {}x{} subgroup {} groups {} ({:.3f}ms)",
+               variant, config.local_x, config.local_y, config.subgroup_size,
+               config.groups, best[variant]);
+  }
+  return tuning;
+}
+
+vk::Pipeline MandelbrotRenderer::select_pipeline(int &variant) {
+  variant = m_variant;
+  vk::Pipeline pipeline = m_pipelines[variant]->try_get();
+  for (int i = 0; i < variant_count && !pipeline; i++) {
+    if ((pipeline = m_pipelines[i]->try_get())) {
+      variant = i;
+    }
+  }
+  if (!pipeline) {
+    // nothing compiled yet (first frames) - have to wait
+    ZoneScopedN("wait for pipeline");
+    pipeline = *m_pipelines[variant]->wait();
+  }
+  return pipeline;
+}
+
+void MandelbrotRenderer::dispatch_fractal(CommandBuffer &cb, int variant,
+                                          const PushConstants &pc) {
+  dispatch_kernel(cb, variant, m_kernels.variants[variant], pc);
+}
+
+void MandelbrotRenderer::dispatch_kernel(CommandBuffer &cb, int variant,
+                                         const KernelConfig &config,
+                                         PushConstants pc) {
+  if (variant != variant_persistent) {
+    cb->pushConstants<PushConstants>(
+        *m_pipeline_layout, vk::ShaderStageFlagBits::eCompute, 0, pc);
+
+    // variant 0 computes 2x2 pixels per invocation
+    std::uint32_t const pixels = variant == 0 ? 2 : 1;
+    cb->dispatch(DivCeil(pc.extent.x, config.local_x * pixels),
+                 DivCeil(pc.extent.y, config.local_y * pixels), 1);
+    return;
+  }
+
+  auto &resources = m_ctx->resources();
+  BufferHandle const queue = work_queue();
+  static constexpr auto queue_access =
+      vk::AccessFlagBits2::eShaderStorageRead |
+      vk::AccessFlagBits2::eShaderStorageWrite;
+
+  // empty queue (after the previous dispatch is done with it)
+  cb.barrier({},
+             {vk::MemoryBarrier2{vk::PipelineStageFlagBits2::eComputeShader,
+                                 queue_access,
+                                 vk::PipelineStageFlagBits2::eTransfer,
+                                 vk::AccessFlagBits2::eTransferWrite}},
+             {}, {});
+  cb->updateBuffer<WorkQueueHeader>(resources.buffer(queue), 0,
+                                    WorkQueueHeader{});
+  cb.barrier({},
+             {vk::MemoryBarrier2{vk::PipelineStageFlagBits2::eTransfer,
+                                 vk::AccessFlagBits2::eTransferWrite,
+                                 vk::PipelineStageFlagBits2::eComputeShader,
+                                 queue_access}},
+             {}, {});
+
+  pc.queue = resources.deviceAddress(queue);
+  std::uint32_t const groups = std::max(config.groups, 1U);
+
+  cb->pushConstants<PushConstants>(
+      *m_pipeline_layout, vk::ShaderStageFlagBits::eCompute, 0, pc);
+  cb->dispatch(groups, 1, 1);
+
+  // the deferred orbits
+  cb.barrier({},
+             {vk::MemoryBarrier2{vk::PipelineStageFlagBits2::eComputeShader,
+                                 queue_access,
+                                 vk::PipelineStageFlagBits2::eComputeShader,
+                                 queue_access}},
+             {}, {});
+
+  pc.flags |= flag_slow_pass;
+  cb->pushConstants<PushConstants>(
+      *m_pipeline_layout, vk::ShaderStageFlagBits::eCompute, 0, pc);
+  cb->dispatch(groups, 1, 1);
+}
+
+void MandelbrotRenderer::record_direct(CommandBuffer &cb,
+                                       BindlessResource target,
+                                       std::uint32_t flags) {
+  int variant{};
+  vk::Pipeline const pipeline = select_pipeline(variant);
+
+  auto label = cb.debugLabelScope("mandelbrot", {0.0F, 1.0F, 0.0F, 1.0F});
+  cb->bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+
+  m_ctx->bindlessManager().bind(cb, *m_pipeline_layout,
+                                vk::PipelineBindPoint::eCompute);
+
+  m_push_constants.offset = {0, 0};
+  m_push_constants.extent = glm::uvec2(m_extent.width, m_extent.height);
+  m_push_constants.image_idx = target;
+  m_push_constants.flags = flags;
+  m_push_constants.max_iter = current_max_iter();
+
+  dispatch_fractal(cb, variant, m_push_constants);
+}
+
+bool MandelbrotRenderer::plan_tiles() {
+  ZoneScopedN("plan tiles");
+
+  const auto &pc = m_push_constants;
+  if (!(pc.scale.x > 0. && pc.scale.y > 0.)) {
+    return false;
+  }
+
+  // the level whose texels are closest to the screen pixels
+  auto const level = static_cast<std::int64_t>(
+      std::round(std::log2(default_scale / pc.scale.x)));
+  double const level_scale =
+      std::ldexp(default_scale, -static_cast<int>(level));
+  double const tile_world = level_scale * tile_size;
+  std::uint64_t const cost =
+      std::uint64_t{tile_size} * tile_size * max_iter_for(level_scale);
+
+  if (m_tiles_adaptive != m_adaptive_iter) {
+    m_tile_cache.clear();
+    m_tiles_adaptive = m_adaptive_iter;
+  }
+
+  // the same mapping as Mandelbrot.comp
+  glm::dvec2 const extent(m_extent.width, m_extent.height);
+  glm::dvec2 const half(m_extent.width / 2, m_extent.height / 2);
+  glm::dvec2 const first =
+      glm::floor((pc.center - half * pc.scale) / tile_world);
+  glm::dvec2 const last =
+      glm::floor((pc.center + (extent - half) * pc.scale) / tile_world);
+  glm::dvec2 const grid = last - first + 1.;
+
+  // tile coordinates have to stay exact in doubles
+  static constexpr double max_tile_coord = 0x1p52;
+  if (grid.x * grid.y > max_visible_tiles ||
+      glm::any(glm::greaterThan(glm::abs(first), glm::dvec2{max_tile_coord}))) {
+    return false;
+  }
+
+  auto const cols = static_cast<std::uint32_t>(grid.x);
+  auto const rows = static_cast<std::uint32_t>(grid.y);
+  auto const x0 = static_cast<std::int64_t>(first.x);
+  auto const y0 = static_cast<std::int64_t>(first.y);
+  auto key_of = [&](std::uint32_t idx) {
+    return TileKey{level, x0 + (idx % cols), y0 + (idx / cols)};
+  };
+
+  m_tile_cache.next_frame();
+  m_jobs.clear();
+  m_table.assign(std::size_t{cols} * rows, TileEntry{});
+
+  // lookups first so that the allocations do not evict the stand-ins
+  std::vector<std::uint32_t> missing;
+  for (std::uint32_t idx = 0; idx < m_table.size(); idx++) {
+    auto const key = key_of(idx);
+    auto &entry = m_table[idx];
+    if (auto slot = m_tile_cache.find(key)) {
+      entry = {slot_texel(*slot), 0, 1};
+      continue;
+    }
+
+    missing.push_back(idx);
+
+    // a part of a coarser tile stands in until this one is computed
+    for (std::int64_t k = 1; k <= max_fallback_levels; k++) {
+      auto const parent = key.ancestor(k);
+      if (auto slot = m_tile_cache.find(parent)) {
+        auto const scale = std::int64_t{1} << k;
+        glm::i64vec2 const sub{key.x - (parent.x * scale),
+                               key.y - (parent.y * scale)};
+        entry = {
+            slot_texel(*slot) +
+                glm::ivec2((sub * std::int64_t{tile_size}) >> k),
+            static_cast<std::uint32_t>(k),
+            1,
+        };
+        break;
+      }
+    }
+  }
+
+  // the tiles closest to the center of the view are computed first
+  glm::dvec2 const center_tile = (pc.center / tile_world) - first;
+  std::ranges::sort(missing, {}, [&](std::uint32_t idx) {
+    glm::dvec2 const tile{idx % cols + .5, idx / cols + .5};
+    auto const d = tile - center_tile;
+    return glm::dot(d, d);
+  });
+
+  std::uint64_t spent = 0;
+  for (auto idx : missing) {
+    // at least one tile per frame so that the view always converges
+    if (spent != 0 && spent + cost > m_iteration_budget) {
+      break;
+    }
+
+    auto const key = key_of(idx);
+    auto slot = m_tile_cache.allocate(key);
+    if (!slot) {
+      break;
+    }
+
+    spent += cost;
+    m_jobs.push_back({key, *slot});
+    m_table[idx] = {slot_texel(*slot), 0, 1};
+  }
+
+  m_composite_constants = {
+      .center = pc.center,
+      .scale = pc.scale,
+      .grid_origin = first * tile_world,
+      .level_scale = level_scale,
+      .table = {},
+      .grid_size = {cols, rows},
+      .tile_size = tile_size,
+      .atlas_idx = {},
+      .image_idx = {},
+  };
+
+  m_tile_stats.cache = m_tile_cache.stats();
+  m_tile_stats.level = level;
+  m_tile_stats.visible = static_cast<std::uint32_t>(m_table.size());
+  m_tile_stats.computed = static_cast<std::uint32_t>(m_jobs.size());
+  m_tile_stats.fallback = static_cast<std::uint32_t>(
+      std::ranges::count_if(m_table, [](const TileEntry &e) {
+        return e.valid != 0 && e.shift != 0;
+      }));
+  m_tile_stats.missing = static_cast<std::uint32_t>(std::ranges::count_if(
+      m_table, [](const TileEntry &e) { return e.valid == 0; }));
+  return true;
+}
+
+void MandelbrotRenderer::record_tiled(CommandBuffer &cb) {
+  const auto &table = m_tile_tables[m_ctx->frame_ref()];
+  {
+    auto ai = table->allocator().getAllocationInfo(table->allocation());
+    std::ranges::copy(m_table, static_cast<TileEntry *>(ai.pMappedData));
+    table->flush(0, m_table.size() * sizeof(TileEntry));
+  }
+
+  auto &resources = m_ctx->resources();
+  ImageViewHandle const atlas_view = atlas();
+  vk::Image const atlas = resources.image(resources.image(atlas_view));
+  auto const atlas_storage = resources.storageHandle(atlas_view);
+
+  if (!m_jobs.empty() || !m_atlas_initialized) {
+    // after the previous composite read the tiles
+    cb.barrier({}, {}, {},
+               {whole_image_barrier(
+                   vk::PipelineStageFlagBits2::eComputeShader,
+                   vk::AccessFlagBits2::eNone,
+                   vk::PipelineStageFlagBits2::eComputeShader,
+                   vk::AccessFlagBits2::eShaderStorageWrite,
+                   m_atlas_initialized ? vk::ImageLayout::eGeneral
+                                       : vk::ImageLayout::eUndefined,
+                   vk::ImageLayout::eGeneral, atlas)});
+    m_atlas_initialized = true;
+  }
+
+  if (!m_jobs.empty()) {
+    int variant{};
+    vk::Pipeline const pipeline = select_pipeline(variant);
+
+    auto label =
+        cb.debugLabelScope("mandelbrot tiles", {0.0F, 1.0F, 0.0F, 1.0F});
+    cb->bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+
+    m_ctx->bindlessManager().bind(cb, *m_pipeline_layout,
+                                  vk::PipelineBindPoint::eCompute);
+
+    double const level_scale = m_composite_constants.level_scale;
+    std::uint32_t const level_iter = max_iter_for(level_scale);
+    for (const auto &job : m_jobs) {
+      glm::dvec2 const origin =
+          glm::dvec2(job.key.x, job.key.y) * (level_scale * tile_size);
+      dispatch_fractal(
+          cb, variant,
+          PushConstants{
+              .center = origin + (tile_size / 2) * level_scale,
+              .scale = glm::dvec2{level_scale},
+              .offset = slot_texel(job.slot),
+              .extent = glm::uvec2{tile_size},
+              .image_idx = atlas_storage,
+              .flags = flags(),
+              .max_iter = level_iter,
+          });
+    }
+
+    cb.barrier({}, {}, {},
+               {whole_image_barrier(vk::PipelineStageFlagBits2::eComputeShader,
+                                    vk::AccessFlagBits2::eShaderStorageWrite,
+                                    vk::PipelineStageFlagBits2::eComputeShader,
+                                    vk::AccessFlagBits2::eShaderStorageRead,
+                                    vk::ImageLayout::eGeneral,
+                                    vk::ImageLayout::eGeneral, atlas)});
+  }
+
+  {
+    auto label =
+        cb.debugLabelScope("mandelbrot composite", {0.0F, 0.5F, 1.0F, 1.0F});
+    cb->bindPipeline(vk::PipelineBindPoint::eCompute, m_composite->try_get());
+
+    m_ctx->bindlessManager().bind(cb, *m_composite_layout,
+                                  vk::PipelineBindPoint::eCompute);
+
+    m_composite_constants.table = table->deviceAddress();
+    m_composite_constants.atlas_idx = atlas_storage;
+    m_composite_constants.image_idx = m_texture->storageHandle();
+
+    cb->pushConstants<CompositeConstants>(*m_composite_layout,
+                                          vk::ShaderStageFlagBits::eCompute, 0,
+                                          m_composite_constants);
+
+    static constexpr auto workgroup_size = 8;
+    cb->dispatch(DivCeil(m_extent.width, workgroup_size),
+                 DivCeil(m_extent.height, workgroup_size), 1);
+  }
+}
+
+void MandelbrotRenderer::update_reference() {
+  ZoneScoped;
+
+  if (m_pending_reference.valid() &&
+      m_pending_reference.wait_for(std::chrono::seconds{0}) ==
+          std::future_status::ready) {
+    auto orbit = m_pending_reference.get();
+
+    auto &resources = m_ctx->resources();
+    UniqueBuffer buffer{
+        resources,
+        resources.create_buffer(
+            orbit.z.size() * sizeof(glm::dvec2),
+            vk::BufferUsageFlagBits2KHR::eStorageBuffer |
+                vk::BufferUsageFlagBits2KHR::eShaderDeviceAddress,
+            m_ctx->device().memoryPools().allocation_info(
+                MemoryClass::SmallBuffer)),
+    };
+    resources.setName(*buffer, "mandelbrot reference orbit");
+
+    std::ranges::copy(orbit.z,
+                      static_cast<glm::dvec2 *>(resources.mapped(*buffer)));
+    resources.flush(*buffer);
+
+    // the registry keeps the old one for the frames in flight
+    m_orbit_buffer = std::move(buffer);
+
+    m_deep_stats.references++;
+    // the escape values were computed with the previous reference
+    m_escape_view.reset();
+    m_deep_stats.orbit_length = static_cast<std::uint32_t>(orbit.z.size());
+    m_deep_stats.precision_bits = orbit.precision_bits;
+    m_reference = std::move(orbit);
+  }
+
+  m_deep_stats.computing = m_pending_reference.valid();
+  if (m_deep_stats.computing) {
+    return;
+  }
+
+  const auto &pc = m_push_constants;
+  double const radius = view_radius(m_extent, pc.scale);
+
+  bool needed = !m_reference;
+  if (m_reference) {
+    const auto &ref = *m_reference;
+    glm::dvec2 const delta{(m_center_x - ref.cx).to_double(),
+                           (m_center_y - ref.cy).to_double()};
+    needed = glm::length(delta) + radius > ref.radius ||
+             pc.scale.x < ref.scale / rereference_zoom ||
+             ref.max_iter != m_deep_max_iter;
+  }
+
+  if (!needed) {
+    return;
+  }
+
+  m_pending_reference = m_ctx->executor().async(
+      [cx = m_center_x, cy = m_center_y, scale = pc.scale.x,
+       radius = radius * reference_slack, max_iter = m_deep_max_iter,
+       bits = precision_bits()] {
+        return compute_reference_orbit(cx, cy, scale, radius, max_iter, bits);
+      });
+  m_deep_stats.computing = true;
+}
+
+bool MandelbrotRenderer::record_deep(CommandBuffer &cb, BindlessResource target,
+                                     std::uint32_t flags) {
+  vk::Pipeline const pipeline = m_deep->try_get();
+  if (!m_reference || !m_orbit_buffer || !pipeline) {
+    return false;
+  }
+
+  const auto &ref = *m_reference;
+  const auto &pc = m_push_constants;
+
+  glm::dvec2 const delta{(m_center_x - ref.cx).to_double(),
+                         (m_center_y - ref.cy).to_double()};
+  // the series approximation only holds within the radius it was made for
+  bool const series =
+      glm::length(delta) + view_radius(m_extent, pc.scale) <= ref.radius;
+
+  DeepConstants const constants{
+      .delta_center = delta,
+      .scale = pc.scale,
+      .sa_a = series ? ref.a : glm::dvec2{},
+      .sa_b = series ? ref.b : glm::dvec2{},
+      .sa_c = series ? ref.c : glm::dvec2{},
+      .orbit = m_ctx->resources().deviceAddress(*m_orbit_buffer),
+      .offset = {0, 0},
+      .extent = glm::uvec2(m_extent.width, m_extent.height),
+      .orbit_length = static_cast<std::uint32_t>(ref.z.size()),
+      .skip = series ? ref.skip : 0,
+      .max_iter = ref.max_iter,
+      .image_idx = target,
+      .flags = flags,
+  };
+  m_deep_stats.skip = constants.skip;
+
+  auto label =
+      cb.debugLabelScope("mandelbrot perturbation", {1.0F, 0.5F, 0.0F, 1.0F});
+  cb->bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+
+  m_ctx->bindlessManager().bind(cb, *m_deep_layout,
+                                vk::PipelineBindPoint::eCompute);
+
+  cb->pushConstants<DeepConstants>(*m_deep_layout,
+                                   vk::ShaderStageFlagBits::eCompute, 0,
+                                   constants);
+
+  static constexpr auto workgroup_size = 8;
+  cb->dispatch(DivCeil(m_extent.width, workgroup_size),
+               DivCeil(m_extent.height, workgroup_size), 1);
+  return true;
+}
+
+bool MandelbrotRenderer::record_smooth(CommandBuffer &cb, bool deep) {
+  vk::Pipeline const count = m_histogram[0]->try_get();
+  vk::Pipeline const scan = m_histogram[1]->try_get();
+  vk::Pipeline const color = m_color->try_get();
+  if (!count || !scan || !color) {
+    return false;
+  }
+
+  const auto &pc = m_push_constants;
+  RefineView const view{
+      .center = pc.center,
+      .scale = pc.scale,
+      .max_iter = deep ? m_deep_max_iter : current_max_iter(),
+      .flags = flags() | flag_escape_values,
+  };
+
+  auto &resources = m_ctx->resources();
+  ImageViewHandle const values_view = escape_values();
+  BindlessResource const values = resources.storageHandle(values_view);
+  vk::DeviceAddress const histogram = m_histogram_buffer->deviceAddress();
+  glm::uvec2 const extent(m_extent.width, m_extent.height);
+  static constexpr auto workgroup_size = 8;
+
+  if (view != m_escape_view) {
+    // the previous values are read by the passes of the previous frame
+    cb.barrier(
+        {},
+        {vk::MemoryBarrier2{vk::PipelineStageFlagBits2::eComputeShader,
+                            vk::AccessFlagBits2::eShaderStorageRead,
+                            vk::PipelineStageFlagBits2::eClear,
+                            vk::AccessFlagBits2::eTransferWrite}},
+        {},
+        {whole_image_barrier(vk::PipelineStageFlagBits2::eComputeShader,
+                             vk::AccessFlagBits2::eNone,
+                             vk::PipelineStageFlagBits2::eComputeShader,
+                             vk::AccessFlagBits2::eShaderStorageWrite,
+                             vk::ImageLayout::eUndefined,
+                             vk::ImageLayout::eGeneral,
+                             resources.image(resources.image(values_view)))});
+
+    bool const deep_done = deep && record_deep(cb, values, view.flags);
+    if (!deep_done) {
+      record_direct(cb, values, view.flags);
+    }
+    m_escape_max_iter =
+        deep_done ? m_reference->max_iter : m_push_constants.max_iter;
+    // a deep view without its reference orbit is computed again
+    m_escape_view = deep == deep_done ? std::optional{view} : std::nullopt;
+
+    auto label =
+        cb.debugLabelScope("mandelbrot histogram", {1.0F, 1.0F, 0.0F, 1.0F});
+
+    cb->fillBuffer(m_histogram_buffer->vk(), 0, vk::WholeSize, 0);
+    cb.barrier(
+        {},
+        {vk::MemoryBarrier2{vk::PipelineStageFlagBits2::eComputeShader |
+                                vk::PipelineStageFlagBits2::eClear,
+                            vk::AccessFlagBits2::eShaderStorageWrite |
+                                vk::AccessFlagBits2::eTransferWrite,
+                            vk::PipelineStageFlagBits2::eComputeShader,
+                            vk::AccessFlagBits2::eShaderStorageRead |
+                                vk::AccessFlagBits2::eShaderStorageWrite}},
+        {}, {});
+
+    HistogramConstants const constants{
+        .histogram = histogram,
+        .extent = extent,
+        .max_iter = m_escape_max_iter,
+        .values_idx = values,
+    };
+
+    m_ctx->bindlessManager().bind(cb, *m_histogram_layout,
+                                  vk::PipelineBindPoint::eCompute);
+    cb->pushConstants<HistogramConstants>(*m_histogram_layout,
+                                          vk::ShaderStageFlagBits::eCompute,
+                                          0, constants);
+
+    static constexpr auto histogram_group = 16;
+    cb->bindPipeline(vk::PipelineBindPoint::eCompute, count);
+    cb->dispatch(DivCeil(m_extent.width, histogram_group),
+                 DivCeil(m_extent.height, histogram_group), 1);
+
+    cb.barrier({},
+               {vk::MemoryBarrier2{
+                   vk::PipelineStageFlagBits2::eComputeShader,
+                   vk::AccessFlagBits2::eShaderStorageWrite,
+                   vk::PipelineStageFlagBits2::eComputeShader,
+                   vk::AccessFlagBits2::eShaderStorageRead |
+                       vk::AccessFlagBits2::eShaderStorageWrite}},
+               {}, {});
+
+    cb->bindPipeline(vk::PipelineBindPoint::eCompute, scan);
+    cb->dispatch(1, 1, 1);
+
+    cb.barrier({},
+               {vk::MemoryBarrier2{vk::PipelineStageFlagBits2::eComputeShader,
+                                   vk::AccessFlagBits2::eShaderStorageWrite,
+                                   vk::PipelineStageFlagBits2::eComputeShader,
+                                   vk::AccessFlagBits2::eShaderStorageRead}},
+               {}, {});
+  }
+
+  // palette changes only repeat this pass
+  auto label =
+      cb.debugLabelScope("mandelbrot palette", {1.0F, 0.5F, 0.5F, 1.0F});
+  cb->bindPipeline(vk::PipelineBindPoint::eCompute, color);
+  m_ctx->bindlessManager().bind(cb, *m_color_layout,
+                                vk::PipelineBindPoint::eCompute);
+
+  cb->pushConstants<ColorConstants>(
+      *m_color_layout, vk::ShaderStageFlagBits::eCompute, 0,
+      ColorConstants{
+          .histogram = histogram,
+          .extent = extent,
+          .max_iter = m_escape_max_iter,
+          .values_idx = values,
+          .image_idx = m_texture->storageHandle(),
+          .equalize = m_palette.equalize ? 1U : 0U,
+          .hue_offset = m_palette.hue_offset,
+          .hue_cycles = m_palette.hue_cycles,
+      });
+
+  cb->dispatch(DivCeil(m_extent.width, workgroup_size),
+               DivCeil(m_extent.height, workgroup_size), 1);
+  return true;
+}
+
+bool MandelbrotRenderer::record_subdivided(CommandBuffer &cb) {
+  vk::Pipeline const pipeline = m_subdivide->try_get();
+  if (!pipeline) {
+    return false;
+  }
+
+  auto label =
+      cb.debugLabelScope("mandelbrot subdivision", {0.5F, 1.0F, 0.0F, 1.0F});
+
+  auto &resources = m_ctx->resources();
+  vk::Buffer const buffer = resources.buffer(subdivision_buffer());
+  vk::DeviceAddress const address =
+      resources.deviceAddress(subdivision_buffer());
+
+  static constexpr auto list_access =
+      vk::AccessFlagBits2::eShaderStorageRead |
+      vk::AccessFlagBits2::eShaderStorageWrite |
+      vk::AccessFlagBits2::eIndirectCommandRead;
+  static constexpr auto list_stages =
+      vk::PipelineStageFlagBits2::eComputeShader |
+      vk::PipelineStageFlagBits2::eDrawIndirect;
+
+  // empty lists (after the previous frame is done with them)
+  cb.barrier({},
+             {vk::MemoryBarrier2{list_stages, list_access,
+                                 vk::PipelineStageFlagBits2::eTransfer,
+                                 vk::AccessFlagBits2::eTransferWrite}},
+             {}, {});
+  static constexpr RectListHeader empty{.groups_x = 0,
+                                        .groups_y = 1,
+                                        .groups_z = 1,
+                                        .pad = 0};
+  for (std::uint32_t level = 1; level < subdivision_levels; level++) {
+    cb->updateBuffer<RectListHeader>(buffer, m_subdivision_layout[level],
+                                     empty);
+  }
+  cb.barrier({},
+             {vk::MemoryBarrier2{vk::PipelineStageFlagBits2::eTransfer,
+                                 vk::AccessFlagBits2::eTransferWrite,
+                                 list_stages, list_access}},
+             {}, {});
+
+  cb->bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+  m_ctx->bindlessManager().bind(cb, *m_subdivide_layout,
+                                vk::PipelineBindPoint::eCompute);
+
+  const auto &pc = m_push_constants;
+  for (std::uint32_t level = 0; level < subdivision_levels; level++) {
+    bool const last = level + 1 == subdivision_levels;
+    std::uint32_t const rect_size = subdivision_rect >> level;
+
+    SubdivideConstants const constants{
+        .center = pc.center,
+        .scale = pc.scale,
+        .counts = address,
+        .in_list = level == 0 ? 0 : address + m_subdivision_layout[level],
+        .out_list = last ? 0 : address + m_subdivision_layout[level + 1],
+        .extent = glm::uvec2(m_extent.width, m_extent.height),
+        .rect_size = rect_size,
+        .level = level,
+        .levels = subdivision_levels,
+        .flags = flags(),
+        .image_idx = m_texture->storageHandle(),
+        .max_iter = current_max_iter(),
+    };
+    cb->pushConstants<SubdivideConstants>(*m_subdivide_layout,
+                                          vk::ShaderStageFlagBits::eCompute, 0,
+                                          constants);
+
+    if (level == 0) {
+      cb->dispatch(DivCeil(m_extent.width, rect_size),
+                   DivCeil(m_extent.height, rect_size), 1);
+    } else {
+      cb->dispatchIndirect(buffer, m_subdivision_layout[level]);
+    }
+
+    // the next pass reads the border counts and its rectangles
+    if (!last) {
+      cb.barrier({},
+                 {vk::MemoryBarrier2{
+                     vk::PipelineStageFlagBits2::eComputeShader,
+                     vk::AccessFlagBits2::eShaderStorageWrite, list_stages,
+                     list_access}},
+                 {}, {});
+    }
+  }
+  return true;
+}
+
+bool MandelbrotRenderer::record_progressive(CommandBuffer &cb) {
+  vk::Pipeline const preview = m_pipelines[0]->try_get();
+  vk::Pipeline const refine = m_refine->try_get();
+  if (!preview || !refine) {
+    return false;
+  }
+
+  const auto &pc = m_push_constants;
+  RefineView const view{
+      .center = pc.center,
+      .scale = pc.scale,
+      .max_iter = current_max_iter(),
+      .flags = flags(),
+  };
+
+  if (view != m_refine_view) {
+    // interaction: cheap preview, the refinement starts once the view stops
+    m_refine_view = view;
+    m_refined = 0;
+
+    auto label =
+        cb.debugLabelScope("mandelbrot preview", {0.0F, 1.0F, 0.0F, 1.0F});
+    cb->bindPipeline(vk::PipelineBindPoint::eCompute, preview);
+
+    m_ctx->bindlessManager().bind(cb, *m_pipeline_layout,
+                                  vk::PipelineBindPoint::eCompute);
+
+    dispatch_fractal(
+        cb, 0,
+        PushConstants{
+            .center = pc.center,
+            .scale = pc.scale,
+            .offset = {0, 0},
+            .extent = glm::uvec2(m_extent.width, m_extent.height),
+            .image_idx = m_texture->storageHandle(),
+            .flags = view.flags | flag_preview,
+            .max_iter = view.max_iter,
+        });
+    return true;
+  }
+
+  // every pixel is final - the texture already has the image
+  if (m_refined >= view.max_iter) {
+    return true;
+  }
+
+  auto label =
+      cb.debugLabelScope("mandelbrot refine", {0.0F, 1.0F, 0.5F, 1.0F});
+
+  // the states of the previous frame
+  cb.barrier({},
+             {vk::MemoryBarrier2{vk::PipelineStageFlagBits2::eComputeShader,
+                                 vk::AccessFlagBits2::eShaderStorageWrite,
+                                 vk::PipelineStageFlagBits2::eComputeShader,
+                                 vk::AccessFlagBits2::eShaderStorageRead |
+                                     vk::AccessFlagBits2::eShaderStorageWrite}},
+             {}, {});
+
+  cb->bindPipeline(vk::PipelineBindPoint::eCompute, refine);
+  m_ctx->bindlessManager().bind(cb, *m_refine_layout,
+                                vk::PipelineBindPoint::eCompute);
+
+  std::uint32_t const steps = std::max(m_refine_step, 1U);
+  cb->pushConstants<RefineConstants>(
+      *m_refine_layout, vk::ShaderStageFlagBits::eCompute, 0,
+      RefineConstants{
+          .center = view.center,
+          .scale = view.scale,
+          .states = m_ctx->resources().deviceAddress(refine_states()),
+          .extent = glm::uvec2(m_extent.width, m_extent.height),
+          .max_iter = view.max_iter,
+          .steps = steps,
+          .reset = m_refined == 0 ? 1U : 0U,
+          .flags = view.flags,
+          .image_idx = m_texture->storageHandle(),
+      });
+
+  static constexpr auto workgroup_size = 8;
+  cb->dispatch(DivCeil(m_extent.width, workgroup_size),
+               DivCeil(m_extent.height, workgroup_size), 1);
+
+  m_refined = std::min(m_refined + steps, view.max_iter);
+  return true;
+}
+
+bool MandelbrotRenderer::upscale(CommandBuffer &cb, vk::Extent2D extent) {
+  vk::Pipeline const pipeline = m_upscale->try_get();
+  if (!pipeline) {
+    return false;
+  }
+
+  auto &resources = m_ctx->resources();
+  auto const current = m_upscaled.image ? resources.extent(*m_upscaled.image)
+                                        : vk::Extent3D{};
+  if (current.width != extent.width || current.height != extent.height) {
+    // the registry keeps the old one for the frames in flight
+    m_upscaled = make_transient(extent, texture_format, texture_usage,
+                                "mandelbrot upscaled");
+  }
+  vk::Image const target = resources.image(*m_upscaled.image);
+
+  auto label =
+      cb.debugLabelScope("mandelbrot upscale", {0.0F, 0.5F, 1.0F, 1.0F});
+
+  cb.barrier(
+      {}, {}, {},
+      {whole_image_barrier(vk::PipelineStageFlagBits2::eTransfer,
+                           vk::AccessFlagBits2::eNone,
+                           vk::PipelineStageFlagBits2::eComputeShader,
+                           vk::AccessFlagBits2::eShaderStorageRead,
+                           vk::ImageLayout::eTransferSrcOptimal,
+                           vk::ImageLayout::eGeneral, m_texture->vkImage()),
+       whole_image_barrier(vk::PipelineStageFlagBits2::eBlit,
+                           vk::AccessFlagBits2::eNone,
+                           vk::PipelineStageFlagBits2::eComputeShader,
+                           vk::AccessFlagBits2::eShaderStorageWrite,
+                           vk::ImageLayout::eUndefined,
+                           vk::ImageLayout::eGeneral, target)});
+
+  cb->bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+  m_ctx->bindlessManager().bind(cb, *m_upscale_layout,
+                                vk::PipelineBindPoint::eCompute);
+
+  cb->pushConstants<UpscaleConstants>(
+      *m_upscale_layout, vk::ShaderStageFlagBits::eCompute, 0,
+      UpscaleConstants{
+          .src_extent = glm::uvec2(m_extent.width, m_extent.height),
+          .dst_extent = glm::uvec2(extent.width, extent.height),
+          .src_idx = m_texture->storageHandle(),
+          .dst_idx = resources.storageHandle(*m_upscaled.view),
+      });
+
+  static constexpr auto workgroup_size = 8;
+  cb->dispatch(DivCeil(extent.width, workgroup_size),
+               DivCeil(extent.height, workgroup_size), 1);
+
+  cb.barrier(
+      {}, {}, {},
+      {whole_image_barrier(vk::PipelineStageFlagBits2::eComputeShader,
+                           vk::AccessFlagBits2::eShaderStorageRead,
+                           vk::PipelineStageFlagBits2::eBlit,
+                           vk::AccessFlagBits2::eNone,
+                           vk::ImageLayout::eGeneral,
+                           vk::ImageLayout::eTransferSrcOptimal,
+                           m_texture->vkImage()),
+       whole_image_barrier(vk::PipelineStageFlagBits2::eComputeShader,
+                           vk::AccessFlagBits2::eShaderStorageWrite,
+                           vk::PipelineStageFlagBits2::eBlit,
+                           vk::AccessFlagBits2::eTransferRead,
+                           vk::ImageLayout::eGeneral,
+                           vk::ImageLayout::eTransferSrcOptimal, target)});
+  return true;
+}
+
+void MandelbrotRenderer::blit(CommandBuffer &cb, vk::Image target,
+                              vk::Extent2D extent) {
+  ZoneScopedN("blit");
+
+  // a 1:1 copy of the upscaled image or a linear blit of the texture
+  bool const upscaled = m_edge_aware_upscale && extent != m_extent &&
+                        upscale(cb, extent);
+  const auto &resources = m_ctx->resources();
+  vk::Image const source = upscaled ? resources.image(*m_upscaled.image)
+                                    : m_texture->vkImage();
+  auto const source_extent = upscaled ? resources.extent(*m_upscaled.image)
+                                      : m_texture->image()->extent();
+
+  cb->blitImage(source, vk::ImageLayout::eTransferSrcOptimal,
+                target, vk::ImageLayout::eTransferDstOptimal,
+                vk::ImageBlit{
+                    {vk::ImageAspectFlagBits::eColor, 0, 0, 1},
+                    {
+                        vk::Offset3D{0, 0, 0},
+                        vk::Offset3D{int32_t(source_extent.width),
+                                     int32_t(source_extent.height), 1},
+                    },
+                    {vk::ImageAspectFlagBits::eColor, 0, 0, 1},
+                    {
+                        vk::Offset3D{0, 0, 0},
+                        vk::Offset3D{int32_t(extent.width),
+                                     int32_t(extent.height), 1},
+                    },
+                },
+                upscaled ? vk::Filter::eNearest : vk::Filter::eLinear);
+}
+
+void MandelbrotRenderer::record_iterations(CommandBuffer &cb, int variant,
+                                           BufferHandle out) {
+  ZoneScopedN("record iterations");
+
+  auto &resources = m_ctx->resources();
+  auto counts = make_transient(m_extent, vk::Format::eR32Sfloat,
+                               vk::ImageUsageFlagBits::eStorage |
+                                   vk::ImageUsageFlagBits::eTransferSrc,
+                               "mandelbrot iteration counts");
+  vk::Image const image = resources.image(*counts.image);
+
+  auto label =
+      cb.debugLabelScope("mandelbrot iterations", {0.0F, 1.0F, 0.0F, 1.0F});
+
+  cb.barrier({}, {}, {},
+             {whole_image_barrier(vk::PipelineStageFlagBits2::eNone,
+                                  vk::AccessFlagBits2::eNone,
+                                  vk::PipelineStageFlagBits2::eComputeShader,
+                                  vk::AccessFlagBits2::eShaderStorageWrite,
+                                  vk::ImageLayout::eUndefined,
+                                  vk::ImageLayout::eGeneral, image)});
+
+  cb->bindPipeline(vk::PipelineBindPoint::eCompute,
+                   *m_pipelines[variant]->wait());
+  m_ctx->bindlessManager().bind(cb, *m_pipeline_layout,
+                                vk::PipelineBindPoint::eCompute);
+
+  PushConstants pc = m_push_constants;
+  pc.offset = {0, 0};
+  pc.extent = glm::uvec2(m_extent.width, m_extent.height);
+  pc.image_idx = resources.storageHandle(*counts.view);
+  pc.flags = flag_iteration_counts;
+  pc.max_iter = current_max_iter();
+  dispatch_fractal(cb, variant, pc);
+
+  cb.barrier({}, {}, {},
+             {whole_image_barrier(vk::PipelineStageFlagBits2::eComputeShader,
+                                  vk::AccessFlagBits2::eShaderStorageWrite,
+                                  vk::PipelineStageFlagBits2::eCopy,
+                                  vk::AccessFlagBits2::eTransferRead,
+                                  vk::ImageLayout::eGeneral,
+                                  vk::ImageLayout::eTransferSrcOptimal,
+                                  image)});
+  cb->copyImageToBuffer(image, vk::ImageLayout::eTransferSrcOptimal,
+                        resources.buffer(out),
+                        vk::BufferImageCopy{
+                            0,
+                            0,
+                            0,
+                            {vk::ImageAspectFlagBits::eColor, 0, 0, 1},
+                            {},
+                            {m_extent.width, m_extent.height, 1},
+                        });
+
+  cb.add_resource(std::move(counts.view));
+  cb.add_resource(std::move(counts.image));
+}
@@ -0,0 +1,555 @@
+#pragma once
+
+#include "DeepZoom.hpp"
+#include "MandelbrotAutotune.hpp"
+#include "MandelbrotTileCache.hpp"
+
+#include <BindlessManager.hpp>
+#include <CommandBuffer.hpp>
+#include <Config.hpp>
+#include <Context.hpp>
+#include <MemoryPools.hpp>
+#include <ResourceRegistry.hpp>
+#include <VulkanCaches.hpp>
+#include <VulkanConstructs.hpp>
+#include <VulkanResources.hpp>
+#include <cppHelpers.hpp>
+#include <v4dgCore.hpp>
+
+#include <glm/glm.hpp>
+#include <vulkan/vulkan.hpp>
+#include <vulkan/vulkan_raii.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <optional>
+#include <vector>
+
+namespace v4dg {
+// renders the mandelbrot set into an internal storage texture
+//   shared by the windowed and headless front-ends
+//
+// The fractal is cached as a world-space tile pyramid: level L has texels of
+//   default_scale * 2^-L world units and the view uses the level closest to
+//   its scale. Visible tiles missing from the atlas are computed under a
+//   per-frame iteration budget (coarser cached tiles stand in meanwhile) and
+//   the texture is composited from the atlas.
+//
+// Below perturbation_scale doubles cannot tell the pixels apart: the view
+//   center is kept in arbitrary precision, a reference orbit is computed on a
+//   worker thread and the pixels iterate their double difference to it
+//   (MandelbrotDeep.comp).
+//
+// Mariani-Silver subdivision (MandelbrotSubdivide.comp) renders the whole
+//   view in subdivision_levels passes instead: rectangles with a border of a
+//   single iteration count are filled without iterating their interior and
+//   the others are split for the next pass (indirect dispatches).
+//
+// Progressive mode renders a 2x2 preview while the view changes and then
+//   refines the full resolution image over the next frames: every pixel
+//   resumes its iteration for refine_step() iterations per frame
+//   (MandelbrotRefine.comp).
+//
+// Smooth coloring splits the pass: the direct and perturbation kernels write
+//   continuous escape values to an R32F image, a histogram of them is built
+//   (MandelbrotHistogram.comp) and the palette is applied on it
+//   (MandelbrotColor.comp). Palette changes only repeat the last pass.
+//
+// The render resolution is set with resize() (e.g. by DynamicResolution) and
+//   blit() upscales the texture to the output, by default with a clamped
+//   Catmull-Rom compute pass (MandelbrotUpscale.comp).
+//
+// The workgroup shape and subgroup size of every Mandelbrot.comp variant are
+//   measured on the device on the first start (timestamp queries over a
+//   fixed view) and the fastest ones are kept in the cache dir. The
+//   persistent variant runs a fixed number of workgroups that take pixels
+//   from a queue and defer the slow ones to a second pass.
+class MandelbrotRenderer {
+public:
+  // render resolution until the first resize()
+  static constexpr vk::Extent2D default_extent{1024, 720};
+  static constexpr vk::Extent2D min_extent{8, 8};
+  // the common maxImageDimension2D (offline renders use the output size)
+  static constexpr vk::Extent2D max_extent{16384, 16384};
+  // GPU profiler zone of the whole record() (the dynamic resolution input)
+  static constexpr const char *gpu_zone = "mandelbrot frame";
+  static constexpr auto default_scale = 1. / 128;
+  static constexpr int variant_count = 4;
+  // persistent threads with a work queue (two dispatches)
+  static constexpr int variant_persistent = 3;
+  // iteration count of non-adaptive views
+  static constexpr std::uint32_t max_iter = 512;
+  // adaptive views iterate more the deeper they are:
+  //   base + per_octave * log2(default_scale / scale)
+  static constexpr std::uint32_t adaptive_iter_base = 256;
+  static constexpr std::uint32_t adaptive_iter_per_octave = 64;
+  static constexpr std::uint32_t max_adaptive_iter = 1 << 14;
+  static constexpr std::uint32_t default_refine_step = 64;
+
+  static constexpr std::uint32_t tile_size = 128;
+  // the atlas has atlas_tiles.width x atlas_tiles.height tile slots
+  static constexpr vk::Extent2D atlas_tiles{32, 16};
+  // larger views (e.g. very anisotropic scale) are rendered directly
+  static constexpr std::uint32_t max_visible_tiles = 256;
+  // how many coarser levels are searched for a missing tile
+  static constexpr std::int64_t max_fallback_levels = 4;
+  // worst case: every texel reaches max_iter (unit of the budget - adaptive
+  //   tiles cost proportionally to their iteration count)
+  static constexpr std::uint64_t tile_cost =
+      std::uint64_t{tile_size} * tile_size * max_iter;
+  static constexpr std::uint64_t default_iteration_budget = 64 * tile_cost;
+
+  // the view switches to perturbation rendering below this pixel size
+  static constexpr double perturbation_scale = 1e-12;
+  // the pixel deltas are doubles
+  static constexpr double min_scale = 1e-300;
+  static constexpr std::uint32_t default_deep_max_iter = 4096;
+  // reference precision above the pixel size
+  static constexpr std::size_t guard_bits = 64;
+
+  // rectangles of the first subdivision pass (halved by every next one)
+  static constexpr std::uint32_t subdivision_rect = 64;
+  static constexpr std::uint32_t subdivision_levels = 4;
+
+  // cardioid/bulb tests and periodicity checking of the iteration
+  static constexpr std::uint32_t flag_interior_checks = 1;
+  // one sample per 2x2 block (variant 0)
+  static constexpr std::uint32_t flag_preview = 2;
+  // write the continuous escape value instead of the color
+  static constexpr std::uint32_t flag_escape_values = 4;
+  // second pass of the persistent variant (the deferred orbits)
+  static constexpr std::uint32_t flag_slow_pass = 8;
+  // write the iteration count instead of the color (record_iterations)
+  static constexpr std::uint32_t flag_iteration_counts = 16;
+
+  // bins of the escape value histogram over [0, max_iter)
+  static constexpr std::uint32_t histogram_bins = 4096;
+
+  struct Palette {
+    // hue by the share of the pixels below the value (else by the value)
+    bool equalize{true};
+    float hue_offset{0.F};
+    // palette repetitions over the value range
+    float hue_cycles{1.F};
+  };
+
+  struct PushConstants {
+    glm::dvec2 center;
+    glm::dvec2 scale{default_scale};
+    // computed region of the image
+    glm::ivec2 offset;
+    glm::uvec2 extent;
+    BindlessResource image_idx;
+    std::uint32_t flags;
+    std::uint32_t max_iter;
+    // work queue of the persistent variant (set by the renderer)
+    vk::DeviceAddress queue{};
+  };
+
+  struct DeepStats {
+    bool active;
+    bool computing;
+    std::uint64_t references;
+    std::uint32_t orbit_length;
+    std::uint32_t skip;
+    std::size_t precision_bits;
+  };
+
+  struct TileStats {
+    TileCacheStats cache;
+    std::int64_t level;
+    std::uint32_t visible;
+    // this frame
+    std::uint32_t computed;
+    std::uint32_t fallback;
+    std::uint32_t missing;
+    // 0 while the atlas is evicted
+    vk::DeviceSize atlas_bytes;
+    // by the memory budget
+    std::uint64_t atlas_evictions;
+  };
+
+  MandelbrotRenderer(const Config &cfg, Context &ctx);
+
+  // the memory budget evictor refers to this renderer
+  MandelbrotRenderer(const MandelbrotRenderer &) = delete;
+  MandelbrotRenderer &operator=(const MandelbrotRenderer &) = delete;
+  MandelbrotRenderer(MandelbrotRenderer &&) = delete;
+  MandelbrotRenderer &operator=(MandelbrotRenderer &&) = delete;
+
+  // params().center is a double approximation of the view center - use
+  //   move() to keep the precise one (direct writes reset it)
+  [[nodiscard]] PushConstants &params() noexcept { return m_push_constants; }
+  void move(glm::dvec2 delta);
+
+  [[nodiscard]] bool &perturbation() noexcept { return m_perturbation; }
+  [[nodiscard]] std::uint32_t &deep_max_iter() noexcept {
+    return m_deep_max_iter;
+  }
+  [[nodiscard]] const DeepStats &deep_stats() const noexcept {
+    return m_deep_stats;
+  }
+
+  [[nodiscard]] int &variant() noexcept { return m_variant; }
+  // workgroup shapes of the variants (tuned or loaded in the constructor)
+  [[nodiscard]] const KernelTuning &kernels() const noexcept {
+    return m_kernels;
+  }
+  [[nodiscard]] bool &interior_checks() noexcept { return m_interior_checks; }
+  [[nodiscard]] bool &subdivision() noexcept { return m_subdivision; }
+  [[nodiscard]] bool &adaptive_iter() noexcept { return m_adaptive_iter; }
+  [[nodiscard]] bool &progressive() noexcept { return m_progressive; }
+  [[nodiscard]] std::uint32_t &refine_step() noexcept { return m_refine_step; }
+  // iterations the progressive refinement has done of current_max_iter()
+  [[nodiscard]] std::uint32_t refined() const noexcept { return m_refined; }
+
+  [[nodiscard]] static std::uint32_t adaptive_max_iter(double scale);
+  // iteration count of the view
+  [[nodiscard]] std::uint32_t current_max_iter() const;
+  // the tile cache, subdivision and progressive modes write colors directly
+  //   and are bypassed while smooth coloring is on
+  [[nodiscard]] bool &smooth_coloring() noexcept { return m_smooth_coloring; }
+  [[nodiscard]] Palette &palette() noexcept { return m_palette; }
+  [[nodiscard]] bool &tiled() noexcept { return m_tiled; }
+  [[nodiscard]] std::uint64_t &iteration_budget() noexcept {
+    return m_iteration_budget;
+  }
+  [[nodiscard]] const ImageView &texture() const noexcept { return m_texture; }
+  [[nodiscard]] vk::Extent2D extent() const noexcept { return m_extent; }
+  [[nodiscard]] bool &edge_aware_upscale() noexcept {
+    return m_edge_aware_upscale;
+  }
+
+  // renders at `extent` (clamped to min/max_extent) from the next record()
+  //   keeps the view: params().scale follows the pixel size
+  void resize(vk::Extent2D extent);
+
+  // blocks until record() renders the current view at full quality: all
+  //   pipelines compiled and the reference orbit of a deep view computed
+  //   (interactive frames fall back to what is ready instead)
+  void wait_until_ready();
+  [[nodiscard]] const TileStats &tile_stats() const noexcept {
+    return m_tile_stats;
+  }
+
+  // dispatch the fractal; leaves the texture in eTransferSrcOptimal
+  //   uses any compiled variant while the selected one is not ready
+  void record(CommandBuffer &cb);
+
+  // blit the texture to the whole `extent` of `target`
+  //   (target has to be in eTransferDstOptimal)
+  void blit(CommandBuffer &cb, vk::Image target, vk::Extent2D extent);
+
+  // copies the iteration count of every pixel of the view (row major, as
+  //   floats) to `out`, computed by `variant` without the interior checks
+  //   like mandelbrot_cpu(); waits for the pipeline of the variant
+  void record_iterations(CommandBuffer &cb, int variant, BufferHandle out);
+
+private:
+  // keep in sync with MandelbrotComposite.comp
+  struct TileEntry {
+    // atlas texel of the tile (or of its part in a coarser tile)
+    glm::ivec2 texel;
+    // levels between the tile and the atlas tile
+    std::uint32_t shift;
+    std::uint32_t valid;
+  };
+
+  struct CompositeConstants {
+    glm::dvec2 center;
+    glm::dvec2 scale;
+    // world position of the corner of the first visible tile
+    glm::dvec2 grid_origin;
+    // world size of a texel of the level
+    double level_scale;
+    vk::DeviceAddress table;
+    glm::uvec2 grid_size;
+    std::uint32_t tile_size;
+    BindlessResource atlas_idx;
+    BindlessResource image_idx;
+  };
+
+  // keep in sync with MandelbrotDeep.comp
+  struct DeepConstants {
+    // view center - reference point
+    glm::dvec2 delta_center;
+    glm::dvec2 scale;
+    glm::dvec2 sa_a;
+    glm::dvec2 sa_b;
+    glm::dvec2 sa_c;
+    vk::DeviceAddress orbit;
+    glm::ivec2 offset;
+    glm::uvec2 extent;
+    std::uint32_t orbit_length;
+    std::uint32_t skip;
+    std::uint32_t max_iter;
+    BindlessResource image_idx;
+    std::uint32_t flags;
+  };
+
+  // keep in sync with MandelbrotHistogram.comp
+  struct HistogramConstants {
+    vk::DeviceAddress histogram;
+    glm::uvec2 extent;
+    std::uint32_t max_iter;
+    BindlessResource values_idx;
+  };
+
+  // keep in sync with MandelbrotColor.comp
+  struct ColorConstants {
+    vk::DeviceAddress histogram;
+    glm::uvec2 extent;
+    std::uint32_t max_iter;
+    BindlessResource values_idx;
+    BindlessResource image_idx;
+    std::uint32_t equalize;
+    float hue_offset;
+    float hue_cycles;
+  };
+
+  // keep in sync with MandelbrotSubdivide.comp
+  struct SubdivideConstants {
+    glm::dvec2 center;
+    glm::dvec2 scale;
+    vk::DeviceAddress counts;
+    vk::DeviceAddress in_list;
+    vk::DeviceAddress out_list;
+    glm::uvec2 extent;
+    std::uint32_t rect_size;
+    std::uint32_t level;
+    std::uint32_t levels;
+    std::uint32_t flags;
+    BindlessResource image_idx;
+    std::uint32_t max_iter;
+  };
+
+  // keep in sync with MandelbrotRefine.comp
+  struct RefineConstants {
+    glm::dvec2 center;
+    glm::dvec2 scale;
+    vk::DeviceAddress states;
+    glm::uvec2 extent;
+    std::uint32_t max_iter;
+    std::uint32_t steps;
+    std::uint32_t reset;
+    std::uint32_t flags;
+    BindlessResource image_idx;
+  };
+
+  // State of MandelbrotRefine.comp
+  struct RefineState {
+    glm::dvec2 z;
+    std::uint32_t n;
+    std::uint32_t done;
+  };
+
+  // what the refinement state was computed for
+  struct RefineView {
+    glm::dvec2 center;
+    glm::dvec2 scale;
+    std::uint32_t max_iter;
+    std::uint32_t flags;
+
+    bool operator==(const RefineView &) const = default;
+  };
+
+  // keep in sync with MandelbrotUpscale.comp
+  struct UpscaleConstants {
+    glm::uvec2 src_extent;
+    glm::uvec2 dst_extent;
+    BindlessResource src_idx;
+    BindlessResource dst_idx;
+  };
+
+  // keep in sync with Mandelbrot.comp
+  struct WorkQueueHeader {
+    std::uint32_t next;
+    std::uint32_t slow_count;
+    std::uint32_t slow_next;
+    std::uint32_t pad;
+  };
+
+  // orbit deferred by the first pass of the persistent variant
+  struct SlowOrbit {
+    glm::dvec2 z;
+    std::uint32_t pixel;
+    std::uint32_t n;
+  };
+
+  // rectangle list of a subdivision pass (VkDispatchIndirectCommand header)
+  struct RectListHeader {
+    std::uint32_t groups_x;
+    std::uint32_t groups_y;
+    std::uint32_t groups_z;
+    std::uint32_t pad;
+  };
+
+  // plans the visible tiles; false if the view cannot be tiled
+  bool plan_tiles();
+
+  // the shapes used without a tuning (no timestamps on the queue)
+  [[nodiscard]] static KernelTuning default_kernels();
+  // benchmarks kernel_candidates() of every variant and picks the fastest;
+  //   std::nullopt if the queue cannot measure them
+  std::optional<KernelTuning>
+  autotune(const std::shared_ptr<const std::vector<std::uint32_t>> &code);
+
+  vk::Pipeline select_pipeline(int &variant);
+  // pipeline and bindless sets have to be bound
+  void dispatch_fractal(CommandBuffer &cb, int variant,
+                        const PushConstants &pc);
+  void dispatch_kernel(CommandBuffer &cb, int variant,
+                       const KernelConfig &config, PushConstants pc);
+  // target: storage image handle
+  void record_direct(CommandBuffer &cb, BindlessResource target,
+                     std::uint32_t flags);
+  void record_tiled(CommandBuffer &cb);
+  // false if there is no reference orbit yet
+  bool record_deep(CommandBuffer &cb, BindlessResource target,
+                   std::uint32_t flags);
+  // false if the pipelines are not compiled yet
+  bool record_smooth(CommandBuffer &cb, bool deep);
+  // false if the pipeline is not compiled yet
+  bool record_subdivided(CommandBuffer &cb);
+  // false if the pipelines are not compiled yet
+  bool record_progressive(CommandBuffer &cb);
+  [[nodiscard]] std::uint32_t flags() const noexcept;
+  // iteration count of a view with pixels of `scale`
+  [[nodiscard]] std::uint32_t max_iter_for(double scale) const;
+  [[nodiscard]] static std::array<vk::DeviceSize, subdivision_levels + 1>
+  subdivision_layout(vk::Extent2D extent);
+  // allocated for the current extent on first use
+  BufferHandle subdivision_buffer();
+  BufferHandle refine_states();
+  ImageViewHandle escape_values();
+  BufferHandle work_queue();
+
+  // registry image with a view of the whole of it
+  struct transient_texture {
+    UniqueImage image;
+    UniqueImageView view;
+  };
+  transient_texture make_transient(vk::Extent2D extent, vk::Format format,
+                                   vk::ImageUsageFlags usage,
+                                   zstring_view name);
+  // allocated on first use after an eviction
+  ImageViewHandle atlas();
+  // drops the atlas with the cached tiles; returns the bytes freed
+  vk::DeviceSize evict_atlas();
+
+  // false if the pipeline is not compiled yet
+  bool upscale(CommandBuffer &cb, vk::Extent2D extent);
+
+  // picks up finished reference orbits and starts new ones when needed
+  void update_reference();
+  // resets the precise center if params().center was written directly
+  void sync_center();
+  [[nodiscard]] std::size_t precision_bits() const;
+
+  Context *m_ctx;
+
+  vk::Extent2D m_extent{default_extent};
+  ImageView m_texture;
+  // the texture is kept between frames (eTransferSrcOptimal)
+  bool m_texture_initialized{false};
+
+  vk::raii::PipelineLayout m_pipeline_layout;
+
+  KernelTuning m_kernels;
+  // compiled in the background
+  std::array<std::shared_ptr<const AsyncPipeline>, variant_count> m_pipelines;
+  // pixels of the persistent variant (for the extent or a tile)
+  UniqueBuffer m_work_queue;
+  int m_variant{2};
+  bool m_interior_checks{true};
+  bool m_adaptive_iter{true};
+
+  PushConstants m_push_constants;
+
+  // tiled rendering stays off while it is evicted and the memory budget
+  //   throttles
+  transient_texture m_atlas;
+  bool m_atlas_initialized{false};
+  per_frame<Buffer> m_tile_tables;
+
+  vk::raii::PipelineLayout m_composite_layout;
+  std::shared_ptr<const AsyncPipeline> m_composite;
+
+  MandelbrotTileCache m_tile_cache;
+  // iteration mode the cached tiles were computed with
+  bool m_tiles_adaptive{true};
+  bool m_tiled{true};
+  std::uint64_t m_iteration_budget{default_iteration_budget};
+
+  // the current plan
+  struct tile_job {
+    TileKey key;
+    std::uint32_t slot;
+  };
+  std::vector<tile_job> m_jobs;
+  std::vector<TileEntry> m_table;
+  CompositeConstants m_composite_constants{};
+  TileStats m_tile_stats{};
+
+  vk::raii::PipelineLayout m_deep_layout;
+  std::shared_ptr<const AsyncPipeline> m_deep;
+
+  bool m_perturbation{true};
+  std::uint32_t m_deep_max_iter{default_deep_max_iter};
+
+  BigFixed m_center_x;
+  BigFixed m_center_y;
+  // params().center when the precise center was last updated
+  glm::dvec2 m_center_approx{};
+
+  std::optional<ReferenceOrbit> m_reference;
+  UniqueBuffer m_orbit_buffer;
+  std::future<ReferenceOrbit> m_pending_reference;
+  DeepStats m_deep_stats{};
+
+  vk::raii::PipelineLayout m_subdivide_layout;
+  std::shared_ptr<const AsyncPipeline> m_subdivide;
+  bool m_subdivision{false};
+  // offsets of the rectangle lists of the passes after the first one
+  //   (the iteration counts of the borders come first); the last one is the
+  //   size of the buffer
+  std::array<vk::DeviceSize, subdivision_levels + 1> m_subdivision_layout{};
+  UniqueBuffer m_subdivision_buffer;
+
+  vk::raii::PipelineLayout m_refine_layout;
+  std::shared_ptr<const AsyncPipeline> m_refine;
+  bool m_progressive{false};
+  std::uint32_t m_refine_step{default_refine_step};
+  UniqueBuffer m_refine_states;
+  // nullopt: the texture does not show the preview of the current view
+  std::optional<RefineView> m_refine_view;
+  std::uint32_t m_refined{0};
+
+  vk::raii::PipelineLayout m_histogram_layout;
+  // counting and prefix sum variants
+  std::array<std::shared_ptr<const AsyncPipeline>, 2> m_histogram;
+  vk::raii::PipelineLayout m_color_layout;
+  std::shared_ptr<const AsyncPipeline> m_color;
+  bool m_smooth_coloring{false};
+  Palette m_palette;
+  // R32F, kept in eGeneral between frames
+  transient_texture m_escape_values;
+  Buffer m_histogram_buffer;
+  // nullopt: the escape values have to be computed
+  std::optional<RefineView> m_escape_view;
+  // iteration count the escape values were computed with
+  std::uint32_t m_escape_max_iter{0};
+
+  vk::raii::PipelineLayout m_upscale_layout;
+  std::shared_ptr<const AsyncPipeline> m_upscale;
+  bool m_edge_aware_upscale{true};
+  // the texture upscaled to the output extent
+  transient_texture m_upscaled;
+
+  // last - removed before the members it evicts are destroyed
+  UniqueEvictor m_atlas_evictor;
+};
+} // namespace v4dg
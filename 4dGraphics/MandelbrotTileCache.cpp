@@ -0,0 +1,59 @@
+#include "MandelbrotTileCache.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+using namespace v4dg;
+
+MandelbrotTileCache::MandelbrotTileCache(std::uint32_t slots)
+    : m_slots(slots, slot{.key = {}, .last_used = 0, .live = false}) {
+  m_lookup.reserve(slots);
+}
+
+std::optional<std::uint32_t> MandelbrotTileCache::find(const TileKey &key) {
+  auto it = m_lookup.find(key);
+  if (it == m_lookup.end()) {
+    return std::nullopt;
+  }
+
+  m_slots[it->second].last_used = m_frame;
+  m_hits++;
+  return it->second;
+}
+
+std::optional<std::uint32_t>
+MandelbrotTileCache::allocate(const TileKey &key) {
+  auto lru = std::ranges::min_element(
+      m_slots, {}, [](const slot &s) { return s.last_used; });
+  if (lru == m_slots.end() || lru->last_used == m_frame) {
+    return std::nullopt;
+  }
+
+  if (lru->live) {
+    m_lookup.erase(lru->key);
+    m_evictions++;
+  }
+
+  *lru = {.key = key, .last_used = m_frame, .live = true};
+  auto const idx = static_cast<std::uint32_t>(lru - m_slots.begin());
+  m_lookup[key] = idx;
+  m_computed++;
+  return idx;
+}
+
+void MandelbrotTileCache::clear() {
+  m_lookup.clear();
+  std::ranges::fill(m_slots, slot{.key = {}, .last_used = 0, .live = false});
+}
+
+TileCacheStats MandelbrotTileCache::stats() const noexcept {
+  return {
+      .live = m_lookup.size(),
+      .capacity = m_slots.size(),
+      .hits = m_hits,
+      .computed = m_computed,
+      .evictions = m_evictions,
+  };
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <VulkanCaches.hpp>
+
+#include <ankerl/unordered_dense.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace v4dg {
+// tile (x, y) of `level` covers [x, x + 1) * tile world size of the level
+struct TileKey {
+  std::int64_t level;
+  std::int64_t x;
+  std::int64_t y;
+
+  bool operator==(const TileKey &) const = default;
+
+  // the tile of `levels` coarser level containing this one
+  [[nodiscard]] TileKey ancestor(std::int64_t levels) const noexcept {
+    // arithmetic shifts floor the negative coordinates
+    return {level - levels, x >> levels, y >> levels};
+  }
+};
+
+struct TileCacheStats {
+  std::size_t live;
+  std::size_t capacity;
+  std::uint64_t hits;
+  std::uint64_t computed;
+  std::uint64_t evictions;
+};
+
+// Slot bookkeeping of the tile atlas (CPU only).
+//   Slots are reused in least recently used order; slots used in the current
+//   frame are never evicted.
+class MandelbrotTileCache {
+public:
+  explicit MandelbrotTileCache(std::uint32_t slots);
+
+  // starts a new frame of lookups/allocations
+  void next_frame() noexcept { m_frame++; }
+
+  // slot of a computed tile (marks it as used this frame)
+  [[nodiscard]] std::optional<std::uint32_t> find(const TileKey &key);
+
+  // slot for a tile that is going to be computed this frame
+  //   nullopt if all slots are used this frame
+  [[nodiscard]] std::optional<std::uint32_t> allocate(const TileKey &key);
+
+  void clear();
+
+  [[nodiscard]] TileCacheStats stats() const noexcept;
+
+private:
+  struct slot {
+    TileKey key;
+    std::uint64_t last_used;
+    bool live;
+  };
+
+  std::vector<slot> m_slots;
+  ankerl::unordered_dense::map<TileKey, std::uint32_t,
+                               detail::omni_hash<TileKey>>
+      m_lookup;
+
+  // frame 0 is "never used"
+  std::uint64_t m_frame{1};
+
+  std::uint64_t m_hits{0};
+  std::uint64_t m_computed{0};
+  std::uint64_t m_evictions{0};
+};
+} // namespace v4dg
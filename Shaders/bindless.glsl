@@ -12,11 +12,13 @@
 #extension GL_EXT_ray_tracing : require
 #extension GL_EXT_scalar_block_layout : require
 #extension GL_EXT_shader_8bit_storage : require
+#extension GL_EXT_shader_explicit_arithmetic_types_int64 : require
 
 const uint sampler_type = 0, sampler_set = 0, sampler_binding = 0;
 const uint texture_type = 1, texture_set = 0, texture_binding = 1;
 const uint image_type = 2, image_set = 0, image_binding = 2;
 const uint AS_type = 3, AS_set = 0, AS_binding = 3;
+const uint buffer_type = 4, buffer_set = 0, buffer_binding = 5;
 
 // first number not used by bindless framework
 const uint user_set = 1;
@@ -27,13 +29,13 @@ layout(buffer_reference, scalar) buffer VersionBuffer {
 };
 
 layout(set = 0, binding = 4, scalar) uniform AllVersionBuffers {
-    uint maxHandles[4];
-    VersionBuffer versions[4];
+    uint maxHandles[5];
+    VersionBuffer versions[5];
 } bindlessVersionBuffers;
 #endif
 
 uint indexFromHandleFrom(uint handle, uint type_expected) {
-    uint idx = handle & ((1 << 23) - 1);
+    uint idx = handle & ((1 << 22) - 1);
 
 #ifdef BINDLESS_CHECKS
     uint valid = (handle >> 31);
@@ -42,7 +44,7 @@ uint indexFromHandleFrom(uint handle, uint type_expected) {
         return 0;
     }
 
-    uint type = (handle >> 23) & 0x3;
+    uint type = (handle >> 22) & 0x7;
     if (type != type_expected) {
         debugPrintfEXT("Invalid handle type %d, expected %d\n", type, type_expected);
         return 0;
@@ -156,4 +158,43 @@ accelerationStructureEXT toAccStruct(uint handle) {
 }
 #endif
 
+///////// BUFFERS ///////////
+
+uint bufferIdx(uint handle) {
+    return indexFromHandleFrom(handle, buffer_type);
+}
+
+struct BindlessBuffer {
+    uint64_t address;
+    uint64_t size;
+};
+
+layout(set = buffer_set, binding = buffer_binding, scalar) readonly buffer BindlessBuffers {
+    BindlessBuffer bindlessBuffers[];
+};
+
+uint64_t bufferAddress(uint handle) {
+    return bindlessBuffers[bufferIdx(handle)].address;
+}
+
+uint64_t bufferSize(uint handle) {
+    return bindlessBuffers[bufferIdx(handle)].size;
+}
+
+// address of `access_size` bytes at `offset` (0 if out of bounds with checks)
+//   use: MyBufferRef(bufferAddress(handle, offset, size))
+uint64_t bufferAddress(uint handle, uint64_t offset, uint64_t access_size) {
+    BindlessBuffer buf = bindlessBuffers[bufferIdx(handle)];
+
+#ifdef BINDLESS_CHECKS
+    if (offset + access_size > buf.size) {
+        debugPrintfEXT("Buffer access out of bounds: offset %lu, size %lu, buffer size %lu\n",
+                       offset, access_size, buf.size);
+        return 0;
+    }
+#endif
+
+    return buf.address + offset;
+}
+
 #endif // BINDLESS_
@@ -1,24 +1,31 @@
 #include "BindlessManager.hpp"
 #include "Debug.hpp"
 #include "Device.hpp"
+#include "MemoryPools.hpp"
 #include "Queue.hpp"
 #include "VulkanCaches.hpp"
 #include "VulkanConstructs.hpp"
 #include "cppHelpers.hpp"
 #include "v4dgCore.hpp"
 
+#include <tracy/Tracy.hpp>
 #include <vulkan-memory-allocator-hpp/vk_mem_alloc.hpp>
 #include <vulkan/vulkan.hpp>
 #include <vulkan/vulkan_raii.hpp>
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cassert>
 #include <cstddef>
 #include <cstdint>
 #include <functional>
+#include <memory>
 #include <mutex>
 #include <ranges>
+#include <span>
+#include <string_view>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -40,86 +47,534 @@ vk::DescriptorType BindlessResource::type_to_vk(BindlessType t) noexcept {
   };
 }
 
+std::string_view BindlessResource::type_name(BindlessType t) noexcept {
+  switch (t) {
+  case BindlessType::eSampler:
+    return "sampler";
+  case BindlessType::eSampledImage:
+    return "sampled image";
+  case BindlessType::eStorageImage:
+    return "storage image";
+  case BindlessType::eAccelerationStructureKHR:
+    return "acceleration structure";
+  case BindlessType::eBuffer:
+    return "buffer";
+  default:
+    assert(false && "invalid v4dg::BindlessType");
+    return "invalid";
+  };
+}
+
 UniqueBindlessResource::~UniqueBindlessResource() {
   if (m_manager != nullptr) {
     m_manager->free(m_res);
   }
 }
 
-void BindlessManager::BindlessHeap::setup(BindlessType type,
-                                          uint32_t max_count) {
+BindlessHeap::~BindlessHeap() { release_links(); }
+
+void BindlessHeap::setup(BindlessType type, std::uint32_t max_count) {
+  release_links();
+
   m_type = type;
   m_max_count = max_count;
 
-  m_count = 1; // null resource
-  m_free.clear();
+  m_count.store(1, std::memory_order_relaxed); // null resource
+  m_stack.store(0, std::memory_order_relaxed);
+  m_frame.store(0, std::memory_order_relaxed);
+  m_exhausted.store(0, std::memory_order_relaxed);
+  for (auto &&[stack, count] : std::views::zip(m_retired, m_retired_count)) {
+    stack.store(0, std::memory_order_relaxed);
+    count.store(0, std::memory_order_relaxed);
+  }
+  m_chunks = std::make_unique<std::atomic<link *>[]>(chunk_count());
+
+  for (auto &cache : m_caches) {
+    // never exceeded - free() and next_frame() must not allocate
+    cache.free.clear();
+    cache.free.reserve(2 * batch_size);
+    cache.retired.clear();
+    cache.retired.reserve(batch_size);
+    cache.retired_frame = 0;
+    cache.live = 0;
+  }
 }
 
-BindlessResource BindlessManager::BindlessHeap::allocate() {
-  std::scoped_lock const _{m_mutex};
-  if (m_free.empty()) {
-    if (m_count >= m_max_count) {
-      throw exception("out of bindless resources of type {} (max {})",
-                      BindlessResource::type_to_vk(m_type), m_max_count);
-    }
-
-    return BindlessResource{m_count++, m_type};
+BindlessResource BindlessHeap::allocate() {
+  auto &cache = acquire_cache();
+  detail::destroy_helper const release{
+      [&] { cache.busy.clear(std::memory_order_release); }};
+
+  if (cache.free.empty() && !pop_batch(cache.free) &&
+      !reserve_fresh(cache.free) && !steal(cache)) {
+    throw exception("out of bindless resources of type {} (max {}; freed "
+                    "ones are reused after {} frames)",
+                    BindlessResource::type_name(m_type), m_max_count,
+                    max_frames_in_flight);
   }
 
-  BindlessResource res = m_free.back();
-  m_free.pop_back();
-  res.bump_version();
-
+  BindlessResource const res = cache.free.back();
+  cache.free.pop_back();
+  cache.live++;
   return res;
 }
 
-void BindlessManager::BindlessHeap::free(BindlessResource res) {
+void BindlessHeap::free(BindlessResource res) noexcept {
   if (!res) {
     return;
   }
 
-  std::scoped_lock const _{m_mutex};
   assert(res.type() == m_type);
   assert(res.index() != 0); // do not free the null resource
-  assert(res.index() <= m_count);
+  assert(res.index() < m_count.load(std::memory_order_relaxed));
 
-  m_free.push_back(res);
+  res.bump_version();
+
+  auto &cache = acquire_cache();
+  detail::destroy_helper const release{
+      [&] { cache.busy.clear(std::memory_order_release); }};
+
+  if (res.version() == 0) {
+    // a handle of the first use would validate again - drop the index
+    cache.live--;
+    m_exhausted.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  // read under the cache lock - next_frame() drains the caches first
+  auto const frame = m_frame.load(std::memory_order_acquire);
+  if (cache.retired_frame != frame) {
+    retire(cache);
+    cache.retired_frame = frame;
+  }
+
+  cache.retired.push_back(res);
+  cache.live--;
+
+  if (cache.retired.size() == batch_size) {
+    retire(cache);
+  }
 }
 
+void BindlessHeap::next_frame(std::size_t frame) noexcept {
+  ZoneScoped;
+  assert(frame < max_frames_in_flight);
+
+  for (auto &cache : m_caches) {
+    lock_cache(cache);
+    if (cache.retired_frame == frame) {
+      // straight back to the thread that freed them, if they fit
+      if (cache.free.size() + cache.retired.size() <= 2 * batch_size) {
+        cache.free.insert(cache.free.end(), cache.retired.begin(),
+                          cache.retired.end());
+        cache.retired.clear();
+      } else {
+        retire(cache);
+      }
+    }
+    cache.busy.clear(std::memory_order_release);
+  }
+
+  // the whole retired stack is owned after the exchange
+  auto const first = static_cast<std::uint32_t>(
+      m_retired[frame].exchange(0, std::memory_order_acquire));
+  m_retired_count[frame].store(0, std::memory_order_relaxed);
+
+  if (first != 0) {
+    std::uint32_t last = first;
+    while (auto next =
+               link_of(last).next_batch.load(std::memory_order_relaxed)) {
+      last = next;
+    }
+
+    // on top of the free stack - the most recently freed are reused first
+    push_chain(m_stack, first, last);
+  }
+
+  m_frame.store(frame, std::memory_order_release);
+}
+
+BindlessHeapStats BindlessHeap::stats() noexcept {
+  BindlessHeapStats stats{
+      .capacity = std::max(m_max_count, 1U) - 1,
+      .high_water = std::max(m_count.load(std::memory_order_relaxed), 1U) - 1,
+  };
+
+  std::int64_t live = 0;
+  for (const auto &count : m_retired_count) {
+    stats.retired += count.load(std::memory_order_relaxed);
+  }
+  for (auto &cache : m_caches) {
+    lock_cache(cache);
+    live += cache.live;
+    stats.retired += static_cast<std::uint32_t>(cache.retired.size());
+    cache.busy.clear(std::memory_order_release);
+  }
+
+  // the counters are not read atomically - keep the result consistent
+  stats.exhausted = std::min(m_exhausted.load(std::memory_order_relaxed),
+                             stats.high_water);
+  stats.retired = std::min(stats.retired, stats.high_water - stats.exhausted);
+  stats.live = static_cast<std::uint32_t>(std::clamp<std::int64_t>(
+      live, 0, stats.high_water - stats.retired - stats.exhausted));
+  return stats;
+}
+
+BindlessHeap::link &BindlessHeap::link_of(std::uint32_t index) noexcept {
+  link *chunk = m_chunks[index / chunk_size].load(std::memory_order_acquire);
+  assert(chunk != nullptr);
+  return chunk[index % chunk_size];
+}
+
+void BindlessHeap::ensure_links(std::uint32_t begin, std::uint32_t end) {
+  for (std::uint32_t i = begin / chunk_size; i <= (end - 1) / chunk_size;
+       i++) {
+    if (m_chunks[i].load(std::memory_order_acquire) != nullptr) {
+      continue;
+    }
+
+    auto chunk = std::make_unique<link[]>(chunk_size);
+    link *expected = nullptr;
+    if (m_chunks[i].compare_exchange_strong(expected, chunk.get(),
+                                            std::memory_order_acq_rel)) {
+      (void)chunk.release();
+    }
+  }
+}
+
+void BindlessHeap::release_links() noexcept {
+  if (!m_chunks) {
+    return;
+  }
+
+  for (std::uint32_t i = 0; i < chunk_count(); i++) {
+    delete[] m_chunks[i].load(std::memory_order_relaxed);
+  }
+  m_chunks.reset();
+}
+
+BindlessHeap::thread_cache &BindlessHeap::acquire_cache() noexcept {
+  // the cache of this thread is only taken by others when threads outnumber
+  //   the caches or when stealing from it
+  auto const stripe = detail::thread_stripe();
+  for (std::size_t i = 0;; i++) {
+    auto &cache = m_caches[(stripe + i) % thread_cache_count];
+    if (!cache.busy.test_and_set(std::memory_order_acquire)) {
+      return cache;
+    }
+
+    if (i % thread_cache_count == thread_cache_count - 1) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+void BindlessHeap::lock_cache(thread_cache &cache) noexcept {
+  while (cache.busy.test_and_set(std::memory_order_acquire)) {
+    std::this_thread::yield();
+  }
+}
+
+std::uint32_t
+BindlessHeap::link_batch(std::span<const BindlessResource> batch) noexcept {
+  assert(!batch.empty() && batch.size() <= batch_size);
+
+  for (std::size_t i = 0; i < batch.size(); i++) {
+    link &l = link_of(batch[i].index());
+    l.next = i + 1 < batch.size() ? batch[i + 1].index() : 0;
+    l.version = batch[i].version();
+  }
+
+  std::uint32_t const first = batch.front().index();
+  link_of(first).size = static_cast<std::uint32_t>(batch.size());
+  return first;
+}
+
+void BindlessHeap::push_batch(
+    batch_stack &stack, std::span<const BindlessResource> batch) noexcept {
+  std::uint32_t const first = link_batch(batch);
+  push_chain(stack, first, first);
+}
+
+void BindlessHeap::push_chain(batch_stack &stack, std::uint32_t first,
+                              std::uint32_t last) noexcept {
+  link &tail = link_of(last);
+
+  // the tag in the upper half makes a stale head fail the exchange (ABA)
+  std::uint64_t top = stack.load(std::memory_order_relaxed);
+  std::uint64_t new_top{};
+  do {
+    tail.next_batch.store(static_cast<std::uint32_t>(top),
+                          std::memory_order_relaxed);
+    new_top = (((top >> 32) + 1) << 32) | first; // NOLINT(*-magic-numbers)
+  } while (!stack.compare_exchange_weak(top, new_top,
+                                        std::memory_order_release,
+                                        std::memory_order_relaxed));
+}
+
+bool BindlessHeap::pop_batch(std::vector<BindlessResource> &out) noexcept {
+  std::uint64_t top = m_stack.load(std::memory_order_acquire);
+  std::uint32_t first{};
+  while (true) {
+    first = static_cast<std::uint32_t>(top);
+    if (first == 0) {
+      return false;
+    }
+
+    // links are never freed, so a stale read only fails the exchange
+    std::uint64_t const next =
+        link_of(first).next_batch.load(std::memory_order_relaxed);
+    std::uint64_t const new_top =
+        (((top >> 32) + 1) << 32) | next; // NOLINT(*-magic-numbers)
+
+    if (m_stack.compare_exchange_weak(top, new_top, std::memory_order_acquire,
+                                      std::memory_order_acquire)) {
+      break;
+    }
+  }
+
+  // the batch is owned exclusively now; it is linked oldest first, so the
+  //   most recently freed handle ends up at the back of `out`
+  auto const begin = out.size();
+  out.resize(begin + link_of(first).size);
+
+  std::uint32_t index = first;
+  for (auto &res : out | std::views::drop(begin)) {
+    const link &l = link_of(index);
+    res = BindlessResource{index, m_type, l.version};
+    index = l.next;
+  }
+
+  return true;
+}
+
+bool BindlessHeap::reserve_fresh(std::vector<BindlessResource> &out) {
+  std::uint32_t begin = m_count.load(std::memory_order_relaxed);
+  std::uint32_t end{};
+  do {
+    if (begin >= m_max_count) {
+      return false;
+    }
+    end = begin + std::min(batch_size, m_max_count - begin);
+  } while (!m_count.compare_exchange_weak(begin, end,
+                                          std::memory_order_relaxed));
+
+  ensure_links(begin, end);
+
+  // hand out the lowest index first
+  for (std::uint32_t i = end; i-- > begin;) {
+    out.push_back(BindlessResource{i, m_type});
+  }
+
+  return true;
+}
+
+bool BindlessHeap::steal(thread_cache &self) noexcept {
+  // the heap is exhausted - take free handles parked in other caches
+  for (auto &cache : m_caches) {
+    if (&cache == &self || cache.busy.test_and_set(std::memory_order_acquire)) {
+      continue;
+    }
+
+    auto const count = std::min<std::size_t>(batch_size, cache.free.size());
+    self.free.insert(self.free.end(), cache.free.end() - count,
+                     cache.free.end());
+    cache.free.resize(cache.free.size() - count);
+
+    cache.busy.clear(std::memory_order_release);
+
+    if (!self.free.empty()) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void BindlessHeap::retire(thread_cache &cache) noexcept {
+  if (cache.retired.empty()) {
+    return;
+  }
+
+  push_batch(m_retired[cache.retired_frame], cache.retired);
+  m_retired_count[cache.retired_frame].fetch_add(
+      static_cast<std::uint32_t>(cache.retired.size()),
+      std::memory_order_relaxed);
+  cache.retired.clear();
+}
+
+namespace {
+// usage of the descriptor buffer (it holds samplers and resources)
+constexpr auto descriptor_buffer_usage =
+    vk::BufferUsageFlagBits::eSamplerDescriptorBufferEXT |
+    vk::BufferUsageFlagBits::eResourceDescriptorBufferEXT |
+    vk::BufferUsageFlagBits::eShaderDeviceAddress;
+
+// without it acceleration structures are left out of the descriptor set
+bool acceleration_structures_update_after_bind(const Device &device) {
+  const auto *features =
+      device.stats()
+          .features.get<vk::PhysicalDeviceAccelerationStructureFeaturesKHR>();
+  return features != nullptr &&
+         features->descriptorBindingAccelerationStructureUpdateAfterBind ==
+             vk::True;
+}
+
+// compute and graphics families (the buffers are shared between them)
+std::vector<std::uint32_t> shader_queue_families(const Device &device) {
+  std::vector<std::uint32_t> queue_fam;
+  for (const auto &q_fam : device.queues() | std::views::filter(std::not_fn(
+                                                 &std::vector<Queue>::empty))) {
+    const Queue &q = q_fam.front();
+    if (q.flags() &
+            (vk::QueueFlagBits::eCompute | vk::QueueFlagBits::eGraphics) &&
+        !std::ranges::contains(queue_fam, q.family())) {
+      queue_fam.push_back(q.family());
+    }
+  }
+  return queue_fam;
+}
+} // namespace
+
 BindlessManager::BindlessManager(const Device &device)
     : m_device(&device), m_layout(nullptr), m_pool(nullptr) {
 
   auto sizes = calculate_sizes(device);
+  bool const use_descriptor_buffer = descriptor_buffer_usable(device, sizes);
+
+  logger.Log("BindlessManager: using {}", use_descriptor_buffer
+                                              ? "a descriptor buffer"
+                                              : "a descriptor set");
+
+  // the set is written on submit - after command buffers of the frame have
+  //   bound it - so its resource bindings have to be update-after-bind
+  //   (not allowed with descriptor buffers, writes there are plain memory
+  //   writes anyway)
+  vk::DescriptorBindingFlags const binding_flags =
+      use_descriptor_buffer
+          ? vk::DescriptorBindingFlagBits::ePartiallyBound
+          : vk::DescriptorBindingFlagBits::eUpdateAfterBind |
+                vk::DescriptorBindingFlagBits::eUpdateUnusedWhilePending |
+                vk::DescriptorBindingFlagBits::ePartiallyBound;
+
+  if (!use_descriptor_buffer &&
+      !acceleration_structures_update_after_bind(device)) {
+    sizes[static_cast<std::uint32_t>(
+        BindlessType::eAccelerationStructureKHR)] = 0;
+  }
 
-  DescriptorSetLayoutInfo layout_ci;
+  DescriptorSetLayoutInfo layout_ci{
+      use_descriptor_buffer
+          ? vk::DescriptorSetLayoutCreateFlagBits::eDescriptorBufferEXT
+          : vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPool};
 
   for (auto [i, type, size] :
        std::views::zip(std::views::iota(0U), resource_types, sizes)) {
-    if (type == BindlessType::eAccelerationStructureKHR &&
-        !device.stats().has_extension(
-            vk::KHRAccelerationStructureExtensionName)) {
+    // not supported by the device (or not update-after-bind)
+    if (size == 0) {
       continue;
     }
 
-    layout_ci.add_binding(
-        i, BindlessResource::type_to_vk(type), vk::ShaderStageFlagBits::eAll,
-        size, {},
-        vk::DescriptorBindingFlagBits::eUpdateUnusedWhilePending |
-            vk::DescriptorBindingFlagBits::ePartiallyBound);
+    layout_ci.add_binding(i, BindlessResource::type_to_vk(type),
+                          vk::ShaderStageFlagBits::eAll, size, {},
+                          binding_flags);
   }
 
   if (is_debug) {
-    layout_ci.add_binding(resource_count, vk::DescriptorType::eUniformBuffer,
+    layout_ci.add_binding(version_binding, vk::DescriptorType::eUniformBuffer,
                           vk::ShaderStageFlagBits::eAll);
   }
+  layout_ci.add_binding(buffer_table_binding,
+                        vk::DescriptorType::eStorageBuffer,
+                        vk::ShaderStageFlagBits::eAll);
 
   m_layout = layout_ci.create(device);
 
+  if (use_descriptor_buffer) {
+    init_descriptor_buffer();
+  } else {
+    init_descriptor_set(sizes);
+  }
+
+  std::array<std::uint32_t, type_count> heap_sizes{};
+  std::ranges::copy(sizes, heap_sizes.begin());
+  heap_sizes[static_cast<std::uint32_t>(BindlessType::eBuffer)] =
+      buffer_table_size;
+
+  for (auto &&[heap, type, size] :
+       std::views::zip(m_heaps, handle_types, heap_sizes)) {
+    heap.setup(type, size);
+  }
+
+  init_buffer_table();
+
+  if (is_debug) {
+    init_version_buffer(heap_sizes);
+  }
+}
+
+bool BindlessManager::descriptor_buffer_usable(
+    const Device &device, std::span<const std::uint32_t> sizes) {
+  const auto *features =
+      device.stats()
+          .features.get<vk::PhysicalDeviceDescriptorBufferFeaturesEXT>();
+  if (features == nullptr || features->descriptorBuffer == vk::False) {
+    return false;
+  }
+
+  const auto &props =
+      *device.stats()
+           .properties.get<vk::PhysicalDeviceDescriptorBufferPropertiesEXT>();
+
+  // upper estimate of the layout size (alignment and the debug binding)
+  static constexpr vk::DeviceSize slack = 1024;
+  vk::DeviceSize needed = slack;
+  for (auto [type, size] : std::views::zip(resource_types, sizes)) {
+    needed += size * descriptor_size(props, type);
+  }
+
+  // the buffer is both a sampler and a resource descriptor buffer
+  vk::DeviceSize const limit = std::min({
+      props.maxSamplerDescriptorBufferRange,
+      props.maxResourceDescriptorBufferRange,
+      props.samplerDescriptorBufferAddressSpaceSize,
+      props.resourceDescriptorBufferAddressSpaceSize,
+      props.descriptorBufferAddressSpaceSize,
+  });
+
+  if (needed > limit) {
+    logger.Warning("BindlessManager: descriptor buffer would need {} bytes "
+                   "(max {}) - falling back to a descriptor set",
+                   needed, limit);
+    return false;
+  }
+
+  return true;
+}
+
+std::size_t BindlessManager::descriptor_size(
+    const vk::PhysicalDeviceDescriptorBufferPropertiesEXT &props,
+    BindlessType type) noexcept {
+  switch (type) {
+  case BindlessType::eSampler:
+    return props.samplerDescriptorSize;
+  case BindlessType::eSampledImage:
+    return props.sampledImageDescriptorSize;
+  case BindlessType::eStorageImage:
+    return props.storageImageDescriptorSize;
+  case BindlessType::eAccelerationStructureKHR:
+    return props.accelerationStructureDescriptorSize;
+  default:
+    assert(false && "invalid v4dg::BindlessType");
+    return 0;
+  }
+}
+
+void BindlessManager::init_descriptor_set(
+    std::span<const std::uint32_t> sizes) {
   std::vector<vk::DescriptorPoolSize> pool_sizes;
   for (auto [type, size] : std::views::zip(resource_types, sizes)) {
-    if (type == BindlessType::eAccelerationStructureKHR &&
-        !device.stats().has_extension(
-            vk::KHRAccelerationStructureExtensionName)) {
+    if (size == 0) {
       continue;
     }
 
@@ -129,8 +584,11 @@ BindlessManager::BindlessManager(const Device &device)
   if (is_debug) {
     pool_sizes.emplace_back(vk::DescriptorType::eUniformBuffer, 1);
   }
+  pool_sizes.emplace_back(vk::DescriptorType::eStorageBuffer, 1);
 
-  m_pool = {m_device->device(), {{}, layout_count, pool_sizes}};
+  m_pool = {m_device->device(),
+            {vk::DescriptorPoolCreateFlagBits::eUpdateAfterBind, layout_count,
+             pool_sizes}};
 
   auto sets = (*m_device->device())
                   .allocateDescriptorSets({*m_pool, *m_layout},
@@ -139,50 +597,78 @@ BindlessManager::BindlessManager(const Device &device)
   m_set = sets[0];
 
   m_device->setDebugName(m_set, "bindless set");
+}
 
-  for (auto &&[heap, type, size] :
-       std::views::zip(m_heaps, resource_types, sizes)) {
-    heap.setup(type, size);
+void BindlessManager::init_descriptor_buffer() {
+  const auto &props =
+      *m_device->stats()
+           .properties.get<vk::PhysicalDeviceDescriptorBufferPropertiesEXT>();
+
+  Buffer buffer{
+      *m_device,
+      m_layout.getSizeEXT(),
+      vk::BufferUsageFlagBits2KHR::eSamplerDescriptorBufferEXT |
+          vk::BufferUsageFlagBits2KHR::eResourceDescriptorBufferEXT |
+          vk::BufferUsageFlagBits2KHR::eShaderDeviceAddress,
+      {
+          vma::AllocationCreateFlagBits::eHostAccessSequentialWrite |
+              vma::AllocationCreateFlagBits::eMapped,
+          vma::MemoryUsage::eAuto,
+          vk::MemoryPropertyFlagBits::eHostCoherent,
+      },
+      {},
+      shader_queue_families(*m_device),
+  };
+
+  buffer->setName(*m_device, "bindless descriptor buffer");
+
+  auto ai = buffer->allocator().getAllocationInfo(buffer->allocation());
+
+  DescriptorBuffer db{
+      .buffer = std::move(buffer),
+      .data = static_cast<std::byte *>(ai.pMappedData),
+      .offsets = {},
+      .descriptor_sizes = {},
+  };
+
+  for (auto [i, type] : std::views::zip(std::views::iota(0U), resource_types)) {
+    db.descriptor_sizes[i] = descriptor_size(props, type);
+    if (type == BindlessType::eAccelerationStructureKHR &&
+        !m_device->stats().has_extension(
+            vk::KHRAccelerationStructureExtensionName)) {
+      continue;
+    }
+    db.offsets[i] = m_layout.getBindingOffsetEXT(i);
   }
 
-  if (!is_debug) {
-    return;
+  if (is_debug) {
+    db.offsets[version_binding] = m_layout.getBindingOffsetEXT(version_binding);
   }
+  db.offsets[buffer_table_binding] =
+      m_layout.getBindingOffsetEXT(buffer_table_binding);
+
+  m_descriptorBuffer = std::move(db);
+}
 
+void BindlessManager::init_version_buffer(
+    std::span<const std::uint32_t> sizes) {
   static constexpr auto size_alignment = 16;
 
-  std::size_t whole_size = sizeof(VersionBufferInfo);
+  // the header is followed by the version array of every type
+  std::size_t whole_size = sizeof(VersionBufferHeader);
   for (std::uint32_t const size : sizes) {
     whole_size = AlignUp(whole_size, size_alignment);
     whole_size += size * sizeof(std::uint8_t);
   }
 
-  std::vector<std::uint32_t> queue_fam;
-  for (const auto &q_fam : device.queues() | std::views::filter(std::not_fn(
-                                                 &std::vector<Queue>::empty))) {
-    if (!q_fam.empty()) {
-      const Queue &q = q_fam.front();
-      if (q.flags() &
-              (vk::QueueFlagBits::eCompute | vk::QueueFlagBits::eGraphics) &&
-          !std::ranges::contains(queue_fam, q.family())) {
-        queue_fam.push_back(q.family());
-      }
-    }
-  }
-
   Buffer version_buf{
       *m_device,
       whole_size,
       vk::BufferUsageFlagBits2KHR::eUniformBuffer |
           vk::BufferUsageFlagBits2KHR::eShaderDeviceAddress,
-      {
-          vma::AllocationCreateFlagBits::eHostAccessRandom |
-              vma::AllocationCreateFlagBits::eMapped,
-          vma::MemoryUsage::eAuto,
-          vk::MemoryPropertyFlagBits::eHostCoherent,
-      },
+      m_device->memoryPools().allocation_info(MemoryClass::SmallBuffer),
       {},
-      queue_fam,
+      shader_queue_families(*m_device),
   };
 
   version_buf->setName(*m_device, "bindless version buffer");
@@ -220,18 +706,68 @@ BindlessManager::BindlessManager(const Device &device)
 
   m_versionBuffer = {.buffer = std::move(version_buf), .info = info};
 
-  vk::DescriptorBufferInfo const buf_info{
-      m_versionBuffer->buffer->vk(),
-      0,
-      sizeof(VersionBufferHeader),
+  write_buffer_descriptor(version_binding, vk::DescriptorType::eUniformBuffer,
+                          m_versionBuffer->buffer, sizeof(VersionBufferHeader));
+}
+
+void BindlessManager::init_buffer_table() {
+  Buffer table{
+      *m_device,
+      buffer_table_size * sizeof(BindlessBufferEntry),
+      vk::BufferUsageFlagBits2KHR::eStorageBuffer |
+          vk::BufferUsageFlagBits2KHR::eShaderDeviceAddress,
+      m_device->memoryPools().allocation_info(MemoryClass::SmallBuffer),
+      {},
+      shader_queue_families(*m_device),
   };
+
+  table->setName(*m_device, "bindless buffer table");
+
+  auto ai = table->allocator().getAllocationInfo(table->allocation());
+  auto *entries = static_cast<BindlessBufferEntry *>(ai.pMappedData);
+
+  // the null handle points at nothing
+  entries[0] = {};
+
+  m_bufferTable = {.buffer = std::move(table), .entries = entries};
+
+  write_buffer_descriptor(buffer_table_binding,
+                          vk::DescriptorType::eStorageBuffer,
+                          m_bufferTable->buffer,
+                          buffer_table_size * sizeof(BindlessBufferEntry));
+}
+
+void BindlessManager::write_buffer_descriptor(std::uint32_t binding,
+                                              vk::DescriptorType type,
+                                              const Buffer &buffer,
+                                              vk::DeviceSize range) {
+  if (m_descriptorBuffer) {
+    const auto &props =
+        *m_device->stats()
+             .properties
+             .get<vk::PhysicalDeviceDescriptorBufferPropertiesEXT>();
+
+    vk::DescriptorAddressInfoEXT const address_info{buffer->deviceAddress(),
+                                                    range};
+    bool const is_uniform = type == vk::DescriptorType::eUniformBuffer;
+    m_device->device().getDescriptorEXT(
+        {type, is_uniform
+                   ? vk::DescriptorDataEXT{}.setPUniformBuffer(&address_info)
+                   : vk::DescriptorDataEXT{}.setPStorageBuffer(&address_info)},
+        is_uniform ? props.uniformBufferDescriptorSize
+                   : props.storageBufferDescriptorSize,
+        m_descriptorBuffer->data + m_descriptorBuffer->offsets[binding]);
+    return;
+  }
+
+  vk::DescriptorBufferInfo const buf_info{buffer->vk(), 0, range};
   m_device->device().updateDescriptorSets(
       {
           vk::WriteDescriptorSet{
               m_set,
-              resource_count,
+              binding,
               0,
-              vk::DescriptorType::eUniformBuffer,
+              type,
               {},
               buf_info,
               {},
@@ -240,6 +776,25 @@ BindlessManager::BindlessManager(const Device &device)
       {});
 }
 
+void BindlessManager::bind(const vk::raii::CommandBuffer &cb,
+                           vk::PipelineLayout pipelineLayout,
+                           vk::PipelineBindPoint bind_point) const {
+  if (!m_descriptorBuffer) {
+    cb.bindDescriptorSets(bind_point, pipelineLayout, 0, m_set, {});
+    return;
+  }
+
+  cb.bindDescriptorBuffersEXT(vk::DescriptorBufferBindingInfoEXT{
+      m_descriptorBuffer->buffer->deviceAddress(),
+      descriptor_buffer_usage,
+  });
+
+  std::uint32_t const buffer_index = 0;
+  vk::DeviceSize const offset = 0;
+  cb.setDescriptorBufferOffsetsEXT(bind_point, pipelineLayout, 0, buffer_index,
+                                   offset);
+}
+
 std::array<uint32_t, 4> BindlessManager::calculate_sizes(const Device &device) {
   std::array<uint32_t, 4> out{0, 0, 0, 0};
 
@@ -253,7 +808,8 @@ std::array<uint32_t, 4> BindlessManager::calculate_sizes(const Device &device) {
   auto &accel =
       properties.get<vk::PhysicalDeviceAccelerationStructurePropertiesKHR>();
 
-  // all have update after bind and partially bound
+  // the plain limits - the update-after-bind ones (used by the descriptor
+  //   set backend) are required to be at least as large
 
   for (auto &&[type, size] : std::views::zip(resource_types, out)) {
     uint32_t max_count = 0;
@@ -332,7 +888,7 @@ std::array<uint32_t, 4> BindlessManager::calculate_sizes(const Device &device) {
 UniqueBindlessResource BindlessManager::allocate(BindlessType type) {
   auto type_idx = static_cast<uint32_t>(type);
 
-  assert(type_idx < resource_count && "invalid BindlessType");
+  assert(type_idx < type_count && "invalid BindlessType");
 
   auto &heap = m_heaps[type_idx];
   UniqueBindlessResource resource{heap.allocate(), *this};
@@ -354,7 +910,7 @@ void BindlessManager::free(BindlessResource res) noexcept {
 
   auto type_idx = static_cast<std::uint32_t>(res.type());
 
-  if (type_idx >= resource_count) {
+  if (type_idx >= type_count) {
     assert(false && "invalid BindlessResource type");
     return;
   }
@@ -368,11 +924,197 @@ void BindlessManager::free(BindlessResource res) noexcept {
     values[res.index()] = std::numeric_limits<uint8_t>::max();
   }
 
+  if (m_has_writes.load(std::memory_order_acquire)) {
+    std::scoped_lock const _{m_write_mutex};
+    auto &pending = m_pending_writes[type_idx];
+    if (auto it = pending.find(res.index());
+        it != pending.end() && it->second.res == res) {
+      pending.erase(it);
+    }
+  }
+
   m_heaps[type_idx].free(res);
 }
 
+UniqueBindlessResource
+BindlessManager::allocate_buffer(vk::DeviceAddress address,
+                                 vk::DeviceSize size) {
+  auto res = allocate(BindlessType::eBuffer);
+  queue_write(res.get(), BindlessBufferEntry{address, size});
+  return res;
+}
+
+void BindlessManager::queue_write(BindlessResource res,
+                                  vk::DescriptorImageInfo image_info) {
+  assert(res.type() == BindlessType::eSampledImage ||
+         res.type() == BindlessType::eStorageImage ||
+         res.type() == BindlessType::eSampler);
+  queue_write(PendingWrite{.res = res, .image_info = image_info});
+}
+
+void BindlessManager::queue_write(BindlessResource res,
+                                  vk::AccelerationStructureKHR as) {
+  assert(res.type() == BindlessType::eAccelerationStructureKHR);
+  queue_write(PendingWrite{.res = res, .acceleration_structure = as});
+}
+
+void BindlessManager::queue_write(BindlessResource res,
+                                  BindlessBufferEntry buffer) {
+  assert(res.type() == BindlessType::eBuffer);
+  queue_write(PendingWrite{.res = res, .buffer = buffer});
+}
+
+void BindlessManager::queue_write(PendingWrite write) {
+  assert(write.res);
+
+  if (m_descriptorBuffer && write.res.type() != BindlessType::eBuffer) {
+    // the slot is not used by in-flight frames - nothing to wait for
+    write_descriptor(write);
+    return;
+  }
+
+  auto type_idx = static_cast<std::uint32_t>(write.res.type());
+
+  std::scoped_lock const _{m_write_mutex};
+  m_pending_writes[type_idx].insert_or_assign(write.res.index(), write);
+  m_has_writes.store(true, std::memory_order_release);
+}
+
+void BindlessManager::write_descriptor(const PendingWrite &write) const {
+  auto type_idx = static_cast<std::uint32_t>(write.res.type());
+  std::size_t const size = m_descriptorBuffer->descriptor_sizes[type_idx];
+
+  vk::DescriptorDataEXT data;
+  switch (write.res.type()) {
+  case BindlessType::eSampler:
+    data.setPSampler(&write.image_info.sampler);
+    break;
+  case BindlessType::eSampledImage:
+    data.setPSampledImage(&write.image_info);
+    break;
+  case BindlessType::eStorageImage:
+    data.setPStorageImage(&write.image_info);
+    break;
+  case BindlessType::eAccelerationStructureKHR:
+    data.setAccelerationStructure(
+        m_device->device().getAccelerationStructureAddressKHR(
+            {write.acceleration_structure}));
+    break;
+  default:
+    assert(false && "invalid v4dg::BindlessType");
+    return;
+  }
+
+  m_device->device().getDescriptorEXT(
+      {BindlessResource::type_to_vk(write.res.type()), data}, size,
+      m_descriptorBuffer->data + m_descriptorBuffer->offsets[type_idx] +
+          write.res.index() * size);
+}
+
+void BindlessManager::flush_writes() {
+  if (!m_has_writes.load(std::memory_order_acquire)) {
+    return;
+  }
+
+  ZoneScoped;
+
+  std::scoped_lock const _{m_write_mutex};
+
+  std::size_t total = 0;
+  for (const auto &pending : m_pending_writes) {
+    total += pending.size();
+  }
+
+  // reserved up front - the writes point into these
+  std::vector<vk::WriteDescriptorSet> writes;
+  std::vector<vk::DescriptorImageInfo> image_infos;
+  std::vector<vk::AccelerationStructureKHR> structures;
+  std::vector<vk::WriteDescriptorSetAccelerationStructureKHR> as_writes;
+  writes.reserve(total);
+  image_infos.reserve(total);
+  structures.reserve(total);
+  as_writes.reserve(total);
+
+  std::size_t copies = 0;
+
+  for (auto &&[type, pending] : std::views::zip(handle_types,
+                                                m_pending_writes)) {
+    auto sorted = pending.extract();
+    std::ranges::sort(sorted, {}, [](const auto &w) { return w.first; });
+
+    bool const is_as = type == BindlessType::eAccelerationStructureKHR;
+    bool const is_buffer = type == BindlessType::eBuffer;
+
+    for (std::size_t i = 0; i < sorted.size();) {
+      // the longest run of adjacent array elements
+      std::size_t count = 1;
+      while (i + count < sorted.size() &&
+             sorted[i + count].first == sorted[i].first + count) {
+        count++;
+      }
+
+      if (is_buffer) {
+        // plain memory - one contiguous copy per run
+        std::ranges::transform(
+            sorted | std::views::drop(i) | std::views::take(count),
+            m_bufferTable->entries + sorted[i].first,
+            [](const auto &w) { return w.second.buffer; });
+        copies++;
+        i += count;
+        continue;
+      }
+
+      auto write = write_for(sorted[i].second.res)
+                       .setDescriptorCount(static_cast<std::uint32_t>(count));
+
+      if (is_as) {
+        write.setPNext(&as_writes.emplace_back(
+            static_cast<std::uint32_t>(count),
+            structures.data() + structures.size()));
+        for (std::size_t j = i; j < i + count; j++) {
+          structures.push_back(sorted[j].second.acceleration_structure);
+        }
+      } else {
+        write.setPImageInfo(image_infos.data() + image_infos.size());
+        for (std::size_t j = i; j < i + count; j++) {
+          image_infos.push_back(sorted[j].second.image_info);
+        }
+      }
+
+      writes.push_back(write);
+      i += count;
+    }
+  }
+
+  if (!writes.empty()) {
+    m_device->device().updateDescriptorSets(writes, {});
+  }
+
+  // only now - free() skips the lock while this is clear, and the objects
+  //   written above must outlive the update
+  m_has_writes.store(false, std::memory_order_release);
+
+  logger.Debug("BindlessManager: flushed {} writes in {} ranges and {} "
+               "buffer table copies",
+               total, writes.size(), copies);
+}
+
+void BindlessManager::next_frame(std::size_t frame) noexcept {
+  for (auto &heap : m_heaps) {
+    heap.next_frame(frame);
+  }
+}
+
+std::array<BindlessHeapStats, BindlessManager::type_count>
+BindlessManager::stats() noexcept {
+  std::array<BindlessHeapStats, type_count> stats{};
+  std::ranges::transform(m_heaps, stats.begin(), &BindlessHeap::stats);
+  return stats;
+}
+
 vk::WriteDescriptorSet BindlessManager::write_for(BindlessResource res) const {
   assert(res);
+  assert(!m_descriptorBuffer && "no descriptor set with a descriptor buffer");
   return {
       m_set,
       static_cast<std::uint32_t>(res.type()), // binding
@@ -3,18 +3,25 @@
 #include "Device.hpp"
 #include "VulkanConstructs.hpp"
 #include "cppHelpers.hpp"
+#include "v4dgCore.hpp"
 
+#include <ankerl/unordered_dense.h>
 #include <vulkan/vulkan.hpp>
 #include <vulkan/vulkan_raii.hpp>
 
 #include <array>
+#include <atomic>
 #include <cassert>
+#include <cstddef>
 #include <cstdint>
-#include <deque>
+#include <memory>
 #include <mutex>
 #include <optional>
 #include <ranges>
+#include <span>
+#include <string_view>
 #include <utility>
+#include <vector>
 
 namespace v4dg {
 enum class BindlessType : std::uint8_t {
@@ -22,9 +29,12 @@ enum class BindlessType : std::uint8_t {
   eSampledImage,
   eStorageImage,
   eAccelerationStructureKHR,
+  // entry of the buffer device address table (not a descriptor)
+  eBuffer,
 };
 
 class BindlessManager;
+class BindlessHeap;
 class BindlessResource {
 public:
   BindlessResource() noexcept = default;
@@ -42,17 +52,22 @@ public:
   }
 
   static vk::DescriptorType type_to_vk(BindlessType) noexcept;
+  static std::string_view type_name(BindlessType) noexcept;
 
   auto operator<=>(const BindlessResource &) const = default;
   explicit operator bool() const { return valid(); }
   bool operator!() const { return !valid(); }
 
 private:
-  static constexpr uint32_t index_mask = (1 << 23) - 1;
+  // bit 31: valid, 30..25: version, 24..22: type, 21..0: index
+  //   (decoded by bindless.glsl; the type took 2 bits before eBuffer)
+  //   The version of an index wraps after 64 frees - BindlessHeap retires
+  //   the index for good instead, so a stale handle never validates again.
+  static constexpr uint32_t index_mask = (1 << 22) - 1;
   static constexpr uint32_t index_shift = 0;
 
-  static constexpr uint32_t type_mask = (1 << 2) - 1;
-  static constexpr uint32_t type_shift = 23;
+  static constexpr uint32_t type_mask = (1 << 3) - 1;
+  static constexpr uint32_t type_shift = 22;
 
   static constexpr uint32_t version_mask = (1 << 6) - 1;
   static constexpr uint32_t version_shift = 25;
@@ -77,6 +92,7 @@ private:
   static constexpr uint32_t max_count = index_mask + 1;
 
   friend class BindlessManager;
+  friend class BindlessHeap;
 
   uint32_t m_resource{0};
 };
@@ -111,13 +127,154 @@ private:
   BindlessManager *m_manager{nullptr};
 };
 
+struct BindlessHeapStats {
+  std::uint32_t capacity{};
+  // indices handed out at least once (the null resource excluded)
+  std::uint32_t high_water{};
+  std::uint32_t live{};
+  // freed but possibly still used by in-flight frames
+  std::uint32_t retired{};
+  // never reused - their version would wrap
+  std::uint32_t exhausted{};
+
+  [[nodiscard]] std::uint32_t free() const noexcept {
+    return high_water - live - retired - exhausted;
+  }
+  [[nodiscard]] double occupancy() const noexcept {
+    return capacity == 0 ? 0. : static_cast<double>(live) / capacity;
+  }
+  // share of the used index range not holding a live descriptor
+  [[nodiscard]] double fragmentation() const noexcept {
+    return high_water == 0
+               ? 0.
+               : static_cast<double>(high_water - live) / high_water;
+  }
+};
+
+// Allocator of the descriptor indices of a single BindlessType.
+//   Every thread allocates from and frees to a small cache of its own; the
+//   caches exchange batches of handles with global lock-free stacks, so the
+//   shared state is touched once per `batch_size` operations.
+//   Freed handles are retired to the current frame and only become
+//   allocatable again once next_frame() reaches that frame again (the GPU
+//   is done with it). Allocation is LIFO to reuse cache-warm descriptors.
+//   An index whose version wraps on a free is not reused at all.
+class BindlessHeap {
+public:
+  static constexpr std::uint32_t batch_size = 64;
+  static constexpr std::size_t thread_cache_count = 16;
+
+  BindlessHeap() = default;
+  BindlessHeap(const BindlessHeap &) = delete;
+  BindlessHeap(BindlessHeap &&) = delete;
+  BindlessHeap &operator=(const BindlessHeap &) = delete;
+  BindlessHeap &operator=(BindlessHeap &&) = delete;
+  ~BindlessHeap();
+
+  // not thread-safe; forgets all allocations
+  void setup(BindlessType type, std::uint32_t max_count);
+
+  BindlessResource allocate();
+  void free(BindlessResource res) noexcept;
+
+  // recycle the handles retired in `frame` and retire to it from now on;
+  //   call once the GPU finished the previous use of `frame`
+  void next_frame(std::size_t frame) noexcept;
+
+  [[nodiscard]] BindlessHeapStats stats() noexcept;
+
+private:
+  // bookkeeping of a free index; the first index of a batch links the batch
+  struct link {
+    std::atomic<std::uint32_t> next_batch{0};
+    std::uint32_t next{0};
+    std::uint32_t size{0};
+    std::uint8_t version{0};
+  };
+  static constexpr std::uint32_t chunk_size = 4096;
+
+  struct alignas(cache_line_size) thread_cache {
+    std::atomic_flag busy;
+    std::vector<BindlessResource> free;
+
+    // freed in `retired_frame`, not yet pushed to the frame's stack
+    std::vector<BindlessResource> retired;
+    std::size_t retired_frame{0};
+
+    // allocations - frees done through this cache (may be negative)
+    std::int64_t live{0};
+  };
+
+  // (ABA tag << 32) | first index of the top batch
+  using batch_stack = std::atomic<std::uint64_t>;
+
+  BindlessType m_type{};
+  std::uint32_t m_max_count{};
+
+  // next never allocated index
+  alignas(cache_line_size) std::atomic<std::uint32_t> m_count{0};
+  alignas(cache_line_size) batch_stack m_stack{0};
+
+  // frame that frees are retired to
+  alignas(cache_line_size) std::atomic<std::size_t> m_frame{0};
+  per_frame<batch_stack> m_retired{};
+  per_frame<std::atomic<std::uint32_t>> m_retired_count{};
+  std::atomic<std::uint32_t> m_exhausted{0};
+
+  // lazily allocated storage of the links, chunk_size links each
+  std::unique_ptr<std::atomic<link *>[]> m_chunks;
+  std::array<thread_cache, thread_cache_count> m_caches;
+
+  [[nodiscard]] std::uint32_t chunk_count() const noexcept {
+    return (m_max_count + chunk_size - 1) / chunk_size;
+  }
+  link &link_of(std::uint32_t index) noexcept;
+  void ensure_links(std::uint32_t begin, std::uint32_t end);
+  void release_links() noexcept;
+
+  thread_cache &acquire_cache() noexcept;
+  static void lock_cache(thread_cache &cache) noexcept;
+
+  // links the handles of the batch; returns its first index
+  std::uint32_t link_batch(std::span<const BindlessResource> batch) noexcept;
+  void push_batch(batch_stack &stack,
+                  std::span<const BindlessResource> batch) noexcept;
+  void push_chain(batch_stack &stack, std::uint32_t first,
+                  std::uint32_t last) noexcept;
+  bool pop_batch(std::vector<BindlessResource> &out) noexcept;
+  bool reserve_fresh(std::vector<BindlessResource> &out);
+  bool steal(thread_cache &self) noexcept;
+
+  void retire(thread_cache &cache) noexcept;
+};
+
+// entry of the bindless buffer table (`BindlessBuffer` in bindless.glsl)
+struct BindlessBufferEntry {
+  vk::DeviceAddress address;
+  vk::DeviceSize size;
+};
+
 class BindlessManager {
 public:
   static constexpr std::uint32_t layout_count = 1;
+  // types backed by descriptors (binding == type)
   static constexpr std::uint32_t resource_count = 4;
   static constexpr auto resource_types =
       std::views::iota(0U, resource_count) |
       detail::views::static_casted<BindlessType>;
+  // all handle types (+ buffer table entries)
+  static constexpr std::uint32_t type_count = resource_count + 1;
+  static constexpr auto handle_types =
+      std::views::iota(0U, type_count) |
+      detail::views::static_casted<BindlessType>;
+
+  // debug builds only (BINDLESS_CHECK_BUFFER)
+  static constexpr std::uint32_t version_binding = resource_count;
+  // storage buffer of BindlessBufferEntry
+  static constexpr std::uint32_t buffer_table_binding = resource_count + 1;
+  static constexpr std::uint32_t binding_count = resource_count + 2;
+
+  static constexpr std::uint32_t buffer_table_size = 1 << 16;
 
   explicit BindlessManager(const Device &device);
 
@@ -125,13 +282,27 @@ public:
 
   void bind(const vk::raii::CommandBuffer &cb,
             vk::PipelineLayout pipelineLayout,
-            vk::PipelineBindPoint bind_point) const {
-    cb.bindDescriptorSets(bind_point, pipelineLayout, 0, m_set, {});
+            vk::PipelineBindPoint bind_point) const;
+
+  // descriptors live in a VK_EXT_descriptor_buffer instead of a set
+  [[nodiscard]] bool uses_descriptor_buffer() const noexcept {
+    return m_descriptorBuffer.has_value();
+  }
+  // must be added to every pipeline using the bindless layout
+  [[nodiscard]] vk::PipelineCreateFlags pipeline_flags() const noexcept {
+    return uses_descriptor_buffer()
+               ? vk::PipelineCreateFlagBits::eDescriptorBufferEXT
+               : vk::PipelineCreateFlags{};
   }
 
   UniqueBindlessResource allocate(BindlessType type);
   void free(BindlessResource res) noexcept;
 
+  // allocates a buffer table entry for `size` bytes at `address`
+  //   (the caller keeps the buffer alive as long as the handle)
+  UniqueBindlessResource allocate_buffer(vk::DeviceAddress address,
+                                         vk::DeviceSize size);
+
   [[nodiscard]] vk::WriteDescriptorSet write_for(BindlessResource res) const;
   vk::WriteDescriptorSet write_for(BindlessResource res,
                                    vk::DescriptorImageInfo &image_info) const {
@@ -147,33 +318,35 @@ public:
     return write_for(res).setPNext(&as_info);
   }
 
-private:
-  class BindlessHeap {
-  public:
-    BindlessHeap() = default;
-    void setup(BindlessType type, uint32_t max_count);
-
-    BindlessResource allocate();
-    void free(BindlessResource);
+  // Queue the descriptor of `res` to be written by the next flush_writes().
+  //   Thread-safe; a later write to the same handle replaces the earlier one
+  //   and writes of handles freed before the flush are dropped.
+  //   With a descriptor buffer the descriptor is written immediately
+  //   (buffer table entries are always batched).
+  void queue_write(BindlessResource res, vk::DescriptorImageInfo image_info);
+  void queue_write(BindlessResource res, vk::AccelerationStructureKHR as);
+  void queue_write(BindlessResource res, BindlessBufferEntry buffer);
 
-  private:
-    BindlessType m_type{};
+  // Apply the queued writes, merging adjacent array elements into ranged
+  //   writes (copies for the buffer table). Called before every queue
+  //   submission - the set is update-after-bind so this may happen after
+  //   the command buffers have bound it.
+  void flush_writes();
 
-    uint32_t m_max_count{};
-    uint32_t m_count{0};
+  // see BindlessHeap::next_frame()
+  void next_frame(std::size_t frame) noexcept;
 
-    std::mutex m_mutex;
-    std::deque<BindlessResource> m_free;
-  };
+  [[nodiscard]] std::array<BindlessHeapStats, type_count> stats() noexcept;
 
+private:
   struct VersionBufferHeader {
-    std::array<std::uint32_t, resource_count> maxHandles;
-    std::array<vk::DeviceAddress, resource_count> versionBuffers;
+    std::array<std::uint32_t, type_count> maxHandles;
+    std::array<vk::DeviceAddress, type_count> versionBuffers;
   };
 
   struct VersionBufferInfo {
     VersionBufferHeader *buffers_header;
-    std::array<std::uint8_t *, resource_count> versionBuffers;
+    std::array<std::uint8_t *, type_count> versionBuffers;
   };
 
   const Device *m_device;
@@ -189,9 +362,58 @@ private:
   std::optional<VersionBuffer> m_versionBuffer;
   vk::DescriptorSet m_set;
 
-  std::array<BindlessHeap, resource_count> m_heaps;
+  // VK_EXT_descriptor_buffer backend (replaces m_pool and m_set)
+  struct DescriptorBuffer {
+    Buffer buffer;
+    std::byte *data;
+    // per binding
+    std::array<vk::DeviceSize, binding_count> offsets;
+    std::array<std::size_t, resource_count> descriptor_sizes;
+  };
+  std::optional<DescriptorBuffer> m_descriptorBuffer;
+
+  std::array<BindlessHeap, type_count> m_heaps;
+
+  // persistently mapped - device local if the heap is host visible
+  struct BufferTable {
+    Buffer buffer;
+    BindlessBufferEntry *entries;
+  };
+  std::optional<BufferTable> m_bufferTable;
+
+  struct PendingWrite {
+    BindlessResource res;
+    vk::DescriptorImageInfo image_info;
+    vk::AccelerationStructureKHR acceleration_structure;
+    BindlessBufferEntry buffer;
+  };
+
+  // held while flushing so that a handle cannot be freed (and its object
+  //   destroyed) between being taken from the queue and written;
+  //   m_has_writes is cleared only once the writes are done
+  std::mutex m_write_mutex;
+  std::atomic<bool> m_has_writes{false};
+  // by index, per BindlessType
+  std::array<ankerl::unordered_dense::map<std::uint32_t, PendingWrite>,
+             type_count>
+      m_pending_writes;
+
+  void queue_write(PendingWrite write);
+  void write_descriptor(const PendingWrite &write) const;
+
+  void init_descriptor_set(std::span<const std::uint32_t> sizes);
+  void init_descriptor_buffer();
+  void init_buffer_table();
+  void init_version_buffer(std::span<const std::uint32_t> sizes);
+  void write_buffer_descriptor(std::uint32_t binding, vk::DescriptorType type,
+                               const Buffer &buffer, vk::DeviceSize range);
 
   static std::array<uint32_t, resource_count>
   calculate_sizes(const Device &device);
+  static bool descriptor_buffer_usable(const Device &device,
+                                       std::span<const std::uint32_t> sizes);
+  static std::size_t
+  descriptor_size(const vk::PhysicalDeviceDescriptorBufferPropertiesEXT &props,
+                  BindlessType type) noexcept;
 };
 } // namespace v4dg
@@ -1,6 +1,7 @@
 #include "CommandBuffer.hpp"
 
 #include "DSAllocator.hpp"
+#include "GpuProfiler.hpp"
 #include "cppHelpers.hpp"
 #include "v4dgCore.hpp"
 #include "v4dgVulkan.hpp"
@@ -16,6 +17,7 @@
 #include <mutex>
 #include <optional>
 #include <ranges>
+#include <source_location>
 #include <span>
 #include <stdexcept>
 #include <tuple>
@@ -27,10 +29,12 @@ using namespace v4dg;
 CommandBuffer::CommandBuffer(vulkan_raii_view<vk::raii::CommandBuffer> &&other,
                              const Device &device, DSAllocator DSallocator,
                              std::uint32_t family_index,
-                             std::unique_lock<std::mutex> lock)
+                             std::unique_lock<std::mutex> lock,
+                             GpuProfiler *profiler, std::uint32_t frame)
     : vulkan_raii_view<vk::raii::CommandBuffer>(std::move(other)),
       m_device(&device), m_ds_allocator(std::move(DSallocator)),
-      m_lock(std::move(lock)), m_queue_family_index(family_index) {}
+      m_lock(std::move(lock)), m_queue_family_index(family_index),
+      m_profiler(profiler), m_frame(frame) {}
 
 void CommandBuffer::beginDebugLabel(zstring_view name,
                                     glm::vec4 color) noexcept {
@@ -58,6 +62,53 @@ void CommandBuffer::insertDebugLabel(zstring_view name,
       {name.data(), {color.r, color.g, color.b, color.a}});
 }
 
+std::uint32_t
+CommandBuffer::beginGpuZone(zstring_view name, glm::vec4 color,
+                            const std::source_location &loc) noexcept {
+  if (m_profiler == nullptr) {
+    return GpuProfiler::invalid_zone;
+  }
+  const vk::raii::CommandBuffer &cb = *this;
+  return m_profiler->begin_zone(cb, m_frame, name, color, loc);
+}
+
+void CommandBuffer::endGpuZone(std::uint32_t zone) noexcept {
+  if (m_profiler == nullptr) {
+    return;
+  }
+  const vk::raii::CommandBuffer &cb = *this;
+  m_profiler->end_zone(cb, m_frame, zone);
+}
+
+bool CommandBuffer::transient_sets_supported(const Device &device,
+                                             bool descriptor_buffer) noexcept {
+  if (!descriptor_buffer) {
+    return true;
+  }
+
+  const auto *props =
+      device.stats()
+          .properties.get<vk::PhysicalDeviceDescriptorBufferPropertiesEXT>();
+  return props != nullptr && props->bufferlessPushDescriptors == vk::True;
+}
+
+vk::DescriptorSetLayoutCreateFlags
+CommandBuffer::transient_set_layout_flags(bool descriptor_buffer) noexcept {
+  vk::DescriptorSetLayoutCreateFlags flags =
+      vk::DescriptorSetLayoutCreateFlagBits::ePushDescriptorKHR;
+  // all set layouts of a pipeline layout agree on this
+  if (descriptor_buffer) {
+    flags |= vk::DescriptorSetLayoutCreateFlagBits::eDescriptorBufferEXT;
+  }
+  return flags;
+}
+
+void CommandBuffer::bindTransientSet(
+    vk::PipelineBindPoint bindPoint, vk::PipelineLayout layout,
+    std::uint32_t set, std::span<const vk::WriteDescriptorSet> writes) {
+  (*this)->pushDescriptorSetKHR(bindPoint, layout, set, writes);
+}
+
 CommandBuffer &SubmitGroup::bind_command_buffer(std::size_t index,
                                                 CommandBuffer cb) {
   if (index >= m_command_buffer_wrappers.size()) {
@@ -3,6 +3,7 @@
 #include "Constants.hpp"
 #include "DSAllocator.hpp"
 #include "Device.hpp"
+#include "ResourceRegistry.hpp"
 #include "cppHelpers.hpp"
 #include "v4dgVulkan.hpp"
 
@@ -14,17 +15,20 @@
 #include <cstdint>
 #include <mutex>
 #include <optional>
+#include <source_location>
 #include <span>
 #include <utility>
 #include <vector>
 
 namespace v4dg {
+class GpuProfiler;
 class SubmitGroup;
 class CommandBuffer : public vulkan_raii_view<vk::raii::CommandBuffer> {
 public:
   CommandBuffer(vulkan_raii_view<vk::raii::CommandBuffer> &&, const Device &,
                 DSAllocator DSallocator, std::uint32_t,
-                std::unique_lock<std::mutex>);
+                std::unique_lock<std::mutex>, GpuProfiler *profiler = nullptr,
+                std::uint32_t frame = 0);
 
   void beginDebugLabel(zstring_view name,
                        glm::vec4 color = constants::vBlack) noexcept;
@@ -32,16 +36,45 @@ public:
   void insertDebugLabel(zstring_view name,
                         glm::vec4 color = constants::vBlack) noexcept;
 
+  // GPU timestamp zone (no-op if the queue has no profiler)
+  [[nodiscard]] std::uint32_t
+  beginGpuZone(zstring_view name, glm::vec4 color = constants::vBlack,
+               const std::source_location &loc =
+                   std::source_location::current()) noexcept;
+  void endGpuZone(std::uint32_t zone) noexcept;
+
+  // debug label + GPU timestamp zone
   [[nodiscard]] auto
-  debugLabelScope(zstring_view name,
-                  glm::vec4 color = constants::vBlack) noexcept {
+  debugLabelScope(zstring_view name, glm::vec4 color = constants::vBlack,
+                  const std::source_location &loc =
+                      std::source_location::current()) noexcept {
     beginDebugLabel(name, color);
-    return detail::destroy_helper([this] { endDebugLabel(); });
+    auto zone = beginGpuZone(name, color, loc);
+    return detail::destroy_helper([this, zone] {
+      endGpuZone(zone);
+      endDebugLabel();
+    });
   }
 
   [[nodiscard]] auto &device() const noexcept { return *m_device; }
   [[nodiscard]] auto &ds_allocator() noexcept { return m_ds_allocator; }
 
+  // Small transient sets are pushed with VK_KHR_push_descriptor (a required
+  //   extension) - no pool allocation.
+  //   Pipelines created with eDescriptorBufferEXT can only push without a
+  //   push descriptor buffer (bufferlessPushDescriptors); false if the
+  //   device cannot do that.
+  [[nodiscard]] static bool
+  transient_sets_supported(const Device &device,
+                           bool descriptor_buffer) noexcept;
+  // the set layout of bindTransientSet() must be created with these
+  [[nodiscard]] static vk::DescriptorSetLayoutCreateFlags
+  transient_set_layout_flags(bool descriptor_buffer) noexcept;
+  // The dstSet of the writes is ignored.
+  void bindTransientSet(vk::PipelineBindPoint bindPoint,
+                        vk::PipelineLayout layout, std::uint32_t set,
+                        std::span<const vk::WriteDescriptorSet> writes);
+
   template <typename... Chain>
   void barrier(vk::DependencyFlags flags,
                vk::ArrayProxy<const vk::MemoryBarrier2> memoryBarriers,
@@ -58,6 +91,8 @@ public:
   void end() noexcept {
     (*this)->end();
     m_lock = {};
+    // on the recording thread - per-worker pools are not synchronized
+    m_ds_allocator.release();
     ended = true;
   }
 
@@ -74,6 +109,13 @@ public:
   void add_resource(DestructionItem resource) {
     m_resources.push(std::move(resource));
   }
+  // registry resources are released once the command buffer completes
+  template <typename Handle>
+  void add_resource(UniqueResource<Handle> resource) {
+    m_resources.push([resource = std::move(resource)]() mutable noexcept {
+      resource.reset();
+    });
+  }
 
   [[nodiscard]] std::uint32_t queueFamily() const noexcept {
     return m_queue_family_index;
@@ -88,6 +130,9 @@ private:
 
   std::uint32_t m_queue_family_index;
 
+  GpuProfiler *m_profiler;
+  std::uint32_t m_frame;
+
   std::vector<vk::SemaphoreSubmitInfo> m_waits;
   std::vector<vk::SemaphoreSubmitInfo> m_signals;
 
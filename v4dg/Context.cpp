@@ -5,6 +5,8 @@
 #include "DSAllocator.hpp"
 #include "Debug.hpp"
 #include "Device.hpp"
+#include "GpuProfiler.hpp"
+#include "PipelineCache.hpp"
 #include "Queue.hpp"
 #include "cppHelpers.hpp"
 #include "v4dgCore.hpp"
@@ -14,16 +16,18 @@
 
 #include <array>
 #include <bit>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
 #include <exception>
-#include <ios>
+#include <format>
 #include <limits>
 #include <memory>
 #include <mutex>
 #include <optional>
 #include <ranges>
 #include <span>
+#include <string_view>
 #include <thread>
 #include <utility>
 #include <vector>
@@ -43,7 +47,12 @@ PerQueueFamily::PerQueueFamily(Context &ctx, const Queue &queue)
       m_command_buffer_managers{
           make_per_frame<command_buffer_manager>(m_ctx->vkDevice(),
                                                  m_queue->family()),
-      } {}
+      },
+      m_profiler(queue.timestampValidBits() != 0
+                     ? std::make_unique<GpuProfiler>(
+                           m_ctx->device(), queue,
+                           std::format("queue fam-{}", queue.family()))
+                     : nullptr) {}
 
 void PerQueueFamily::submit(std::span<SubmitionInfo> infos, vk::Fence fence) {
   ZoneScoped;
@@ -52,6 +61,10 @@ void PerQueueFamily::submit(std::span<SubmitionInfo> infos, vk::Fence fence) {
     return;
   }
 
+  // descriptors used by the submitted command buffers (update-after-bind,
+  //   so valid after recording)
+  m_ctx->bindlessManager().flush_writes();
+
   std::scoped_lock const _{queue_mutex()};
 
   infos.back().signals.emplace_back(
@@ -97,51 +110,165 @@ PerQueueFamily::getCommandBuffer(vk::CommandBufferLevel level,
       m_ctx->get_frame_ctx().m_ds_allocator,
       queue().family(),
       std::unique_lock(m_cbm_mutex),
+      m_profiler.get(),
+      m_ctx->frame_ref(),
   };
 }
 
 void PerQueueFamily::flush_frame(std::uint32_t frame) {
   m_command_buffer_managers[frame].reset();
+
+  if (m_profiler) {
+    m_profiler->collect(frame);
+  }
 }
 
 Context::Context(const Config &cfg, const Device &dev,
                  const std::optional<DSAllocatorWeights> &weights)
     : m_cfg(cfg), m_instance(dev.instance()), m_device(dev),
       m_main_thread_id(std::this_thread::get_id()), m_families(getFamilies()),
+      m_ds_tuner(weights.or_else([&] {
+                          return DSAllocatorWeights::load(
+                              get_ds_weights_path());
+                        })
+                     .value_or(default_weights(dev))),
+      m_store_ds_weights(!weights),
       m_per_frame{
-          make_per_frame<PerFrame>(vkDevice(), m_families.size(),
-                                   weights.value_or(default_weights(dev)))},
+          make_per_frame<PerFrame>(vkDevice(), m_families.size(), m_ds_tuner)},
       m_pipeline_cache(nullptr), m_bindless_manager(device()) {
   auto &graphics_queue = get_queue(PerQueueFamily::Type::Graphics);
   uint32_t const graphics_family = graphics_queue->queue().family();
 
   m_per_thread.reserve(m_executor.num_workers());
   for (size_t i{}; i < m_executor.num_workers(); ++i) {
-    m_per_thread.emplace_back(vkDevice(), graphics_family);
+    m_per_thread.emplace_back(vkDevice(), graphics_family, m_ds_tuner);
   }
 
-  auto pipeline_cache_data =
-      GetFileString(get_pipeline_cache_path()).value_or(std::string{});
-  m_pipeline_cache = vkDevice().createPipelineCache(
-      {{}, pipeline_cache_data.size(), pipeline_cache_data.data()});
+  // evicted handles may still be used by in-flight frames
+  auto retire = [this](std::shared_ptr<const void> handle) {
+    get_frame_ctx().m_destruction_stack.push(std::move(handle));
+  };
+  m_graphics_pipelines.set_retire_hook(retire);
+  m_compute_pipelines.set_retire_hook(retire);
+  m_samplers.set_retire_hook(retire);
+  m_descriptor_set_layouts.set_retire_hook(retire);
+  m_pipeline_layouts.set_retire_hook(retire);
+
+  m_samplers.set_lru_budget(sampler_cache_budget);
+
+  // start empty and load the on-disk cache in the background
+  m_pipeline_cache = vkDevice().createPipelineCache({});
+  m_pipeline_cache_data =
+      m_executor
+          .async([path = get_pipeline_cache_path(), &stats = dev.stats()] {
+            return load_pipeline_cache(path, stats);
+          })
+          .share();
 }
 
 Context::~Context() {
   try {
     cleanup();
-    auto data = m_pipeline_cache.getData();
-    std::ofstream(get_pipeline_cache_path(), std::ios::binary)
-        .write(reinterpret_cast<const char *>(data.data()),
-               static_cast<std::streamsize>(data.size()));
+    save_pipeline_cache();
+    if (m_store_ds_weights) {
+      m_ds_tuner.learned_weights().store(get_ds_weights_path());
+    }
+
+    // handles retired by the last flush_caches() (the device is idle)
+    for (auto &frame : m_per_frame) {
+      frame.m_destruction_stack.flush();
+    }
   } catch (const std::exception &e) {
     logger.Error("Exception in Context destructor: {}", e.what());
   }
 }
 
+vk::raii::PipelineCache &Context::pipeline_cache() {
+  int const id = m_executor.this_worker_id();
+  if (id == -1) {
+    return m_pipeline_cache;
+  }
+
+  auto &cache = m_per_thread[id].m_pipeline_cache;
+  if (*cache) {
+    return cache;
+  }
+
+  // let the worker do other tasks while the file is still being loaded
+  m_executor.corun_until([&] {
+    return m_pipeline_cache_data.wait_for(std::chrono::seconds{0}) ==
+           std::future_status::ready;
+  });
+
+  std::span<const std::byte> initial_data;
+  try {
+    initial_data = m_pipeline_cache_data.get();
+  } catch (const std::exception &e) {
+    logger.Warning("Could not load pipeline cache: {}", e.what());
+  }
+
+  cache = vk::raii::PipelineCache{
+      vkDevice(),
+      {vk::PipelineCacheCreateFlagBits::eExternallySynchronized,
+       initial_data.size(), initial_data.data()}};
+  device().setDebugName(cache, "pipeline cache (worker {})", id);
+
+  return cache;
+}
+
+void Context::merge_loaded_pipeline_cache() {
+  if (m_pipeline_cache_merged ||
+      m_pipeline_cache_data.wait_for(std::chrono::seconds{0}) !=
+          std::future_status::ready) {
+    return;
+  }
+
+  m_pipeline_cache_merged = true;
+
+  try {
+    const auto &data = m_pipeline_cache_data.get();
+    if (data.empty()) {
+      return;
+    }
+
+    vk::raii::PipelineCache const loaded{vkDevice(),
+                                         {{}, data.size(), data.data()}};
+    m_pipeline_cache.merge(*loaded);
+  } catch (const std::exception &e) {
+    logger.Warning("Could not load pipeline cache: {}", e.what());
+  }
+}
+
+void Context::save_pipeline_cache() {
+  ZoneScoped;
+  assert(std::this_thread::get_id() == m_main_thread_id);
+
+  // worker caches are externally synchronized
+  m_executor.wait_for_all();
+
+  merge_loaded_pipeline_cache();
+
+  std::vector<vk::PipelineCache> thread_caches;
+  for (const auto &per_thread : m_per_thread) {
+    if (*per_thread.m_pipeline_cache) {
+      thread_caches.push_back(*per_thread.m_pipeline_cache);
+    }
+  }
+
+  if (!thread_caches.empty()) {
+    m_pipeline_cache.merge(thread_caches);
+  }
+
+  auto data = m_pipeline_cache.getData();
+  store_pipeline_cache(get_pipeline_cache_path(),
+                       std::as_bytes(std::span{data}));
+}
+
 void Context::cleanup() {
   m_executor.wait_for_all();
   vkDevice().waitIdle();
 
+  m_defragmenter.stop();
   for (size_t i{}; i < max_frames_in_flight; ++i) {
     next_frame();
   }
@@ -281,6 +408,12 @@ void Context::next_frame() {
   logger.Debug("  waiting ended");
   logger.Debug("moving to frame {}", m_frame_idx);
 
+  merge_loaded_pipeline_cache();
+  m_memory_budget.next_frame(device().allocator(), m_frame_idx);
+
+  // before the pools are recycled - they drop outdated shapes
+  m_ds_tuner.end_frame();
+
   {
     ZoneScopedN("clear stacks");
 
@@ -294,6 +427,59 @@ void Context::next_frame() {
       }
     }
   }
+
+  // the GPU is done with the previous use of this frame
+  m_bindless_manager.next_frame(frame_ref());
+  m_resources.collect(completed_timeline());
+  // after the flush - a finished pass ends there
+  m_defragmenter.next_frame(m_frame_idx);
+
+  // after clearing - evicted handles go to this frame's destruction stack
+  flush_caches();
+}
+
+static_assert(timeline_count == PerQueueFamily::QueueTypes.size());
+
+timeline_point Context::submitted_timeline() {
+  timeline_point point{};
+  for (auto [i, q] : std::views::enumerate(m_families)) {
+    if (q) {
+      std::scoped_lock const _{q->queue_mutex()};
+      point[i] = q->semaphore_value();
+    }
+  }
+  return point;
+}
+
+timeline_point Context::completed_timeline() const {
+  timeline_point point{};
+  for (auto [i, q] : std::views::enumerate(m_families)) {
+    if (q) {
+      point[i] = q->semaphore().getCounterValue();
+    }
+  }
+  return point;
+}
+
+void Context::flush_caches() {
+  ZoneScoped;
+
+  m_graphics_pipelines.flush();
+  m_compute_pipelines.flush();
+  m_samplers.flush();
+  m_descriptor_set_layouts.flush();
+  m_pipeline_layouts.flush();
+}
+
+std::vector<std::pair<std::string_view, handle_cache_stats>>
+Context::cache_stats() {
+  return {
+      {"graphics pipelines", m_graphics_pipelines.stats()},
+      {"compute pipelines", m_compute_pipelines.stats()},
+      {"samplers", m_samplers.stats()},
+      {"descriptor set layouts", m_descriptor_set_layouts.stats()},
+      {"pipeline layouts", m_pipeline_layouts.stats()},
+  };
 }
 
 DSAllocatorWeights Context::default_weights(const Device & /*dev*/) {
@@ -320,3 +506,15 @@ DSAllocatorWeights Context::default_weights(const Device & /*dev*/) {
 std::filesystem::path Context::get_pipeline_cache_path() const {
   return m_cfg.cache_dir() / "pipeline_cache.bin";
 }
+
+std::filesystem::path Context::get_ds_weights_path() const {
+  return m_cfg.cache_dir() / "descriptor_pool_weights.txt";
+}
+
+vk::DescriptorSetLayout
+Context::descriptor_set_layout(const DescriptorSetLayoutInfo &info) {
+  vk::DescriptorSetLayout const layout = *m_descriptor_set_layouts.get(info);
+  m_ds_tuner.describe_layout(layout, info.get_bindings(),
+                             info.get_binding_flags());
+  return layout;
+}
@@ -5,8 +5,12 @@
 #include "CommandBufferManager.hpp"
 #include "Config.hpp"
 #include "DSAllocator.hpp"
+#include "Defragmenter.hpp"
 #include "Device.hpp"
+#include "GpuProfiler.hpp"
+#include "MemoryPools.hpp"
 #include "Queue.hpp"
+#include "ResourceRegistry.hpp"
 #include "Swapchain.hpp"
 #include "VulkanCaches.hpp"
 #include "v4dgCore.hpp"
@@ -19,10 +23,12 @@
 #include <cstddef>
 #include <cstdint>
 #include <filesystem>
+#include <future>
 #include <memory>
 #include <mutex>
 #include <optional>
 #include <span>
+#include <string_view>
 #include <thread>
 #include <utility>
 #include <vector>
@@ -88,8 +94,14 @@ public:
       command_buffer_manager::category cat =
           command_buffer_manager::category::c0_100);
 
+  // reads back GPU timings of `frame` too
   void flush_frame(std::uint32_t frame);
 
+  // nullptr if the queue does not support timestamps
+  [[nodiscard]] GpuProfiler *profiler() const noexcept {
+    return m_profiler.get();
+  }
+
 private:
   Context *m_ctx;
   std::mutex m_queue_mutex;
@@ -101,14 +113,16 @@ private:
 
   std::mutex m_cbm_mutex;
   per_frame<command_buffer_manager> m_command_buffer_managers;
+
+  std::unique_ptr<GpuProfiler> m_profiler;
 };
 
 struct PerFrame {
   PerFrame(const vk::raii::Device &device, std::size_t queues,
-           DSAllocatorWeights weights)
+           DSAllocatorTuner &ds_tuner)
       : m_semaphore_ready_values(queues, 0), m_image_ready(device, {{}, {}}),
         m_render_finished(device, {{}, {}}),
-        m_ds_allocator(device, std::move(weights)) {}
+        m_ds_allocator(device, ds_tuner, false, 1) {}
 
   void flush() {
     m_ds_allocator.advance_frame();
@@ -119,6 +133,7 @@ struct PerFrame {
   vk::raii::Semaphore m_image_ready;
   vk::raii::Semaphore m_render_finished;
 
+  // rotated with the frame - a single storage of its own
   DSAllocatorPool m_ds_allocator;
 
   // for the main thread
@@ -127,12 +142,16 @@ struct PerFrame {
 
 struct PerThread {
   struct PerFrame {
-    PerFrame(const vk::raii::Device &device, uint32_t graphics_family)
-        : m_command_buffer_manager(device, graphics_family) {}
+    PerFrame(const vk::raii::Device &device, uint32_t graphics_family,
+             DSAllocatorTuner &ds_tuner)
+        : m_command_buffer_manager(device, graphics_family),
+          m_ds_allocator(std::make_unique<DSAllocatorPool>(device, ds_tuner,
+                                                           true, 1)) {}
 
     void flush() {
       m_destruction_stack.flush();
       m_command_buffer_manager.reset();
+      m_ds_allocator->advance_frame();
     }
 
     DestructionStack m_destruction_stack;
@@ -141,12 +160,22 @@ struct PerThread {
     //   are expected to have only small number of command buffers per frame
     //   so they can be allocated on per queue basis
     command_buffer_manager m_command_buffer_manager;
+
+    // lock-free pools of the graphics command buffers of this worker
+    //   (boxed - the pool is not movable; rotated with the frame)
+    std::unique_ptr<DSAllocatorPool> m_ds_allocator;
   };
 
-  PerThread(const vk::raii::Device &device, uint32_t graphics_family)
-      : m_per_frame(make_per_frame<PerFrame>(device, graphics_family)) {}
+  PerThread(const vk::raii::Device &device, uint32_t graphics_family,
+            DSAllocatorTuner &ds_tuner)
+      : m_per_frame(
+            make_per_frame<PerFrame>(device, graphics_family, ds_tuner)) {}
 
   per_frame<PerFrame> m_per_frame;
+
+  // externally synchronized cache (only used by the owning worker);
+  //   created on first use and merged into the main cache on save
+  vk::raii::PipelineCache m_pipeline_cache{nullptr};
 };
 
 class Context {
@@ -165,6 +194,7 @@ public:
 
   auto &instance() const { return m_instance; }
   auto &device() const { return m_device; }
+  const Config &config() const noexcept { return m_cfg; }
 
   auto &vkInstance() const { return instance().instance(); }
   auto &vkPhysicalDevice() const { return device().physicalDevice(); }
@@ -197,7 +227,13 @@ public:
   void next_frame();
 
   auto &executor() { return m_executor; }
-  auto &pipeline_cache() { return m_pipeline_cache; }
+
+  // per-worker cache on executor threads, shared cache everywhere else
+  vk::raii::PipelineCache &pipeline_cache();
+
+  // merge all pipeline caches and write them to disk
+  //   (main thread only; waits for the executor to be idle)
+  void save_pipeline_cache();
 
   // wait for all work to finish
   void cleanup();
@@ -206,19 +242,58 @@ public:
       vk::CommandBufferLevel level = vk::CommandBufferLevel::ePrimary,
       command_buffer_manager::category cat =
           command_buffer_manager::category::c0_100) {
+    auto &graphics = *get_queue(QueueType::Graphics);
     return {
         get_thread_frame_ctx().m_command_buffer_manager.get(level, cat),
         device(),
-        get_frame_ctx().m_ds_allocator,
-        m_families[static_cast<std::size_t>(QueueType::Graphics)]
-            ->queue()
-            .family(),
+        *get_thread_frame_ctx().m_ds_allocator,
+        graphics.queue().family(),
         std::unique_lock<std::mutex>{},
+        graphics.profiler(),
+        frame_ref(),
     };
   }
 
   BindlessManager &bindlessManager() noexcept { return m_bindless_manager; }
 
+  // budget aware upload throttling and eviction of streamable data
+  MemoryBudget &memoryBudget() noexcept { return m_memory_budget; }
+
+  // moves streamed textures to compact the streaming texture pool
+  Defragmenter &defragmenter() noexcept { return m_defragmenter; }
+
+  // handle based buffers/images; destruction is collected in next_frame()
+  ResourceRegistry &resources() noexcept { return m_resources; }
+
+  // timeline values of the work submitted so far / finished by the GPU
+  //   (0 for missing queues)
+  [[nodiscard]] timeline_point submitted_timeline();
+  [[nodiscard]] timeline_point completed_timeline() const;
+
+  // pipelines are compiled on the executor; identical descriptions share
+  //   a single pipeline as long as someone holds it
+  auto &graphics_pipelines() noexcept { return m_graphics_pipelines; }
+  auto &compute_pipelines() noexcept { return m_compute_pipelines; }
+
+  // unreferenced samplers are kept for reuse up to `sampler_cache_budget`
+  auto &samplers() noexcept { return m_samplers; }
+
+  // cached layout whose sets are counted by the descriptor pool tuner
+  //   (the cache itself is not exposed so that no layout bypasses it)
+  vk::DescriptorSetLayout
+  descriptor_set_layout(const DescriptorSetLayoutInfo &info);
+
+  // pool weights are learned from the demand and saved on destruction
+  //   (unless they were passed to the constructor)
+  [[nodiscard]] auto &ds_tuner() noexcept { return m_ds_tuner; }
+  auto &pipeline_layouts() noexcept { return m_pipeline_layouts; }
+
+  static constexpr std::size_t sampler_cache_budget = 256;
+
+  // must not race with next_frame() (the caches are flushed there)
+  [[nodiscard]] std::vector<std::pair<std::string_view, handle_cache_stats>>
+  cache_stats();
+
 private:
   const Config &m_cfg;
 
@@ -235,17 +310,34 @@ private:
   PerQueueFamilyArray m_families;
 
   uint64_t m_frame_idx{0};
+  MemoryBudget m_memory_budget{m_device.memoryPools()};
+  DSAllocatorTuner m_ds_tuner;
+  bool m_store_ds_weights;
   per_frame<PerFrame> m_per_frame;
   std::vector<PerThread> m_per_thread;
 
+  // main thread cache - loaded data is merged into it once available
   vk::raii::PipelineCache m_pipeline_cache;
+  std::shared_future<std::vector<std::byte>> m_pipeline_cache_data;
+  bool m_pipeline_cache_merged{false};
 
   BindlessManager m_bindless_manager;
+  ResourceRegistry m_resources{*this};
+  Defragmenter m_defragmenter{*this};
+
+  graphics_pipeline_cache m_graphics_pipelines{*this};
+  compute_pipeline_cache m_compute_pipelines{*this};
+  sampler_cache m_samplers{*this};
+  descriptor_set_layout_cache m_descriptor_set_layouts{m_device};
+  pipeline_layout_cache m_pipeline_layouts{m_device};
 
   static DSAllocatorWeights default_weights(const Device &device);
 
   PerQueueFamilyArray getFamilies();
 
   std::filesystem::path get_pipeline_cache_path() const;
+  std::filesystem::path get_ds_weights_path() const;
+  void merge_loaded_pipeline_cache();
+  void flush_caches();
 };
 } // namespace v4dg
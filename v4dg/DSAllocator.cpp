@@ -1,16 +1,33 @@
 #include "DSAllocator.hpp"
 
+#include "Debug.hpp"
+#include "cppHelpers.hpp"
 #include "v4dgCore.hpp"
+#include "v4dgVulkan.hpp"
 
+#include <tracy/Tracy.hpp>
 #include <vulkan/vulkan.hpp>
 #include <vulkan/vulkan_raii.hpp>
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cmath>
+#include <cstddef>
 #include <cstdint>
+#include <filesystem>
+#include <fstream>
 #include <iterator>
 #include <mutex>
+#include <optional>
+#include <ranges>
+#include <shared_mutex>
 #include <span>
+#include <sstream>
 #include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
@@ -18,7 +35,9 @@ using namespace v4dg;
 
 DSAllocator::DSAllocator(DSAllocatorPool &owner)
     : m_owner(&owner), m_pool(nullptr) {}
-DSAllocator::~DSAllocator() {
+DSAllocator::~DSAllocator() { release(); }
+
+void DSAllocator::release() noexcept {
   if (*m_pool) {
     m_owner->ret_allocator(std::move(m_pool));
   }
@@ -79,6 +98,7 @@ void DSAllocator::allocate_internal(
     res = device.allocateDescriptorSets(&createInfo.get<>(), out.data(), *disp);
 
     if (res == vk::Result::eSuccess) {
+      m_owner->tuner().record_sets(setLayouts, descriptorCounts);
       return;
     }
 
@@ -86,6 +106,7 @@ void DSAllocator::allocate_internal(
     handle_errors(res, true);
 
     // pool is full - try again
+    m_owner->tuner().record_retry();
     m_owner->replace_full_allocator(m_pool);
   }
 
@@ -132,35 +153,292 @@ DSAllocatorWeights::create(const vk::raii::Device &device,
   return {device, chain.get<>()};
 }
 
+std::optional<DSAllocatorWeights>
+DSAllocatorWeights::load(const std::filesystem::path &path) {
+  auto file = GetFileString(path);
+  if (!file) {
+    logger.Log("No descriptor pool weights at {} ({})", path.string(),
+               to_string(file.error()));
+    return std::nullopt;
+  }
+
+  DSAllocatorWeights weights{};
+
+  std::istringstream stream{*file};
+  std::string line;
+  while (std::getline(stream, line)) {
+    if (line.empty() || line.front() == '#') {
+      continue;
+    }
+
+    std::istringstream fields{line};
+    std::underlying_type_t<vk::DescriptorType> type{};
+    float weight{};
+    if (!(fields >> type >> weight) || !std::isfinite(weight) ||
+        weight <= 0.F) {
+      logger.Warning("Descriptor pool weights {} are malformed - ignoring",
+                     path.string());
+      return std::nullopt;
+    }
+
+    weights.m_weights.push_back(
+        {.type = static_cast<vk::DescriptorType>(type), .weight = weight});
+  }
+
+  if (weights.m_weights.empty()) {
+    return std::nullopt;
+  }
+
+  logger.Debug("Loaded {} descriptor pool weights from {}",
+               weights.m_weights.size(), path.string());
+  return weights;
+}
+
+void DSAllocatorWeights::store(const std::filesystem::path &path) const {
+  auto tmp_path = path;
+  tmp_path += ".tmp";
+
+  {
+    std::ofstream file(tmp_path, std::ios::trunc);
+    file << "# descriptor pool weights: <vk::DescriptorType> <sets per pool "
+            "fraction>\n";
+    for (const auto &weight : m_weights) {
+      file << "# " << vk::to_string(weight.type) << '\n'
+           << static_cast<std::underlying_type_t<vk::DescriptorType>>(
+                  weight.type)
+           << ' ' << weight.weight << '\n';
+    }
+    file.flush();
+
+    if (!file) {
+      logger.Warning("Could not write descriptor pool weights {}",
+                     tmp_path.string());
+      std::error_code ec;
+      std::filesystem::remove(tmp_path, ec);
+      return;
+    }
+  }
+
+  std::error_code ec;
+  std::filesystem::rename(tmp_path, path, ec);
+  if (ec) {
+    logger.Warning("Could not replace descriptor pool weights {}: {}",
+                   path.string(), ec.message());
+    std::filesystem::remove(tmp_path, ec);
+  }
+}
+
+DSAllocatorTuner::DSAllocatorTuner(DSAllocatorWeights initial)
+    : m_learned(initial), m_published(std::move(initial)) {}
+
+void DSAllocatorTuner::describe_layout(
+    vk::DescriptorSetLayout layout,
+    std::span<const vk::DescriptorSetLayoutBinding> bindings,
+    std::span<const vk::DescriptorBindingFlags> flags) {
+  {
+    std::shared_lock const lock(m_layouts_mut);
+    if (m_layouts.contains(static_cast<VkDescriptorSetLayout>(layout))) {
+      return;
+    }
+  }
+
+  auto demand = std::make_unique<layout_demand>();
+  for (auto [i, binding] : std::views::enumerate(bindings)) {
+    auto const idx = static_cast<std::size_t>(i);
+    if (idx < flags.size() &&
+        (flags[idx] &
+         vk::DescriptorBindingFlagBits::eVariableDescriptorCount)) {
+      demand->variable_type = binding.descriptorType;
+      continue;
+    }
+
+    demand->sizes.emplace_back(binding.descriptorType,
+                               binding.descriptorCount);
+  }
+
+  std::unique_lock const lock(m_layouts_mut);
+  m_layouts.try_emplace(static_cast<VkDescriptorSetLayout>(layout),
+                        std::move(demand));
+}
+
+void DSAllocatorTuner::record_sets(
+    std::span<const vk::DescriptorSetLayout> setLayouts,
+    std::span<const uint32_t> descriptorCounts) noexcept {
+  m_sets.fetch_add(setLayouts.size(), std::memory_order_relaxed);
+
+  std::shared_lock const lock(m_layouts_mut);
+  for (auto [i, layout] : std::views::enumerate(setLayouts)) {
+    auto it = m_layouts.find(static_cast<VkDescriptorSetLayout>(layout));
+    if (it == m_layouts.end()) {
+      m_undescribed_sets.fetch_add(1, std::memory_order_relaxed);
+      continue;
+    }
+
+    auto &demand = *it->second;
+    demand.sets.fetch_add(1, std::memory_order_relaxed);
+    auto const idx = static_cast<std::size_t>(i);
+    if (demand.variable_type && idx < descriptorCounts.size()) {
+      demand.variable_descriptors.fetch_add(descriptorCounts[idx],
+                                            std::memory_order_relaxed);
+    }
+  }
+}
+
+void DSAllocatorTuner::end_frame() {
+  ZoneScoped;
+
+  // descriptors per type allocated this frame
+  ankerl::unordered_dense::map<vk::DescriptorType, std::uint64_t> descriptors;
+  std::uint64_t sets = 0;
+
+  {
+    std::shared_lock const lock(m_layouts_mut);
+    for (const auto &[layout, demand] : m_layouts) {
+      auto const layout_sets =
+          demand->sets.exchange(0, std::memory_order_relaxed);
+      auto const variable =
+          demand->variable_descriptors.exchange(0, std::memory_order_relaxed);
+      if (layout_sets == 0) {
+        continue;
+      }
+
+      sets += layout_sets;
+      for (const auto &size : demand->sizes) {
+        descriptors[size.type] += layout_sets * size.descriptorCount;
+      }
+      if (demand->variable_type) {
+        descriptors[*demand->variable_type] += variable;
+      }
+    }
+  }
+
+  if (sets == 0) {
+    return;
+  }
+
+  std::scoped_lock const lock(m_weights_mut);
+
+  for (const auto &[type, count] : descriptors) {
+    if (!std::ranges::contains(m_learned.m_weights, type,
+                               &DSAllocatorWeights::DescriptorWieght::type)) {
+      m_learned.m_weights.push_back({.type = type, .weight = 0.F});
+    }
+  }
+
+  bool reshape = false;
+  for (auto &weight : m_learned.m_weights) {
+    auto it = descriptors.find(weight.type);
+    float const observed =
+        it == descriptors.end()
+            ? 0.F
+            : static_cast<float>(it->second) / static_cast<float>(sets);
+
+    weight.weight = std::max(
+        weight.weight + learn_rate * (observed - weight.weight), min_weight);
+
+    auto published = std::ranges::find(
+        m_published.m_weights, weight.type,
+        &DSAllocatorWeights::DescriptorWieght::type);
+    float const base = published == m_published.m_weights.end()
+                           ? min_weight
+                           : published->weight;
+    reshape |= std::abs(weight.weight - base) > reshape_threshold * base;
+  }
+
+  if (reshape) {
+    m_published.m_weights = m_learned.m_weights;
+    auto const generation =
+        m_generation.fetch_add(1, std::memory_order_release) + 1;
+
+    logger.Debug("DSAllocatorTuner: reshaped pools (generation {})",
+                 generation);
+    for (const auto &weight : m_published.m_weights) {
+      logger.Debug("  {}: {:.3f}", weight.type, weight.weight);
+    }
+  }
+}
+
+DSAllocatorWeights DSAllocatorTuner::weights() const {
+  std::scoped_lock const lock(m_weights_mut);
+  return m_published;
+}
+
+DSAllocatorWeights DSAllocatorTuner::learned_weights() const {
+  std::scoped_lock const lock(m_weights_mut);
+  return m_learned;
+}
+
+DSAllocatorStats DSAllocatorTuner::stats() const noexcept {
+  return {
+      .sets = m_sets.load(std::memory_order_relaxed),
+      .undescribed_sets = m_undescribed_sets.load(std::memory_order_relaxed),
+      .retries = m_retries.load(std::memory_order_relaxed),
+      .pools_created = m_pools_created.load(std::memory_order_relaxed),
+      .pools_full = m_pools_full.load(std::memory_order_relaxed),
+      .pools_dropped = m_pools_dropped.load(std::memory_order_relaxed),
+      .generation = generation(),
+  };
+}
+
 DSAllocatorPool::DSAllocatorPool(const vk::raii::Device &device,
-                                 DSAllocatorWeights weights)
-    : m_device(device), m_weights(std::move(weights)) {}
+                                 DSAllocatorTuner &tuner,
+                                 bool externally_synchronized,
+                                 std::uint32_t frames)
+    : m_device(device), m_tuner(&tuner),
+      m_externally_synchronized(externally_synchronized),
+      m_generation(tuner.generation()), m_perFramePools(frames) {
+  assert(frames > 0);
+}
+
+std::unique_lock<std::mutex> DSAllocatorPool::acquire() {
+  if (m_externally_synchronized) {
+    return {};
+  }
+  return std::unique_lock{m_mut};
+}
 
 void DSAllocatorPool::advance_frame(vk::Bool32 trim,
                                     vk::DescriptorPoolResetFlags ResetFlags) {
-  std::scoped_lock const lock(m_mut);
+  auto const lock = acquire();
 
-  m_frameIdx = (m_frameIdx + 1) % max_frames_in_flight;
+  m_frameIdx = static_cast<std::uint32_t>((m_frameIdx + 1) %
+                                          m_perFramePools.size());
 
   if (trim != 0U) {
     m_cleanPools.clear();
   }
 
+  // pools shaped by outdated weights are not recycled
+  if (auto generation = m_tuner->generation(); generation != m_generation) {
+    m_tuner->record_pools_dropped(m_cleanPools.size());
+    m_cleanPools.clear();
+    m_generation = generation;
+  }
+
   frame_storage &storage = m_perFramePools[m_frameIdx];
 
-  for (auto &pool : storage.full) {
-    pool.reset(ResetFlags);
-  }
-  for (auto &pool : storage.usable) {
-    pool.reset(ResetFlags);
-  }
+  if (storage.generation == m_generation) {
+    for (auto &pool : storage.full) {
+      pool.reset(ResetFlags);
+    }
+    for (auto &pool : storage.usable) {
+      pool.reset(ResetFlags);
+    }
 
-  m_cleanPools.insert(m_cleanPools.end(),
-                      std::move_iterator(storage.full.begin()),
-                      std::move_iterator(storage.full.end()));
+    // partially used pools are just as clean after the reset
+    m_cleanPools.insert(m_cleanPools.end(),
+                        std::move_iterator(storage.full.begin()),
+                        std::move_iterator(storage.full.end()));
+    m_cleanPools.insert(m_cleanPools.end(),
+                        std::move_iterator(storage.usable.begin()),
+                        std::move_iterator(storage.usable.end()));
+  } else {
+    m_tuner->record_pools_dropped(storage.full.size() + storage.usable.size());
+  }
 
   storage.full.clear();
   storage.usable.clear();
+  storage.generation = m_generation;
 
   if (trim != 0U) {
     m_cleanPools.shrink_to_fit();
@@ -170,20 +448,21 @@ void DSAllocatorPool::advance_frame(vk::Bool32 trim,
 }
 
 void DSAllocatorPool::ret_allocator(vk::raii::DescriptorPool pool) {
-  std::scoped_lock const lock(m_mut);
+  auto const lock = acquire();
   m_perFramePools[m_frameIdx].usable.emplace_back(std::move(pool));
 }
 
 void DSAllocatorPool::replace_full_allocator(vk::raii::DescriptorPool &pool) {
-  std::scoped_lock const lock(m_mut);
+  auto const lock = acquire();
 
   frame_storage &storage = m_perFramePools[m_frameIdx];
   storage.full.emplace_back(std::move(pool));
+  m_tuner->record_pool_full();
   pool = get_new_pool_internal();
 }
 
 vk::raii::DescriptorPool DSAllocatorPool::get_new_pool() {
-  std::scoped_lock const lock(m_mut);
+  auto const lock = acquire();
   return get_new_pool_internal();
 }
 
@@ -201,7 +480,8 @@ vk::raii::DescriptorPool DSAllocatorPool::get_new_pool_internal() {
     pool = std::move(m_cleanPools.back());
     m_cleanPools.pop_back();
   } else {
-    pool = m_weights.create(m_device, d_sets_per_pool);
+    pool = m_tuner->weights().create(m_device, d_sets_per_pool);
+    m_tuner->record_pool_created();
   }
 
   return pool;
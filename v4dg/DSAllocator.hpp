@@ -2,19 +2,24 @@
 
 #include "v4dgCore.hpp"
 
+#include <ankerl/unordered_dense.h>
 #include <vulkan/vulkan.hpp>
 #include <vulkan/vulkan_raii.hpp>
 
+#include <atomic>
 #include <cstdint>
+#include <filesystem>
 #include <memory>
 #include <mutex>
 #include <optional>
+#include <shared_mutex>
 #include <span>
 #include <vector>
 
 namespace v4dg {
 
 class DSAllocatorPool;
+class DSAllocatorTuner;
 
 class DSAllocator {
 public:
@@ -47,6 +52,12 @@ public:
     return out;
   }
 
+  // give the current pool back to the owner (done by the destructor too);
+  //   must run on the owner's thread if it is externally synchronized.
+  //   Cannot fail gracefully - the pool must not be destroyed while its
+  //   sets may be in use - so running out of memory here terminates.
+  void release() noexcept;
+
 private:
   void allocate_internal(std::span<const vk::DescriptorSetLayout> setLayouts,
                          std::span<const uint32_t> descriptorCounts,
@@ -71,11 +82,117 @@ struct DSAllocatorWeights {
   [[nodiscard]] vk::raii::DescriptorPool
   create(const vk::raii::Device &device, std::uint32_t maxSets,
          vk::DescriptorPoolCreateFlags flags = {}) const;
+
+  // only m_weights is stored (one `<vk::DescriptorType> <weight>` per line);
+  //   a missing or malformed file yields std::nullopt
+  [[nodiscard]] static std::optional<DSAllocatorWeights>
+  load(const std::filesystem::path &path);
+  // writes to a temporary file and renames it over `path`
+  void store(const std::filesystem::path &path) const;
+};
+
+struct DSAllocatorStats {
+  std::uint64_t sets;
+  // sets of layouts never described - missing from the learned weights
+  std::uint64_t undescribed_sets;
+  // allocations that hit a full pool and were retried in a new one
+  std::uint64_t retries;
+  std::uint64_t pools_created;
+  // pools retired as full before the end of their frame
+  std::uint64_t pools_full;
+  // clean pools destroyed because the weights were reshaped
+  std::uint64_t pools_dropped;
+  // number of reshapes so far
+  std::uint32_t generation;
+};
+
+// Learns the DSAllocatorWeights of new pools from the descriptors that are
+//   actually allocated. Shared by all DSAllocatorPools.
+//   Only sets of layouts passed to describe_layout() are counted (every
+//   layout from Context::descriptor_set_layout() is).
+class DSAllocatorTuner {
+public:
+  explicit DSAllocatorTuner(DSAllocatorWeights initial);
+
+  // thread-safe; describing a layout again is a no-op
+  void describe_layout(vk::DescriptorSetLayout layout,
+                       std::span<const vk::DescriptorSetLayoutBinding> bindings,
+                       std::span<const vk::DescriptorBindingFlags> flags = {});
+
+  void record_sets(std::span<const vk::DescriptorSetLayout> setLayouts,
+                   std::span<const uint32_t> descriptorCounts) noexcept;
+  void record_retry() noexcept {
+    m_retries.fetch_add(1, std::memory_order_relaxed);
+  }
+  void record_pool_created() noexcept {
+    m_pools_created.fetch_add(1, std::memory_order_relaxed);
+  }
+  void record_pool_full() noexcept {
+    m_pools_full.fetch_add(1, std::memory_order_relaxed);
+  }
+  void record_pools_dropped(std::size_t count) noexcept {
+    m_pools_dropped.fetch_add(count, std::memory_order_relaxed);
+  }
+
+  // Blend the per-set demand recorded since the last call into the weights.
+  //   Once a weight drifts far enough from the published ones the new
+  //   weights are published and generation() is bumped.
+  void end_frame();
+
+  // the published weights
+  [[nodiscard]] DSAllocatorWeights weights() const;
+  // the weights being learned (published or not)
+  [[nodiscard]] DSAllocatorWeights learned_weights() const;
+  [[nodiscard]] std::uint32_t generation() const noexcept {
+    return m_generation.load(std::memory_order_acquire);
+  }
+  [[nodiscard]] DSAllocatorStats stats() const noexcept;
+
+  // fraction of the demand taken over every frame
+  static constexpr float learn_rate = 0.05F;
+  // relative drift of any weight that triggers a reshape
+  static constexpr float reshape_threshold = 0.25F;
+  // keeps every known type in the pools (a size of 0 is invalid)
+  static constexpr float min_weight = 1.F / 64;
+
+private:
+  struct layout_demand {
+    // fixed-count bindings
+    std::vector<vk::DescriptorPoolSize> sizes;
+    // the binding with a variable descriptor count (if any)
+    std::optional<vk::DescriptorType> variable_type;
+
+    std::atomic<std::uint64_t> sets{0};
+    std::atomic<std::uint64_t> variable_descriptors{0};
+  };
+
+  mutable std::shared_mutex m_layouts_mut;
+  ankerl::unordered_dense::map<VkDescriptorSetLayout,
+                               std::unique_ptr<layout_demand>>
+      m_layouts;
+
+  mutable std::mutex m_weights_mut;
+  DSAllocatorWeights m_learned;
+  DSAllocatorWeights m_published;
+  std::atomic<std::uint32_t> m_generation{0};
+
+  std::atomic<std::uint64_t> m_sets{0};
+  std::atomic<std::uint64_t> m_undescribed_sets{0};
+  std::atomic<std::uint64_t> m_retries{0};
+  std::atomic<std::uint64_t> m_pools_created{0};
+  std::atomic<std::uint64_t> m_pools_full{0};
+  std::atomic<std::uint64_t> m_pools_dropped{0};
 };
 
 class DSAllocatorPool {
 public:
-  DSAllocatorPool(const vk::raii::Device &device, DSAllocatorWeights weights);
+  // an externally synchronized pool takes no locks - for per-worker pools.
+  //   Used pools are reset after `frames` calls to advance_frame(); a pool
+  //   that is itself kept per frame (and advanced when its frame comes
+  //   around again) needs only 1.
+  DSAllocatorPool(const vk::raii::Device &device, DSAllocatorTuner &tuner,
+                  bool externally_synchronized = false,
+                  std::uint32_t frames = max_frames_in_flight);
 
   void advance_frame(vk::Bool32 trim = vk::False,
                      vk::DescriptorPoolResetFlags ResetFlags = {});
@@ -88,23 +205,31 @@ public:
   void replace_full_allocator(vk::raii::DescriptorPool &pool);
   void ret_allocator(vk::raii::DescriptorPool pool);
 
+  [[nodiscard]] DSAllocatorTuner &tuner() const noexcept { return *m_tuner; }
+
 private:
   vk::raii::DescriptorPool get_new_pool_internal();
+  [[nodiscard]] std::unique_lock<std::mutex> acquire();
 
   using dpvec = std::vector<vk::raii::DescriptorPool>;
 
   struct frame_storage {
     dpvec usable;
     dpvec full;
+    // tuner generation while this frame was recorded
+    std::uint32_t generation{0};
   };
 
   const vk::raii::Device &m_device;
-  DSAllocatorWeights m_weights;
+  DSAllocatorTuner *m_tuner;
 
   std::mutex m_mut;
+  bool m_externally_synchronized;
   std::uint32_t m_frameIdx{0};
+  // tuner generation the clean pools were created with
+  std::uint32_t m_generation{0};
 
-  per_frame<frame_storage> m_perFramePools; // destruction queue
+  std::vector<frame_storage> m_perFramePools; // destruction queue
   dpvec m_cleanPools;
 };
 } // namespace v4dg
@@ -0,0 +1,358 @@
+#include "Defragmenter.hpp"
+
+#include "BindlessManager.hpp"
+#include "CommandBuffer.hpp"
+#include "Constants.hpp"
+#include "Context.hpp"
+#include "Debug.hpp"
+#include "MemoryPools.hpp"
+#include "ResourceRegistry.hpp"
+#include "VulkanConstructs.hpp"
+#include "v4dgVulkan.hpp"
+
+#include <tracy/Tracy.hpp>
+#include <vulkan-memory-allocator-hpp/vk_mem_alloc.hpp>
+#include <vulkan/vulkan.hpp>
+#include <vulkan/vulkan_raii.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <utility>
+#include <vector>
+
+using namespace v4dg;
+
+namespace {
+// the old objects of a pass - destroyed once the GPU finished the frame
+struct retired_pass {
+  // pinned - their memory is moved until the pass ends
+  std::vector<ImageHandle> images;
+  std::vector<RelocatedImage> old;
+};
+
+vk::ImageSubresourceRange whole_image() {
+  return {vk::ImageAspectFlagBits::eColor, 0, vk::RemainingMipLevels, 0,
+          vk::RemainingArrayLayers};
+}
+
+std::vector<vk::ImageCopy> mip_copies(const vk::ImageCreateInfo &image) {
+  std::vector<vk::ImageCopy> copies;
+  copies.reserve(image.mipLevels);
+
+  auto const extent = image.extent;
+  for (std::uint32_t mip = 0; mip < image.mipLevels; mip++) {
+    vk::ImageSubresourceLayers const layers{vk::ImageAspectFlagBits::eColor,
+                                            mip, 0, image.arrayLayers};
+    copies.emplace_back(layers, vk::Offset3D{}, layers, vk::Offset3D{},
+                        vk::Extent3D{
+                            std::max(extent.width >> mip, 1U),
+                            std::max(extent.height >> mip, 1U),
+                            std::max(extent.depth >> mip, 1U),
+                        });
+  }
+  return copies;
+}
+} // namespace
+
+Defragmenter::Defragmenter(Context &ctx)
+    : m_ctx(&ctx),
+      m_pool(ctx.device().memoryPools().pool(MemoryClass::StreamingTexture)) {}
+
+Defragmenter::~Defragmenter() {
+  // stopped and the frame stacks were flushed (Context::cleanup()) - no
+  //   pass should be pending
+  if (m_pass_pending) {
+    end_pass();
+  }
+  if (m_defrag != nullptr) {
+    finish();
+  }
+}
+
+void Defragmenter::track(ImageHandle image, const Image::ImageCreateInfo &info,
+                         std::span<const ImageViewHandle> views,
+                         vk::ImageLayout layout, std::uint32_t family) {
+  auto &graphics = m_ctx->get_queue(Context::QueueType::Graphics);
+  if (!m_pool || !graphics || graphics->queue().family() != family) {
+    return;
+  }
+
+  // the copies need both transfer usages; the rest is not kept
+  vk::ImageUsageFlags const transfer = vk::ImageUsageFlagBits::eTransferSrc |
+                                       vk::ImageUsageFlagBits::eTransferDst;
+  if (info.tiling != vk::ImageTiling::eOptimal ||
+      (info.usage & transfer) != transfer || info.formats ||
+      info.stencilUsage || info.sharingMode != vk::SharingMode::eExclusive) {
+    return;
+  }
+
+  auto const allocation =
+      static_cast<VmaAllocation>(m_ctx->resources().allocation(image));
+
+  std::scoped_lock const _{m_mut};
+  m_tracked[allocation] = {
+      .image = image,
+      .info = {info.flags, info.imageType, info.format, info.extent,
+               info.mipLevels, info.arrayLayers, info.samples, info.tiling,
+               info.usage},
+      .views = {views.begin(), views.end()},
+      .layout = layout,
+  };
+}
+
+void Defragmenter::next_frame(std::uint64_t frame_idx) {
+  if (!m_pool || m_pass_pending || m_stopped) {
+    return;
+  }
+
+  if (m_defrag == nullptr) {
+    bool const requested = std::exchange(m_requested, false);
+    if (!requested && frame_idx < m_last_check + check_interval) {
+      return;
+    }
+    m_last_check = frame_idx;
+
+    ZoneScopedN("defragmentation check");
+
+    double const frag = fragmentation();
+    bool tracked = false;
+    {
+      const auto &resources = m_ctx->resources();
+      std::scoped_lock const _{m_mut};
+      std::erase_if(m_tracked, [&](const auto &t) {
+        return !resources.alive(t.second.image);
+      });
+      m_stats.fragmentation = frag;
+      tracked = !m_tracked.empty();
+    }
+
+    // nothing opted in - every move of a pass would be ignored
+    if (!tracked || (!requested && frag < fragmentation_threshold)) {
+      return;
+    }
+
+    VmaDefragmentationInfo const info{
+        .flags = VMA_DEFRAGMENTATION_FLAG_ALGORITHM_BALANCED_BIT,
+        .pool = static_cast<VmaPool>(m_pool),
+        .maxBytesPerPass = max_bytes_per_pass,
+        .maxAllocationsPerPass = max_moves_per_pass,
+    };
+
+    auto const result = vmaBeginDefragmentation(
+        static_cast<VmaAllocator>(m_ctx->device().allocator()), &info,
+        &m_defrag);
+    if (result != VK_SUCCESS) {
+      throw exception("vmaBeginDefragmentation failed: {}",
+                      static_cast<vk::Result>(result));
+    }
+
+    logger.Debug("defragmenting the streaming texture pool ({:.1f}%)",
+                 frag * 100.); // NOLINT(*-magic-numbers)
+  }
+
+  begin_pass();
+}
+
+double Defragmenter::fragmentation() const {
+  auto const stats =
+      m_ctx->device().allocator().calculatePoolStatistics(m_pool);
+
+  auto const free =
+      stats.statistics.blockBytes - stats.statistics.allocationBytes;
+  if (free == 0 || stats.unusedRangeCount < 2) {
+    return 0.;
+  }
+
+  return 1. - (static_cast<double>(stats.unusedRangeSizeMax) /
+               static_cast<double>(free));
+}
+
+void Defragmenter::begin_pass() {
+  ZoneScoped;
+
+  auto const vma_allocator =
+      static_cast<VmaAllocator>(m_ctx->device().allocator());
+
+  m_pass = {};
+  auto const result =
+      vmaBeginDefragmentationPass(vma_allocator, m_defrag, &m_pass);
+  if (result == VK_SUCCESS) {
+    // nothing left to move
+    finish();
+    return;
+  }
+  if (result != VK_INCOMPLETE) {
+    throw exception("vmaBeginDefragmentationPass failed: {}",
+                    static_cast<vk::Result>(result));
+  }
+
+  const auto &device = m_ctx->device();
+  auto &resources = m_ctx->resources();
+  auto &graphics = *m_ctx->get_queue(Context::QueueType::Graphics);
+  auto retired = std::make_unique<retired_pass>();
+
+  std::vector<vk::ImageMemoryBarrier2> before;
+  std::vector<vk::ImageMemoryBarrier2> after;
+  struct copy {
+    vk::Image src;
+    vk::Image dst;
+    std::vector<vk::ImageCopy> regions;
+  };
+  std::vector<copy> copies;
+
+  vk::DeviceSize bytes = 0;
+
+  for (auto &move : std::span{m_pass.pMoves, m_pass.moveCount}) {
+    tracked_image tracked{};
+    {
+      std::scoped_lock const _{m_mut};
+      if (auto it = m_tracked.find(move.srcAllocation);
+          it != m_tracked.end()) {
+        tracked = it->second;
+      }
+    }
+
+    // the allocation may have been reused since it was tracked
+    if (!resources.alive(tracked.image) ||
+        static_cast<VmaAllocation>(resources.allocation(tracked.image)) !=
+            move.srcAllocation) {
+      // not uploaded yet or not opted in
+      move.operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+      continue;
+    }
+    std::erase_if(tracked.views,
+                  [&](ImageViewHandle view) { return !resources.alive(view); });
+
+    vk::raii::Image new_image{device.device(), tracked.info};
+
+    auto const bind_result =
+        vmaBindImageMemory(vma_allocator, move.dstTmpAllocation, *new_image);
+    if (bind_result != VK_SUCCESS) {
+      move.operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+      continue;
+    }
+
+    vk::Image const old_image = resources.image(tracked.image);
+
+    // any earlier write (upload, storage) must be visible to the copy
+    before.emplace_back(
+        vk::PipelineStageFlagBits2::eAllCommands,
+        vk::AccessFlagBits2::eMemoryWrite, vk::PipelineStageFlagBits2::eCopy,
+        vk::AccessFlagBits2::eTransferRead,
+        tracked.layout, vk::ImageLayout::eTransferSrcOptimal,
+        vk::QueueFamilyIgnored, vk::QueueFamilyIgnored, old_image,
+        whole_image());
+    before.emplace_back(
+        vk::PipelineStageFlagBits2::eNone, vk::AccessFlagBits2::eNone,
+        vk::PipelineStageFlagBits2::eCopy, vk::AccessFlagBits2::eTransferWrite,
+        vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal,
+        vk::QueueFamilyIgnored, vk::QueueFamilyIgnored, *new_image,
+        whole_image());
+    after.emplace_back(
+        vk::PipelineStageFlagBits2::eCopy, vk::AccessFlagBits2::eTransferWrite,
+        vk::PipelineStageFlagBits2::eAllCommands,
+        vk::AccessFlagBits2::eMemoryRead | vk::AccessFlagBits2::eMemoryWrite,
+        vk::ImageLayout::eTransferDstOptimal, tracked.layout,
+        vk::QueueFamilyIgnored, vk::QueueFamilyIgnored, *new_image,
+        whole_image());
+    copies.push_back({old_image, *new_image, mip_copies(tracked.info)});
+
+    bytes += device.allocator()
+                 .getAllocationInfo(resources.allocation(tracked.image))
+                 .size;
+
+    // nothing records commands while next_frame() runs; the old objects
+    //   may still be read by frames in flight
+    retired->old.push_back(resources.relocate(
+        tracked.image, std::move(new_image), tracked.views));
+    retired->images.push_back(tracked.image);
+  }
+
+  if (copies.empty()) {
+    m_pass_pending = true;
+    end_pass();
+    return;
+  }
+
+  {
+    auto cb = graphics.getCommandBuffer();
+    {
+      auto _{cb.debugLabelScope("defragmentation", constants::vDarkCyan)};
+      cb.barrier({}, {}, {}, before);
+      for (const auto &c : copies) {
+        cb->copyImage(c.src, vk::ImageLayout::eTransferSrcOptimal, c.dst,
+                      vk::ImageLayout::eTransferDstOptimal, c.regions);
+      }
+      cb.barrier({}, {}, {}, after);
+    }
+    cb.end();
+    graphics.submit(SubmitionInfo::gather(std::move(cb)));
+  }
+
+  {
+    std::scoped_lock const _{m_mut};
+    m_stats.moves += copies.size();
+    m_stats.bytes_moved += bytes;
+  }
+
+  // the old memory is reused by VMA once the pass ends - wait for the GPU
+  m_pass_pending = true;
+  m_ctx->get_destruction_stack().push(
+      [this, retired = std::move(retired)]() mutable noexcept {
+        retired->old.clear();
+        end_pass();
+        for (auto image : retired->images) {
+          m_ctx->resources().unpin(image);
+        }
+        retired.reset();
+      });
+}
+
+void Defragmenter::end_pass() noexcept {
+  auto const vma_allocator =
+      static_cast<VmaAllocator>(m_ctx->device().allocator());
+
+  auto const result =
+      vmaEndDefragmentationPass(vma_allocator, m_defrag, &m_pass);
+  m_pass_pending = false;
+
+  {
+    std::scoped_lock const _{m_mut};
+    m_stats.passes++;
+  }
+
+  if (result == VK_INCOMPLETE) {
+    // next pass in next_frame()
+    return;
+  }
+  if (result != VK_SUCCESS) {
+    logger.Error("vmaEndDefragmentationPass failed: {}",
+                 static_cast<vk::Result>(result));
+  }
+
+  finish();
+}
+
+void Defragmenter::finish() noexcept {
+  VmaDefragmentationStats stats{};
+  vmaEndDefragmentation(static_cast<VmaAllocator>(m_ctx->device().allocator()),
+                        m_defrag, &stats);
+
+  std::scoped_lock const _{m_mut};
+  m_defrag = nullptr;
+  m_stats.bytes_freed += stats.bytesFreed;
+
+  logger.Debug("defragmentation done: {} bytes moved, {} bytes freed",
+               stats.bytesMoved, stats.bytesFreed);
+}
+
+DefragmenterStats Defragmenter::stats() const {
+  std::scoped_lock const _{m_mut};
+  auto stats = m_stats;
+  stats.tracked = m_tracked.size();
+  stats.running = m_defrag != nullptr;
+  return stats;
+}
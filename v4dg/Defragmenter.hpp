@@ -0,0 +1,106 @@
+#pragma once
+
+#include "ResourceRegistry.hpp"
+#include "VulkanConstructs.hpp"
+
+#include <ankerl/unordered_dense.h>
+#include <vulkan-memory-allocator-hpp/vk_mem_alloc.hpp>
+#include <vulkan/vulkan.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <span>
+#include <vector>
+
+namespace v4dg {
+class Context;
+
+struct DefragmenterStats {
+  std::uint64_t passes;
+  std::uint64_t moves;
+  vk::DeviceSize bytes_moved;
+  vk::DeviceSize bytes_freed;
+  // of the streaming texture pool at the last check (0 - one free range)
+  double fragmentation;
+  std::size_t tracked;
+  bool running;
+};
+
+// Incremental defragmentation of the streaming texture pool.
+//   Only registry images opted in with track() are moved. Every pass moves a
+//   bounded number of them: the copies are recorded on the graphics queue,
+//   ResourceRegistry::relocate() points the handles at a new image, views
+//   and bindless handles, and the old ones are retired through the frame
+//   DestructionStack. The pass is ended (and the old memory reused) once the
+//   GPU finished the frame.
+class Defragmenter {
+public:
+  static constexpr std::uint32_t max_moves_per_pass = 16;
+  static constexpr vk::DeviceSize max_bytes_per_pass = 64 << 20;
+  // frames between the fragmentation checks
+  static constexpr std::uint64_t check_interval = 120;
+  // 1 - largest free range / free bytes
+  static constexpr double fragmentation_threshold = 0.5;
+
+  explicit Defragmenter(Context &ctx);
+  ~Defragmenter();
+
+  Defragmenter(const Defragmenter &) = delete;
+  Defragmenter &operator=(const Defragmenter &) = delete;
+  Defragmenter(Defragmenter &&) = delete;
+  Defragmenter &operator=(Defragmenter &&) = delete;
+
+  // `image` (created with `info`) may be moved from now on - it is in
+  //   `layout` and owned by `family`. `views` must be all of its views.
+  //   Users resolve the image, views and bindless handles through the
+  //   registry while recording and keep none of them across frames.
+  //   Images without transfer usage, with a format list, stencil usage or
+  //   concurrent sharing are not moved. Thread-safe.
+  void track(ImageHandle image, const Image::ImageCreateInfo &info,
+             std::span<const ImageViewHandle> views, vk::ImageLayout layout,
+             std::uint32_t family);
+
+  // starts a defragmentation with the next frame whatever the fragmentation
+  //   (e.g. after a level was unloaded); main thread. No pass is started
+  //   while no image is tracked.
+  void request() noexcept { m_requested = true; }
+
+  // main thread, after the frame resources were flushed (no recording)
+  void next_frame(std::uint64_t frame_idx);
+
+  // no new passes; the pending one ends with the next frame stack flushes
+  void stop() noexcept { m_stopped = true; }
+
+  [[nodiscard]] DefragmenterStats stats() const;
+
+private:
+  struct tracked_image {
+    ImageHandle image;
+    // without pNext and queue families
+    vk::ImageCreateInfo info;
+    std::vector<ImageViewHandle> views;
+    vk::ImageLayout layout;
+  };
+
+  [[nodiscard]] double fragmentation() const;
+  void begin_pass();
+  void end_pass() noexcept;
+  void finish() noexcept;
+
+  Context *m_ctx;
+  vma::Pool m_pool;
+
+  mutable std::mutex m_mut;
+  ankerl::unordered_dense::map<VmaAllocation, tracked_image> m_tracked;
+
+  VmaDefragmentationContext m_defrag{};
+  VmaDefragmentationPassMoveInfo m_pass{};
+  bool m_pass_pending{false};
+  bool m_stopped{false};
+  bool m_requested{false};
+  std::uint64_t m_last_check{0};
+
+  DefragmenterStats m_stats{};
+};
+} // namespace v4dg
@@ -231,6 +231,10 @@ const std::map<std::string_view, DeviceStats_ext_adder> device_ext_spec{
     make_ext_adder(vk::EXTSwapchainColorSpaceExtensionName),
     make_ext_adder<vk::PhysicalDeviceFaultFeaturesEXT>(
         vk::EXTDeviceFaultExtensionName),
+    make_ext_adder(vk::EXTCalibratedTimestampsExtensionName),
+    make_ext_adder<vk::PhysicalDeviceDescriptorBufferFeaturesEXT,
+                   vk::PhysicalDeviceDescriptorBufferPropertiesEXT>(
+        vk::EXTDescriptorBufferExtensionName),
 #ifdef VK_KHR_portability_subset
     make_ext_adder<vk::PhysicalDevicePortabilitySubsetFeaturesKHR,
                    vk::PhysicalDevicePortabilitySubsetPropertiesKHR>(
@@ -278,15 +282,21 @@ const std::array required_device_exts{
     vk::KHRPushDescriptorExtensionName,
 
     // other
-    vk::KHRSwapchainExtensionName,
     vk::KHRDynamicRenderingLocalReadExtensionName,
 };
 
+// only required when the device is created for a surface
+const std::array present_device_exts{
+    vk::KHRSwapchainExtensionName,
+};
+
 const std::array wanted_device_exts{
     vk::EXTMemoryBudgetExtensionName,
     vk::EXTMemoryPriorityExtensionName,
     vk::EXTSwapchainColorSpaceExtensionName,
     vk::EXTDeviceFaultExtensionName,
+    vk::EXTCalibratedTimestampsExtensionName,
+    vk::EXTDescriptorBufferExtensionName,
 #ifdef VK_KHR_portability_subset
     vk::KHRPortabilitySubsetExtensionName,
 #endif
@@ -299,11 +309,11 @@ const std::array wanted_device_exts{
 
 } // namespace
 
-Instance::Instance(vk::raii::Context context,
+Instance::Instance(vk::raii::Context context, bool headless,
                    vk::Optional<const vk::AllocationCallbacks> allocator)
     : m_context(std::move(context)), m_maxApiVer(vk::ApiVersion13),
       m_apiVer(std::min(m_maxApiVer, m_context.enumerateInstanceVersion())),
-      m_layers(chooseLayers()), m_extensions(chooseExtensions()),
+      m_headless(headless), m_layers(chooseLayers()), m_extensions(chooseExtensions()),
       m_debugUtilsEnabled(contains(
           m_extensions, make_ext_storage(vk::EXTDebugUtilsExtensionName))),
       m_instance(initInstance(allocator)),
@@ -345,27 +355,31 @@ std::vector<extension_storage> Instance::chooseExtensions() const {
   std::vector<std::string_view> requiredInstanceExts;
   std::vector<std::string_view> wantedInstanceExts;
 
-  for (const auto &ext : required_instance_exts) {
-    unique_add(requiredInstanceExts, ext);
-  }
-
   for (const auto &ext : wanted_instance_exts) {
     unique_add(wantedInstanceExts, ext);
   }
 
-  uint32_t window_ext_count = 0;
-  SDL_Vulkan_GetInstanceExtensions(nullptr, &window_ext_count, nullptr);
-  std::vector<const char *> window_exts(window_ext_count);
-  SDL_Vulkan_GetInstanceExtensions(nullptr, &window_ext_count,
-                                   window_exts.data());
+  if (m_headless) {
+    logger.Log("Headless instance: no window extensions requested");
+  } else {
+    for (const auto &ext : required_instance_exts) {
+      unique_add(requiredInstanceExts, ext);
+    }
 
-  logger.Debug("Required window extensions:");
-  for (const auto &ext : window_exts) {
-    logger.Debug("\t{}", std::string_view{ext});
-  }
+    uint32_t window_ext_count = 0;
+    SDL_Vulkan_GetInstanceExtensions(nullptr, &window_ext_count, nullptr);
+    std::vector<const char *> window_exts(window_ext_count);
+    SDL_Vulkan_GetInstanceExtensions(nullptr, &window_ext_count,
+                                     window_exts.data());
 
-  for (const auto &ext : window_exts) {
-    unique_add(requiredInstanceExts, ext);
+    logger.Debug("Required window extensions:");
+    for (const auto &ext : window_exts) {
+      logger.Debug("\t{}", std::string_view{ext});
+    }
+
+    for (const auto &ext : window_exts) {
+      unique_add(requiredInstanceExts, ext);
+    }
   }
 
   std::vector<extension_storage> avaiable_exts;
@@ -494,13 +508,19 @@ DeviceStats::DeviceStats(const vk::raii::PhysicalDevice &pd,
 }
 
 Device::Device(const Instance &instance, vk::SurfaceKHR surface)
-    : m_instance(instance), m_physicalDevice(nullptr), m_device(nullptr),
+    : m_instance(instance), m_physicalDevice(nullptr),
+      m_presentable(static_cast<bool>(surface)), m_device(nullptr),
       m_allocator(nullptr) {
+  if (!m_presentable) {
+    logger.Log("Creating headless device");
+  }
+
   DeviceStats pd_stats;
   std::tie(pd_stats, m_physicalDevice) = choosePhysicalDevice(surface);
-  m_stats = chooseFeatures(pd_stats);
+  m_stats = chooseFeatures(pd_stats, m_presentable);
   m_device = initDevice();
   m_allocator = initAllocator();
+  m_memory_pools = MemoryPools{allocator()};
   m_queues = initQueues();
 }
 
@@ -520,13 +540,24 @@ Device::rankPhysicalDevice(const DeviceStats &stats,
 
   auto has_ext = std::bind_front(&DeviceStats::has_extension, stats);
 
-  if (!std::ranges::all_of(required_device_exts, has_ext)) {
+  bool const has_present_exts =
+      !surface || std::ranges::all_of(present_device_exts, has_ext);
+
+  if (!std::ranges::all_of(required_device_exts, has_ext) ||
+      !has_present_exts) {
     std::string missing_exts;
     for (const auto &ext : required_device_exts) {
       if (!has_ext(ext)) {
         missing_exts += std::format("\n\t{}", ext);
       }
     }
+    if (surface) {
+      for (const auto &ext : present_device_exts) {
+        if (!has_ext(ext)) {
+          missing_exts += std::format("\n\t{}", ext);
+        }
+      }
+    }
 
     logger.Debug("Physical device {} does not support required extensions: {}",
                  props.deviceName, missing_exts);
@@ -633,10 +664,17 @@ Device::choosePhysicalDevice(vk::SurfaceKHR surface) const {
   return {best.stats, best.pd};
 }
 
-DeviceStats Device::chooseFeatures(const DeviceStats &avaiable) const {
+DeviceStats Device::chooseFeatures(const DeviceStats &avaiable,
+                                   bool presentable) const {
   DeviceStats enabled;
 
-  for (std::string_view e : required_device_exts) {
+  std::vector<std::string_view> required_exts{required_device_exts.begin(),
+                                              required_device_exts.end()};
+  if (presentable) {
+    required_exts.append_range(present_device_exts);
+  }
+
+  for (std::string_view e : required_exts) {
     if (!device_ext_spec.contains(e)) {
       throw exception("No feature mapping for extension {}", e);
     }
@@ -858,6 +896,14 @@ DeviceStats Device::chooseFeatures(const DeviceStats &avaiable) const {
   copy_if_present(vk::PhysicalDeviceMemoryPriorityFeaturesEXT{});
   copy_if_present(vk::PhysicalDeviceFaultFeaturesEXT{});
 
+  // used by BindlessManager; capture replay and push descriptors are not
+  if (const auto *a_descriptor_buffer =
+          avaiable_f.get<vk::PhysicalDeviceDescriptorBufferFeaturesEXT>()) {
+    enabled_f.assign(vk::PhysicalDeviceDescriptorBufferFeaturesEXT{}
+                         .setDescriptorBuffer(
+                             a_descriptor_buffer->descriptorBuffer));
+  }
+
 #ifdef VK_KHR_portability_subset
 
   // should enable all features that are needed by the app
@@ -2,6 +2,7 @@
 
 #include "Config.hpp"
 #include "DynamicStructureChain.hpp"
+#include "MemoryPools.hpp"
 #include "Queue.hpp"
 #include "cppHelpers.hpp"
 #include "v4dgCore.hpp"
@@ -24,8 +25,9 @@ namespace v4dg {
 using extension_storage = vk::ArrayWrapper1D<char, vk::MaxExtensionNameSize>;
 class Instance {
 public:
+  // headless instances do not enable any surface/window extensions
   explicit Instance(
-      vk::raii::Context context,
+      vk::raii::Context context, bool headless = false,
       vk::Optional<const vk::AllocationCallbacks> allocator = nullptr);
 
   // we will be refering to this class as a reference type -> no copying/moving
@@ -53,12 +55,16 @@ public:
     return m_debugUtilsEnabled;
   }
 
+  [[nodiscard]] bool headless() const noexcept { return m_headless; }
+
 private:
   vk::raii::Context m_context;
 
   uint32_t m_maxApiVer;
   uint32_t m_apiVer;
 
+  bool m_headless;
+
   std::vector<extension_storage> m_layers;
   std::vector<extension_storage> m_extensions;
 
@@ -123,6 +129,7 @@ struct DeviceStats {
 
 class Device {
 public:
+  // without a surface the device is created headless (no swapchain support)
   explicit Device(const Instance &instance, vk::SurfaceKHR surface = {});
 
   // we will be refering to this class as a reference type -> no copying/moving
@@ -144,10 +151,17 @@ public:
   [[nodiscard]] vma::Allocator allocator() const noexcept {
     return *m_allocator;
   }
+  // per resource class pools (see MemoryClass)
+  [[nodiscard]] const MemoryPools &memoryPools() const noexcept {
+    return m_memory_pools;
+  }
 
   // after device creation features are immutable
   [[nodiscard]] const DeviceStats &stats() const { return m_stats; }
 
+  // can the device present to a surface (false in headless mode)
+  [[nodiscard]] bool presentable() const noexcept { return m_presentable; }
+
   [[nodiscard]] bool debugNamesAvaiable() const noexcept {
     if constexpr (is_production) {
       return false;
@@ -227,11 +241,13 @@ public:
 private:
   const Instance &m_instance;
   vk::raii::PhysicalDevice m_physicalDevice;
+  bool m_presentable;
 
   DeviceStats m_stats;
 
   vk::raii::Device m_device;
   vma::UniqueAllocator m_allocator;
+  MemoryPools m_memory_pools;
 
   std::vector<std::vector<Queue>> m_queues;
 
@@ -241,7 +257,8 @@ private:
 
   [[nodiscard]] std::pair<DeviceStats, vk::raii::PhysicalDevice>
       choosePhysicalDevice(vk::SurfaceKHR) const;
-  [[nodiscard]] DeviceStats chooseFeatures(const DeviceStats &) const;
+  [[nodiscard]] DeviceStats chooseFeatures(const DeviceStats &,
+                                           bool presentable) const;
   [[nodiscard]] vk::raii::Device initDevice() const;
   [[nodiscard]] vma::UniqueAllocator initAllocator() const;
   [[nodiscard]] std::vector<std::vector<Queue>> initQueues() const;
@@ -0,0 +1,367 @@
+#include "GpuProfiler.hpp"
+
+#include "Debug.hpp"
+#include "Device.hpp"
+#include "Queue.hpp"
+#include "v4dgCore.hpp"
+
+#include <glm/glm.hpp>
+#include <tracy/Tracy.hpp>
+#include <tracy/TracyC.h>
+#include <vulkan/vulkan.hpp>
+#include <vulkan/vulkan_raii.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <format>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <ranges>
+#include <source_location>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+using namespace v4dg;
+
+namespace {
+constexpr std::uint32_t queries_per_zone = 2;
+constexpr double stats_ema_factor = 0.05;
+
+#ifdef _WIN32
+constexpr vk::TimeDomainEXT host_time_domain =
+    vk::TimeDomainEXT::eQueryPerformanceCounter;
+#else
+constexpr vk::TimeDomainEXT host_time_domain =
+    vk::TimeDomainEXT::eClockMonotonicRaw;
+#endif
+
+#ifdef TRACY_ENABLE
+// values of tracy::GpuContextType::Vulkan and
+//   tracy::GpuContextCalibration (not exposed by TracyC.h)
+constexpr std::uint8_t tracy_context_type_vulkan = 2;
+constexpr std::uint8_t tracy_context_flag_calibration = 1;
+
+// all tracy GPU contexts of the process are created here
+std::atomic<std::uint8_t> tracy_next_context{0};
+#endif
+
+std::uint32_t pack_color(glm::vec4 color) {
+  auto to_byte = [](float c) {
+    return static_cast<std::uint32_t>(std::clamp(c, 0.F, 1.F) * 255.F);
+  };
+  // NOLINTNEXTLINE(*-magic-numbers)
+  return to_byte(color.r) << 16 | to_byte(color.g) << 8 | to_byte(color.b);
+}
+} // namespace
+
+GpuProfiler::FrameData::FrameData(const vk::raii::Device &device)
+    : pool(device, {{},
+                    vk::QueryType::eTimestamp,
+                    max_zones_per_frame * queries_per_zone}) {
+  pool.reset(0, max_zones_per_frame * queries_per_zone);
+}
+
+GpuProfiler::GpuProfiler(const Device &device, const Queue &queue,
+                         std::string_view name)
+    : m_device(&device), m_queue(&queue),
+      m_timestamp_mask(queue.timestampValidBits() >= 64
+                           ? std::numeric_limits<std::uint64_t>::max()
+                           : (std::uint64_t{1} << queue.timestampValidBits()) -
+                                 1),
+      m_period_ns(device.stats()
+                      .properties.get<vk::PhysicalDeviceProperties2>()
+                      ->properties.limits.timestampPeriod),
+      m_frames(make_per_frame<FrameData>(device.device())) {
+  assert(queue.timestampValidBits() != 0);
+
+  if (device.stats().has_extension(vk::EXTCalibratedTimestampsExtensionName)) {
+    auto domains = device.physicalDevice().getCalibrateableTimeDomainsEXT();
+    if (std::ranges::contains(domains, vk::TimeDomainEXT::eDevice) &&
+        std::ranges::contains(domains, host_time_domain)) {
+      m_host_domain = host_time_domain;
+    }
+  }
+
+  auto [gpu_time, host_time] = sample_clocks();
+  m_last_raw = gpu_time;
+  m_last_host_time = host_time;
+
+  logger.Debug("GPU profiler for {}: {} valid bits, period {}ns, {}", name,
+               queue.timestampValidBits(), m_period_ns,
+               calibrated() ? "calibrated" : "not calibrated");
+
+#ifdef TRACY_ENABLE
+  m_tracy_context = tracy_next_context.fetch_add(1);
+
+  ___tracy_emit_gpu_new_context_serial({
+      .gpuTime = static_cast<std::int64_t>(gpu_time),
+      .period = m_period_ns,
+      .context = m_tracy_context,
+      .flags = calibrated() ? tracy_context_flag_calibration : std::uint8_t{0},
+      .type = tracy_context_type_vulkan,
+  });
+
+  ___tracy_emit_gpu_context_name_serial({
+      .context = m_tracy_context,
+      .name = name.data(),
+      .len = static_cast<std::uint16_t>(name.size()),
+  });
+#endif
+}
+
+std::uint32_t GpuProfiler::begin_zone(const vk::raii::CommandBuffer &cb,
+                                      std::uint32_t frame,
+                                      std::string_view name, glm::vec4 color,
+                                      const std::source_location &loc) noexcept {
+  auto &fd = m_frames[frame];
+
+  std::uint32_t zone{};
+  try {
+    std::scoped_lock const _{fd.mutex};
+    if (fd.zones.size() >= max_zones_per_frame) {
+      return invalid_zone;
+    }
+
+    zone = static_cast<std::uint32_t>(fd.zones.size());
+    fd.zones.push_back({std::string{name}, pack_color(color), loc});
+  } catch (...) {
+    return invalid_zone;
+  }
+
+  cb.writeTimestamp2(vk::PipelineStageFlagBits2::eTopOfPipe, *fd.pool,
+                     zone * queries_per_zone);
+  return zone;
+}
+
+void GpuProfiler::end_zone(const vk::raii::CommandBuffer &cb,
+                           std::uint32_t frame, std::uint32_t zone) noexcept {
+  if (zone == invalid_zone) {
+    return;
+  }
+
+  cb.writeTimestamp2(vk::PipelineStageFlagBits2::eBottomOfPipe,
+                     *m_frames[frame].pool, zone * queries_per_zone + 1);
+}
+
+void GpuProfiler::collect(std::uint32_t frame) {
+  ZoneScoped;
+  auto &fd = m_frames[frame];
+
+  std::vector<Zone> zones;
+  {
+    std::scoped_lock const _{fd.mutex};
+    zones = std::exchange(fd.zones, {});
+  }
+
+  if (!zones.empty()) {
+    auto query_count = static_cast<std::uint32_t>(zones.size()) *
+                       queries_per_zone;
+
+    // (value, availability) pairs
+    static constexpr std::size_t stride = 2 * sizeof(std::uint64_t);
+
+    // never waits: zones of command buffers that were not submitted are
+    //   unavailable and skipped
+    auto [result, data] = fd.pool.getResults<std::uint64_t>(
+        0, query_count, query_count * stride, stride,
+        vk::QueryResultFlagBits::e64 |
+            vk::QueryResultFlagBits::eWithAvailability);
+
+    struct resolved {
+      std::uint64_t begin;
+      std::uint64_t end;
+      const Zone *zone;
+      std::uint32_t index;
+    };
+    std::vector<resolved> done;
+    done.reserve(zones.size());
+
+    for (auto [i, zone] : std::views::enumerate(zones)) {
+      auto base = static_cast<std::size_t>(i) * queries_per_zone * 2;
+      if (data[base + 1] == 0 || data[base + 3] == 0) {
+        continue;
+      }
+
+      auto begin = data[base] & m_timestamp_mask;
+      auto ticks = (data[base + 2] - begin) & m_timestamp_mask;
+
+      // NOLINTNEXTLINE(*-magic-numbers): ns -> ms
+      update_stats(zone, static_cast<double>(ticks) * m_period_ns / 1e6);
+
+      auto ubegin = unwrap(begin);
+      done.push_back({ubegin, ubegin + ticks, &zone,
+                      static_cast<std::uint32_t>(i)});
+    }
+
+#ifdef TRACY_ENABLE
+    // tracy needs properly nested zones - emit in begin order and close
+    //   every zone that ended before the next one begins
+    std::ranges::sort(done, [](const resolved &l, const resolved &r) {
+      return l.begin != r.begin ? l.begin < r.begin : l.end > r.end;
+    });
+
+    std::vector<const resolved *> open;
+    auto close_until = [&](std::uint64_t time) {
+      while (!open.empty() && open.back()->end <= time) {
+        const auto &z = *open.back();
+        auto query = static_cast<std::uint16_t>(z.index * queries_per_zone + 1);
+        ___tracy_emit_gpu_zone_end_serial(
+            {.queryId = query, .context = m_tracy_context});
+        ___tracy_emit_gpu_time_serial(
+            {.gpuTime = static_cast<std::int64_t>(z.end),
+             .queryId = query,
+             .context = m_tracy_context});
+        open.pop_back();
+      }
+    };
+
+    for (const auto &z : done) {
+      close_until(z.begin);
+
+      const auto &loc = z.zone->loc;
+      std::string_view const file = loc.file_name();
+      std::string_view const function = loc.function_name();
+
+      auto srcloc = ___tracy_alloc_srcloc_name(
+          loc.line(), file.data(), file.size(), function.data(),
+          function.size(), z.zone->name.data(), z.zone->name.size(),
+          z.zone->color);
+
+      auto query = static_cast<std::uint16_t>(z.index * queries_per_zone);
+      ___tracy_emit_gpu_zone_begin_alloc_serial(
+          {.srcloc = srcloc, .queryId = query, .context = m_tracy_context});
+      ___tracy_emit_gpu_time_serial(
+          {.gpuTime = static_cast<std::int64_t>(z.begin),
+           .queryId = query,
+           .context = m_tracy_context});
+
+      open.push_back(&z);
+    }
+    close_until(std::numeric_limits<std::uint64_t>::max());
+#endif
+  }
+
+  fd.pool.reset(0, max_zones_per_frame * queries_per_zone);
+
+#ifdef TRACY_ENABLE
+  // keep CPU and GPU clocks from drifting apart
+  if (calibrated()) {
+    auto [gpu_time, host_time] = sample_clocks();
+    if (host_time > m_last_host_time) {
+      ___tracy_emit_gpu_calibration_serial({
+          .gpuTime = static_cast<std::int64_t>(unwrap(gpu_time)),
+          .cpuDelta = static_cast<std::int64_t>(host_time - m_last_host_time),
+          .context = m_tracy_context,
+      });
+      m_last_host_time = host_time;
+    }
+  }
+#endif
+}
+
+std::vector<GpuProfiler::ZoneStats> GpuProfiler::stats() const {
+  std::scoped_lock const _{m_stats_mutex};
+  return m_stats | std::views::values | std::ranges::to<std::vector>();
+}
+
+std::optional<GpuProfiler::ZoneStats>
+GpuProfiler::zone(std::string_view name) const {
+  std::scoped_lock const _{m_stats_mutex};
+  if (auto it = m_stats.find(name); it != m_stats.end()) {
+    return it->second;
+  }
+  return std::nullopt;
+}
+
+std::uint64_t GpuProfiler::unwrap(std::uint64_t raw) noexcept {
+  if (m_timestamp_mask == std::numeric_limits<std::uint64_t>::max()) {
+    return raw;
+  }
+
+  // a jump back by more than half of the range means the counter wrapped
+  if (raw < m_last_raw && m_last_raw - raw > m_timestamp_mask / 2) {
+    m_wrap_offset += m_timestamp_mask + 1;
+    m_last_raw = raw;
+  } else if (raw > m_last_raw) {
+    m_last_raw = raw;
+  }
+
+  return raw + m_wrap_offset;
+}
+
+std::pair<std::uint64_t, std::uint64_t> GpuProfiler::sample_clocks() const {
+  if (!m_host_domain) {
+    return {sample_gpu_time_submit(), 0};
+  }
+
+  std::array const infos{
+      vk::CalibratedTimestampInfoEXT{vk::TimeDomainEXT::eDevice},
+      vk::CalibratedTimestampInfoEXT{*m_host_domain},
+  };
+
+  auto [timestamps, max_deviation] =
+      m_device->device().getCalibratedTimestampsEXT(infos);
+
+  return {timestamps[0] & m_timestamp_mask, timestamps[1]};
+}
+
+std::uint64_t GpuProfiler::sample_gpu_time_submit() const {
+  // called only during construction so nobody else is using the queue yet
+  const auto &device = m_device->device();
+
+  vk::raii::CommandPool const pool{
+      device, {vk::CommandPoolCreateFlagBits::eTransient, m_queue->family()}};
+  auto cbs =
+      device.allocateCommandBuffers({*pool, vk::CommandBufferLevel::ePrimary, 1});
+  auto &cb = cbs.front();
+
+  vk::raii::QueryPool query{device, {{}, vk::QueryType::eTimestamp, 1}};
+  query.reset(0, 1);
+
+  cb.begin({vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+  cb.writeTimestamp2(vk::PipelineStageFlagBits2::eAllCommands, *query, 0);
+  cb.end();
+
+  vk::raii::Fence const fence{device, vk::FenceCreateInfo{}};
+  vk::CommandBufferSubmitInfo const cbsi{*cb};
+  m_queue->queue().submit2(vk::SubmitInfo2{{}, {}, cbsi, {}}, *fence);
+
+  auto result = device.waitForFences(*fence, vk::True,
+                                     std::numeric_limits<std::uint64_t>::max());
+  if (result != vk::Result::eSuccess) {
+    throw exception("waitForFences failed: {}", result);
+  }
+
+  auto [res, data] = query.getResults<std::uint64_t>(
+      0, 1, sizeof(std::uint64_t), sizeof(std::uint64_t),
+      vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait);
+
+  return data[0] & m_timestamp_mask;
+}
+
+void GpuProfiler::update_stats(const Zone &zone, double ms) {
+  std::scoped_lock const _{m_stats_mutex};
+
+  auto it = m_stats.find(zone.name);
+  if (it == m_stats.end()) {
+    it = m_stats
+             .emplace(zone.name, ZoneStats{.name = zone.name,
+                                           .last_ms = ms,
+                                           .avg_ms = ms,
+                                           .max_ms = ms,
+                                           .samples = 0})
+             .first;
+  }
+
+  auto &s = it->second;
+  s.last_ms = ms;
+  s.avg_ms += (ms - s.avg_ms) * stats_ema_factor;
+  s.max_ms = std::max(s.max_ms, ms);
+  s.samples++;
+}
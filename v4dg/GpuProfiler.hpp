@@ -0,0 +1,113 @@
+#pragma once
+
+#include "Device.hpp"
+#include "Queue.hpp"
+#include "v4dgCore.hpp"
+
+#include <glm/glm.hpp>
+#include <vulkan/vulkan.hpp>
+#include <vulkan/vulkan_raii.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <source_location>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace v4dg {
+// GPU timestamp profiler for a single queue.
+//   Zones are written into a per-frame query pool and read back without
+//   waiting when the frame slot is reused (max_frames_in_flight frames later,
+//   after Context::next_frame waited on the queue's timeline semaphore).
+//   Results are sent to Tracy's GPU timeline and kept as per-zone stats.
+class GpuProfiler {
+public:
+  static constexpr std::uint32_t max_zones_per_frame = 512;
+  static constexpr std::uint32_t invalid_zone = ~0U;
+
+  struct ZoneStats {
+    std::string name;
+    double last_ms{};
+    double avg_ms{}; // exponential moving average
+    double max_ms{};
+    std::uint64_t samples{};
+  };
+
+  // queue.timestampValidBits() must be non-zero
+  GpuProfiler(const Device &device, const Queue &queue, std::string_view name);
+
+  GpuProfiler(const GpuProfiler &) = delete;
+  GpuProfiler &operator=(const GpuProfiler &) = delete;
+  GpuProfiler(GpuProfiler &&) = delete;
+  GpuProfiler &operator=(GpuProfiler &&) = delete;
+  ~GpuProfiler() = default;
+
+  // returns invalid_zone if the frame ran out of queries
+  [[nodiscard]] std::uint32_t
+  begin_zone(const vk::raii::CommandBuffer &cb, std::uint32_t frame,
+             std::string_view name, glm::vec4 color,
+             const std::source_location &loc) noexcept;
+  void end_zone(const vk::raii::CommandBuffer &cb, std::uint32_t frame,
+                std::uint32_t zone) noexcept;
+
+  // read back the results of `frame` and reset its pool
+  //   all GPU work of that frame has to be finished
+  void collect(std::uint32_t frame);
+
+  [[nodiscard]] std::vector<ZoneStats> stats() const;
+  [[nodiscard]] std::optional<ZoneStats> zone(std::string_view name) const;
+
+  // CPU/GPU clocks are aligned with VK_EXT_calibrated_timestamps
+  [[nodiscard]] bool calibrated() const noexcept {
+    return m_host_domain.has_value();
+  }
+
+private:
+  struct Zone {
+    std::string name;
+    std::uint32_t color;
+    std::source_location loc;
+  };
+
+  struct FrameData {
+    explicit FrameData(const vk::raii::Device &device);
+
+    vk::raii::QueryPool pool;
+
+    std::mutex mutex;
+    std::vector<Zone> zones;
+  };
+
+  const Device *m_device;
+  const Queue *m_queue;
+
+  std::uint64_t m_timestamp_mask;
+  float m_period_ns;
+
+  per_frame<FrameData> m_frames;
+
+  std::optional<vk::TimeDomainEXT> m_host_domain;
+  std::uint64_t m_last_host_time{0};
+
+  // extension of timestamps with less than 64 valid bits
+  std::uint64_t m_last_raw{0};
+  std::uint64_t m_wrap_offset{0};
+
+  std::uint8_t m_tracy_context{0};
+
+  mutable std::mutex m_stats_mutex;
+  std::map<std::string, ZoneStats, std::less<>> m_stats;
+
+  [[nodiscard]] std::uint64_t unwrap(std::uint64_t raw) noexcept;
+
+  // (gpu time, host time) - host time only if calibrated
+  [[nodiscard]] std::pair<std::uint64_t, std::uint64_t> sample_clocks() const;
+  [[nodiscard]] std::uint64_t sample_gpu_time_submit() const;
+
+  void update_stats(const Zone &zone, double ms);
+};
+} // namespace v4dg
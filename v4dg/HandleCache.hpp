@@ -1,14 +1,24 @@
 #pragma once
 
+#include "v4dgCore.hpp"
+
 #include <ankerl/unordered_dense.h>
 
-#include <cassert>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <concepts>
+#include <cstddef>
 #include <cstdint>
-#include <iterator>
+#include <deque>
+#include <functional>
 #include <memory>
 #include <mutex>
-#include <shared_mutex>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 namespace v4dg {
 template <typename T>
@@ -25,91 +35,519 @@ concept handle_descriptor_base = requires(
   { typename T::hash{}(cref) } -> std::convertible_to<std::uint64_t>;
 };
 
-template <typename T>
-concept permament_handle_descriptor =
-    handle_descriptor_base<T> &&
-    requires(const T &cref, typename T::handle_data &d) {
-      { cref.create(d) } -> std::same_as<typename T::handle_type>;
-    };
+namespace detail {
+// Epoch based reclamation shared by all rcu_maps.
+//   Readers publish the global epoch in a slot of their own (one cache line
+//   per thread - no shared cache line is written on the read path).
+//   Memory retired at epoch `e` may be freed once no slot holds an epoch
+//   `<= e`.
+//   The slot store is followed by the load of the published pointer (and the
+//   unpublishing store by the slot scan): store-load orderings, so both
+//   sides are seq_cst - release/acquire would let a reader see a pointer a
+//   reclaimer does not know about.
+class epoch_domain {
+  struct slot_type;
 
-template <permament_handle_descriptor handle_desc>
-class permament_handle_cache {
 public:
-  using handle_type = typename handle_desc::handle_type;
-  using handle_data = typename handle_desc::handle_data;
+  static constexpr std::size_t max_threads = 256;
 
-  explicit permament_handle_cache(handle_data data) : m_data(data) {}
+  static epoch_domain &instance() {
+    static epoch_domain domain;
+    return domain;
+  }
+
+  class read_guard {
+  public:
+    read_guard() : m_slot(instance().local()) {
+      if (m_slot.depth++ == 0) {
+        m_slot.epoch.store(instance().m_epoch.load(std::memory_order_acquire),
+                           std::memory_order_seq_cst);
+      }
+    }
+    read_guard(const read_guard &) = delete;
+    read_guard(read_guard &&) = delete;
+    read_guard &operator=(const read_guard &) = delete;
+    read_guard &operator=(read_guard &&) = delete;
+    ~read_guard() {
+      if (--m_slot.depth == 0) {
+        m_slot.epoch.store(0, std::memory_order_release);
+      }
+    }
+
+  private:
+    slot_type &m_slot;
+  };
+
+  // index of the calling thread's slot (for per-thread data of the readers)
+  static std::size_t thread_index() {
+    auto &domain = instance();
+    return static_cast<std::size_t>(&domain.local() - domain.m_slots.data());
+  }
+
+  // call after unpublishing; returns the epoch to retire the memory with
+  std::uint64_t advance() noexcept {
+    return m_epoch.fetch_add(1, std::memory_order_acq_rel);
+  }
+
+  [[nodiscard]] bool can_reclaim(std::uint64_t retire_epoch) const noexcept {
+    for (const auto &slot : m_slots) {
+      auto epoch = slot.epoch.load(std::memory_order_seq_cst);
+      if (epoch != 0 && epoch <= retire_epoch) {
+        return false;
+      }
+    }
+    return true;
+  }
 
 private:
-  using hash = typename handle_desc::hash;
-  using map_type = ankerl::unordered_dense::map<handle_desc, handle_type, hash>;
+  struct alignas(cache_line_size) slot_type {
+    std::atomic<std::uint64_t> epoch{0};
+    std::atomic<bool> used{false};
+    std::uint32_t depth{0}; // only touched by the owning thread
+  };
+
+  // 0 marks an idle slot
+  std::atomic<std::uint64_t> m_epoch{1};
+  std::array<slot_type, max_threads> m_slots;
+
+  slot_type &local() {
+    struct registration {
+      slot_type *slot{nullptr};
+
+      registration() = default;
+      registration(const registration &) = delete;
+      registration(registration &&) = delete;
+      registration &operator=(const registration &) = delete;
+      registration &operator=(registration &&) = delete;
+      ~registration() {
+        if (slot != nullptr) {
+          slot->used.store(false, std::memory_order_release);
+        }
+      }
+    };
+    thread_local registration reg;
+
+    if (reg.slot == nullptr) {
+      for (auto &slot : m_slots) {
+        bool expected = false;
+        if (slot.used.compare_exchange_strong(expected, true,
+                                              std::memory_order_acquire)) {
+          reg.slot = &slot;
+          break;
+        }
+      }
+      if (reg.slot == nullptr) {
+        throw exception("epoch_domain: more than {} reader threads",
+                        max_threads);
+      }
+    }
+
+    return *reg.slot;
+  }
+
+  friend read_guard;
+};
+} // namespace detail
+
+struct handle_cache_stats {
+  std::uint64_t hits{};
+  std::uint64_t misses{};
+  std::uint64_t evictions{};
+
+  // objects owned by the cache
+  std::size_t live{};
+  // evicted objects waiting for readers (and the retire hook)
+  std::size_t retired{};
+
+  std::chrono::nanoseconds create_time{};
+  std::chrono::nanoseconds max_create_time{};
+
+  [[nodiscard]] double hit_rate() const noexcept {
+    auto const total = hits + misses;
+    return total == 0 ? 0. : static_cast<double>(hits) / total;
+  }
+  [[nodiscard]] std::chrono::nanoseconds avg_create_time() const noexcept {
+    return misses == 0 ? std::chrono::nanoseconds{}
+                       : create_time / static_cast<std::int64_t>(misses);
+  }
+};
 
+// receives evicted objects once no reader can see them
+//   (e.g. to keep them alive until the GPU is done with them)
+using handle_retire_hook = std::function<void(std::shared_ptr<const void>)>;
+
+namespace detail {
+// Read-optimized map used by the handle caches.
+//   Lookups go to an immutable snapshot published through an atomic pointer
+//   - no locks and no writes to shared cache lines. Misses go to one of
+//   `shard_count` insert buffers striped by hash, so equal keys always meet
+//   in the same buffer and are created once. flush() (once per frame,
+//   single thread) merges the buffers into a new snapshot and publishes it.
+//   Hits are counted per thread without read-modify-writes and summed by
+//   flush().
+//   Replaced snapshots and evicted values are freed once no reader can see
+//   them (epoch_domain), but not before `grace_period` flushes.
+//
+//   With a budget, flush() evicts the least recently used values that are
+//   `unused` and were not accessed in the last `grace_period` flushes.
+template <typename Key, typename Value, typename Hash> class rcu_map {
 public:
-  const handle_type &get(const handle_desc &desc) {
-    if (auto phandle = get_old(desc); phandle) {
-      return *phandle;
-    }
+  static constexpr std::size_t shard_count = 16;
+  static constexpr std::size_t grace_period = max_frames_in_flight + 1;
 
-    return get_locked(desc);
+  rcu_map() : m_current(std::make_unique<snapshot_type>()) {
+    m_published.store(m_current.get(), std::memory_order_seq_cst);
   }
 
-  const handle_type &get_locked(const handle_desc &desc) {
+  rcu_map(const rcu_map &) = delete;
+  rcu_map(rcu_map &&) = delete;
+  rcu_map &operator=(const rcu_map &) = delete;
+  rcu_map &operator=(rcu_map &&) = delete;
+  ~rcu_map() {
+    for (auto &chunk : m_hits) {
+      delete chunk.load(std::memory_order_relaxed); // NOLINT(*-owning-memory)
+    }
+  }
+
+  // returns `proj(value)`; the projection runs while the value is protected
+  //   - values may be evicted as soon as it returns
+  template <typename F, typename Proj>
+  std::invoke_result_t<Proj, const Value &> get(const Key &key, F &&create,
+                                                Proj &&proj) {
     {
-      std::shared_lock lock(m_mut);
-      if (auto phandle = get_lockless(desc); phandle) {
-        return *phandle;
+      epoch_domain::read_guard const guard;
+      if (const auto *n = find(key); n) {
+        return hit(*n, proj);
       }
     }
 
+    auto &shard = m_shards[Hash{}(key) % shard_count];
+    std::scoped_lock lock(shard.mut);
+
+    // flush publishes while holding every shard lock
     {
-      // lock for write
-      std::unique_lock lock(m_mut);
-      if (auto phandle = get_lockless(desc); phandle) {
-        return *phandle;
+      epoch_domain::read_guard const guard;
+      if (const auto *n = find(key); n) {
+        return hit(*n, proj);
       }
+    }
 
-      return m_new.insert(desc, desc.create(m_data)).first->second;
+    // pending values cannot be evicted while the shard is locked
+    if (auto it = shard.pending.find(key); it != shard.pending.end()) {
+      return hit(*it->second, proj);
     }
+
+    auto start = std::chrono::steady_clock::now();
+    auto n = std::make_unique<node>(std::forward<F>(create)());
+    auto time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start);
+
+    shard.misses++;
+    shard.create_time += time;
+    shard.max_create_time = std::max(shard.max_create_time, time);
+
+    n->last_use.store(m_flush_idx.load(std::memory_order_relaxed),
+                      std::memory_order_relaxed);
+    return std::invoke(
+        proj, shard.pending.emplace(key, std::move(n)).first->second->value);
   }
 
-  void flush() {
-    std::unique_lock lock(m_mut);
+  // merge pending values; `unused(value)` marks values that may be evicted
+  //   - all of them if `drop_unused`, otherwise only to stay in the budget
+  template <typename Pred> void flush(Pred &&unused, bool drop_unused) {
+    std::array<std::unique_lock<std::mutex>, shard_count> locks;
+    for (std::size_t i = 0; i < shard_count; i++) {
+      locks[i] = std::unique_lock{m_shards[i].mut};
+    }
+
+    auto const flush_idx =
+        m_flush_idx.fetch_add(1, std::memory_order_relaxed) + 1;
+    merge_hits();
+    reclaim();
 
-    auto storage = m_new.extract();
-    m_old.insert(std::move_iterator(storage.begin()),
-                 std::move_iterator(storage.end()));
+    bool changed = false;
+    for (auto &shard : m_shards) {
+      for (auto &&[key, n] : shard.pending.extract()) {
+        m_owned.emplace(std::move(key), std::move(n));
+        changed = true;
+      }
+    }
+
+    std::vector<std::unique_ptr<node>> evicted;
+    if (drop_unused) {
+      for (auto it = m_owned.begin(); it != m_owned.end();) {
+        if (unused(std::as_const(it->second->value))) {
+          evicted.push_back(std::move(it->second));
+          it = m_owned.erase(it);
+        } else {
+          ++it;
+        }
+      }
+    }
+
+    if (m_budget && m_owned.size() > *m_budget) {
+      evict_lru(unused, flush_idx, evicted);
+    }
+
+    changed |= !evicted.empty();
+    m_evictions += evicted.size();
+
+    if (!changed) {
+      return;
+    }
+
+    auto next = std::make_unique<snapshot_type>();
+    next->reserve(m_owned.size());
+    for (const auto &[key, n] : m_owned) {
+      next->emplace(key, n.get());
+    }
+
+    m_published.store(next.get(), std::memory_order_seq_cst);
+    m_retired.push_back({
+        .epoch = epoch_domain::instance().advance(),
+        .flush_idx = flush_idx,
+        .snapshot = std::exchange(m_current, std::move(next)),
+        .values = std::move(evicted),
+    });
   }
 
-private:
-  const handle_type *get_old(const handle_desc &desc) const {
-    if (auto it = m_old.find(desc); it != m_old.end()) {
-      return &it->second;
+  // maximal number of values kept by LRU eviction (nullopt - unbounded)
+  //   the setters are to be called from the flushing thread
+  void set_budget(std::optional<std::size_t> budget) noexcept {
+    m_budget = budget;
+  }
+  [[nodiscard]] std::optional<std::size_t> budget() const noexcept {
+    return m_budget;
+  }
+
+  void set_retire_hook(handle_retire_hook hook) {
+    m_retire_hook = std::move(hook);
+  }
+
+  // must not race with flush()
+  [[nodiscard]] handle_cache_stats stats() {
+    merge_hits();
+    handle_cache_stats stats{
+        .hits = m_hits_total,
+        .evictions = m_evictions,
+        .live = m_owned.size(),
+    };
+
+    for (auto &shard : m_shards) {
+      std::scoped_lock lock(shard.mut);
+      stats.misses += shard.misses;
+      stats.live += shard.pending.size();
+      stats.create_time += shard.create_time;
+      stats.max_create_time =
+          std::max(stats.max_create_time, shard.max_create_time);
+    }
+
+    for (const auto &retired : m_retired) {
+      stats.retired += retired.values.size();
     }
 
+    return stats;
+  }
+
+private:
+  struct node {
+    explicit node(Value value) : value(std::move(value)) {}
+
+    Value value;
+    // flush index of the last access (for LRU)
+    mutable std::atomic<std::size_t> last_use{0};
+  };
+
+  using snapshot_type = ankerl::unordered_dense::map<Key, const node *, Hash>;
+  using owning_map =
+      ankerl::unordered_dense::map<Key, std::unique_ptr<node>, Hash>;
+
+  struct alignas(cache_line_size) shard_type {
+    std::mutex mut;
+    owning_map pending;
+
+    std::uint64_t misses{0};
+    std::chrono::nanoseconds create_time{};
+    std::chrono::nanoseconds max_create_time{};
+  };
+
+  // written only by the thread owning the epoch_domain slot (a plain load
+  //   and store - the atomic only makes the reads of flush() race-free)
+  struct alignas(cache_line_size) hit_counter {
+    std::atomic<std::uint64_t> hits{0};
+  };
+  // the counters of `hit_chunk` epoch_domain slots - allocated on the first
+  //   hit of one of them (a map is only read by a few threads)
+  static constexpr std::size_t hit_chunk = 8;
+  using hit_chunk_type = std::array<hit_counter, hit_chunk>;
+  static_assert(epoch_domain::max_threads % hit_chunk == 0);
+
+  struct retired_type {
+    std::uint64_t epoch;
+    std::size_t flush_idx;
+    std::unique_ptr<snapshot_type> snapshot;
+    std::vector<std::unique_ptr<node>> values;
+  };
+
+  std::atomic<const snapshot_type *> m_published;
+  std::atomic<std::size_t> m_flush_idx{0};
+  std::array<shard_type, shard_count> m_shards;
+  std::array<std::atomic<hit_chunk_type *>,
+             epoch_domain::max_threads / hit_chunk>
+      m_hits{};
+
+  // only touched by flush()
+  std::unique_ptr<snapshot_type> m_current;
+  owning_map m_owned;
+  std::deque<retired_type> m_retired;
+  std::uint64_t m_evictions{0};
+  std::uint64_t m_hits_total{0};
+
+  std::optional<std::size_t> m_budget;
+  handle_retire_hook m_retire_hook;
+
+  // requires a read_guard
+  [[nodiscard]] const node *find(const Key &key) const {
+    const auto *snapshot = m_published.load(std::memory_order_seq_cst);
+    if (auto it = snapshot->find(key); it != snapshot->end()) {
+      return it->second;
+    }
     return nullptr;
   }
 
-  const handle_type *get_new(const handle_desc &desc) const {
-    if (auto it = m_new.find(desc); it != m_new.end()) {
-      return &it->second;
+  template <typename Proj>
+  std::invoke_result_t<Proj, const Value &> hit(const node &n, Proj &proj) {
+    auto &counter = hit_counter_of(epoch_domain::thread_index()).hits;
+    counter.store(counter.load(std::memory_order_relaxed) + 1,
+                  std::memory_order_relaxed);
+
+    // written at most once per flush
+    auto const flush_idx = m_flush_idx.load(std::memory_order_relaxed);
+    if (n.last_use.load(std::memory_order_relaxed) != flush_idx) {
+      n.last_use.store(flush_idx, std::memory_order_relaxed);
     }
 
-    return nullptr;
+    return std::invoke(proj, n.value);
   }
 
-  const handle_type *get_lockless(const handle_desc &desc) const {
-    if (auto phandle = get_old(desc); phandle) {
-      return phandle;
+  template <typename Pred>
+  void evict_lru(Pred &unused, std::size_t flush_idx,
+                 std::vector<std::unique_ptr<node>> &evicted) {
+    std::vector<std::pair<std::size_t, const Key *>> candidates;
+    for (const auto &[key, n] : m_owned) {
+      auto last_use = n->last_use.load(std::memory_order_relaxed);
+      if (last_use + grace_period <= flush_idx &&
+          unused(std::as_const(n->value))) {
+        candidates.emplace_back(last_use, &key);
+      }
+    }
+
+    auto const excess = std::min(m_owned.size() - *m_budget, candidates.size());
+    std::ranges::partial_sort(candidates, candidates.begin() + excess, {},
+                              &std::pair<std::size_t, const Key *>::first);
+
+    // copy the keys - erasing moves the elements of the map
+    std::vector<Key> keys;
+    keys.reserve(excess);
+    for (std::size_t i = 0; i < excess; i++) {
+      keys.push_back(*candidates[i].second);
+    }
+
+    for (const auto &key : keys) {
+      auto it = m_owned.find(key);
+      evicted.push_back(std::move(it->second));
+      m_owned.erase(it);
     }
-    return get_new(desc);
   }
 
-  // lockless, already created at least frame before
-  map_type m_old;
+  hit_counter &hit_counter_of(std::size_t thread) {
+    auto &slot = m_hits[thread / hit_chunk];
+    auto *chunk = slot.load(std::memory_order_acquire);
+    if (chunk == nullptr) {
+      auto fresh = std::make_unique<hit_chunk_type>();
+      if (slot.compare_exchange_strong(chunk, fresh.get(),
+                                       std::memory_order_acq_rel,
+                                       std::memory_order_acquire)) {
+        chunk = fresh.release();
+      }
+    }
+    return (*chunk)[thread % hit_chunk];
+  }
 
-  // stores handle and atomic bool telling if the object is already constucted
-  mutable std::shared_mutex m_mut;
-  map_type m_new;
+  void merge_hits() {
+    m_hits_total = 0;
+    for (const auto &slot : m_hits) {
+      const auto *chunk = slot.load(std::memory_order_acquire);
+      if (chunk == nullptr) {
+        continue;
+      }
+      for (const auto &counter : *chunk) {
+        m_hits_total += counter.hits.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  void reclaim() {
+    const auto &domain = epoch_domain::instance();
+    auto const flush_idx = m_flush_idx.load(std::memory_order_relaxed);
+
+    while (!m_retired.empty() &&
+           m_retired.front().flush_idx + grace_period <= flush_idx &&
+           domain.can_reclaim(m_retired.front().epoch)) {
+      if (m_retire_hook) {
+        for (auto &n : m_retired.front().values) {
+          m_retire_hook(std::shared_ptr<const void>(std::move(n)));
+        }
+      }
+      m_retired.pop_front();
+    }
+  }
+};
+} // namespace detail
+
+template <typename T>
+concept permament_handle_descriptor =
+    handle_descriptor_base<T> &&
+    requires(const T &cref, typename T::handle_data &d) {
+      { cref.create(d) } -> std::same_as<typename T::handle_type>;
+    };
+
+// handles live as long as the cache
+//   - unless an LRU budget is set; then references must not be used longer
+//   than `grace_period` flushes after the last get()
+template <permament_handle_descriptor handle_desc>
+class permament_handle_cache {
+public:
+  using handle_type = typename handle_desc::handle_type;
+  using handle_data = typename handle_desc::handle_data;
+
+  explicit permament_handle_cache(handle_data data) : m_data(data) {}
+
+  const handle_type &get(const handle_desc &desc) {
+    return *m_map.get(
+        desc, [&] { return desc.create(m_data); },
+        [](const handle_type &handle) { return &handle; });
+  }
+
+  // call once per frame from a single thread
+  void flush() {
+    m_map.flush([](const handle_type &) { return true; }, false);
+  }
+
+  void set_lru_budget(std::optional<std::size_t> max_entries) noexcept {
+    m_map.set_budget(max_entries);
+  }
+  void set_retire_hook(handle_retire_hook hook) {
+    m_map.set_retire_hook(std::move(hook));
+  }
+
+  // call from the flushing thread
+  [[nodiscard]] handle_cache_stats stats() { return m_map.stats(); }
+
+private:
+  using hash = typename handle_desc::hash;
+
+  detail::rcu_map<handle_desc, handle_type, hash> m_map;
 
   handle_data m_data;
 };
@@ -123,6 +561,9 @@ concept handle_descriptor =
       } -> std::same_as<std::shared_ptr<const typename T::handle_type>>;
     };
 
+// handles are dropped on flush once only the cache references them
+//   - unless an LRU budget is set; then unreferenced handles are kept for
+//   reuse and only the least recently used ones over the budget are dropped
 template <handle_descriptor handle_desc> class handle_cache {
 public:
   using handle_type = typename handle_desc::handle_type;
@@ -130,87 +571,48 @@ public:
 
   explicit handle_cache(handle_data data) : m_data(data) {}
 
-private:
-  using hash = typename handle_desc::hash;
-  using map_type =
-      ankerl::unordered_dense::map<handle_desc,
-                                   std::weak_ptr<const handle_type>, hash>;
-
-public:
   std::shared_ptr<const handle_type> get(const handle_desc &desc) {
-    if (auto phandle = get_old(desc); phandle) {
-      return phandle;
-    }
-
-    return get_locked(desc);
+    return m_map.get(
+        desc, [&] { return desc.create(m_data); },
+        [](const std::shared_ptr<const handle_type> &handle) {
+          return handle;
+        });
   }
 
-  std::shared_ptr<const handle_type> get_locked(const handle_desc &desc) {
-    {
-      std::shared_lock lock(m_mut);
-      if (auto phandle = get_lockless(desc); phandle) {
-        return phandle;
-      }
-    }
-
-    {
-      // lock for write
-      std::unique_lock lock(m_mut);
-      if (auto phandle = get_lockless(desc); phandle) {
-        return phandle;
-      }
-
-      auto handle = desc.create(m_data);
-      m_new.insert(desc, handle);
-      return handle;
-    }
+  // no reference counting - the handle stays valid for at least
+  //   `grace_period` flushes after nothing else references it
+  const handle_type &get_ref(const handle_desc &desc) {
+    return *m_map.get(
+        desc, [&] { return desc.create(m_data); },
+        [](const std::shared_ptr<const handle_type> &handle) {
+          return handle.get();
+        });
   }
 
+  // call once per frame from a single thread
   void flush(bool cleanup = true) {
-    std::unique_lock lock(m_mut);
-
-    auto storage = m_new.extract();
-    for (auto &&[desc, handle] : storage) {
-      m_old.insert_or_assign(std::move(desc), std::move(handle));
-    }
-
-    if (cleanup) {
-      std::erase_if(m_old,
-                    [](const auto &pair) { return pair.second.expired(); });
-    }
+    m_map.flush(
+        [](const std::shared_ptr<const handle_type> &handle) {
+          return handle.use_count() == 1;
+        },
+        cleanup && !m_map.budget());
   }
 
-private:
-  std::shared_ptr<const handle_type> get_old(const handle_desc &desc) const {
-    if (auto it = m_old.find(desc); it != m_old.end()) {
-      return it->second.lock();
-    }
-
-    return nullptr;
+  void set_lru_budget(std::optional<std::size_t> max_entries) noexcept {
+    m_map.set_budget(max_entries);
   }
-
-  std::shared_ptr<const handle_type> get_new(const handle_desc &desc) const {
-    if (auto it = m_new.find(desc); it != m_new.end()) {
-      return it->second.lock();
-    }
-
-    return nullptr;
+  void set_retire_hook(handle_retire_hook hook) {
+    m_map.set_retire_hook(std::move(hook));
   }
 
-  std::shared_ptr<const handle_type>
-  get_lockless(const handle_desc &desc) const {
-    if (auto phandle = get_old(desc); phandle) {
-      return phandle;
-    }
-    return get_new(desc);
-  }
+  // call from the flushing thread
+  [[nodiscard]] handle_cache_stats stats() { return m_map.stats(); }
 
-  // lockless, already created at least frame before
-  map_type m_old;
+private:
+  using hash = typename handle_desc::hash;
 
-  // stores handle and atomic bool telling if the object is already constucted
-  mutable std::shared_mutex m_mut;
-  map_type m_new;
+  detail::rcu_map<handle_desc, std::shared_ptr<const handle_type>, hash>
+      m_map;
 
   handle_data m_data;
 };
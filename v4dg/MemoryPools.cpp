@@ -0,0 +1,313 @@
+#include "MemoryPools.hpp"
+
+#include "Debug.hpp"
+#include "cppHelpers.hpp"
+
+#include <tracy/Tracy.hpp>
+#include <vulkan-memory-allocator-hpp/vk_mem_alloc.hpp>
+#include <vulkan/vulkan.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+using namespace v4dg;
+
+namespace {
+struct pool_desc {
+  MemoryClass cls;
+  std::string_view name;
+  // the resource used to choose the memory type
+  std::variant<vk::BufferCreateInfo, vk::ImageCreateInfo> representative;
+  vma::AllocationCreateInfo allocation;
+  vma::PoolCreateFlags flags;
+  vk::DeviceSize block_size;
+  std::size_t max_blocks;
+};
+
+constexpr std::size_t class_index(MemoryClass cls) noexcept {
+  return static_cast<std::size_t>(cls);
+}
+
+// NOLINTBEGIN(*-magic-numbers)
+const std::array<pool_desc, MemoryPools::class_count> pool_descs{{
+    {
+        .cls = MemoryClass::StreamingTexture,
+        .name = "streaming textures",
+        .representative =
+            vk::ImageCreateInfo{
+                {},
+                vk::ImageType::e2D,
+                vk::Format::eR8G8B8A8Unorm,
+                {1024, 1024, 1},
+                1,
+                1,
+                vk::SampleCountFlagBits::e1,
+                vk::ImageTiling::eOptimal,
+                vk::ImageUsageFlagBits::eSampled |
+                    vk::ImageUsageFlagBits::eTransferDst,
+            },
+        // the driver may page them out first
+        .allocation = vma::AllocationCreateInfo{}
+                          .setUsage(vma::MemoryUsage::eAutoPreferDevice)
+                          .setPriority(0.F),
+        .flags = {},
+        .block_size = 0,
+        .max_blocks = 0,
+    },
+    {
+        .cls = MemoryClass::RenderTarget,
+        .name = "render targets",
+        .representative =
+            vk::ImageCreateInfo{
+                {},
+                vk::ImageType::e2D,
+                vk::Format::eR16G16B16A16Sfloat,
+                {1024, 1024, 1},
+                1,
+                1,
+                vk::SampleCountFlagBits::e1,
+                vk::ImageTiling::eOptimal,
+                vk::ImageUsageFlagBits::eColorAttachment |
+                    vk::ImageUsageFlagBits::eStorage |
+                    vk::ImageUsageFlagBits::eSampled |
+                    vk::ImageUsageFlagBits::eTransferSrc |
+                    vk::ImageUsageFlagBits::eTransferDst,
+            },
+        .allocation = vma::AllocationCreateInfo{}
+                          .setFlags(vma::AllocationCreateFlagBits::
+                                        eDedicatedMemory)
+                          .setUsage(vma::MemoryUsage::eAutoPreferDevice)
+                          .setPriority(1.F),
+        .flags = {},
+        .block_size = 0,
+        .max_blocks = 0,
+    },
+    {
+        .cls = MemoryClass::Staging,
+        .name = "staging",
+        .representative =
+            vk::BufferCreateInfo{
+                {},
+                1 << 16,
+                vk::BufferUsageFlagBits::eTransferSrc,
+            },
+        .allocation =
+            vma::AllocationCreateInfo{}
+                .setFlags(
+                    vma::AllocationCreateFlagBits::eHostAccessSequentialWrite)
+                .setUsage(vma::MemoryUsage::eAuto),
+        // a single block makes the linear algorithm a ring buffer
+        .flags = vma::PoolCreateFlagBits::eLinearAlgorithm,
+        .block_size = MemoryPools::staging_block_size,
+        .max_blocks = 1,
+    },
+    {
+        .cls = MemoryClass::SmallBuffer,
+        .name = "small buffers",
+        .representative =
+            vk::BufferCreateInfo{
+                {},
+                1 << 16,
+                vk::BufferUsageFlagBits::eUniformBuffer |
+                    vk::BufferUsageFlagBits::eStorageBuffer |
+                    vk::BufferUsageFlagBits::eShaderDeviceAddress,
+            },
+        .allocation =
+            vma::AllocationCreateInfo{}
+                .setFlags(vma::AllocationCreateFlagBits::eHostAccessRandom |
+                          vma::AllocationCreateFlagBits::eMapped)
+                .setUsage(vma::MemoryUsage::eAuto)
+                .setRequiredFlags(vk::MemoryPropertyFlagBits::eHostCoherent),
+        .flags = {},
+        .block_size = MemoryPools::small_buffer_block_size,
+        .max_blocks = 0,
+    },
+}};
+// NOLINTEND(*-magic-numbers)
+} // namespace
+
+MemoryPools::MemoryPools(vma::Allocator allocator) : m_allocator(allocator) {
+  for (const auto &desc : pool_descs) {
+    std::uint32_t const memory_type = std::visit(
+        detail::overload_set{
+            [&](const vk::BufferCreateInfo &bci) {
+              return allocator.findMemoryTypeIndexForBufferInfo(
+                  bci, desc.allocation);
+            },
+            [&](const vk::ImageCreateInfo &ici) {
+              return allocator.findMemoryTypeIndexForImageInfo(
+                  ici, desc.allocation);
+            },
+        },
+        desc.representative);
+
+    m_pools[class_index(desc.cls)] = allocator.createPoolUnique(
+        vma::PoolCreateInfo{}
+            .setMemoryTypeIndex(memory_type)
+            .setFlags(desc.flags)
+            .setBlockSize(desc.block_size)
+            .setMaxBlockCount(desc.max_blocks)
+            .setPriority(desc.allocation.priority));
+
+    allocator.setPoolName(*m_pools[class_index(desc.cls)], desc.name.data());
+    logger.Debug("memory pool {}: memory type {}", desc.name, memory_type);
+  }
+}
+
+vma::AllocationCreateInfo
+MemoryPools::allocation_info(MemoryClass cls) const noexcept {
+  auto info = pool_descs[class_index(cls)].allocation;
+  if (const auto &pool = m_pools[class_index(cls)]) {
+    info.setPool(*pool);
+  }
+  return info;
+}
+
+std::string_view MemoryPools::name(MemoryClass cls) noexcept {
+  return pool_descs[class_index(cls)].name;
+}
+
+auto MemoryPools::stats() const -> std::array<MemoryPoolStats, class_count> {
+  std::array<MemoryPoolStats, class_count> out{};
+  for (auto cls : classes) {
+    auto &stats = out[class_index(cls)];
+    stats.name = name(cls);
+    if (const auto &pool = m_pools[class_index(cls)]) {
+      auto const vma_stats = m_allocator.getPoolStatistics(*pool);
+      stats.blocks = vma_stats.blockCount;
+      stats.allocations = vma_stats.allocationCount;
+      stats.block_bytes = vma_stats.blockBytes;
+      stats.allocation_bytes = vma_stats.allocationBytes;
+    }
+  }
+  return out;
+}
+
+std::vector<MemoryHeapBudget> MemoryPools::budgets() const {
+  if (!m_allocator) {
+    return {};
+  }
+
+  const auto &props = *m_allocator.getMemoryProperties();
+  std::array<vma::Budget, vk::MaxMemoryHeaps> budgets{};
+  m_allocator.getHeapBudgets(budgets.data());
+
+  std::vector<MemoryHeapBudget> out;
+  out.reserve(props.memoryHeapCount);
+  for (std::uint32_t heap = 0; heap < props.memoryHeapCount; heap++) {
+    const auto &budget = budgets[heap];
+    out.push_back({
+        .heap = heap,
+        .device_local = static_cast<bool>(
+            props.memoryHeaps[heap].flags &
+            vk::MemoryHeapFlagBits::eDeviceLocal),
+        .usage = budget.usage,
+        .budget = budget.budget,
+        .block_bytes = budget.statistics.blockBytes,
+        .allocation_bytes = budget.statistics.allocationBytes,
+    });
+  }
+  return out;
+}
+
+double MemoryPools::device_pressure() const {
+  double pressure = 0.;
+  for (const auto &heap : budgets()) {
+    if (heap.device_local) {
+      pressure = std::max(pressure, heap.pressure());
+    }
+  }
+  return pressure;
+}
+
+auto MemoryBudget::add_evictor(evictor fn) -> evictor_id {
+  std::scoped_lock const _{m_mut};
+  auto const id = m_next_id++;
+  m_evictors.emplace_back(id, std::move(fn));
+  return id;
+}
+
+void MemoryBudget::remove_evictor(evictor_id id) {
+  std::scoped_lock const _{m_mut};
+  std::erase_if(m_evictors, [&](const auto &e) { return e.first == id; });
+}
+
+void MemoryBudget::next_frame(vma::Allocator allocator,
+                              std::uint64_t frame_idx) {
+  ZoneScoped;
+
+  // VMA refreshes the budget from the driver on frame index changes
+  allocator.setCurrentFrameIndex(static_cast<std::uint32_t>(frame_idx));
+
+  update(m_pools->budgets());
+}
+
+void MemoryBudget::update(std::span<const MemoryHeapBudget> heaps) {
+  double pressure = 0.;
+  vk::DeviceSize over_target = 0;
+  for (const auto &heap : heaps) {
+    if (!heap.device_local) {
+      continue;
+    }
+
+    pressure = std::max(pressure, heap.pressure());
+    auto const target = static_cast<vk::DeviceSize>(
+        static_cast<double>(heap.budget) * evict_target);
+    if (heap.pressure() > evict_pressure && heap.usage > target) {
+      over_target = std::max(over_target, heap.usage - target);
+    }
+  }
+  m_pressure.store(pressure, std::memory_order_relaxed);
+
+  std::scoped_lock const _{m_mut};
+  if (pressure > throttle_pressure) {
+    m_throttled_frames++;
+  }
+
+  if (over_target == 0) {
+    return;
+  }
+
+  logger.Debug("memory pressure {:.2f}: evicting {} bytes", pressure,
+               over_target);
+
+  for (auto &[id, fn] : m_evictors) {
+    if (over_target == 0) {
+      break;
+    }
+
+    auto const freed = fn(over_target);
+    over_target -= std::min(freed, over_target);
+    m_evicted_bytes += freed;
+    m_evictions += freed != 0 ? 1 : 0;
+  }
+}
+
+std::size_t MemoryBudget::transfer_budget(std::size_t max_bytes) const {
+  double const p = pressure();
+  if (p <= throttle_pressure) {
+    return max_bytes;
+  }
+
+  // linear falloff from throttle_pressure to the full budget
+  double const left = std::clamp((1. - p) / (1. - throttle_pressure), 0., 1.);
+  return static_cast<std::size_t>(static_cast<double>(max_bytes) * left);
+}
+
+MemoryBudgetStats MemoryBudget::stats() const {
+  std::scoped_lock const _{m_mut};
+  return {
+      .pressure = pressure(),
+      .throttled_frames = m_throttled_frames,
+      .evictions = m_evictions,
+      .evicted_bytes = m_evicted_bytes,
+  };
+}
@@ -0,0 +1,208 @@
+#pragma once
+
+#include "v4dgCore.hpp"
+
+#include <vulkan-memory-allocator-hpp/vk_mem_alloc.hpp>
+#include <vulkan/vulkan.hpp>
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace v4dg {
+// what an allocation is used for - every class has its own VMA pool
+enum class MemoryClass : std::uint8_t {
+  // sampled textures that can be reloaded (lowest residency priority)
+  StreamingTexture,
+  // attachments and storage images written every frame
+  RenderTarget,
+  // host-visible upload buffers, freed in submission order (ring buffer)
+  Staging,
+  // small persistently mapped uniform/storage buffers
+  SmallBuffer,
+};
+
+struct MemoryPoolStats {
+  std::string_view name;
+  std::uint32_t blocks;
+  std::uint32_t allocations;
+  vk::DeviceSize block_bytes;
+  vk::DeviceSize allocation_bytes;
+};
+
+struct MemoryHeapBudget {
+  std::uint32_t heap;
+  bool device_local;
+  // bytes used by the whole process / available to it (VK_EXT_memory_budget)
+  vk::DeviceSize usage;
+  vk::DeviceSize budget;
+  // bytes allocated through VMA
+  vk::DeviceSize block_bytes;
+  vk::DeviceSize allocation_bytes;
+
+  [[nodiscard]] double pressure() const noexcept {
+    return budget == 0
+               ? 0.
+               : static_cast<double>(usage) / static_cast<double>(budget);
+  }
+};
+
+// Per MemoryClass VMA pools. Resources whose memory type does not fit the
+//   pool (or that do not fit in a full pool) fall back to the default pools,
+//   see allocate_with_fallback().
+class MemoryPools {
+public:
+  static constexpr std::size_t class_count = 4;
+  static constexpr std::array classes{
+      MemoryClass::StreamingTexture,
+      MemoryClass::RenderTarget,
+      MemoryClass::Staging,
+      MemoryClass::SmallBuffer,
+  };
+
+  // the ring buffer; bigger uploads get their own allocation
+  static constexpr vk::DeviceSize staging_block_size = 64 << 20;
+  static constexpr vk::DeviceSize small_buffer_block_size = 16 << 20;
+
+  MemoryPools() = default;
+  explicit MemoryPools(vma::Allocator allocator);
+
+  // allocation info placing the resource into the pool of `cls`
+  [[nodiscard]] vma::AllocationCreateInfo
+  allocation_info(MemoryClass cls) const noexcept;
+
+  // null if the pools could not be created
+  [[nodiscard]] vma::Pool pool(MemoryClass cls) const noexcept {
+    const auto &pool = m_pools[static_cast<std::size_t>(cls)];
+    return pool ? *pool : vma::Pool{};
+  }
+
+  [[nodiscard]] std::array<MemoryPoolStats, class_count> stats() const;
+  [[nodiscard]] std::vector<MemoryHeapBudget> budgets() const;
+
+  // highest usage/budget ratio of the device local heaps
+  [[nodiscard]] double device_pressure() const;
+
+  [[nodiscard]] static std::string_view name(MemoryClass cls) noexcept;
+
+private:
+  vma::Allocator m_allocator;
+  std::array<vma::UniquePool, class_count> m_pools;
+};
+
+// calls fn(allocationCreateInfo) and retries without the pool if the pool
+//   cannot take the resource
+template <typename Fn>
+decltype(auto)
+allocate_with_fallback(const vma::AllocationCreateInfo &allocationCreateInfo,
+                       Fn &&fn) {
+  if (!allocationCreateInfo.pool) {
+    return std::invoke(fn, allocationCreateInfo);
+  }
+
+  try {
+    return std::invoke(fn, allocationCreateInfo);
+  } catch (const vk::SystemError &) {
+    auto fallback = allocationCreateInfo;
+    fallback.pool = nullptr;
+    return std::invoke(fn, fallback);
+  }
+}
+
+struct MemoryBudgetStats {
+  double pressure;
+  std::uint64_t throttled_frames;
+  std::uint64_t evictions;
+  vk::DeviceSize evicted_bytes;
+};
+
+// Reacts to the VK_EXT_memory_budget numbers before the driver starts
+//   paging: uploads are throttled and streamable data is evicted.
+class MemoryBudget {
+public:
+  // uploads slow down above this device heap pressure
+  static constexpr double throttle_pressure = 0.85;
+  // evictors run above this pressure and free down to evict_target
+  static constexpr double evict_pressure = 0.92;
+  static constexpr double evict_target = 0.8;
+
+  // frees up to `bytes` of streamable data; returns the bytes freed
+  //   (called from next_frame(), must not add or remove evictors)
+  using evictor = std::function<vk::DeviceSize(vk::DeviceSize bytes)>;
+  using evictor_id = std::uint32_t;
+
+  explicit MemoryBudget(const MemoryPools &pools) : m_pools(&pools) {}
+
+  evictor_id add_evictor(evictor fn);
+  void remove_evictor(evictor_id id);
+
+  // refreshes the budget (once per frame)
+  void next_frame(vma::Allocator allocator, std::uint64_t frame_idx);
+  // throttles and evicts for these heap numbers (next_frame() passes the
+  //   driver's ones; checks simulate pressure with it)
+  void update(std::span<const MemoryHeapBudget> heaps);
+
+  [[nodiscard]] double pressure() const noexcept {
+    return m_pressure.load(std::memory_order_relaxed);
+  }
+  [[nodiscard]] bool throttled() const noexcept {
+    return pressure() > throttle_pressure;
+  }
+
+  // `max_bytes` scaled down to zero as the pressure approaches the budget
+  [[nodiscard]] std::size_t transfer_budget(std::size_t max_bytes) const;
+
+  [[nodiscard]] MemoryBudgetStats stats() const;
+
+private:
+  const MemoryPools *m_pools;
+  std::atomic<double> m_pressure{0.};
+
+  mutable std::mutex m_mut;
+  std::vector<std::pair<evictor_id, evictor>> m_evictors;
+  evictor_id m_next_id{0};
+
+  std::uint64_t m_throttled_frames{0};
+  std::uint64_t m_evictions{0};
+  vk::DeviceSize m_evicted_bytes{0};
+};
+
+// removes the evictor when it goes out of scope
+class UniqueEvictor {
+public:
+  UniqueEvictor() = default;
+  UniqueEvictor(MemoryBudget &budget, MemoryBudget::evictor fn)
+      : m_budget(&budget), m_id(budget.add_evictor(std::move(fn))) {}
+
+  UniqueEvictor(const UniqueEvictor &) = delete;
+  UniqueEvictor &operator=(const UniqueEvictor &) = delete;
+  UniqueEvictor(UniqueEvictor &&o) noexcept
+      : m_budget(std::exchange(o.m_budget, nullptr)), m_id(o.m_id) {}
+  UniqueEvictor &operator=(UniqueEvictor &&o) noexcept {
+    if (this != &o) {
+      reset();
+      m_budget = std::exchange(o.m_budget, nullptr);
+      m_id = o.m_id;
+    }
+    return *this;
+  }
+  ~UniqueEvictor() { reset(); }
+
+  void reset() noexcept {
+    if (m_budget != nullptr) {
+      std::exchange(m_budget, nullptr)->remove_evictor(m_id);
+    }
+  }
+
+private:
+  MemoryBudget *m_budget{nullptr};
+  MemoryBudget::evictor_id m_id{};
+};
+} // namespace v4dg
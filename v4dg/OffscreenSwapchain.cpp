@@ -0,0 +1,51 @@
+#include "OffscreenSwapchain.hpp"
+
+#include "Context.hpp"
+#include "MemoryPools.hpp"
+#include "VulkanConstructs.hpp"
+#include "VulkanResources.hpp"
+#include "v4dgCore.hpp"
+
+#include <vulkan-memory-allocator-hpp/vk_mem_alloc.hpp>
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+
+using namespace v4dg;
+
+OffscreenSwapchain::OffscreenSwapchain(Context &ctx, vk::Extent2D extent,
+                                       vk::Format format,
+                                       std::uint32_t image_count,
+                                       vk::ImageUsageFlags usage)
+    : m_format(format), m_extent(extent), m_imageUsage(usage) {
+  if (image_count < max_frames_in_flight) {
+    throw exception("Offscreen swapchain needs at least {} images (got {})",
+                    max_frames_in_flight, image_count);
+  }
+
+  if (extent.width == 0 || extent.height == 0) {
+    throw exception("Offscreen swapchain extent must be non-zero");
+  }
+
+  m_images.reserve(image_count);
+  for (std::uint32_t i = 0; i < image_count; ++i) {
+    auto &view = m_images.emplace_back(ImageView::createTexture(
+        ctx,
+        Image::ImageCreateInfo{
+            .format = format,
+            .extent = {extent.width, extent.height, 1},
+            .usage = usage,
+        },
+        ctx.device().memoryPools().allocation_info(
+            MemoryClass::RenderTarget)));
+
+    view->image()->setName(ctx.device(), "offscreen image {}", i);
+    view->setName(ctx.device(), "offscreen image view {}", i);
+  }
+}
+
+std::uint32_t OffscreenSwapchain::acquire() {
+  auto idx = m_next;
+  m_next = (m_next + 1) % static_cast<std::uint32_t>(m_images.size());
+  return idx;
+}
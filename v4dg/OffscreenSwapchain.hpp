@@ -0,0 +1,60 @@
+#pragma once
+
+#include "VulkanResources.hpp"
+#include "v4dgCore.hpp"
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace v4dg {
+class Context;
+
+// Swapchain replacement for headless rendering.
+//   Owns N render targets that are handed out round-robin by acquire().
+//   There is no presentation engine so no acquire/present semaphores are
+//   needed: an image is reused only after N frames and Context::next_frame
+//   already guarantees that work older than max_frames_in_flight is done.
+class OffscreenSwapchain {
+public:
+  static constexpr vk::ImageUsageFlags default_usage =
+      vk::ImageUsageFlagBits::eColorAttachment |
+      vk::ImageUsageFlagBits::eTransferDst |
+      vk::ImageUsageFlagBits::eTransferSrc;
+
+  OffscreenSwapchain(Context &ctx, vk::Extent2D extent,
+                     vk::Format format = vk::Format::eR8G8B8A8Unorm,
+                     std::uint32_t image_count = max_frames_in_flight + 1,
+                     vk::ImageUsageFlags usage = default_usage);
+
+  [[nodiscard]] const auto &images() const { return m_images; }
+  [[nodiscard]] const ImageView &texture(size_t idx) const {
+    return m_images[idx];
+  }
+  [[nodiscard]] vk::Image image(size_t idx) const {
+    return m_images[idx]->vkImage();
+  }
+  [[nodiscard]] vk::ImageView imageView(size_t idx) const {
+    return m_images[idx]->imageView();
+  }
+
+  [[nodiscard]] vk::Format format() const { return m_format; }
+  [[nodiscard]] vk::Extent2D extent() const { return m_extent; }
+  [[nodiscard]] vk::ImageUsageFlags getImageUsage() const {
+    return m_imageUsage;
+  }
+
+  // index of the image to render into this frame (call once per frame)
+  [[nodiscard]] std::uint32_t acquire();
+
+private:
+  vk::Format m_format;
+  vk::Extent2D m_extent;
+  vk::ImageUsageFlags m_imageUsage;
+
+  std::vector<ImageView> m_images;
+  std::uint32_t m_next{0};
+};
+} // namespace v4dg
@@ -1,18 +1,23 @@
 #include "PipelineBuilder.hpp"
 
 #include "Context.hpp"
+#include "VulkanCaches.hpp"
 #include "cppHelpers.hpp"
 
+#include <ankerl/unordered_dense.h>
 #include <vulkan/vulkan.hpp>
 #include <vulkan/vulkan_raii.hpp>
 
+#include <algorithm>
 #include <bit>
 #include <cstddef>
 #include <cstdint>
 #include <expected>
 #include <filesystem>
+#include <memory>
 #include <optional>
 #include <span>
+#include <string_view>
 #include <utility>
 #include <variant>
 #include <vector>
@@ -42,6 +47,11 @@ bool fix_spirv_endianess(std::span<uint32_t> code) {
   // invalid magic number
   return false;
 }
+
+std::span<const std::uint32_t>
+get_code(const vk::ShaderModuleCreateInfo &smci) {
+  return {smci.pCode, smci.codeSize / sizeof(std::uint32_t)};
+}
 } // namespace
 
 std::expected<std::vector<std::uint32_t>,
@@ -79,6 +89,9 @@ ShaderStageData::ShaderStageData(
   info_chain.get<vk::PipelineShaderStageCreateInfo>().setStage(stage);
 
   info_chain.get<vk::ShaderModuleCreateInfo>().setCode(shader_data);
+  code_hash = ankerl::unordered_dense::hash<std::string_view>{}(
+      std::string_view{reinterpret_cast<const char *>(shader_data.data()),
+                       shader_data.size() * sizeof(std::uint32_t)});
 
   info_chain.unlink<vk::PipelineShaderStageRequiredSubgroupSizeCreateInfoEXT>();
   info_chain.unlink<vk::PipelineRobustnessCreateInfoEXT>();
@@ -87,24 +100,36 @@ ShaderStageData::ShaderStageData(
   fixup();
 }
 
+ShaderStageData::ShaderStageData(
+    vk::ShaderStageFlagBits stage,
+    std::shared_ptr<const std::vector<std::uint32_t>> shader_data,
+    std::string entry)
+    : ShaderStageData(stage, *shader_data, std::move(entry)) {
+  owned_code = std::move(shader_data);
+}
+
 ShaderStageData::ShaderStageData(const ShaderStageData &o)
-    : entry(o.entry), specialization_entries(o.specialization_entries),
-      specialization_data(o.specialization_data), info_chain(o.info_chain),
-      specialization_info(o.specialization_info) {
+    : entry(o.entry), owned_code(o.owned_code), code_hash(o.code_hash),
+      specialization_entries(o.specialization_entries),
+      specialization_data(o.specialization_data), debug_name(o.debug_name),
+      info_chain(o.info_chain), specialization_info(o.specialization_info) {
   fixup();
 }
 
 ShaderStageData::ShaderStageData(ShaderStageData &&o) noexcept
-    : entry(std::move(o.entry)),
+    : entry(std::move(o.entry)), owned_code(std::move(o.owned_code)),
+      code_hash(o.code_hash),
       specialization_entries(std::move(o.specialization_entries)),
       specialization_data(std::move(o.specialization_data)),
-      info_chain(std::move(o.info_chain)),
+      debug_name(std::move(o.debug_name)), info_chain(std::move(o.info_chain)),
       specialization_info(o.specialization_info) {
   fixup();
 }
 
 ShaderStageData &ShaderStageData::operator=(const ShaderStageData &o) {
   entry = o.entry;
+  owned_code = o.owned_code;
+  code_hash = o.code_hash;
   specialization_entries = o.specialization_entries;
   specialization_data = o.specialization_data;
   debug_name = o.debug_name;
@@ -122,6 +147,8 @@ ShaderStageData &ShaderStageData::operator=(ShaderStageData &&o) noexcept {
   }
 
   entry = std::move(o.entry);
+  owned_code = std::move(o.owned_code);
+  code_hash = o.code_hash;
   specialization_entries = std::move(o.specialization_entries);
   specialization_data = std::move(o.specialization_data);
   debug_name = std::move(o.debug_name);
@@ -133,9 +160,75 @@ ShaderStageData &ShaderStageData::operator=(ShaderStageData &&o) noexcept {
   return *this;
 }
 
-vk::raii::Pipeline
-GraphicsPipelineBuilder::build(Context &ctx,
-                               std::span<const ShaderStageData> shader_stages) {
+bool ShaderStageData::operator==(const ShaderStageData &o) const {
+  const auto &info = get();
+  const auto &o_info = o.get();
+
+  if (code_hash != o.code_hash || info.stage != o_info.stage ||
+      info.flags != o_info.flags || entry != o.entry ||
+      specialization_entries != o.specialization_entries ||
+      specialization_data != o.specialization_data) {
+    return false;
+  }
+
+  using subgroup_info =
+      vk::PipelineShaderStageRequiredSubgroupSizeCreateInfoEXT;
+  if (info_chain.isLinked<subgroup_info>() !=
+          o.info_chain.isLinked<subgroup_info>() ||
+      (info_chain.isLinked<subgroup_info>() &&
+       info_chain.get<subgroup_info>().requiredSubgroupSize !=
+           o.info_chain.get<subgroup_info>().requiredSubgroupSize)) {
+    return false;
+  }
+
+  using robustness_info = vk::PipelineRobustnessCreateInfoEXT;
+  if (info_chain.isLinked<robustness_info>() !=
+      o.info_chain.isLinked<robustness_info>()) {
+    return false;
+  }
+  if (info_chain.isLinked<robustness_info>()) {
+    const auto &r = info_chain.get<robustness_info>();
+    const auto &o_r = o.info_chain.get<robustness_info>();
+    if (r.storageBuffers != o_r.storageBuffers ||
+        r.uniformBuffers != o_r.uniformBuffers ||
+        r.vertexInputs != o_r.vertexInputs || r.images != o_r.images) {
+      return false;
+    }
+  }
+
+  auto code = get_code(info_chain.get<vk::ShaderModuleCreateInfo>());
+  auto o_code = get_code(o.info_chain.get<vk::ShaderModuleCreateInfo>());
+  return code.data() == o_code.data()
+             ? code.size() == o_code.size()
+             : std::ranges::equal(code, o_code);
+}
+
+std::size_t
+ShaderStageData::hash::operator()(const ShaderStageData &ssd) const noexcept {
+  const auto &info = ssd.get();
+
+  std::size_t seed = ssd.code_hash;
+  detail::add_hash(seed, info.stage, info.flags, ssd.entry,
+                   ssd.specialization_entries, ssd.specialization_data);
+  return seed;
+}
+
+std::size_t GraphicsPipelineBuilder::hash::operator()(
+    const GraphicsPipelineBuilder &gpb) const noexcept {
+  std::size_t seed{};
+  detail::add_hash(seed, gpb.layout, gpb.flags, gpb.topology,
+                   gpb.primitive_restart, gpb.viewports,
+                   gpb.rasterization_state, gpb.multisample_state,
+                   gpb.sample_mask.value_or(~vk::SampleMask{}),
+                   gpb.depth_stencil_state, gpb.color_blend_state,
+                   gpb.color_blend_attachments, gpb.view_mask,
+                   gpb.color_formats, gpb.depth_format, gpb.stencil_format,
+                   gpb.dynamic_states);
+  return seed;
+}
+
+vk::raii::Pipeline GraphicsPipelineBuilder::build(
+    Context &ctx, std::span<const ShaderStageData> shader_stages) const {
   std::vector<vk::PipelineShaderStageCreateInfo> psscis;
   psscis.reserve(shader_stages.size());
 
@@ -1,6 +1,5 @@
 #pragma once
 
-#include "Context.hpp"
 #include "cppHelpers.hpp"
 
 #include <vulkan/vulkan.hpp>
@@ -10,6 +9,7 @@
 #include <cstdint>
 #include <expected>
 #include <filesystem>
+#include <memory>
 #include <optional>
 #include <span>
 #include <string>
@@ -19,6 +19,7 @@
 #include <vector>
 
 namespace v4dg {
+class Context;
 
 enum class load_shader_error {
   bad_magic_number,
@@ -41,9 +42,14 @@ struct GraphicsPipelineBuilder;
 class ShaderStageData {
 public:
   ShaderStageData() = delete;
+  // does not own the code - it has to outlive the stage data
   ShaderStageData(vk::ShaderStageFlagBits stage,
                   vk::ArrayProxyNoTemporaries<const uint32_t> shader_data,
                   std::string entry = "main");
+  // shares ownership of the code (required for background compilation)
+  ShaderStageData(vk::ShaderStageFlagBits stage,
+                  std::shared_ptr<const std::vector<std::uint32_t>> shader_data,
+                  std::string entry = "main");
   ShaderStageData(const ShaderStageData &);
   ShaderStageData(ShaderStageData &&) noexcept;
   ShaderStageData &operator=(const ShaderStageData &);
@@ -97,9 +103,20 @@ public:
     return info_chain.get<vk::PipelineShaderStageCreateInfo>();
   }
 
+  // identity of the stage (code, entry, flags and specializations);
+  //   the debug name is ignored
+  bool operator==(const ShaderStageData &) const;
+
+  struct hash {
+    std::size_t operator()(const ShaderStageData &) const noexcept;
+  };
+
 private:
   std::string entry{"main"};
 
+  std::shared_ptr<const std::vector<std::uint32_t>> owned_code;
+  std::size_t code_hash{};
+
   std::vector<vk::SpecializationMapEntry> specialization_entries;
   std::vector<std::byte> specialization_data;
 
@@ -180,8 +197,14 @@ struct GraphicsPipelineBuilder {
     return *this;
   }
 
-  vk::raii::Pipeline build(Context &ctx,
-                           std::span<const ShaderStageData> shader_stages);
+  [[nodiscard]] vk::raii::Pipeline
+  build(Context &ctx, std::span<const ShaderStageData> shader_stages) const;
+
+  bool operator==(const GraphicsPipelineBuilder &) const = default;
+
+  struct hash {
+    std::size_t operator()(const GraphicsPipelineBuilder &) const noexcept;
+  };
 
   vk::PipelineLayout layout;
   vk::PipelineCreateFlags flags;
@@ -0,0 +1,153 @@
+#include "PipelineCache.hpp"
+
+#include "Debug.hpp"
+#include "Device.hpp"
+#include "cppHelpers.hpp"
+
+#include <ankerl/unordered_dense.h>
+#include <tracy/Tracy.hpp>
+#include <vulkan/vulkan.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <ios>
+#include <span>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+using namespace v4dg;
+
+namespace {
+struct file_header {
+  static constexpr std::array<char, 8> expected_magic{'V', '4', 'D', 'G',
+                                                      'P', 'C', '0', '1'};
+
+  std::array<char, 8> magic;
+  std::uint64_t payload_size;
+  std::uint64_t checksum;
+};
+
+std::uint64_t checksum(std::span<const std::byte> data) {
+  return ankerl::unordered_dense::hash<std::string_view>{}(std::string_view{
+      reinterpret_cast<const char *>(data.data()), data.size()});
+}
+
+bool is_compatible(std::span<const std::byte> payload,
+                   const DeviceStats &stats) {
+  // VkPipelineCacheHeaderVersionOne
+  struct {
+    std::uint32_t headerSize;
+    std::uint32_t headerVersion;
+    std::uint32_t vendorID;
+    std::uint32_t deviceID;
+    std::array<std::uint8_t, vk::UuidSize> pipelineCacheUUID;
+  } header{};
+  static_assert(sizeof(header) == 32);
+
+  if (payload.size() < sizeof(header)) {
+    return false;
+  }
+  std::memcpy(&header, payload.data(), sizeof(header));
+
+  const auto &props =
+      stats.properties.get<vk::PhysicalDeviceProperties2>()->properties;
+
+  return header.headerSize >= sizeof(header) &&
+         header.headerVersion ==
+             static_cast<std::uint32_t>(vk::PipelineCacheHeaderVersion::eOne) &&
+         header.vendorID == props.vendorID &&
+         header.deviceID == props.deviceID &&
+         std::ranges::equal(header.pipelineCacheUUID, props.pipelineCacheUUID);
+}
+} // namespace
+
+std::vector<std::byte>
+v4dg::load_pipeline_cache(const std::filesystem::path &path,
+                          const DeviceStats &stats) {
+  ZoneScoped;
+
+  auto file = GetFileBinary<std::byte>(path);
+  if (!file) {
+    logger.Log("No pipeline cache at {} ({})", path.string(),
+               to_string(file.error()));
+    return {};
+  }
+
+  std::span<const std::byte> const data{*file};
+
+  file_header header{};
+  if (data.size() < sizeof(header)) {
+    logger.Warning("Pipeline cache {} is truncated - ignoring", path.string());
+    return {};
+  }
+  std::memcpy(&header, data.data(), sizeof(header));
+
+  auto payload = data.subspan(sizeof(header));
+
+  if (header.magic != file_header::expected_magic ||
+      header.payload_size != payload.size()) {
+    logger.Warning("Pipeline cache {} has invalid header - ignoring",
+                   path.string());
+    return {};
+  }
+
+  if (header.checksum != checksum(payload)) {
+    logger.Warning("Pipeline cache {} checksum mismatch - ignoring",
+                   path.string());
+    return {};
+  }
+
+  if (!is_compatible(payload, stats)) {
+    logger.Log("Pipeline cache {} is from a different device/driver - "
+               "ignoring",
+               path.string());
+    return {};
+  }
+
+  logger.Debug("Loaded pipeline cache {} ({} bytes)", path.string(),
+               payload.size());
+  return {payload.begin(), payload.end()};
+}
+
+void v4dg::store_pipeline_cache(const std::filesystem::path &path,
+                                std::span<const std::byte> data) {
+  ZoneScoped;
+
+  file_header const header{
+      .magic = file_header::expected_magic,
+      .payload_size = data.size(),
+      .checksum = checksum(data),
+  };
+
+  auto tmp_path = path;
+  tmp_path += ".tmp";
+
+  {
+    std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(data.data()),
+               static_cast<std::streamsize>(data.size()));
+    file.flush();
+
+    if (!file) {
+      logger.Warning("Could not write pipeline cache {}", tmp_path.string());
+      std::error_code ec;
+      std::filesystem::remove(tmp_path, ec);
+      return;
+    }
+  }
+
+  std::error_code ec;
+  std::filesystem::rename(tmp_path, path, ec);
+  if (ec) {
+    logger.Warning("Could not replace pipeline cache {}: {}", path.string(),
+                   ec.message());
+    std::filesystem::remove(tmp_path, ec);
+  }
+}
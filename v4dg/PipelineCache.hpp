@@ -0,0 +1,24 @@
+#pragma once
+
+#include "Device.hpp"
+
+#include <cstddef>
+#include <filesystem>
+#include <span>
+#include <vector>
+
+namespace v4dg {
+// On-disk pipeline cache storage.
+//   The driver blob is wrapped in a small header with a magic, payload size
+//   and checksum. On load the blob's VkPipelineCacheHeaderVersionOne is
+//   checked against the device (vendor, device ID, pipelineCacheUUID).
+//   Any mismatch or corruption yields an empty cache - never an error.
+[[nodiscard]] std::vector<std::byte>
+load_pipeline_cache(const std::filesystem::path &path,
+                    const DeviceStats &stats);
+
+// writes to a temporary file and renames it over `path`
+//   so a crash mid-write never leaves a truncated cache behind
+void store_pipeline_cache(const std::filesystem::path &path,
+                          std::span<const std::byte> data);
+} // namespace v4dg
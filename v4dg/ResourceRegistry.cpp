@@ -0,0 +1,374 @@
+#include "ResourceRegistry.hpp"
+
+#include "BindlessManager.hpp"
+#include "Context.hpp"
+#include "Debug.hpp"
+#include "MemoryPools.hpp"
+#include "VulkanConstructs.hpp"
+
+#include <tracy/Tracy.hpp>
+#include <vulkan-memory-allocator-hpp/vk_mem_alloc.hpp>
+#include <vulkan/vulkan.hpp>
+#include <vulkan/vulkan_raii.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <ranges>
+#include <span>
+#include <utility>
+#include <vector>
+
+using namespace v4dg;
+
+namespace {
+bool hasAllFlags(auto flags, auto mask) { return (flags & mask) == mask; }
+
+void destroyImageView(const vk::raii::Device &device, vk::ImageView view) {
+  // adopts and destroys the view
+  vk::raii::ImageView{device, view};
+}
+
+struct view_objects {
+  vk::raii::ImageView view;
+  UniqueBindlessResource sampled_optimal;
+  UniqueBindlessResource sampled_general;
+  UniqueBindlessResource storage;
+};
+
+// the view and the bindless handles like ImageView registers them
+view_objects makeView(Context &ctx, vk::Image image, vk::ImageViewType type,
+                      vk::Format format, vk::ImageUsageFlags usage,
+                      vk::ImageSubresourceRange range) {
+  vk::StructureChain<vk::ImageViewCreateInfo, vk::ImageViewUsageCreateInfo>
+      chain{{{}, image, type, format, {}, range}, {usage}};
+  if (!usage) {
+    chain.unlink<vk::ImageViewUsageCreateInfo>();
+  }
+
+  view_objects objects{
+      .view = vk::raii::ImageView{ctx.vkDevice(), chain.get<>()},
+      .sampled_optimal = {},
+      .sampled_general = {},
+      .storage = {},
+  };
+
+  auto &bindless = ctx.bindlessManager();
+
+  vk::DescriptorImageInfo const general_info{{}, *objects.view,
+                                             vk::ImageLayout::eGeneral};
+  vk::DescriptorImageInfo const optimal_info{
+      {}, *objects.view, vk::ImageLayout::eReadOnlyOptimal};
+
+  if (hasAllFlags(usage, vk::ImageUsageFlagBits::eSampled)) {
+    objects.sampled_optimal = bindless.allocate(BindlessType::eSampledImage);
+    bindless.queue_write(*objects.sampled_optimal, optimal_info);
+  }
+
+  if (hasAllFlags(usage, vk::ImageUsageFlagBits::eSampled |
+                             vk::ImageUsageFlagBits::eStorage)) {
+    objects.sampled_general = bindless.allocate(BindlessType::eSampledImage);
+    bindless.queue_write(*objects.sampled_general, general_info);
+  }
+
+  if (hasAllFlags(usage, vk::ImageUsageFlagBits::eStorage)) {
+    objects.storage = bindless.allocate(BindlessType::eStorageImage);
+    bindless.queue_write(*objects.storage, general_info);
+  }
+
+  return objects;
+}
+} // namespace
+
+ResourceRegistry::ResourceRegistry(Context &ctx) : m_ctx(&ctx) {}
+
+ResourceRegistry::~ResourceRegistry() {
+  // the device is idle by now (Context::cleanup())
+  for (const auto &item : m_retired) {
+    destroy_now(item.view);
+    destroy_now(item.image);
+    destroy_now(item.buffer);
+  }
+  m_retired.clear();
+
+  auto const stats = this->stats();
+  if (stats.buffers + stats.images + stats.image_views != 0) {
+    logger.Warning("ResourceRegistry: {} buffers, {} images and {} image "
+                   "views were never destroyed",
+                   stats.buffers, stats.images, stats.image_views);
+  }
+
+  m_views.for_each_live([&](view_chunk &chunk, std::uint32_t i) {
+    destroyImageView(m_ctx->vkDevice(), chunk.view[i]);
+  });
+  m_images.for_each_live([&](image_chunk &chunk, std::uint32_t i) {
+    m_ctx->device().allocator().destroyImage(chunk.image[i],
+                                             chunk.allocation[i]);
+  });
+  m_buffers.for_each_live([&](buffer_chunk &chunk, std::uint32_t i) {
+    m_ctx->device().allocator().destroyBuffer(chunk.buffer[i],
+                                              chunk.allocation[i]);
+  });
+}
+
+BufferHandle
+ResourceRegistry::create_buffer(vk::DeviceSize size,
+                                vk::BufferUsageFlags2KHR usage,
+                                const vma::AllocationCreateInfo &aci) {
+  const auto &device = m_ctx->device();
+
+  vk::StructureChain<vk::BufferCreateInfo, vk::BufferUsageFlags2CreateInfoKHR>
+      chain{{{}, size, {}, vk::SharingMode::eExclusive}, {usage}};
+  auto [buffer, allocation] =
+      allocate_with_fallback(aci, [&](const auto &info) {
+        return device.allocator().createBuffer(chain.get<>(), info);
+      });
+
+  try {
+    vk::DeviceAddress address{};
+    UniqueBindlessResource bindless;
+    if (usage & vk::BufferUsageFlagBits2KHR::eShaderDeviceAddress) {
+      address = device.device().getBufferAddress({buffer});
+      bindless = m_ctx->bindlessManager().allocate_buffer(address, size);
+    }
+
+    auto [handle, slot] = m_buffers.create();
+    auto [chunk, i] = slot;
+    chunk->buffer[i] = buffer;
+    chunk->allocation[i] = allocation;
+    chunk->size[i] = size;
+    chunk->address[i] = address;
+    chunk->bindless[i] = bindless.release();
+    return handle;
+  } catch (...) {
+    device.allocator().destroyBuffer(buffer, allocation);
+    throw;
+  }
+}
+
+ImageHandle
+ResourceRegistry::create_image(const Image::ImageCreateInfo &ici,
+                               const vma::AllocationCreateInfo &aci) {
+  const auto &device = m_ctx->device();
+
+  auto [image, allocation] = detail::ImageObject::allocate(device, ici, aci);
+
+  try {
+    auto [handle, slot] = m_images.create();
+    auto [chunk, i] = slot;
+    chunk->image[i] = image;
+    chunk->allocation[i] = allocation;
+    chunk->format[i] = ici.format;
+    chunk->extent[i] = ici.extent;
+    chunk->mip_levels[i] = ici.mipLevels;
+    chunk->array_layers[i] = ici.arrayLayers;
+    chunk->pinned[i] = false;
+    return handle;
+  } catch (...) {
+    device.allocator().destroyImage(image, allocation);
+    throw;
+  }
+}
+
+ImageViewHandle ResourceRegistry::create_image_view(
+    ImageHandle image, vk::ImageViewType viewType, vk::Format format,
+    vk::ImageUsageFlags usage, vk::ImageSubresourceRange subresourceRange) {
+  auto objects = makeView(*m_ctx, this->image(image), viewType, format,
+                          usage, subresourceRange);
+
+  auto [handle, slot] = m_views.create();
+  auto [chunk, i] = slot;
+  chunk->view[i] = objects.view.release();
+  chunk->image[i] = image;
+  chunk->sampled_optimal[i] = objects.sampled_optimal.release();
+  chunk->sampled_general[i] = objects.sampled_general.release();
+  chunk->storage[i] = objects.storage.release();
+  chunk->type[i] = viewType;
+  chunk->format[i] = format;
+  chunk->usage[i] = usage;
+  chunk->range[i] = subresourceRange;
+
+  return handle;
+}
+
+void ResourceRegistry::destroy(BufferHandle handle) {
+  if (handle) {
+    retire({.point = m_ctx->submitted_timeline(), .buffer = handle});
+  }
+}
+
+void ResourceRegistry::destroy(ImageHandle handle) {
+  if (handle) {
+    retire({.point = m_ctx->submitted_timeline(), .image = handle});
+  }
+}
+
+void ResourceRegistry::destroy(ImageViewHandle handle) {
+  if (handle) {
+    retire({.point = m_ctx->submitted_timeline(), .view = handle});
+  }
+}
+
+void ResourceRegistry::retire(retired item) {
+  std::scoped_lock const _{m_retired_mut};
+  m_retired.push_back(item);
+}
+
+void ResourceRegistry::collect(const timeline_point &completed) {
+  ZoneScoped;
+
+  std::scoped_lock const _{m_retired_mut};
+  while (!m_retired.empty() &&
+         std::ranges::equal(m_retired.front().point, completed,
+                            std::less_equal<>{})) {
+    auto const &item = m_retired.front();
+    if (item.image) {
+      // the Defragmenter still moves its memory - collected after unpin()
+      auto [chunk, i] = m_images.slot(item.image);
+      if (chunk->pinned[i]) {
+        break;
+      }
+    }
+    destroy_now(item.view);
+    destroy_now(item.image);
+    destroy_now(item.buffer);
+    m_retired.pop_front();
+  }
+}
+
+void ResourceRegistry::destroy_now(BufferHandle handle) noexcept {
+  if (!handle) {
+    return;
+  }
+
+  auto [chunk, i] = m_buffers.slot(handle);
+  m_ctx->bindlessManager().free(std::exchange(chunk->bindless[i], {}));
+  m_ctx->device().allocator().destroyBuffer(chunk->buffer[i],
+                                            chunk->allocation[i]);
+  m_buffers.release(handle);
+}
+
+void ResourceRegistry::destroy_now(ImageHandle handle) noexcept {
+  if (!handle) {
+    return;
+  }
+
+  auto [chunk, i] = m_images.slot(handle);
+  m_ctx->device().allocator().destroyImage(chunk->image[i],
+                                           chunk->allocation[i]);
+  m_images.release(handle);
+}
+
+void ResourceRegistry::destroy_now(ImageViewHandle handle) noexcept {
+  if (!handle) {
+    return;
+  }
+
+  auto [chunk, i] = m_views.slot(handle);
+  auto &bindless = m_ctx->bindlessManager();
+  bindless.free(chunk->sampled_optimal[i].exchange({}));
+  bindless.free(chunk->sampled_general[i].exchange({}));
+  bindless.free(chunk->storage[i].exchange({}));
+  destroyImageView(m_ctx->vkDevice(), chunk->view[i]);
+  m_views.release(handle);
+}
+
+void *ResourceRegistry::mapped(BufferHandle h) const {
+  return m_ctx->device().allocator().getAllocationInfo(allocation(h))
+      .pMappedData;
+}
+
+void ResourceRegistry::flush(BufferHandle h, vk::DeviceSize offset,
+                             vk::DeviceSize size) const {
+  m_ctx->device().allocator().flushAllocation(allocation(h), offset, size);
+}
+
+void ResourceRegistry::setName(BufferHandle h, zstring_view name) const {
+  const auto &device = m_ctx->device();
+  if (device.debugNamesAvaiable()) {
+    device.setDebugNameString(buffer(h), name);
+    device.allocator().setAllocationName(allocation(h), name.data());
+  }
+}
+
+void ResourceRegistry::setName(ImageHandle h, zstring_view name) const {
+  const auto &device = m_ctx->device();
+  if (device.debugNamesAvaiable()) {
+    device.setDebugNameString(image(h), name);
+    device.allocator().setAllocationName(allocation(h), name.data());
+  }
+}
+
+void ResourceRegistry::setName(ImageViewHandle h, zstring_view name) const {
+  m_ctx->device().setDebugNameString(imageView(h), name);
+}
+
+RelocatedImage
+ResourceRegistry::relocate(ImageHandle h, vk::raii::Image image,
+                           std::span<const ImageViewHandle> views) {
+  // everything that can throw first - the slots change all at once
+  std::vector<view_objects> created;
+  created.reserve(views.size());
+  for (auto view : views) {
+    auto [chunk, i] = m_views.slot(view);
+    assert(chunk->image[i] == h && "view of another image");
+    created.push_back(makeView(*m_ctx, *image, chunk->type[i],
+                               chunk->format[i], chunk->usage[i],
+                               chunk->range[i]));
+  }
+
+  const auto &device = m_ctx->vkDevice();
+  auto &bindless = m_ctx->bindlessManager();
+
+  RelocatedImage old;
+  old.views.reserve(views.size());
+  old.handles.reserve(views.size() * 3);
+
+  auto [image_chunk, image_i] = m_images.slot(h);
+  old.image = vk::raii::Image{
+      device, image_chunk->image[image_i].exchange(
+                  image.release(), std::memory_order_acq_rel)};
+  image_chunk->pinned[image_i] = true;
+
+  for (auto &&[view, objects] : std::views::zip(views, created)) {
+    auto [chunk, i] = m_views.slot(view);
+    old.views.emplace_back(
+        device, chunk->view[i].exchange(objects.view.release(),
+                                        std::memory_order_acq_rel));
+    for (auto [column, handle] : {
+             std::pair{&view_chunk::sampled_optimal, &objects.sampled_optimal},
+             std::pair{&view_chunk::sampled_general, &objects.sampled_general},
+             std::pair{&view_chunk::storage, &objects.storage},
+         }) {
+      old.handles.emplace_back(
+          (chunk->*column)[i].exchange(handle->release(),
+                                       std::memory_order_acq_rel),
+          bindless);
+    }
+  }
+
+  return old;
+}
+
+void ResourceRegistry::unpin(ImageHandle h) noexcept {
+  auto [chunk, i] = m_images.slot(h);
+  chunk->pinned[i] = false;
+}
+
+ResourceRegistryStats ResourceRegistry::stats() {
+  auto const retired_slots = m_buffers.retired_slots() +
+                             m_images.retired_slots() +
+                             m_views.retired_slots();
+
+  std::scoped_lock const _{m_retired_mut};
+  return {
+      .buffers = m_buffers.live(),
+      .images = m_images.live(),
+      .image_views = m_views.live(),
+      .pending = m_retired.size(),
+      .retired_slots = retired_slots,
+  };
+}
@@ -0,0 +1,466 @@
+#pragma once
+
+#include "BindlessManager.hpp"
+#include "VulkanConstructs.hpp"
+#include "cppHelpers.hpp"
+#include "v4dgCore.hpp"
+
+#include <vulkan-memory-allocator-hpp/vk_mem_alloc.hpp>
+#include <vulkan/vulkan.hpp>
+#include <vulkan/vulkan_raii.hpp>
+
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <utility>
+#include <vector>
+
+namespace v4dg {
+class Context;
+
+// 32-bit generational handle into a ResourceRegistry
+//   index 0 is the null handle; a slot is retired once every generation
+//   was handed out, so a stale handle never matches a newer resource
+template <typename Tag> class ResourceHandle {
+public:
+  static constexpr std::uint32_t index_bits = 24;
+  static constexpr std::uint32_t index_mask = (1U << index_bits) - 1;
+  static constexpr std::uint32_t generation_mask =
+      (1U << (32 - index_bits)) - 1;
+  static constexpr std::uint32_t max_count = index_mask + 1;
+
+  constexpr ResourceHandle() noexcept = default;
+  constexpr ResourceHandle(std::uint32_t index,
+                           std::uint32_t generation) noexcept
+      : m_value((index & index_mask) |
+                ((generation & generation_mask) << index_bits)) {}
+
+  [[nodiscard]] constexpr std::uint32_t index() const noexcept {
+    return m_value & index_mask;
+  }
+  [[nodiscard]] constexpr std::uint32_t generation() const noexcept {
+    return m_value >> index_bits;
+  }
+  [[nodiscard]] constexpr std::uint32_t raw() const noexcept { return m_value; }
+
+  [[nodiscard]] constexpr bool valid() const noexcept { return index() != 0; }
+  constexpr explicit operator bool() const noexcept { return valid(); }
+
+  auto operator<=>(const ResourceHandle &) const = default;
+
+private:
+  std::uint32_t m_value{0};
+};
+
+namespace detail {
+struct buffer_tag;
+struct image_tag;
+struct image_view_tag;
+} // namespace detail
+
+using BufferHandle = ResourceHandle<detail::buffer_tag>;
+using ImageHandle = ResourceHandle<detail::image_tag>;
+using ImageViewHandle = ResourceHandle<detail::image_view_tag>;
+
+// last submitted/completed timeline semaphore value of every queue type
+//   (see PerQueueFamily::QueueTypes)
+static constexpr std::size_t timeline_count = 3;
+using timeline_point = std::array<std::uint64_t, timeline_count>;
+
+namespace detail {
+static constexpr std::uint32_t resource_chunk_size = 1024;
+
+// Chunked slot map. Slots never move, so reading a live slot needs no
+//   lock; only creation and destruction take the mutex.
+//   Chunk is a struct of std::arrays of chunk_size (the SoA columns).
+template <typename Handle, typename Chunk> class slot_chunks {
+public:
+  static constexpr std::uint32_t chunk_size = resource_chunk_size;
+  static constexpr std::uint32_t chunk_count = Handle::max_count / chunk_size;
+  // never matches a handle (past the last generation)
+  static constexpr std::uint16_t retired_generation =
+      Handle::generation_mask + 1;
+
+  slot_chunks() : m_chunks(std::make_unique<chunk_ptr[]>(chunk_count)) {}
+
+  // returns the handle and the chunk/offset to fill in
+  std::pair<Handle, std::pair<Chunk *, std::uint32_t>> create() {
+    std::scoped_lock const _{m_mut};
+
+    std::uint32_t index = 0;
+    if (!m_free.empty()) {
+      index = m_free.back();
+      m_free.pop_back();
+    } else {
+      index = m_count.load(std::memory_order_relaxed);
+      if (index == Handle::max_count) {
+        throw exception("out of resource slots (max {})", Handle::max_count);
+      }
+      if (index % chunk_size == 0) {
+        m_chunks[index / chunk_size] = std::make_unique<slot_chunk>();
+      }
+      // publishes the chunk to alive()
+      m_count.store(index + 1, std::memory_order_release);
+    }
+
+    auto &chunk = *m_chunks[index / chunk_size];
+    std::uint32_t const offset = index % chunk_size;
+    m_live.fetch_add(1, std::memory_order_relaxed);
+    return {
+        Handle{index, chunk.generation[offset].load(std::memory_order_relaxed)},
+        {&chunk.data, offset},
+    };
+  }
+
+  // the slot of a live handle
+  [[nodiscard]] std::pair<Chunk *, std::uint32_t>
+  slot(Handle handle) const noexcept {
+    assert(handle && handle.index() < m_count.load(std::memory_order_relaxed));
+    auto &chunk = *m_chunks[handle.index() / chunk_size];
+    std::uint32_t const offset = handle.index() % chunk_size;
+    assert(chunk.generation[offset].load(std::memory_order_relaxed) ==
+               handle.generation() &&
+           "stale resource handle");
+    return {&chunk.data, offset};
+  }
+
+  [[nodiscard]] bool alive(Handle handle) const noexcept {
+    if (!handle || handle.index() >= m_count.load(std::memory_order_acquire)) {
+      return false;
+    }
+    const auto &chunk = *m_chunks[handle.index() / chunk_size];
+    return chunk.generation[handle.index() % chunk_size].load(
+               std::memory_order_relaxed) == handle.generation();
+  }
+
+  // the slot can be reused (stale handles stop being alive())
+  void release(Handle handle) {
+    std::scoped_lock const _{m_mut};
+    auto &chunk = *m_chunks[handle.index() / chunk_size];
+    auto &generation = chunk.generation[handle.index() % chunk_size];
+    auto const next = generation.load(std::memory_order_relaxed) + 1;
+    generation.store(static_cast<std::uint16_t>(next),
+                     std::memory_order_relaxed);
+    m_live.fetch_sub(1, std::memory_order_relaxed);
+
+    // wrapping around would make the oldest handles alive again
+    if (next == retired_generation) {
+      m_retired_slots++;
+      return;
+    }
+    m_free.push_back(handle.index());
+  }
+
+  // calls fn(chunk, offset) for every live slot (single-threaded use)
+  void for_each_live(auto &&fn) {
+    std::scoped_lock const _{m_mut};
+    auto const count = m_count.load(std::memory_order_relaxed);
+    std::vector<bool> is_free(count);
+    for (auto index : m_free) {
+      is_free[index] = true;
+    }
+    for (std::uint32_t index = 1; index < count; index++) {
+      auto &chunk = *m_chunks[index / chunk_size];
+      std::uint32_t const offset = index % chunk_size;
+      if (!is_free[index] &&
+          chunk.generation[offset].load(std::memory_order_relaxed) !=
+              retired_generation) {
+        fn(chunk.data, offset);
+      }
+    }
+  }
+
+  [[nodiscard]] std::uint32_t live() const noexcept {
+    return m_live.load(std::memory_order_relaxed);
+  }
+  [[nodiscard]] std::uint32_t retired_slots() {
+    std::scoped_lock const _{m_mut};
+    return m_retired_slots;
+  }
+
+private:
+  struct slot_chunk {
+    // one past the handle's generation bits (see retired_generation)
+    std::array<std::atomic<std::uint16_t>, chunk_size> generation{};
+    Chunk data{};
+  };
+  using chunk_ptr = std::unique_ptr<slot_chunk>;
+
+  std::mutex m_mut;
+  std::unique_ptr<chunk_ptr[]> m_chunks;
+  // index 0 is the null handle
+  std::atomic<std::uint32_t> m_count{1};
+  std::atomic<std::uint32_t> m_live{0};
+  std::vector<std::uint32_t> m_free;
+  std::uint32_t m_retired_slots{0};
+};
+} // namespace detail
+
+struct ResourceRegistryStats {
+  std::uint32_t buffers;
+  std::uint32_t images;
+  std::uint32_t image_views;
+  // destroyed but waiting for the GPU
+  std::size_t pending;
+  // slots that ran out of generations (never reused)
+  std::uint32_t retired_slots;
+};
+
+// the objects ResourceRegistry::relocate() replaced - destroy them once the
+//   GPU finished the frames that could use them
+struct RelocatedImage {
+  vk::raii::Image image{nullptr};
+  std::vector<vk::raii::ImageView> views;
+  std::vector<UniqueBindlessResource> handles;
+};
+
+// Registry of buffers, images and image views addressed by 32-bit
+//   generational handles. Metadata is kept in SoA chunks, so there is no
+//   per-resource heap object or reference count.
+//   destroy() is deferred until every queue has finished the work submitted
+//   so far - call it after the last submission using the resource.
+//   Thread-safe.
+class ResourceRegistry {
+public:
+  explicit ResourceRegistry(Context &ctx);
+  ~ResourceRegistry();
+
+  ResourceRegistry(const ResourceRegistry &) = delete;
+  ResourceRegistry &operator=(const ResourceRegistry &) = delete;
+  ResourceRegistry(ResourceRegistry &&) = delete;
+  ResourceRegistry &operator=(ResourceRegistry &&) = delete;
+
+  // buffers with eShaderDeviceAddress get a bindless buffer table entry
+  [[nodiscard]] BufferHandle
+  create_buffer(vk::DeviceSize size, vk::BufferUsageFlags2KHR usage,
+                const vma::AllocationCreateInfo &allocationCreateInfo =
+                    {{}, vma::MemoryUsage::eAuto});
+  [[nodiscard]] ImageHandle
+  create_image(const Image::ImageCreateInfo &imageCreateInfo,
+               const vma::AllocationCreateInfo &allocationCreateInfo =
+                   {{}, vma::MemoryUsage::eAuto});
+  // registers the bindless handles like ImageView does
+  [[nodiscard]] ImageViewHandle create_image_view(
+      ImageHandle image, vk::ImageViewType viewType, vk::Format format,
+      vk::ImageUsageFlags usage,
+      vk::ImageSubresourceRange subresourceRange = {
+          vk::ImageAspectFlagBits::eColor, 0, vk::RemainingMipLevels, 0,
+          vk::RemainingArrayLayers});
+
+  void destroy(BufferHandle handle);
+  void destroy(ImageHandle handle);
+  void destroy(ImageViewHandle handle);
+
+  // destroy everything retired at or before `completed`
+  void collect(const timeline_point &completed);
+
+  [[nodiscard]] bool alive(BufferHandle h) const noexcept {
+    return m_buffers.alive(h);
+  }
+  [[nodiscard]] bool alive(ImageHandle h) const noexcept {
+    return m_images.alive(h);
+  }
+  [[nodiscard]] bool alive(ImageViewHandle h) const noexcept {
+    return m_views.alive(h);
+  }
+
+  [[nodiscard]] vk::Buffer buffer(BufferHandle h) const noexcept {
+    return get(m_buffers, h, &buffer_chunk::buffer);
+  }
+  [[nodiscard]] vk::DeviceSize size(BufferHandle h) const noexcept {
+    return get(m_buffers, h, &buffer_chunk::size);
+  }
+  [[nodiscard]] vk::DeviceAddress
+  deviceAddress(BufferHandle h) const noexcept {
+    return get(m_buffers, h, &buffer_chunk::address);
+  }
+  [[nodiscard]] BindlessResource bindless(BufferHandle h) const noexcept {
+    return get(m_buffers, h, &buffer_chunk::bindless);
+  }
+  [[nodiscard]] vma::Allocation allocation(BufferHandle h) const noexcept {
+    return get(m_buffers, h, &buffer_chunk::allocation);
+  }
+  // host pointer of a buffer allocated with eMapped (nullptr otherwise)
+  [[nodiscard]] void *mapped(BufferHandle h) const;
+  // makes host writes visible (non-coherent memory)
+  void flush(BufferHandle h, vk::DeviceSize offset = 0,
+             vk::DeviceSize size = vk::WholeSize) const;
+
+  [[nodiscard]] vk::Image image(ImageHandle h) const noexcept {
+    return get(m_images, h, &image_chunk::image);
+  }
+  [[nodiscard]] vk::Format format(ImageHandle h) const noexcept {
+    return get(m_images, h, &image_chunk::format);
+  }
+  [[nodiscard]] vk::Extent3D extent(ImageHandle h) const noexcept {
+    return get(m_images, h, &image_chunk::extent);
+  }
+  [[nodiscard]] std::uint32_t mipLevels(ImageHandle h) const noexcept {
+    return get(m_images, h, &image_chunk::mip_levels);
+  }
+  [[nodiscard]] std::uint32_t arrayLayers(ImageHandle h) const noexcept {
+    return get(m_images, h, &image_chunk::array_layers);
+  }
+  [[nodiscard]] vma::Allocation allocation(ImageHandle h) const noexcept {
+    return get(m_images, h, &image_chunk::allocation);
+  }
+
+  [[nodiscard]] vk::ImageView imageView(ImageViewHandle h) const noexcept {
+    return get(m_views, h, &view_chunk::view);
+  }
+  [[nodiscard]] ImageHandle image(ImageViewHandle h) const noexcept {
+    return get(m_views, h, &view_chunk::image);
+  }
+  [[nodiscard]] BindlessResource
+  sampledOptimalHandle(ImageViewHandle h) const noexcept {
+    return get(m_views, h, &view_chunk::sampled_optimal);
+  }
+  [[nodiscard]] BindlessResource
+  sampledGeneralHandle(ImageViewHandle h) const noexcept {
+    return get(m_views, h, &view_chunk::sampled_general);
+  }
+  [[nodiscard]] BindlessResource
+  storageHandle(ImageViewHandle h) const noexcept {
+    return get(m_views, h, &view_chunk::storage);
+  }
+
+  // debug names of the object (and its allocation)
+  void setName(BufferHandle h, zstring_view name) const;
+  void setName(ImageHandle h, zstring_view name) const;
+  void setName(ImageViewHandle h, zstring_view name) const;
+
+  // Defragmenter support (main thread, nothing recording): `h` gets
+  //   `image`, bound to its moved memory, and `views` (all views of `h`) are
+  //   recreated on it with new bindless handles. Handles resolved while
+  //   recording see the new objects; the old ones are returned. `h` is not
+  //   destroyed before unpin().
+  [[nodiscard]] RelocatedImage relocate(ImageHandle h, vk::raii::Image image,
+                                        std::span<const ImageViewHandle> views);
+  void unpin(ImageHandle h) noexcept;
+
+  [[nodiscard]] ResourceRegistryStats stats();
+
+private:
+  template <typename T>
+  using column = std::array<T, detail::resource_chunk_size>;
+
+  struct buffer_chunk {
+    column<vk::Buffer> buffer;
+    column<vma::Allocation> allocation;
+    column<vk::DeviceSize> size;
+    column<vk::DeviceAddress> address;
+    column<BindlessResource> bindless;
+  };
+
+  // the columns relocate() swaps are atomic - a stale read gets the old
+  //   object, which lives until the frames in flight finished
+  struct image_chunk {
+    column<std::atomic<vk::Image>> image;
+    column<vma::Allocation> allocation;
+    column<vk::Format> format;
+    column<vk::Extent3D> extent;
+    column<std::uint32_t> mip_levels;
+    column<std::uint32_t> array_layers;
+    // being relocated - collect() waits (main thread only)
+    column<bool> pinned;
+  };
+
+  struct view_chunk {
+    column<std::atomic<vk::ImageView>> view;
+    column<ImageHandle> image;
+    column<std::atomic<BindlessResource>> sampled_optimal;
+    column<std::atomic<BindlessResource>> sampled_general;
+    column<std::atomic<BindlessResource>> storage;
+    // to recreate the view on a relocated image
+    column<vk::ImageViewType> type;
+    column<vk::Format> format;
+    column<vk::ImageUsageFlags> usage;
+    column<vk::ImageSubresourceRange> range;
+  };
+
+  template <typename Handle, typename Chunk, typename T>
+  static T get(const detail::slot_chunks<Handle, Chunk> &slots, Handle h,
+               column<T> Chunk::*col) noexcept {
+    auto [chunk, offset] = slots.slot(h);
+    return (chunk->*col)[offset];
+  }
+  template <typename Handle, typename Chunk, typename T>
+  static T get(const detail::slot_chunks<Handle, Chunk> &slots, Handle h,
+               column<std::atomic<T>> Chunk::*col) noexcept {
+    auto [chunk, offset] = slots.slot(h);
+    return (chunk->*col)[offset].load(std::memory_order_acquire);
+  }
+
+  struct retired {
+    timeline_point point;
+    BufferHandle buffer;
+    ImageHandle image;
+    ImageViewHandle view;
+  };
+
+  void retire(retired item);
+  void destroy_now(BufferHandle handle) noexcept;
+  void destroy_now(ImageHandle handle) noexcept;
+  void destroy_now(ImageViewHandle handle) noexcept;
+
+  Context *m_ctx;
+
+  detail::slot_chunks<BufferHandle, buffer_chunk> m_buffers;
+  detail::slot_chunks<ImageHandle, image_chunk> m_images;
+  detail::slot_chunks<ImageViewHandle, view_chunk> m_views;
+
+  std::mutex m_retired_mut;
+  // in submission order - points never decrease
+  std::deque<retired> m_retired;
+};
+
+// RAII wrapper destroying the resource (deferred) when it goes out of scope
+template <typename Handle> class UniqueResource {
+public:
+  UniqueResource() = default;
+  UniqueResource(ResourceRegistry &registry, Handle handle) noexcept
+      : m_registry(&registry), m_handle(handle) {}
+
+  UniqueResource(const UniqueResource &) = delete;
+  UniqueResource &operator=(const UniqueResource &) = delete;
+  UniqueResource(UniqueResource &&o) noexcept
+      : m_registry(o.m_registry), m_handle(std::exchange(o.m_handle, {})) {}
+  UniqueResource &operator=(UniqueResource &&o) noexcept {
+    if (this != &o) {
+      reset();
+      m_registry = o.m_registry;
+      m_handle = std::exchange(o.m_handle, {});
+    }
+    return *this;
+  }
+  ~UniqueResource() { reset(); }
+
+  void reset() {
+    if (m_handle) {
+      m_registry->destroy(std::exchange(m_handle, {}));
+    }
+  }
+  [[nodiscard]] Handle release() noexcept {
+    return std::exchange(m_handle, {});
+  }
+
+  [[nodiscard]] Handle get() const noexcept { return m_handle; }
+  Handle operator*() const noexcept { return m_handle; }
+  explicit operator bool() const noexcept { return m_handle.valid(); }
+
+private:
+  ResourceRegistry *m_registry{nullptr};
+  Handle m_handle;
+};
+
+using UniqueBuffer = UniqueResource<BufferHandle>;
+using UniqueImage = UniqueResource<ImageHandle>;
+using UniqueImageView = UniqueResource<ImageViewHandle>;
+} // namespace v4dg
@@ -3,6 +3,7 @@
 #include "CommandBuffer.hpp"
 #include "Constants.hpp"
 #include "Context.hpp"
+#include "MemoryPools.hpp"
 #include "VulkanConstructs.hpp"
 #include "VulkanResources.hpp"
 #include "cppHelpers.hpp"
@@ -24,9 +25,11 @@
 #include <functional>
 #include <list>
 #include <mutex>
+#include <optional>
 #include <ranges>
 #include <span>
 #include <stdexcept>
+#include <string>
 #include <utility>
 #include <variant>
 #include <vector>
@@ -229,6 +232,10 @@ TransferManager::TransferManager(Context &ctx)
                                           0}}.get<>())) {
   m_ctx->device().setDebugName(async_transfer_semaphore,
                                "async transfer semaphore");
+
+  m_texture_evictor = UniqueEvictor{
+      ctx.memoryBudget(),
+      [this](vk::DeviceSize bytes) { return evictTextures(bytes); }};
 }
 
 Buffer TransferManager::allocateBuffer(std::size_t size,
@@ -307,6 +314,13 @@ auto TransferManager::uploadBuffer(const Buffer &buffer, buffer_upload_fn fn,
 auto TransferManager::uploadTexture(const std::filesystem::path &path,
                                     const TextureTransferInfo &ti)
     -> TextureFuture {
+  if (ti.cached) {
+    if (auto texture = findCached(path, ti)) {
+      // already in the target layout and owned by the target family
+      return {.texture = *std::move(texture), .transfer_handle = {}};
+    }
+  }
+
   auto ext = path.extension();
 
   if (ext == ".ktx" || ext == ".ktx2") {
@@ -316,6 +330,72 @@ auto TransferManager::uploadTexture(const std::filesystem::path &path,
   throw exception("unsupported texture format: {}", ext.string());
 }
 
+std::optional<ImageView>
+TransferManager::findCached(const std::filesystem::path &path,
+                            const TextureTransferInfo &ti) {
+  std::scoped_lock const _{m_cache_mut};
+  auto it = m_texture_cache.find(path.lexically_normal().string());
+  if (it == m_texture_cache.end()) {
+    return std::nullopt;
+  }
+
+  auto &entry = it->second;
+  if (entry.usage != ti.usage || entry.layout != ti.layout ||
+      entry.family != ti.target_family) {
+    return std::nullopt;
+  }
+  entry.last_request = m_cache_tick++;
+  return entry.texture;
+}
+
+auto TransferManager::cacheOnAcquire(const std::filesystem::path &path,
+                                     const TextureTransferInfo &ti,
+                                     const ImageView &tex) -> acquired_fn {
+  if (!ti.cached) {
+    return {};
+  }
+
+  return [this, key = path.lexically_normal().string(), tex,
+          usage = ti.usage, layout = ti.layout](std::uint32_t family) {
+    std::scoped_lock const _{m_cache_mut};
+    m_texture_cache.insert_or_assign(key, cached_texture{
+                                              .texture = tex,
+                                              .usage = usage,
+                                              .layout = layout,
+                                              .family = family,
+                                              .last_request = m_cache_tick++,
+                                          });
+  };
+}
+
+vk::DeviceSize TransferManager::evictTextures(vk::DeviceSize bytes) {
+  ZoneScoped;
+  std::scoped_lock const _{m_cache_mut};
+
+  // only the cache holds these - nothing can use them on the GPU either
+  std::vector<std::pair<std::uint64_t, std::string>> unused;
+  for (const auto &[key, entry] : m_texture_cache) {
+    if (entry.texture.use_count() == 1) {
+      unused.emplace_back(entry.last_request, key);
+    }
+  }
+  std::ranges::sort(unused);
+
+  const auto &allocator = m_ctx->device().allocator();
+  vk::DeviceSize freed = 0;
+  for (const auto &[last_request, key] : unused) {
+    if (freed >= bytes) {
+      break;
+    }
+
+    auto it = m_texture_cache.find(key);
+    const auto &image = it->second.texture->image();
+    freed += allocator.getAllocationInfo(image->allocation()).size;
+    m_texture_cache.erase(it);
+  }
+  return freed;
+}
+
 auto TransferManager::uploadTextureKtx(const std::filesystem::path &path,
                                        const TextureTransferInfo &ti)
     -> TextureFuture {
@@ -413,9 +493,8 @@ auto TransferManager::uploadTextureKtx(const std::filesystem::path &path,
           .arrayLayers = layers,
           .usage = ti.usage | vk::ImageUsageFlagBits::eTransferDst,
       },
-      vma::AllocationCreateInfo{}
-          .setUsage(vma::MemoryUsage::eAuto)
-          .setPriority(0.0F),
+      m_ctx->device().memoryPools().allocation_info(
+          MemoryClass::StreamingTexture),
       vk::ImageViewCreateFlags{}, viewType);
 
   std::string name =
@@ -424,6 +503,8 @@ auto TransferManager::uploadTextureKtx(const std::filesystem::path &path,
   tex->setName(m_ctx->device(), "image view {}", name);
   tex->image()->setName(m_ctx->device(), "image {}", name);
 
+  auto acquired = cacheOnAcquire(path, ti, tex);
+
   return uploadTextureHelper(
       tex, ti.priority, ti.layout, ti.target_family,
       [this, texture = std::move(texture),
@@ -433,18 +514,18 @@ auto TransferManager::uploadTextureKtx(const std::filesystem::path &path,
 
         std::size_t const textureSize =
             ktxTexture_GetDataSizeUncompressed(texture);
-        Buffer staging = stagingBuffer(textureSize);
+        UniqueBuffer staging = stagingResource(textureSize);
+        auto &resources = m_ctx->resources();
+        auto *mapped = static_cast<ktx_uint8_t *>(resources.mapped(*staging));
 
         if (texture->pData) {
-          std::memcpy(staging->map<ktx_uint8_t>().get(), texture->pData,
-                      textureSize);
+          std::memcpy(mapped, texture->pData, textureSize);
         } else {
           /* Load the image data directly into the staging buffer. */
-          check_error(
-              ktxTexture_LoadImageData(
-                  texture, staging->map<ktx_uint8_t>().get(), textureSize),
-              "loading");
+          check_error(ktxTexture_LoadImageData(texture, mapped, textureSize),
+                      "loading");
         }
+        resources.flush(*staging);
 
         struct iter_info {
           vk::DeviceSize offset;
@@ -499,23 +580,26 @@ auto TransferManager::uploadTextureKtx(const std::filesystem::path &path,
             .staging = std::move(staging),
             .copyRegions = std::move(regions),
         };
-      });
+      },
+      std::move(acquired));
 }
 
 auto TransferManager::uploadTextureHelper(
     const ImageView &tex, PriorityClass priority, vk::ImageLayout target_layout,
-    std::uint32_t target_family,
-    uploadTextureHelper_fn prepare_transfer_data) -> TextureFuture {
+    std::uint32_t target_family, uploadTextureHelper_fn prepare_transfer_data,
+    acquired_fn acquired) -> TextureFuture {
   return {
       .texture = tex,
       .transfer_handle = enqueueTransfer(
           priority,
-          [tex, prepare_transfer_data = std::move(prepare_transfer_data),
+          [ctx = m_ctx, tex,
+           prepare_transfer_data = std::move(prepare_transfer_data),
            target_layout,
            target_family](CommandBuffer &cmd) mutable -> memory_transfer_info {
-            uploadTextureHelper_data const data = prepare_transfer_data();
+            uploadTextureHelper_data data = prepare_transfer_data();
 
-            cmd.add_resource(data.staging);
+            vk::Buffer const staging = ctx->resources().buffer(*data.staging);
+            cmd.add_resource(std::move(data.staging));
             cmd.add_resource(tex);
 
             cmd.barrier({}, {}, {},
@@ -538,7 +622,7 @@ auto TransferManager::uploadTextureHelper(
                             },
                         });
 
-            cmd->copyBufferToImage(data.staging->vk(), tex->vkImage(),
+            cmd->copyBufferToImage(staging, tex->vkImage(),
                                    vk::ImageLayout::eTransferDstOptimal,
                                    data.copyRegions);
 
@@ -564,7 +648,8 @@ auto TransferManager::uploadTextureHelper(
                         },
                     },
             };
-          }),
+          },
+          std::move(acquired)),
   };
 }
 
@@ -573,13 +658,21 @@ Buffer TransferManager::stagingBuffer(std::size_t size) {
       m_ctx->device(),
       size,
       vk::BufferUsageFlagBits2KHR::eTransferSrc,
-      {
-          vma::AllocationCreateFlagBits::eHostAccessSequentialWrite,
-          vma::MemoryUsage::eAuto,
-      },
+      m_ctx->device().memoryPools().allocation_info(MemoryClass::Staging),
   };
 }
 
+UniqueBuffer TransferManager::stagingResource(std::size_t size) {
+  auto allocation =
+      m_ctx->device().memoryPools().allocation_info(MemoryClass::Staging);
+  allocation.flags |= vma::AllocationCreateFlagBits::eMapped;
+
+  auto &resources = m_ctx->resources();
+  return {resources, resources.create_buffer(
+                         size, vk::BufferUsageFlagBits2KHR::eTransferSrc,
+                         allocation)};
+}
+
 Buffer TransferManager::stagingBuffer(std::span<const std::byte> data) {
   auto buffer = stagingBuffer(data.size_bytes());
   std::ranges::copy(data, buffer->map<std::byte>().get());
@@ -605,13 +698,16 @@ auto TransferManager::getQueueItemList(bool done, PriorityClass priority)
   }
 }
 
-auto TransferManager::enqueueTransfer(
-    PriorityClass priority, transfer_fn transfer) -> ResourceTransferHandle {
+auto TransferManager::enqueueTransfer(PriorityClass priority,
+                                      transfer_fn transfer,
+                                      acquired_fn acquired)
+    -> ResourceTransferHandle {
   std::scoped_lock const _(queue_mut);
 
   auto &queue = getQueueItemList(false, priority);
 
   queue.emplace_front(std::move(transfer), priority, false);
+  queue.front().acquired = std::move(acquired);
   return {queue.begin(), this};
 }
 
@@ -716,6 +812,9 @@ void TransferManager::acquireResources(
                  },
                  ti.barrier);
 
+      if (it->acquired) {
+        it->acquired(cb.queueFamily());
+      }
       getQueueItemList(false, it->priority).erase(it);
     } else {
       // done by async transfer
@@ -741,6 +840,9 @@ void TransferManager::acquireResources(
       cb.add_wait(*async_transfer_semaphore, it->semaphore_value,
                   vk::PipelineStageFlagBits2::eAllCommands);
 
+      if (it->acquired) {
+        it->acquired(cb.queueFamily());
+      }
       list_done.erase(it);
     }
   }
@@ -785,6 +887,10 @@ void TransferManager::doOutstandingTransfers(std::size_t max_transfer_size,
   std::size_t transfer_size = 0;
   std::size_t transfer_count = 0;
 
+  // near the memory budget only high priority uploads run at full speed
+  const auto &budget = m_ctx->memoryBudget();
+  std::size_t const throttled_size = budget.transfer_budget(max_transfer_size);
+
   // use a dedicated queue for transfers if we have a one
   //  otherwise we use a general queue
 
@@ -820,8 +926,14 @@ void TransferManager::doOutstandingTransfers(std::size_t max_transfer_size,
 
     // going from high to low priority
     for (std::list<QueueItem> &queue : queues) {
+      if (&queue == &queue_low && budget.throttled()) {
+        break;
+      }
+      std::size_t const size_limit =
+          &queue == &queue_high ? max_transfer_size : throttled_size;
+
       // try to transfer as much as possible until we reach the limit
-      while (transfer_size < max_transfer_size &&
+      while (transfer_size < size_limit &&
              transfer_count < max_transfer_count && !queue.empty()) {
 
         auto &item = queue.front();
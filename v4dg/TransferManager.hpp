@@ -2,9 +2,12 @@
 
 #include "CommandBuffer.hpp"
 #include "Context.hpp"
+#include "MemoryPools.hpp"
+#include "ResourceRegistry.hpp"
 #include "VulkanConstructs.hpp"
 #include "VulkanResources.hpp"
 
+#include <ankerl/unordered_dense.h>
 #include <vulkan/vulkan.hpp>
 #include <vulkan/vulkan_raii.hpp>
 
@@ -17,6 +20,7 @@
 #include <mutex>
 #include <optional>
 #include <span>
+#include <string>
 #include <string_view>
 #include <variant>
 #include <vector>
@@ -89,6 +93,10 @@ public:
   struct TextureTransferInfo : TransferInfo {
     vk::ImageUsageFlags usage = vk::ImageUsageFlagBits::eSampled;
     vk::ImageLayout layout = vk::ImageLayout::eShaderReadOnlyOptimal;
+    // kept by the manager once acquired: later requests of the same file
+    //   get it without a transfer. Under memory pressure the textures
+    //   nothing else holds are evicted (least recently requested first).
+    bool cached = false;
   };
 
   class ResourceTransferHandle {
@@ -150,9 +158,14 @@ public:
   }
 
   // load a texture for that will be used only as a sampled image
+  //   (a cached texture comes with an empty transfer handle)
   TextureFuture uploadTexture(const std::filesystem::path &path,
                               const TextureTransferInfo &ti);
 
+  // frees up to `bytes` of cached textures; returns the bytes freed
+  //   (the memory budget evictor)
+  vk::DeviceSize evictTextures(vk::DeviceSize bytes);
+
   // CommandBuffer must be in recording state and be from the same family
   //  as the resources' target family
   // If the target family doesn't support transfer operations the
@@ -172,14 +185,27 @@ public:
                               std::size_t max_transfer_count = 8);
 
 private:
+  // called with the target family once the resource is acquired
+  using acquired_fn = std::move_only_function<void(std::uint32_t)>;
+
   TextureFuture uploadTextureKtx(const std::filesystem::path &path,
                                  const TextureTransferInfo &ti);
 
+  // nullopt unless the same file was cached with the same usage, layout and
+  //   target family
+  std::optional<ImageView> findCached(const std::filesystem::path &path,
+                                      const TextureTransferInfo &ti);
+  // caches the texture once acquired (if ti.cached)
+  acquired_fn cacheOnAcquire(const std::filesystem::path &path,
+                             const TextureTransferInfo &ti,
+                             const ImageView &tex);
+
   // TODO: other texture formats (probably using stb_image)
 
   struct uploadTextureHelper_data {
     std::size_t dataSize;
-    Buffer staging;
+    // persistently mapped (see stagingResource)
+    UniqueBuffer staging;
     std::vector<vk::BufferImageCopy> copyRegions;
   };
 
@@ -190,10 +216,13 @@ private:
   uploadTextureHelper(const ImageView &tex, PriorityClass priority,
                       vk::ImageLayout target_layout,
                       std::uint32_t target_family,
-                      uploadTextureHelper_fn prepare_transfer_data);
+                      uploadTextureHelper_fn prepare_transfer_data,
+                      acquired_fn acquired = {});
 
   Buffer stagingBuffer(std::span<const std::byte> data);
   Buffer stagingBuffer(std::size_t size);
+  // registry-owned staging buffer, mapped for its whole lifetime
+  UniqueBuffer stagingResource(std::size_t size);
 
   CommandBuffer getCommandBuffer();
 
@@ -234,7 +263,8 @@ private:
       std::move_only_function<memory_transfer_info(CommandBuffer &)>;
 
   ResourceTransferHandle enqueueTransfer(PriorityClass priority,
-                                         transfer_fn transfer);
+                                         transfer_fn transfer,
+                                         acquired_fn acquired = {});
 
   // when the handle is discarded we know that the transfer will not be waited
   // on, so we can just cancel the transfer and free the resources
@@ -268,6 +298,8 @@ private:
     std::uint64_t semaphore_value = {};
 
     any_memory_barrier barrier;
+
+    acquired_fn acquired;
   };
 
   // a queue for every priority & done
@@ -282,6 +314,23 @@ private:
 
   std::list<QueueItem> queue_high, queue_normal, queue_low;
   std::list<QueueItem> list_done;
+
+  struct cached_texture {
+    ImageView texture;
+    vk::ImageUsageFlags usage;
+    vk::ImageLayout layout;
+    std::uint32_t family;
+    // m_cache_tick of the last request
+    std::uint64_t last_request;
+  };
+
+  std::mutex m_cache_mut;
+  // by the normalized path
+  ankerl::unordered_dense::map<std::string, cached_texture> m_texture_cache;
+  std::uint64_t m_cache_tick{0};
+
+  // last - removed before the cache is destroyed
+  UniqueEvictor m_texture_evictor;
 };
 
 }; // namespace v4dg
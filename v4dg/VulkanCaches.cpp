@@ -3,12 +3,17 @@
 #include "BindlessManager.hpp"
 #include "Context.hpp"
 #include "Device.hpp"
+#include "PipelineBuilder.hpp"
 
+#include <tracy/Tracy.hpp>
 #include <vulkan/vulkan.hpp>
 #include <vulkan/vulkan_raii.hpp>
 
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
+#include <exception>
+#include <future>
 #include <memory>
 #include <span>
 
@@ -34,10 +39,8 @@ std::shared_ptr<const Sampler> SamplerInfo::create(Context &ctx) const {
       vk::raii::Sampler{ctx.vkDevice(), chain.get<>()},
       ctx.bindlessManager().allocate(BindlessType::eSampler));
 
-  vk::DescriptorImageInfo dii{*res->sampler};
-
-  ctx.vkDevice().updateDescriptorSets(
-      ctx.bindlessManager().write_for(*res->handle, dii), {});
+  ctx.bindlessManager().queue_write(*res->handle,
+                                    vk::DescriptorImageInfo{*res->sampler});
 
   return res;
 }
@@ -100,6 +103,73 @@ vk::raii::PipelineLayout PipelineLayoutInfo::create(const Device &dev) const {
   return {dev.device(), {flags, setLayouts, pushRanges}};
 }
 
+bool AsyncPipeline::ready() const {
+  return m_pipeline.wait_for(std::chrono::seconds{0}) ==
+         std::future_status::ready;
+}
+
+vk::Pipeline AsyncPipeline::try_get() const {
+  if (!ready()) {
+    return nullptr;
+  }
+
+  try {
+    return *m_pipeline.get();
+  } catch (const std::exception &) {
+    return nullptr;
+  }
+}
+
+const vk::raii::Pipeline &AsyncPipeline::wait() const {
+  if (m_executor->this_worker_id() != -1) {
+    m_executor->corun_until([this] { return ready(); });
+  }
+  return m_pipeline.get();
+}
+
+namespace {
+std::shared_ptr<const AsyncPipeline> compile_async(Context &ctx,
+                                                   const auto &info) {
+  auto pipeline = ctx.executor().async([info, &ctx] {
+    ZoneScopedN("compile pipeline");
+    return info.build(ctx);
+  });
+
+  return std::make_shared<const AsyncPipeline>(ctx.executor(),
+                                               pipeline.share());
+}
+} // namespace
+
+size_t ComputePipelineInfo::hash::operator()(
+    const ComputePipelineInfo &cpi) const noexcept {
+  std::size_t seed = ShaderStageData::hash{}(cpi.stage);
+  detail::add_hash(seed, cpi.flags, cpi.layout);
+  return seed;
+}
+
+vk::raii::Pipeline ComputePipelineInfo::build(Context &ctx) const {
+  return {ctx.vkDevice(), ctx.pipeline_cache(), {flags, stage.get(), layout}};
+}
+
+std::shared_ptr<const AsyncPipeline>
+ComputePipelineInfo::create(Context &ctx) const {
+  return compile_async(ctx, *this);
+}
+
+size_t GraphicsPipelineInfo::hash::operator()(
+    const GraphicsPipelineInfo &gpi) const noexcept {
+  std::size_t seed = GraphicsPipelineBuilder::hash{}(gpi.builder);
+  for (const auto &stage : gpi.stages) {
+    detail::hash_combine(seed, ShaderStageData::hash{}(stage));
+  }
+  return seed;
+}
+
+std::shared_ptr<const AsyncPipeline>
+GraphicsPipelineInfo::create(Context &ctx) const {
+  return compile_async(ctx, *this);
+}
+
 /*
 file_watcher::file_data::file_data(const fs::path &file,
                                    vector<callback_handle> callbacks)
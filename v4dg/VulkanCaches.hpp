@@ -3,6 +3,7 @@
 #include "BindlessManager.hpp"
 #include "Device.hpp"
 #include "HandleCache.hpp"
+#include "PipelineBuilder.hpp"
 
 #include <ankerl/unordered_dense.h>
 #include <vulkan/vulkan.hpp>
@@ -11,11 +12,13 @@
 #include <algorithm>
 #include <cstddef>
 #include <cstdint>
+#include <future>
 #include <iterator>
 #include <memory>
 #include <ranges>
 #include <span>
 #include <type_traits>
+#include <utility>
 #include <vector>
 
 namespace v4dg {
@@ -177,6 +180,15 @@ public:
 
   [[nodiscard]] vk::raii::DescriptorSetLayout create(const Device &) const;
 
+  [[nodiscard]] std::span<const vk::DescriptorSetLayoutBinding>
+  get_bindings() const noexcept {
+    return bindings;
+  }
+  [[nodiscard]] std::span<const vk::DescriptorBindingFlags>
+  get_binding_flags() const noexcept {
+    return bindFlags;
+  }
+
 private:
   vk::DescriptorSetLayoutCreateFlags flags;
   std::vector<vk::DescriptorSetLayoutBinding> bindings;
@@ -238,34 +250,102 @@ private:
   std::vector<vk::PushConstantRange> pushRanges;
 };
 
-/*
-// TODO
-class RenderPassInfo {
+// pipeline compiled in the background on the context's executor
+class AsyncPipeline {
 public:
-  using handle_type = vk::raii::RenderPass;
-  using handle_data = const Device *;
+  AsyncPipeline(tf::Executor &executor,
+                std::shared_future<vk::raii::Pipeline> pipeline)
+      : m_executor(&executor), m_pipeline(std::move(pipeline)) {}
 
-  RenderPassInfo(vk::RenderPassCreateFlags flags = {}) : flags(flags) {}
+  // true when compiled (or when the compilation failed)
+  [[nodiscard]] bool ready() const;
 
-  void normalize();
-  vk::raii::RenderPass create(const Device *) const;
+  // nullptr until ready
+  [[nodiscard]] vk::Pipeline try_get() const;
+
+  [[nodiscard]] vk::Pipeline get_or(vk::Pipeline fallback) const {
+    auto pipeline = try_get();
+    return pipeline ? pipeline : fallback;
+  }
+
+  // blocks until compiled (workers execute other tasks in the meantime);
+  //   rethrows compilation errors
+  [[nodiscard]] const vk::raii::Pipeline &wait() const;
 
 private:
-  vk::RenderPassCreateFlags flags;
+  tf::Executor *m_executor;
+  std::shared_future<vk::raii::Pipeline> m_pipeline;
+};
+
+class ComputePipelineInfo {
+public:
+  using handle_type = AsyncPipeline;
+  using handle_data = Context &;
+  struct hash {
+    size_t operator()(const ComputePipelineInfo &) const noexcept;
+  };
+
+  // the stage should own its code (see ShaderStageData)
+  ComputePipelineInfo(vk::PipelineLayout layout, ShaderStageData stage,
+                      vk::PipelineCreateFlags flags = {})
+      : flags(flags), layout(layout), stage(std::move(stage)) {}
+
+  bool operator==(const ComputePipelineInfo &) const = default;
+
+  // compile synchronously on the calling thread
+  [[nodiscard]] vk::raii::Pipeline build(Context &) const;
+
+  // schedule the compilation on the executor
+  std::shared_ptr<const AsyncPipeline> create(Context &) const;
+
+private:
+  vk::PipelineCreateFlags flags;
+  vk::PipelineLayout layout;
+  ShaderStageData stage;
 };
 
-// TODO
 class GraphicsPipelineInfo {
 public:
-  using handle_type = vk::raii::Pipeline;
-  using handle_data = const Device *;
+  using handle_type = AsyncPipeline;
+  using handle_data = Context &;
+  struct hash {
+    size_t operator()(const GraphicsPipelineInfo &) const noexcept;
+  };
+
+  // the stages should own their code (see ShaderStageData)
+  GraphicsPipelineInfo(GraphicsPipelineBuilder builder,
+                       std::vector<ShaderStageData> stages)
+      : builder(std::move(builder)), stages(std::move(stages)) {}
+
+  bool operator==(const GraphicsPipelineInfo &) const = default;
+
+  // compile synchronously on the calling thread
+  [[nodiscard]] vk::raii::Pipeline build(Context &ctx) const {
+    return builder.build(ctx, stages);
+  }
+
+  // schedule the compilation on the executor
+  std::shared_ptr<const AsyncPipeline> create(Context &) const;
+
+private:
+  GraphicsPipelineBuilder builder;
+  std::vector<ShaderStageData> stages;
 };
 
+/*
 // TODO
-class ComputePipelineInfo {
+class RenderPassInfo {
 public:
-  using handle_type = vk::raii::Pipeline;
+  using handle_type = vk::raii::RenderPass;
   using handle_data = const Device *;
+
+  RenderPassInfo(vk::RenderPassCreateFlags flags = {}) : flags(flags) {}
+
+  void normalize();
+  vk::raii::RenderPass create(const Device *) const;
+
+private:
+  vk::RenderPassCreateFlags flags;
 };
 
 // TODO
@@ -285,14 +365,14 @@ public:
 // typedef permament_handle_cache<SamplerYcbcrConversionInfo>
 // sampler_ycbcr_conversion_cache;
 using sampler_cache = handle_cache<SamplerInfo>;
+using graphics_pipeline_cache = handle_cache<GraphicsPipelineInfo>;
+using compute_pipeline_cache = handle_cache<ComputePipelineInfo>;
 
-// typedef permament_handle_cache<DescriptorSetLayoutInfo>
-// descriptor_set_layout_cache; typedef
-// permament_handle_cache<PipelineLayoutInfo> pipeline_layout_cache; typedef
-// permament_handle_cache<RenderPassInfo> render_pass_cache;
+using descriptor_set_layout_cache =
+    permament_handle_cache<DescriptorSetLayoutInfo>;
+using pipeline_layout_cache = permament_handle_cache<PipelineLayoutInfo>;
+// typedef permament_handle_cache<RenderPassInfo> render_pass_cache;
 
-// typedef handle_cache<GraphicsPipelineInfo> GraphicsPipelineCache;
-// typedef handle_cache<ComputePipelineInfo> ComputePipelineCache;
 // typedef handle_cache<RayTracingPipelineInfo> RayTracingPipelineCache;
 
 } // namespace v4dg
@@ -1,6 +1,7 @@
 #include "VulkanConstructs.hpp"
 
 #include "Device.hpp"
+#include "MemoryPools.hpp"
 #include "v4dgVulkan.hpp"
 
 #include <vulkan-memory-allocator-hpp/vk_mem_alloc.hpp>
@@ -32,8 +33,11 @@ BufferObject::BufferObject(
     : BufferObject(
           internal_construct_t{}, device,
           [&] {
-            auto [buffer, allocation] = device.allocator().createBuffer(
-                bufferCreateInfo, allocationCreateInfo);
+            auto [buffer, allocation] = allocate_with_fallback(
+                allocationCreateInfo, [&](const auto &aci) {
+                  return device.allocator().createBuffer(bufferCreateInfo,
+                                                         aci);
+                });
 
             return std::pair<vma::Allocation, vk::raii::Buffer>(
                 allocation, vk::raii::Buffer(device.device(), buffer));
@@ -80,48 +84,56 @@ ImageObject::ImageObject(internal_construct_t /*unused*/, const Device &device,
       m_arrayLayers(arrayLayers), m_samples(samples) {}
 // NOLINTEND(bugprone-easily-swappable-parameters)
 
+std::pair<vk::Image, vma::Allocation>
+ImageObject::allocate(const Device &device,
+                      const ImageCreateInfo &imageCreateInfo,
+                      const vma::AllocationCreateInfo &allocationCreateInfo) {
+  vk::StructureChain<vk::ImageCreateInfo, vk::ImageFormatListCreateInfo,
+                     vk::ImageStencilUsageCreateInfo>
+      ici{{
+              imageCreateInfo.flags,
+              imageCreateInfo.imageType,
+              imageCreateInfo.format,
+              imageCreateInfo.extent,
+              imageCreateInfo.mipLevels,
+              imageCreateInfo.arrayLayers,
+              imageCreateInfo.samples,
+              imageCreateInfo.tiling,
+              imageCreateInfo.usage,
+              imageCreateInfo.sharingMode,
+              imageCreateInfo.queueFamilyIndices,
+              imageCreateInfo.initialLayout,
+          },
+          {},
+          {}};
+
+  if (imageCreateInfo.formats) {
+    ici.get<vk::ImageFormatListCreateInfo>().setViewFormats(
+        *imageCreateInfo.formats);
+  } else {
+    ici.unlink<vk::ImageFormatListCreateInfo>();
+  }
+
+  if (imageCreateInfo.stencilUsage) {
+    ici.get<vk::ImageStencilUsageCreateInfo>().setStencilUsage(
+        *imageCreateInfo.stencilUsage);
+  } else {
+    ici.unlink<vk::ImageStencilUsageCreateInfo>();
+  }
+
+  return allocate_with_fallback(allocationCreateInfo, [&](const auto &aci) {
+    return device.allocator().createImage(ici.get<vk::ImageCreateInfo>(), aci);
+  });
+}
+
 ImageObject::ImageObject(internal_construct_t /*unused*/, const Device &device,
                          const ImageCreateInfo &imageCreateInfo,
                          const vma::AllocationCreateInfo &allocationCreateInfo)
     : ImageObject(
           internal_construct_t{}, device,
           [&] {
-            vk::StructureChain<vk::ImageCreateInfo,
-                               vk::ImageFormatListCreateInfo,
-                               vk::ImageStencilUsageCreateInfo>
-                ici{{
-                        imageCreateInfo.flags,
-                        imageCreateInfo.imageType,
-                        imageCreateInfo.format,
-                        imageCreateInfo.extent,
-                        imageCreateInfo.mipLevels,
-                        imageCreateInfo.arrayLayers,
-                        imageCreateInfo.samples,
-                        imageCreateInfo.tiling,
-                        imageCreateInfo.usage,
-                        imageCreateInfo.sharingMode,
-                        imageCreateInfo.queueFamilyIndices,
-                        imageCreateInfo.initialLayout,
-                    },
-                    {},
-                    {}};
-
-            if (imageCreateInfo.formats) {
-              ici.get<vk::ImageFormatListCreateInfo>().setViewFormats(
-                  *imageCreateInfo.formats);
-            } else {
-              ici.unlink<vk::ImageFormatListCreateInfo>();
-            }
-
-            if (imageCreateInfo.stencilUsage) {
-              ici.get<vk::ImageStencilUsageCreateInfo>().setStencilUsage(
-                  *imageCreateInfo.stencilUsage);
-            } else {
-              ici.unlink<vk::ImageStencilUsageCreateInfo>();
-            }
-
-            auto [image, allocation] = device.allocator().createImage(
-                ici.get<vk::ImageCreateInfo>(), allocationCreateInfo);
+            auto [image, allocation] =
+                allocate(device, imageCreateInfo, allocationCreateInfo);
 
             return std::pair<vma::Allocation, vk::raii::Image>(
                 allocation, vk::raii::Image(device.device(), image));
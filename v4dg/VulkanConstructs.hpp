@@ -193,6 +193,11 @@ public:
               const ImageCreateInfo &imageCreateInfo,
               const vma::AllocationCreateInfo &allocationCreateInfo);
 
+  // raw image + allocation (the caller owns both)
+  [[nodiscard]] static std::pair<vk::Image, vma::Allocation>
+  allocate(const Device &device, const ImageCreateInfo &imageCreateInfo,
+           const vma::AllocationCreateInfo &allocationCreateInfo);
+
 private:
   vk::raii::Image m_image;
 
@@ -7,10 +7,7 @@
 #include <vulkan-memory-allocator-hpp/vk_mem_alloc.hpp>
 #include <vulkan/vulkan.hpp>
 
-#include <array>
-#include <cstddef>
 #include <memory>
-#include <span>
 
 using namespace v4dg;
 using namespace v4dg::detail;
@@ -38,39 +35,28 @@ ImageViewObject::ImageViewObject(internal_construct_t /*unused*/, Context &ctx,
 
   m_imageView = {ctx.vkDevice(), chain.get<>()};
 
-  std::array<vk::WriteDescriptorSet, 3> writes;
-  std::size_t cnt{0};
+  auto &bindless = ctx.bindlessManager();
 
-  vk::DescriptorImageInfo image_general_info{
+  vk::DescriptorImageInfo const image_general_info{
       {}, *m_imageView, vk::ImageLayout::eGeneral};
 
-  vk::DescriptorImageInfo image_optimal_info{
+  vk::DescriptorImageInfo const image_optimal_info{
       {}, *m_imageView, vk::ImageLayout::eReadOnlyOptimal};
 
   if (hasAllFlags(usage, vk::ImageUsageFlagBits::eSampled)) {
-    m_sampledOptimalHandle =
-        ctx.bindlessManager().allocate(BindlessType::eSampledImage);
-    writes[cnt++] = ctx.bindlessManager().write_for(*m_sampledOptimalHandle,
-                                                    image_optimal_info);
+    m_sampledOptimalHandle = bindless.allocate(BindlessType::eSampledImage);
+    bindless.queue_write(*m_sampledOptimalHandle, image_optimal_info);
   }
 
   if (hasAllFlags(usage, vk::ImageUsageFlagBits::eSampled |
                              vk::ImageUsageFlagBits::eStorage)) {
-    m_sampledGeneralHandle =
-        ctx.bindlessManager().allocate(BindlessType::eSampledImage);
-    writes[cnt++] = ctx.bindlessManager().write_for(*m_sampledGeneralHandle,
-                                                    image_general_info);
+    m_sampledGeneralHandle = bindless.allocate(BindlessType::eSampledImage);
+    bindless.queue_write(*m_sampledGeneralHandle, image_general_info);
   }
 
   if (hasAllFlags(usage, vk::ImageUsageFlagBits::eStorage)) {
-    m_storageHandle =
-        ctx.bindlessManager().allocate(BindlessType::eStorageImage);
-    writes[cnt++] =
-        ctx.bindlessManager().write_for(*m_storageHandle, image_general_info);
-  }
-
-  if (cnt > 0) {
-    ctx.vkDevice().updateDescriptorSets(std::span{writes.data(), cnt}, {});
+    m_storageHandle = bindless.allocate(BindlessType::eStorageImage);
+    bindless.queue_write(*m_storageHandle, image_general_info);
   }
 }
 
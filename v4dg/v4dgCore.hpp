@@ -4,6 +4,7 @@
 #include "cppHelpers.hpp"
 
 #include <array>
+#include <atomic>
 #include <concepts>
 #include <cstddef>
 #include <format>
@@ -24,6 +25,19 @@ constexpr bool is_production = false;
 constexpr size_t max_frames_in_flight = 2;
 template <typename T> using per_frame = std::array<T, max_frames_in_flight>;
 
+// std::hardware_destructive_interference_size is not ABI-stable
+constexpr std::size_t cache_line_size = 64;
+
+namespace detail {
+// stripe index of the calling thread (for striped counters and caches)
+inline std::size_t thread_stripe() noexcept {
+  static std::atomic<std::size_t> next{0};
+  thread_local std::size_t const stripe =
+      next.fetch_add(1, std::memory_order_relaxed);
+  return stripe;
+}
+} // namespace detail
+
 template <typename T, std::size_t N>
 [[nodiscard]] constexpr std::array<T, N>
 make_array_it(std::invocable<std::size_t> auto &&fn) {